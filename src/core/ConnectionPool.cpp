@@ -14,17 +14,27 @@ ConnectionPool& ConnectionPool::Instance() {
     return instance;
 }
 
-std::unique_ptr<HttpClient> ConnectionPool::AcquireHttpClient() {
+std::unique_ptr<HttpClient> ConnectionPool::AcquireHttpClient(const String& url) {
+    String origin = url.empty() ? String() : HttpClient::OriginOf(url);
+    
     Lock lock(m_httpMutex);
+    if (m_httpPool.empty()) return std::make_unique<HttpClient>();
     
-    if (!m_httpPool.empty()) {
-        auto client = std::move(m_httpPool.back());
-        m_httpPool.pop_back();
-        client->Reset();
-        return client;
+    // A client warm for this origin (most recent first); otherwise the
+    // least recently used one, which is the least likely to be warm
+    std::unique_ptr<HttpClient> client;
+    auto warm = std::find_if(m_httpPool.rbegin(), m_httpPool.rend(), [&](const auto& c) {
+        return !origin.empty() && c->GetOrigin() == origin;
+    });
+    if (warm != m_httpPool.rend()) {
+        client = std::move(*warm);
+        m_httpPool.erase(std::next(warm).base());
+    } else {
+        client = std::move(m_httpPool.front());
+        m_httpPool.erase(m_httpPool.begin());
     }
-    
-    return std::make_unique<HttpClient>();
+    client->Reset();
+    return client;
 }
 
 void ConnectionPool::ReleaseHttpClient(std::unique_ptr<HttpClient> client) {
@@ -38,16 +48,39 @@ void ConnectionPool::ReleaseHttpClient(std::unique_ptr<HttpClient> client) {
     // Otherwise, let it destruct (close WinHTTP handles)
 }
 
-std::unique_ptr<FtpClient> ConnectionPool::AcquireFtpClient() {
-    Lock lock(m_ftpMutex);
-    
-    if (!m_ftpPool.empty()) {
-        auto client = std::move(m_ftpPool.back());
-        m_ftpPool.pop_back();
-        return client;
+std::unique_ptr<FtpClient> ConnectionPool::AcquireFtpClient(const String& host, uint16 port,
+                                                            const String& username) {
+    std::unique_ptr<FtpClient> client;
+    {
+        Lock lock(m_ftpMutex);
+        
+        // Prefer a session already logged in to this endpoint
+        if (!host.empty()) {
+            for (auto it = m_ftpPool.begin(); it != m_ftpPool.end(); ++it) {
+                if ((*it)->IsConnectedTo(host, port, username)) {
+                    client = std::move(*it);
+                    m_ftpPool.erase(it);
+                    break;
+                }
+            }
+        }
+        
+        if (!client && !m_ftpPool.empty()) {
+            client = std::move(m_ftpPool.back());
+            m_ftpPool.pop_back();
+        }
     }
     
-    return std::make_unique<FtpClient>();
+    if (!client) return std::make_unique<FtpClient>();
+    
+    client->Reset();
+    
+    // Idle control connections get dropped by servers; probe outside the
+    // lock. A dead session disconnects itself and the caller logs in again.
+    if (client->IsConnected()) {
+        client->Noop();
+    }
+    return client;
 }
 
 void ConnectionPool::ReleaseFtpClient(std::unique_ptr<FtpClient> client) {
@@ -59,7 +92,110 @@ void ConnectionPool::ReleaseFtpClient(std::unique_ptr<FtpClient> client) {
     }
 }
 
+// ─── Pre-warming ───────────────────────────────────────────────────────────
+
+void ConnectionPool::PrewarmHttp(const HttpRequestConfig& config, int count) {
+    String origin = HttpClient::OriginOf(config.url);
+    if (origin.empty() || count <= 0) return;
+    
+    int warm = RunningWarmers(origin);
+    {
+        Lock lock(m_httpMutex);
+        TimePoint now = Clock::now();
+        for (const auto& client : m_httpPool) {
+            if (client->GetOrigin() == origin &&
+                now - client->GetLastUsed() < std::chrono::milliseconds(constants::PREWARM_TTL_MS)) {
+                ++warm;
+            }
+        }
+    }
+    if (warm >= count) return;
+    
+    // A HEAD leaves the connection (and TLS session) open in the client
+    HttpRequestConfig warmConfig = config;
+    warmConfig.timeoutConnect = constants::PREWARM_TIMEOUT_SEC;
+    warmConfig.readGate = {};
+    
+    LOG_DEBUG(L"ConnectionPool: warming %d connections to %s", count - warm, origin.c_str());
+    for (int i = warm; i < count; ++i) {
+        StartWarmer(origin, [this, warmConfig] {
+            auto client = std::make_unique<HttpClient>();
+            HttpResponseInfo response;
+            if (client->Head(warmConfig, response)) {
+                ReleaseHttpClient(std::move(client));
+            }
+        });
+    }
+}
+
+void ConnectionPool::PrewarmFtp(const FtpUrlParts& url, int count) {
+    String key = FtpOrigin(url.host, url.port, url.username);
+    if (url.host.empty() || count <= 0) return;
+    
+    int warm = RunningWarmers(key);
+    {
+        Lock lock(m_ftpMutex);
+        for (const auto& client : m_ftpPool) {
+            if (client->IsConnectedTo(url.host, url.port, url.username)) ++warm;
+        }
+    }
+    if (warm >= count) return;
+    
+    LOG_DEBUG(L"ConnectionPool: warming %d connections to %s", count - warm, key.c_str());
+    for (int i = warm; i < count; ++i) {
+        StartWarmer(key, [this, url] {
+            auto ftp = std::make_unique<FtpClient>();
+            ftp->SetSecurity(url.implicitTls ? FtpSecurity::Implicit : FtpSecurity::None);
+            if (ftp->Connect(url.host, url.port,
+                             url.username.empty() ? L"anonymous" : url.username,
+                             url.username.empty() ? L"anonymous@" : url.password)) {
+                ReleaseFtpClient(std::move(ftp));
+            }
+        });
+    }
+}
+
+void ConnectionPool::StartWarmer(const String& origin, std::function<void()> work) {
+    Lock lock(m_warmMutex);
+    if (m_stopping) return;
+    
+    // Finished warmers are ready futures; dropping them doesn't block
+    m_warmers.erase(std::remove_if(m_warmers.begin(), m_warmers.end(), [](const auto& f) {
+        return f.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+    }), m_warmers.end());
+    
+    ++m_warming[origin];
+    m_warmers.push_back(std::async(std::launch::async, [this, origin, work = std::move(work)] {
+        work();
+        Lock lock(m_warmMutex);
+        if (--m_warming[origin] <= 0) m_warming.erase(origin);
+    }));
+}
+
+int ConnectionPool::RunningWarmers(const String& origin) const {
+    Lock lock(m_warmMutex);
+    auto it = m_warming.find(origin);
+    return it != m_warming.end() ? it->second : 0;
+}
+
+String ConnectionPool::FtpOrigin(const String& host, uint16 port, const String& username) {
+    return L"ftp://" + username + L"@" + host + L":" + std::to_wstring(port);
+}
+
 void ConnectionPool::Clear() {
+    // Let running warmers finish first, or they would park clients again
+    std::vector<std::future<void>> warmers;
+    {
+        Lock lock(m_warmMutex);
+        m_stopping = true;
+        warmers.swap(m_warmers);
+    }
+    warmers.clear();
+    {
+        Lock lock(m_warmMutex);
+        m_stopping = false;
+    }
+    
     {
         Lock lock(m_httpMutex);
         m_httpPool.clear();
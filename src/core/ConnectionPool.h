@@ -1,6 +1,16 @@
 /**
  * @file ConnectionPool.h
  * @brief Connection pool managing concurrent download connections
+ *
+ * Pooled clients keep their connection open: an HttpClient's WinHTTP
+ * session holds on to the socket of its last request, and an FtpClient
+ * stays logged in. Acquire prefers a client already connected to the
+ * same origin, so a request starts without DNS, TCP or TLS setup.
+ *
+ * Prewarm() makes such clients ahead of demand: it opens connections in
+ * the background (a HEAD for HTTP, connect and login for FTP) and parks
+ * them here. Clients that served their origin within PREWARM_TTL_MS, and
+ * warmers still running, count toward the requested number.
  */
 
 #pragma once
@@ -18,9 +28,10 @@ public:
     ConnectionPool& operator=(const ConnectionPool&) = delete;
     
     /**
-     * Get an HTTP client from the pool. Creates a new one if none available.
+     * Get an HTTP client from the pool. One warm for the origin of 'url'
+     * is preferred; creates a new one if none available.
      */
-    std::unique_ptr<HttpClient> AcquireHttpClient();
+    std::unique_ptr<HttpClient> AcquireHttpClient(const String& url = L"");
     
     /**
      * Return an HTTP client to the pool for reuse.
@@ -28,18 +39,29 @@ public:
     void ReleaseHttpClient(std::unique_ptr<HttpClient> client);
     
     /**
-     * Get an FTP client from the pool.
+     * Get an FTP client from the pool. A client that is still logged in to
+     * the given endpoint is preferred, so segment connections reuse their
+     * control connection instead of reconnecting and logging in again.
      */
-    std::unique_ptr<FtpClient> AcquireFtpClient();
+    std::unique_ptr<FtpClient> AcquireFtpClient(const String& host = L"", uint16 port = 21,
+                                                const String& username = L"");
     void ReleaseFtpClient(std::unique_ptr<FtpClient> client);
     
+    /**
+     * Open connections in the background until 'count' clients are warm
+     * for the origin of config.url (or for the FTP server) and park them
+     * in the pool. Returns at once.
+     */
+    void PrewarmHttp(const HttpRequestConfig& config, int count);
+    void PrewarmFtp(const FtpUrlParts& url, int count);
+    
     /**
      * Set the maximum pool size.
      */
     void SetMaxPoolSize(int size) { m_maxPoolSize = size; }
     
     /**
-     * Clear all pooled connections.
+     * Clear all pooled connections, after waiting for running warmers.
      */
     void Clear();
     
@@ -53,11 +75,22 @@ private:
     ConnectionPool() = default;
     ~ConnectionPool() = default;
     
+    // Run 'work' (opens one connection) on a background thread
+    void StartWarmer(const String& origin, std::function<void()> work);
+    int RunningWarmers(const String& origin) const;
+    static String FtpOrigin(const String& host, uint16 port, const String& username);
+    
     mutable Mutex   m_httpMutex;
     mutable Mutex   m_ftpMutex;
     std::vector<std::unique_ptr<HttpClient>>  m_httpPool;
     std::vector<std::unique_ptr<FtpClient>>   m_ftpPool;
     int             m_maxPoolSize{64};
+    
+    // Pre-warming
+    mutable Mutex                       m_warmMutex;
+    std::map<String, int>               m_warming;      // Origin -> running warmers
+    std::vector<std::future<void>>      m_warmers;
+    bool                                m_stopping{false};
 };
 
 } // namespace idm
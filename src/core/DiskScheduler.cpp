@@ -0,0 +1,200 @@
+/**
+ * @file DiskScheduler.cpp
+ * @brief Per-device elevator ordering and depth limits for file writes
+ */
+
+#include "stdafx.h"
+#include "DiskScheduler.h"
+#include "../util/Logger.h"
+
+namespace idm {
+
+namespace {
+
+// Weight of the newest sample in the latency moving averages
+constexpr double LATENCY_EWMA_WEIGHT = 0.1;
+
+double Ewma(double average, double sample) {
+    return average == 0 ? sample : average + LATENCY_EWMA_WEIGHT * (sample - average);
+}
+
+double ElapsedMs(TimePoint since, TimePoint now) {
+    return std::chrono::duration<double, std::milli>(now - since).count();
+}
+
+} // anonymous namespace
+
+DiskScheduler& DiskScheduler::Instance() {
+    static DiskScheduler instance;
+    return instance;
+}
+
+// ─── Devices ───────────────────────────────────────────────────────────────
+
+DiskScheduler::Device* DiskScheduler::GetDevice(const String& path) {
+    wchar_t volume[MAX_PATH] = {};
+    String name;
+    if (::GetVolumePathNameW(path.c_str(), volume, MAX_PATH)) {
+        name = volume;
+    } else {
+        name = std::filesystem::path(path).root_path().wstring();
+    }
+    std::transform(name.begin(), name.end(), name.begin(), ::towupper);
+
+    Lock lock(m_devicesMutex);
+    auto& device = m_devices[name];
+    if (!device) {
+        device = std::make_unique<Device>();
+        device->name = name;
+        device->lastStatsLog = Clock::now();
+        LOG_DEBUG(L"DiskScheduler: new device %s", name.c_str());
+    }
+    return device.get();
+}
+
+void DiskScheduler::SetMaxDepth(int depth) {
+    m_maxDepth.store((std::max)(depth, 0));
+
+    // A larger depth may let waiting writes through right away
+    Lock lock(m_devicesMutex);
+    for (auto& [name, device] : m_devices) {
+        Lock deviceLock(device->mutex);
+        GrantWaiters(*device);
+    }
+}
+
+// ─── Scheduling ────────────────────────────────────────────────────────────
+
+DiskScheduler::Grant DiskScheduler::Acquire(const Request& request) {
+    Grant grant;
+    grant.device = request.device;
+    if (!request.device) return grant;
+
+    Device& device = *request.device;
+    Waiter waiter;
+    waiter.request = request;
+    waiter.queuedAt = Clock::now();
+
+    Lock lock(device.mutex);
+    device.waiting.push_back(&waiter);
+    GrantWaiters(device);
+    device.granted.wait(lock, [&] { return waiter.granted; });
+
+    grant.grantedAt = Clock::now();
+    device.avgWaitMs = Ewma(device.avgWaitMs, ElapsedMs(waiter.queuedAt, grant.grantedAt));
+    return grant;
+}
+
+bool DiskScheduler::TryAcquire(const Request& request, Grant& grant) {
+    grant.device = request.device;
+    grant.grantedAt = Clock::now();
+    if (!request.device) return true;
+
+    Device& device = *request.device;
+    int maxDepth = m_maxDepth.load();
+
+    Lock lock(device.mutex);
+    if (!device.waiting.empty() || (maxDepth > 0 && device.inFlight >= maxDepth)) {
+        grant.device = nullptr;
+        return false;
+    }
+    ++device.inFlight;
+    device.headFile = request.fileKey;
+    device.headPosition = request.position + static_cast<int64>(request.length);
+    device.avgWaitMs = Ewma(device.avgWaitMs, 0);
+    return true;
+}
+
+void DiskScheduler::Release(Grant& grant) {
+    if (!grant.device) return;
+
+    Device& device = *grant.device;
+    grant.device = nullptr;
+    TimePoint now = Clock::now();
+
+    Lock lock(device.mutex);
+    --device.inFlight;
+    ++device.completed;
+    device.avgServiceMs = Ewma(device.avgServiceMs, ElapsedMs(grant.grantedAt, now));
+    GrantWaiters(device);
+
+    if (ElapsedMs(device.lastStatsLog, now) >= constants::IO_STATS_INTERVAL_MS) {
+        device.lastStatsLog = now;
+        LogStats(device);
+    }
+}
+
+void DiskScheduler::GrantWaiters(Device& device) {
+    int maxDepth = m_maxDepth.load();
+    bool grantedAny = false;
+
+    while (!device.waiting.empty() && (maxDepth <= 0 || device.inFlight < maxDepth)) {
+        TimePoint now = Clock::now();
+
+        // Highest (effective) priority first; within it, the nearest write
+        // at or past the head, or the lowest one when the sweep wraps
+        auto best = device.waiting.end();
+        int bestPriority = 0;
+        bool bestAhead = false;
+        for (auto it = device.waiting.begin(); it != device.waiting.end(); ++it) {
+            const Request& r = (*it)->request;
+            int priority = ElapsedMs((*it)->queuedAt, now) >= constants::IO_STARVATION_MS
+                ? INT_MAX : r.priority;
+            bool ahead = std::make_pair(r.fileKey, r.position) >=
+                         std::make_pair(device.headFile, device.headPosition);
+
+            bool better = best == device.waiting.end() ||
+                          priority > bestPriority ||
+                          (priority == bestPriority && ahead && !bestAhead);
+            if (!better && priority == bestPriority && ahead == bestAhead) {
+                const Request& b = (*best)->request;
+                better = std::make_pair(r.fileKey, r.position) <
+                         std::make_pair(b.fileKey, b.position);
+            }
+            if (better) {
+                best = it;
+                bestPriority = priority;
+                bestAhead = ahead;
+            }
+        }
+
+        Waiter* waiter = *best;
+        device.waiting.erase(best);
+        waiter->granted = true;
+        ++device.inFlight;
+        device.headFile = waiter->request.fileKey;
+        device.headPosition = waiter->request.position +
+                              static_cast<int64>(waiter->request.length);
+        grantedAny = true;
+    }
+
+    if (grantedAny) device.granted.notify_all();
+}
+
+// ─── Statistics ────────────────────────────────────────────────────────────
+
+void DiskScheduler::LogStats(Device& device) {
+    LOG_DEBUG(L"DiskScheduler: %s depth %d, queued %zu, wait %.1f ms, service %.1f ms, %lld writes",
+              device.name.c_str(), device.inFlight, device.waiting.size(),
+              device.avgWaitMs, device.avgServiceMs, device.completed);
+}
+
+std::vector<DiskScheduler::DeviceStats> DiskScheduler::GetStats() const {
+    std::vector<DeviceStats> stats;
+
+    Lock lock(m_devicesMutex);
+    for (const auto& [name, device] : m_devices) {
+        Lock deviceLock(device->mutex);
+        DeviceStats s;
+        s.name = name;
+        s.inFlight = device->inFlight;
+        s.queued = static_cast<int>(device->waiting.size());
+        s.avgWaitMs = device->avgWaitMs;
+        s.avgServiceMs = device->avgServiceMs;
+        s.completed = device->completed;
+        stats.push_back(s);
+    }
+    return stats;
+}
+
+} // namespace idm
@@ -0,0 +1,134 @@
+/**
+ * @file DiskScheduler.h
+ * @brief Engine-wide write scheduling per storage device
+ *
+ * Every FileWriter orders its own batch by offset, but with many downloads
+ * on one volume their writes still interleave at random: a spinning disk
+ * (or a NAS share in front of one) spends its time seeking. The scheduler
+ * sits between the writers and the device:
+ *
+ *   - Writers Acquire() a slot before each merged write and Release() it
+ *     when the write completes. At most 'max depth' writes per device are
+ *     outstanding; everything else waits in the device's queue
+ *   - Waiting writes are granted elevator-style (C-SCAN): the next one at
+ *     or after the last granted (file, offset), wrapping to the lowest
+ *   - Higher priority wins over elevator order; a write waiting longer
+ *     than IO_STARVATION_MS is treated as highest priority
+ *
+ * Devices are keyed by volume root (GetVolumePathName), so all downloads
+ * to one drive letter or share are ordered together. Per-device queue
+ * depth, wait and service latency are kept for GetStats() and logged
+ * every IO_STATS_INTERVAL_MS while the device is busy.
+ *
+ * Memory-mapped downloads are written back by the OS and bypass this.
+ */
+
+#pragma once
+#include "stdafx.h"
+
+namespace idm {
+
+class DiskScheduler {
+public:
+    struct Device;
+
+    // One write to schedule
+    struct Request {
+        Device*     device{nullptr};
+        int         priority{0};        // Higher first
+        uint64      fileKey{0};         // Orders files within a sweep
+        int64       position{0};
+        size_t      length{0};
+    };
+
+    // A granted slot; pass back to Release()
+    struct Grant {
+        Device*     device{nullptr};
+        TimePoint   grantedAt;
+    };
+
+    struct DeviceStats {
+        String      name;
+        int         inFlight{0};
+        int         queued{0};
+        double      avgWaitMs{0};       // Queue time (moving average)
+        double      avgServiceMs{0};    // Grant to completion (moving average)
+        int64       completed{0};
+    };
+
+    static DiskScheduler& Instance();
+
+    DiskScheduler(const DiskScheduler&) = delete;
+    DiskScheduler& operator=(const DiskScheduler&) = delete;
+
+    /**
+     * Device that 'path' is stored on. The pointer stays valid for the
+     * lifetime of the process.
+     */
+    Device* GetDevice(const String& path);
+
+    /**
+     * Outstanding writes allowed per device (applies to all devices).
+     * 0 turns scheduling off: every Acquire() is granted at once.
+     */
+    void SetMaxDepth(int depth);
+    int GetMaxDepth() const { return m_maxDepth.load(); }
+
+    /**
+     * Wait until the request is granted.
+     */
+    Grant Acquire(const Request& request);
+
+    /**
+     * Grant only if the device has a free slot and nobody is waiting.
+     * Writers that hold slots use this first: waiting while holding
+     * slots could deadlock once every slot is held by a waiter.
+     */
+    bool TryAcquire(const Request& request, Grant& grant);
+
+    /**
+     * The granted write has completed.
+     */
+    void Release(Grant& grant);
+
+    std::vector<DeviceStats> GetStats() const;
+
+private:
+    DiskScheduler() = default;
+
+    struct Waiter {
+        Request     request;
+        TimePoint   queuedAt;
+        bool        granted{false};
+    };
+
+    // Grant waiting requests while the device has free slots. Caller
+    // holds the device mutex.
+    void GrantWaiters(Device& device);
+    void LogStats(Device& device);
+
+    std::atomic<int>    m_maxDepth{constants::DEFAULT_IO_DEPTH};
+
+    mutable Mutex       m_devicesMutex;
+    std::map<String, std::unique_ptr<Device>> m_devices;
+};
+
+struct DiskScheduler::Device {
+    String                  name;
+    mutable Mutex           mutex;
+    CondVar                 granted;
+    int                     inFlight{0};
+    std::deque<Waiter*>     waiting;
+
+    // Elevator head: the end of the last granted write
+    uint64                  headFile{0};
+    int64                   headPosition{0};
+
+    // Stats
+    double                  avgWaitMs{0};
+    double                  avgServiceMs{0};
+    int64                   completed{0};
+    TimePoint               lastStatsLog;
+};
+
+} // namespace idm
@@ -3,7 +3,7 @@
  * @brief Main download engine implementation
  *
  * Orchestrates the complete download lifecycle:
- *   1. URL probing (HEAD request for file info)
+ *   1. URL probing (HEAD request, or SIZE/MDTM-style listing for FTP)
  *   2. Segmentation initialization
  *   3. Connection spawning (one thread per segment)
  *   4. Progress monitoring and UI notification
@@ -16,6 +16,7 @@
 #include "DownloadEngine.h"
 #include "HttpClient.h"
 #include "FtpClient.h"
+#include "FtpMirror.h"
 #include "SegmentManager.h"
 #include "ResumeEngine.h"
 #include "FileAssembler.h"
@@ -24,6 +25,7 @@
 #include "AuthManager.h"
 #include "CookieJar.h"
 #include "SpeedLimiter.h"
+#include "Scavenger.h"
 #include "../util/Logger.h"
 #include "../util/Unicode.h"
 #include "../util/Registry.h"
@@ -31,6 +33,20 @@
 
 namespace idm {
 
+namespace {
+
+// Entry fields a probe fills in from the server's answer
+constexpr uint32 PROBE_FIELDS = FIELD_STATUS | FIELD_FILE_NAME | FIELD_FILE_SIZE | FIELD_RESUME |
+                                FIELD_FINAL_URL | FIELD_CONTENT_TYPE | FIELD_ETAG |
+                                FIELD_LAST_MODIFIED;
+
+// Entry fields a download worker may have changed by the time it ends.
+// Segments are saved by the progress updates and the .seg file
+constexpr uint32 WORKER_FIELDS = PROBE_FIELDS | FIELD_ERROR_MESSAGE | FIELD_DOWNLOADED |
+                                 FIELD_DATE_COMPLETED;
+
+} // anonymous namespace
+
 // ─── Singleton ─────────────────────────────────────────────────────────────
 DownloadEngine& DownloadEngine::Instance() {
     static DownloadEngine instance;
@@ -57,10 +73,16 @@ bool DownloadEngine::Initialize(const String& dataDir) {
         LOG_FATAL(L"DownloadEngine: failed to open database at %s", dbPath.c_str());
         return false;
     }
+    m_database.SetChangeListener([this](const String& id, const EntryPatch& changes) {
+        NotifyChanged(id, changes);
+    });
     
     // Load site credentials
     AuthManager::Instance().Load();
     
+    // Saved FTP mirror jobs (stopped until resumed)
+    FtpMirror::Instance().Initialize(dataDir);
+    
     // Start background threads
     m_running.store(true);
     
@@ -79,14 +101,16 @@ void DownloadEngine::Shutdown() {
     
     LOG_INFO(L"DownloadEngine: shutting down...");
     
-    // Stop all downloads
+    // Stop all downloads and mirror jobs
     StopAll();
+    FtpMirror::Instance().Shutdown();
     
     // Stop background threads
     m_running.store(false);
     
     if (m_speedMonitor.joinable()) m_speedMonitor.join();
     if (m_statePersist.joinable()) m_statePersist.join();
+    ConnectionPool::Instance().Clear();
     
     // Save database
     m_database.Flush();
@@ -192,7 +216,7 @@ bool DownloadEngine::StartDownload(const String& id) {
     
     auto entry = entryOpt.value();
     entry.status = DownloadStatus::Connecting;
-    m_database.UpdateEntry(entry);
+    m_database.UpdateFields(id, EntryPatch::From(entry, FIELD_STATUS));
     
     // Create active download
     auto active = std::make_shared<ActiveDownload>();
@@ -224,132 +248,240 @@ void DownloadEngine::DownloadWorker(const String& id) {
     }
     
     auto& entry = active->entry;
-    
-    // Phase 1: Probe the URL (HEAD request)
-    auto httpClient = ConnectionPool::Instance().AcquireHttpClient();
-    
-    HttpRequestConfig probeConfig;
-    probeConfig.url = entry.url;
-    probeConfig.userAgent = entry.userAgent;
-    probeConfig.referrer = entry.referrer;
-    probeConfig.cookies = entry.cookies;
-    probeConfig.username = entry.username;
-    probeConfig.password = entry.password;
-    
-    // Apply proxy settings
-    auto proxy = ProxyManager::Instance().GetProxyForUrl(entry.url);
-    if (proxy.type != ProxyType::None) {
-        probeConfig.proxyAddr = proxy.address + L":" + std::to_wstring(proxy.port);
-        probeConfig.proxyUsername = proxy.username;
-        probeConfig.proxyPassword = proxy.password;
-    }
-    
-    HttpResponseInfo probeResponse;
-    bool probeOk = httpClient->Head(probeConfig, probeResponse);
-    
-    if (!probeOk || (probeResponse.statusCode >= 400)) {
-        String error = probeOk 
-            ? L"HTTP " + std::to_wstring(probeResponse.statusCode) + L" " + probeResponse.statusText
-            : httpClient->GetLastErrorMessage();
-        
-        entry.status = DownloadStatus::Error;
-        entry.errorMessage = error;
-        m_database.UpdateEntry(entry);
-        
-        NotifyError(id, error);
-        ConnectionPool::Instance().ReleaseHttpClient(std::move(httpClient));
-        
-        RecursiveLock lock(m_downloadsMutex);
-        m_activeDownloads.erase(id);
-        return;
-    }
-    
-    // Update entry with server info
-    if (probeResponse.contentLength > 0) entry.fileSize = probeResponse.contentLength;
-    entry.resumeSupported = probeResponse.acceptRanges;
-    entry.etag = probeResponse.etag;
-    entry.lastModified = probeResponse.lastModified;
-    entry.finalUrl = probeResponse.finalUrl;
-    entry.contentType = probeResponse.contentType;
-    
-    // Determine filename from Content-Disposition if available
-    String dispositionName = probeResponse.GetDispositionFilename();
-    if (!dispositionName.empty()) {
-        entry.fileName = Unicode::SanitizeFilename(dispositionName);
-    }
-    
-    entry.status = DownloadStatus::Downloading;
-    m_database.UpdateEntry(entry);
-    
-    ConnectionPool::Instance().ReleaseHttpClient(std::move(httpClient));
-    
-    // Phase 2: Initialize segmentation
     auto& segments = active->segments;
     
-    // Try to restore from previous session
+    // A download with saved segment state and a usable validator skips the
+    // HEAD probe: every segment request past byte 0 carries If-Range, so
+    // the first 206 confirms the partial data and a 200 tells us the file
+    // has changed
     bool resumed = false;
-    if (entry.downloadedBytes > 0 && entry.resumeSupported) {
+    if (entry.downloadedBytes > 0 && entry.resumeSupported &&
+        !Unicode::IsFtpUrl(entry.url) &&
+        !ResumeEngine::GetRangeValidator(entry).empty()) {
         resumed = ResumeEngine::RestoreState(entry, segments);
     }
     
-    if (!resumed) {
-        int numConns = entry.resumeSupported ? entry.numConnections : 1;
-        segments.Initialize(entry.fileSize, numConns);
-    }
-    
-    // Phase 3: Open the partial file
-    active->hFile = FileAssembler::OpenPartialFile(entry.PartialPath(), entry.fileSize);
-    if (active->hFile == INVALID_HANDLE_VALUE) {
-        entry.status = DownloadStatus::Error;
-        entry.errorMessage = L"Failed to create download file";
-        m_database.UpdateEntry(entry);
-        NotifyError(id, entry.errorMessage);
+    // Open the connections the segments will use while the probe runs
+    // (the probe's own connection is pooled afterwards), and get the next
+    // queued downloads ready too
+    int plannedConnections = (std::min)(entry.numConnections, constants::MAX_CONNECTIONS);
+    PrewarmDownload(entry, resumed ? plannedConnections : plannedConnections - 1);
+    PrewarmQueue();
+    
+    int restartCount = 0;
+    bool sourceRefreshed = false;
+    bool writeFailed = false;
+    for (;;) {
+        if (!resumed) {
+            // Phase 1: Probe the URL (HEAD request)
+            String validator = ResumeEngine::GetRangeValidator(entry);
+            if (!ProbeDownload(*active)) {
+                RecursiveLock lock(m_downloadsMutex);
+                m_activeDownloads.erase(id);
+                return;
+            }
+            
+            // Re-resolved after the saved final URL expired: the segments of
+            // that run stay valid as long as the file itself is unchanged
+            bool keepSegments = sourceRefreshed && !validator.empty() &&
+                                ResumeEngine::GetRangeValidator(entry) == validator;
+            if (sourceRefreshed && !keepSegments) {
+                ResumeEngine::CleanupPartialFiles(entry);
+                entry.downloadedBytes = 0;
+                entry.segments.clear();
+                m_database.UpdateFields(id, EntryPatch::From(entry, FIELD_DOWNLOADED | FIELD_SEGMENTS));
+            }
+            
+            // Phase 2: Initialize segmentation. Servers that send no
+            // validator at all still get the old trust-the-.seg-file resume
+            if (keepSegments) {
+                segments.LoadState(segments.ToSegmentInfoVector());  // Drop stale assignments
+            } else {
+                if (entry.downloadedBytes > 0 && entry.resumeSupported) {
+                    resumed = ResumeEngine::RestoreState(entry, segments);
+                }
+                if (!resumed) {
+                    int numConns = entry.resumeSupported ? entry.numConnections : 1;
+                    segments.Initialize(entry.fileSize, numConns);
+                }
+            }
+        } else {
+            LOG_INFO(L"DownloadEngine: resuming %s without probe (If-Range: %s)",
+                     entry.fileName.c_str(), ResumeEngine::GetRangeValidator(entry).c_str());
+            entry.status = DownloadStatus::Downloading;
+            m_database.UpdateFields(id, EntryPatch::From(entry, FIELD_STATUS));
+        }
         
-        RecursiveLock lock(m_downloadsMutex);
-        m_activeDownloads.erase(id);
-        return;
-    }
-    
-    // Phase 4: Launch connection threads
-    int numConnections = entry.resumeSupported ? 
-        (std::min)(entry.numConnections, constants::MAX_CONNECTIONS) : 1;
-    
-    LOG_INFO(L"DownloadEngine: starting %d connections for %s (%s bytes)",
-             numConnections, entry.fileName.c_str(),
-             Unicode::FormatFileSize(entry.fileSize).c_str());
-    
-    // Launch connection workers
-    std::vector<std::thread> connThreads;
-    for (int i = 0; i < numConnections; ++i) {
-        connThreads.emplace_back(&DownloadEngine::ConnectionWorker, this, id, i);
-    }
-    
-    // Wait for all connections to complete
-    for (auto& t : connThreads) {
-        if (t.joinable()) t.join();
-    }
-    
-    // Close the file handle
-    if (active->hFile != INVALID_HANDLE_VALUE) {
-        ::CloseHandle(active->hFile);
-        active->hFile = INVALID_HANDLE_VALUE;
+        // Phase 3: Open the partial file. The write mode is picked up from
+        // the settings here, so a change applies to the next start
+        auto ioSettings = Registry::Instance().LoadSettings();
+        FileWriterOptions writerOptions;
+        writerOptions.backend = ioSettings.writeBackend == 1
+            ? WriteBackend::Overlapped : WriteBackend::Synchronous;
+        
+        // Very large downloads can bypass the page cache (opt-in)
+        writerOptions.unbuffered = ioSettings.unbufferedMinMB > 0 && entry.fileSize > 0 &&
+            entry.fileSize >= static_cast<int64>(ioSettings.unbufferedMinMB) * 1024 * 1024;
+        if (writerOptions.unbuffered) {
+            writerOptions.alignment = FileAssembler::GetWriteAlignment(entry.PartialPath());
+            writerOptions.fileSize = entry.fileSize;
+            segments.SetSplitAlignment(writerOptions.alignment);
+        }
+        
+        // Writes from all downloads on this volume are ordered together.
+        // Downloads run from a queue yield to ones the user started
+        DiskScheduler::Instance().SetMaxDepth(ioSettings.ioDepthPerDevice);
+        writerOptions.device = DiskScheduler::Instance().GetDevice(entry.PartialPath());
+        writerOptions.priority = entry.queueId.empty() ? 1 : 0;
+        writerOptions.fileKey = std::hash<String>()(entry.PartialPath());
+        
+        DWORD openFlags = 0;
+        if (writerOptions.backend == WriteBackend::Overlapped) openFlags |= FILE_FLAG_OVERLAPPED;
+        if (writerOptions.unbuffered) openFlags |= FILE_FLAG_NO_BUFFERING;
+        HANDLE hFile = FileAssembler::OpenPartialFile(entry.PartialPath(), entry.fileSize,
+                                                      openFlags);
+        if (hFile == INVALID_HANDLE_VALUE) {
+            entry.status = DownloadStatus::Error;
+            entry.errorMessage = L"Failed to create download file";
+            m_database.UpdateFields(id, EntryPatch::From(entry, FIELD_STATUS | FIELD_ERROR_MESSAGE));
+            NotifyError(id, entry.errorMessage);
+            
+            RecursiveLock lock(m_downloadsMutex);
+            m_activeDownloads.erase(id);
+            return;
+        }
+        {
+            // Checkpoints flush through this handle
+            Lock fileLock(active->fileMutex);
+            active->hFile = hFile;
+            active->durability = static_cast<DurabilityMode>(
+                std::clamp(ioSettings.durabilityMode, 0, 2));
+            active->checkpointedBytes = -1;
+        }
+        
+        // Files that fit the address-space budget are mapped and written
+        // by plain copies; everything else goes through the write-behind
+        // stage, whose commits advance the segment map's written position
+        std::unique_ptr<MappedFile> mapping;
+        if (!writerOptions.unbuffered) {
+            mapping = MappedFile::Open(active->hFile, entry.fileSize,
+                                       static_cast<int64>(ioSettings.mappedBudgetMB) * 1024 * 1024);
+        }
+        if (mapping) {
+            Lock fileLock(active->fileMutex);
+            active->mapping = std::move(mapping);
+        } else {
+            active->writer = std::make_unique<FileWriter>(active->hFile,
+                [&segments](int segmentId, int64 bytes) {
+                    segments.CommitWritten(segmentId, bytes);
+                }, writerOptions);
+        }
+        
+        // Phase 4: Launch connection threads
+        int numConnections = entry.resumeSupported ? 
+            (std::min)(entry.numConnections, constants::MAX_CONNECTIONS) : 1;
+        
+        LOG_INFO(L"DownloadEngine: starting %d connections for %s (%s bytes)",
+                 numConnections, entry.fileName.c_str(),
+                 Unicode::FormatFileSize(entry.fileSize).c_str());
+        
+        // Background downloads (marked on the entry or on their queue)
+        // only use idle bandwidth
+        active->background = entry.trafficClass == TrafficClass::Background ||
+            (!entry.queueId.empty() &&
+             Registry::Instance().ReadBool(String(L"Queues\\") + entry.queueId, L"Background", false));
+        active->connectionCount = numConnections;
+        
+        // Launch connection workers
+        std::vector<std::thread> connThreads;
+        for (int i = 0; i < numConnections; ++i) {
+            connThreads.emplace_back(&DownloadEngine::ConnectionWorker, this, id, i);
+        }
+        
+        // Wait for all connections to complete
+        for (auto& t : connThreads) {
+            if (t.joinable()) t.join();
+        }
+        
+        // Drain queued writes (or mapped pages) before the handle goes away.
+        // The pause and error paths save the state next, so the data has
+        // to reach the disk first
+        bool flushed = active->writer ? active->writer->Stop() : active->mapping->Flush();
+        if (flushed && active->durability != DurabilityMode::None) {
+            flushed = ::FlushFileBuffers(active->hFile) != FALSE;
+        }
+        if (!flushed) {
+            writeFailed = true;
+            entry.errorMessage = L"Failed to write to download file";
+        }
+        active->writer.reset();
+        {
+            Lock fileLock(active->fileMutex);
+            active->mapping.reset();
+            
+            // Close the file handle
+            if (active->hFile != INVALID_HANDLE_VALUE) {
+                ::CloseHandle(active->hFile);
+                active->hFile = INVALID_HANDLE_VALUE;
+            }
+        }
+        
+        // The final URL saved by an earlier run (typically a signed
+        // redirect) has expired: resolve it again from the original URL, once
+        if (active->sourceExpired.exchange(false) && !active->paused.load()) {
+            active->cancelled.store(false);
+            if (sourceRefreshed) {
+                entry.errorMessage = L"Download URL is no longer available";
+                break;
+            }
+            LOG_INFO(L"DownloadEngine: final URL of %s expired, re-resolving from %s",
+                     entry.fileName.c_str(), entry.url.c_str());
+            sourceRefreshed = true;
+            entry.finalUrl.clear();
+            resumed = false;
+            continue;
+        }
+        
+        // A conditional range came back 200: the partial file mixes two
+        // versions of the resource, so drop it and start over from a probe
+        if (!active->resourceChanged.exchange(false) || active->paused.load()) {
+            break;
+        }
+        
+        if (++restartCount > 1) {
+            entry.errorMessage = L"File changed on server during download";
+            active->cancelled.store(false);
+            break;
+        }
+        
+        ResumeEngine::DiscardPartialState(entry);
+        m_database.UpdateFields(id, EntryPatch::From(entry, FIELD_DOWNLOADED | FIELD_SEGMENTS |
+                                                            FIELD_ETAG | FIELD_LAST_MODIFIED));
+        active->cancelled.store(false);
+        resumed = false;
     }
     
     // Phase 5: Check completion status
     if (active->cancelled.load()) {
         entry.status = DownloadStatus::Paused;
-        entry.downloadedBytes = segments.GetTotalDownloaded();
-        m_database.UpdateEntry(entry);
-        ResumeEngine::SaveState(entry, segments);
+        entry.downloadedBytes = segments.GetTotalWritten();
+        m_database.UpdateFields(id, EntryPatch::From(entry, WORKER_FIELDS));
+        ResumeEngine::SaveStateSnapshot(entry, segments.SerializeState(),
+                                        active->durability == DurabilityMode::Strict);
         
         NotifyPaused(id);
-    } else if (segments.IsComplete()) {
+    } else if (segments.IsComplete() && !writeFailed) {
         // Finalize: rename partial to final file
         entry.status = DownloadStatus::Merging;
-        m_database.UpdateEntry(entry);
+        m_database.UpdateFields(id, EntryPatch::From(entry, FIELD_STATUS));
         
+        // Normally a rename; a cross-volume copy reports its progress
+        // while the download shows as Merging
         String finalPath = FileAssembler::Finalize(
-            entry.PartialPath(), entry.FullPath(), ConflictResolution::AutoRename);
+            entry.PartialPath(), entry.FullPath(), ConflictResolution::AutoRename,
+            [this, &id](int64 copied, int64 total) {
+                NotifyProgress(id, copied, total, 0);
+            });
         
         if (!finalPath.empty()) {
             // Set file timestamp
@@ -377,22 +509,207 @@ void DownloadEngine::DownloadWorker(const String& id) {
             NotifyError(id, entry.errorMessage);
         }
         
-        m_database.UpdateEntry(entry);
+        m_database.UpdateFields(id, EntryPatch::From(entry, WORKER_FIELDS));
     } else {
         // Incomplete - error or partial completion
         entry.status = DownloadStatus::Error;
-        entry.downloadedBytes = segments.GetTotalDownloaded();
-        m_database.UpdateEntry(entry);
-        ResumeEngine::SaveState(entry, segments);
+        entry.downloadedBytes = segments.GetTotalWritten();
+        m_database.UpdateFields(id, EntryPatch::From(entry, WORKER_FIELDS));
+        ResumeEngine::SaveStateSnapshot(entry, segments.SerializeState(),
+                                        active->durability == DurabilityMode::Strict);
         
         NotifyError(id, entry.errorMessage.empty() ? L"Download incomplete" : entry.errorMessage);
     }
     
+    {
+        Lock fileLock(active->fileMutex);
+        if (active->checkpointCount > 0) {
+            LOG_INFO(L"DownloadEngine: %d checkpoints for %s, avg %.1f ms, max %.1f ms",
+                     active->checkpointCount, entry.fileName.c_str(),
+                     active->checkpointTotalMs / active->checkpointCount, active->checkpointMaxMs);
+        }
+    }
+    
     // Remove from active downloads
     RecursiveLock lock(m_downloadsMutex);
     m_activeDownloads.erase(id);
 }
 
+// ─── Request Setup / Pre-warming ───────────────────────────────────────────
+HttpRequestConfig DownloadEngine::MakeRequestConfig(const DownloadEntry& entry,
+                                                    const String& url) const {
+    HttpRequestConfig config;
+    config.url = url;
+    config.userAgent = entry.userAgent;
+    config.referrer = entry.referrer;
+    config.cookies = entry.cookies;
+    config.username = entry.username;
+    config.password = entry.password;
+    
+    // Apply proxy settings
+    auto proxy = ProxyManager::Instance().GetProxyForUrl(url);
+    if (proxy.type != ProxyType::None) {
+        config.proxyAddr = proxy.address + L":" + std::to_wstring(proxy.port);
+        config.proxyUsername = proxy.username;
+        config.proxyPassword = proxy.password;
+    }
+    return config;
+}
+
+void DownloadEngine::PrewarmDownload(const DownloadEntry& entry, int count) {
+    if (count <= 0) return;
+    
+    String url = entry.finalUrl.empty() ? entry.url : entry.finalUrl;
+    if (Unicode::IsFtpUrl(url)) {
+        FtpUrlParts parts;
+        if (!FtpClient::ParseUrl(url, parts)) return;
+        if (parts.username.empty() && !entry.username.empty()) {
+            parts.username = entry.username;
+            parts.password = entry.password;
+        }
+        ConnectionPool::Instance().PrewarmFtp(parts, count);
+    } else {
+        ConnectionPool::Instance().PrewarmHttp(MakeRequestConfig(entry, url), count);
+    }
+}
+
+void DownloadEngine::PrewarmQueue() {
+    struct Queued {
+        int             position;
+        SystemTimePoint dateAdded;
+        String          id;
+    };
+    std::vector<Queued> queued;
+    m_database.ForEachByStatus(DownloadStatus::Queued, [&](const DownloadEntry& entry) {
+        queued.push_back({entry.queuePosition, entry.dateAdded, entry.id});
+    });
+    
+    // Queue order: by position within a queue, then unqueued by age
+    std::sort(queued.begin(), queued.end(), [](const Queued& a, const Queued& b) {
+        if ((a.position < 0) != (b.position < 0)) return a.position >= 0;
+        if (a.position != b.position) return a.position < b.position;
+        return a.dateAdded < b.dateAdded;
+    });
+    
+    // Only the few that get warmed are fetched in full
+    int warmed = 0;
+    for (const auto& item : queued) {
+        if (warmed >= constants::PREWARM_QUEUE_DEPTH) break;
+        {
+            RecursiveLock lock(m_downloadsMutex);
+            if (m_activeDownloads.count(item.id)) continue;
+        }
+        auto entry = m_database.GetEntry(item.id);
+        if (!entry) continue;
+        PrewarmDownload(*entry, (std::min)(entry->numConnections, constants::PREWARM_QUEUED_CONNECTIONS));
+        ++warmed;
+    }
+}
+
+// ─── Probe For Download ────────────────────────────────────────────────────
+bool DownloadEngine::ProbeDownload(ActiveDownload& active) {
+    auto& entry = active.entry;
+    if (Unicode::IsFtpUrl(entry.url)) {
+        return ProbeFtpDownload(active);
+    }
+    
+    auto httpClient = ConnectionPool::Instance().AcquireHttpClient(entry.url);
+    HttpRequestConfig probeConfig = MakeRequestConfig(entry, entry.url);
+    
+    HttpResponseInfo probeResponse;
+    bool probeOk = httpClient->Head(probeConfig, probeResponse);
+    
+    if (!probeOk || (probeResponse.statusCode >= 400)) {
+        String error = probeOk 
+            ? L"HTTP " + std::to_wstring(probeResponse.statusCode) + L" " + probeResponse.statusText
+            : httpClient->GetLastErrorMessage();
+        
+        entry.status = DownloadStatus::Error;
+        entry.errorMessage = error;
+        m_database.UpdateFields(active.id, EntryPatch::From(entry, FIELD_STATUS | FIELD_ERROR_MESSAGE));
+        
+        NotifyError(active.id, error);
+        ConnectionPool::Instance().ReleaseHttpClient(std::move(httpClient));
+        return false;
+    }
+    
+    // Update entry with server info
+    if (probeResponse.contentLength > 0) entry.fileSize = probeResponse.contentLength;
+    entry.resumeSupported = probeResponse.acceptRanges;
+    entry.etag = probeResponse.etag;
+    entry.lastModified = probeResponse.lastModified;
+    entry.finalUrl = probeResponse.finalUrl;
+    entry.contentType = probeResponse.contentType;
+    
+    // Determine filename from Content-Disposition if available
+    String dispositionName = probeResponse.GetDispositionFilename();
+    if (!dispositionName.empty()) {
+        entry.fileName = Unicode::SanitizeFilename(dispositionName);
+    }
+    
+    entry.status = DownloadStatus::Downloading;
+    m_database.UpdateFields(active.id, EntryPatch::From(entry, PROBE_FIELDS));
+    
+    ConnectionPool::Instance().ReleaseHttpClient(std::move(httpClient));
+    return true;
+}
+
+bool DownloadEngine::ProbeFtpDownload(ActiveDownload& active) {
+    auto& entry = active.entry;
+    
+    FtpUrlParts parts;
+    if (!FtpClient::ParseUrl(entry.url, parts)) {
+        entry.status = DownloadStatus::Error;
+        entry.errorMessage = L"Invalid FTP URL";
+        m_database.UpdateFields(active.id, EntryPatch::From(entry, FIELD_STATUS | FIELD_ERROR_MESSAGE));
+        NotifyError(active.id, entry.errorMessage);
+        return false;
+    }
+    if (parts.username.empty() && !entry.username.empty()) {
+        parts.username = entry.username;
+        parts.password = entry.password;
+    }
+    
+    auto ftp = ConnectionPool::Instance().AcquireFtpClient(parts.host, parts.port, parts.username);
+    ftp->SetSecurity(parts.implicitTls ? FtpSecurity::Implicit : FtpSecurity::None);
+    bool connected = ftp->IsConnectedTo(parts.host, parts.port, parts.username) ||
+        ftp->Connect(parts.host, parts.port,
+                     parts.username.empty() ? L"anonymous" : parts.username,
+                     parts.username.empty() ? L"anonymous@" : parts.password);
+    
+    FtpFileInfo info;
+    if (!connected || !ftp->GetFileInfo(parts.path, info) || info.isDirectory) {
+        entry.status = DownloadStatus::Error;
+        entry.errorMessage = ftp->GetLastErrorMessage().empty()
+            ? L"FTP file not found: " + parts.path : ftp->GetLastErrorMessage();
+        m_database.UpdateFields(active.id, EntryPatch::From(entry, FIELD_STATUS | FIELD_ERROR_MESSAGE));
+        
+        NotifyError(active.id, entry.errorMessage);
+        ConnectionPool::Instance().ReleaseFtpClient(std::move(ftp));
+        return false;
+    }
+    
+    // Segmented transfer needs a known size and REST support
+    if (info.fileSize > 0) entry.fileSize = info.fileSize;
+    entry.resumeSupported = entry.fileSize > 0 && ftp->SupportsRestart();
+    entry.etag.clear();
+    entry.finalUrl = entry.url;
+    
+    if (info.hasModifiedTime) {
+        entry.lastModified = Unicode::FormatHttpDate(info.lastModified);
+    }
+    
+    if (entry.fileName.empty() && !info.fileName.empty()) {
+        entry.fileName = Unicode::SanitizeFilename(info.fileName);
+    }
+    
+    entry.status = DownloadStatus::Downloading;
+    m_database.UpdateFields(active.id, EntryPatch::From(entry, PROBE_FIELDS));
+    
+    ConnectionPool::Instance().ReleaseFtpClient(std::move(ftp));
+    return true;
+}
+
 // ─── Connection Worker Thread ──────────────────────────────────────────────
 void DownloadEngine::ConnectionWorker(const String& downloadId, int connectionId) {
     std::shared_ptr<ActiveDownload> active;
@@ -406,9 +723,27 @@ void DownloadEngine::ConnectionWorker(const String& downloadId, int connectionId
     auto& entry = active->entry;
     auto& segments = active->segments;
     
+    String sourceUrl = entry.finalUrl.empty() ? entry.url : entry.finalUrl;
+    bool isFtp = Unicode::IsFtpUrl(sourceUrl);
+    
+    FtpUrlParts ftpUrl;
+    if (isFtp && !FtpClient::ParseUrl(sourceUrl, ftpUrl)) {
+        LOG_ERROR(L"Connection %d: invalid FTP URL %s", connectionId, sourceUrl.c_str());
+        return;
+    }
+    if (isFtp && ftpUrl.username.empty() && !entry.username.empty()) {
+        ftpUrl.username = entry.username;
+        ftpUrl.password = entry.password;
+    }
+    
     int retryCount = 0;
+    String host = isFtp ? ftpUrl.host : Unicode::ExtractHostFromUrl(sourceUrl);
+    active->runningConnections.fetch_add(1);
     
     while (!active->cancelled.load() && m_running.load()) {
+        if (active->background) WaitForConnectionBudget(*active);
+        if (active->cancelled.load()) break;
+        
         // Request a segment to download
         auto splitResult = segments.RequestSegment(connectionId);
         if (!splitResult.success) {
@@ -423,92 +758,212 @@ void DownloadEngine::ConnectionWorker(const String& downloadId, int connectionId
         }
         if (active->cancelled.load()) break;
         
-        // Create HTTP client for this connection
-        auto client = ConnectionPool::Instance().AcquireHttpClient();
-        
         HttpRequestConfig config;
-        config.url = entry.finalUrl.empty() ? entry.url : entry.finalUrl;
-        config.userAgent = entry.userAgent;
-        config.referrer = entry.referrer;
-        config.cookies = entry.cookies;
-        config.username = entry.username;
-        config.password = entry.password;
-        config.rangeStart = splitResult.newStart;
-        config.rangeEnd = splitResult.newEnd;
-        
-        // Apply proxy
-        auto proxy = ProxyManager::Instance().GetProxyForUrl(config.url);
-        if (proxy.type != ProxyType::None) {
-            config.proxyAddr = proxy.address + L":" + std::to_wstring(proxy.port);
-        }
+        HttpResponseInfo response;
         
         // Speed tracking for this connection
         int64 bytesThisSecond = 0;
         auto secondStart = Clock::now();
+        bool rangeChecked = false;
+        bool segmentEndReached = false;
         
-        HttpResponseInfo response;
-        bool success = client->Get(config, response, 
-            [&](const uint8* data, size_t length) -> bool {
-                if (active->cancelled.load() || active->paused.load()) {
+        // A pacing limiter is charged before each socket read, so held-back
+        // data waits in the kernel, and is not consulted again afterwards.
+        // Otherwise the token bucket meters data once it arrives.
+        // Background downloads always pass the scavenger first
+        auto& limiter = SpeedLimiter::Instance();
+        auto& scavenger = Scavenger::Instance();
+        const bool paced = limiter.IsPacing();
+        const bool background = active->background;
+        ReadGate gate;
+        if (paced || background) {
+            gate.acquire = [&](size_t wanted) {
+                size_t granted = background ? scavenger.RequestBytes(wanted) : wanted;
+                if (paced) {
+                    size_t permitted = limiter.RequestBytes(granted);
+                    if (background && permitted < granted) scavenger.ReturnBytes(granted - permitted);
+                    granted = permitted;
+                }
+                return granted;
+            };
+            gate.release = [&](size_t unused) {
+                if (background) scavenger.ReturnBytes(unused);
+                if (paced) limiter.ReturnBytes(unused);
+            };
+        }
+        
+        // Background connections feed RTT samples to the scavenger
+        HttpClient* httpConn = nullptr;
+        FtpClient* ftpConn = nullptr;
+        auto lastRttSample = Clock::now();
+        
+        DataCallback onData = [&](const uint8* data, size_t length) -> bool {
+            if (active->cancelled.load() || active->paused.load()) {
+                return false;
+            }
+            
+            // First chunk: an error page is not file data, and a 200 to
+            // our If-Range means the file changed
+            if (!rangeChecked) {
+                rangeChecked = true;
+                if (!isFtp && response.statusCode >= 400) return false;
+                if (ResumeEngine::IsResourceChanged(config, response)) {
+                    LOG_WARN(L"Connection %d: validator mismatch on %s, restarting download",
+                             connectionId, entry.fileName.c_str());
+                    active->resourceChanged.store(true);
+                    active->cancelled.store(true);
+                    return false;
+                }
+            }
+            
+            if (background) {
+                auto sampleTime = Clock::now();
+                if (sampleTime - lastRttSample >= std::chrono::milliseconds(constants::SCAVENGER_SAMPLE_MS)) {
+                    lastRttSample = sampleTime;
+                    int64 rttUs = 0;
+                    if ((httpConn && httpConn->GetRoundTripTime(rttUs)) ||
+                        (ftpConn && ftpConn->GetDataRoundTripTime(rttUs))) {
+                        scavenger.AddRttSample(host, rttUs);
+                    }
+                }
+            }
+            
+            // Apply speed limiter
+            size_t offset = 0;
+            while (offset < length) {
+                // Find our segment's current position. Its end may have moved
+                // since the request was sent (another connection split it),
+                // so never write past it
+                Segment seg;
+                if (!segments.GetSegment(splitResult.newSegmentId, seg)) return false;
+                if (seg.RemainingBytes() <= 0) {
+                    segmentEndReached = true;
                     return false;
                 }
                 
-                // Apply speed limiter
-                size_t offset = 0;
-                while (offset < length) {
-                    size_t permitted = SpeedLimiter::Instance().RequestBytes(length - offset);
-                    if (permitted == 0) permitted = length - offset;
-                    
-                    // Write to file at the correct position
-                    int64 writePos = splitResult.newStart + 
-                                     segments.GetSegments()[0].DownloadedBytes();
-                    
-                    // Find our segment's current position
-                    auto segs = segments.GetSegments();
-                    for (const auto& s : segs) {
-                        if (s.id == splitResult.newSegmentId) {
-                            writePos = s.currentPos;
-                            break;
-                        }
+                size_t permitted = paced ? length - offset : limiter.RequestBytes(length - offset);
+                if (permitted == 0) permitted = length - offset;
+                permitted = static_cast<size_t>(
+                    (std::min<int64>)(static_cast<int64>(permitted), seg.RemainingBytes()));
+                
+                if (active->mapping) {
+                    // Mapped: the copy is the write, so it commits at once
+                    if (!active->mapping->Write(seg.currentPos, data + offset, permitted)) {
+                        return false;
                     }
-                    
-                    if (!FileAssembler::WriteAtPosition(active->hFile, writePos,
-                                                         data + offset, permitted)) {
+                    segments.UpdateProgress(splitResult.newSegmentId,
+                                           static_cast<int64>(permitted), 0);
+                    segments.CommitWritten(splitResult.newSegmentId,
+                                           static_cast<int64>(permitted));
+                } else {
+                    // Queued, not yet on disk: blocks only when the writer
+                    // is a full queue behind
+                    if (!active->writer->Submit(splitResult.newSegmentId, seg.currentPos,
+                                                data + offset, permitted)) {
                         return false;
                     }
-                    
-                    // Update segment progress
-                    segments.UpdateProgress(splitResult.newSegmentId, 
+                    segments.UpdateProgress(splitResult.newSegmentId,
                                            static_cast<int64>(permitted), 0);
-                    
-                    offset += permitted;
-                    bytesThisSecond += static_cast<int64>(permitted);
                 }
                 
-                // Calculate speed every second
-                auto now = Clock::now();
-                double elapsed = std::chrono::duration<double>(now - secondStart).count();
-                if (elapsed >= 1.0) {
-                    double speed = bytesThisSecond / elapsed;
-                    segments.UpdateProgress(splitResult.newSegmentId, 0, speed);
-                    
-                    // Notify UI
-                    NotifyProgress(active->id, segments.GetTotalDownloaded(),
-                                   entry.fileSize, speed);
-                    NotifySegmentUpdate(active->id, segments.GetSegments());
-                    
-                    // Update database progress
-                    m_database.UpdateProgress(active->id, segments.GetTotalDownloaded(),
-                                             speed, segments.ToSegmentInfoVector());
-                    
-                    bytesThisSecond = 0;
-                    secondStart = now;
-                }
+                offset += permitted;
+                bytesThisSecond += static_cast<int64>(permitted);
+            }
+            
+            // Calculate speed every second
+            auto now = Clock::now();
+            double elapsed = std::chrono::duration<double>(now - secondStart).count();
+            if (elapsed >= 1.0) {
+                double speed = bytesThisSecond / elapsed;
+                segments.UpdateProgress(splitResult.newSegmentId, 0, speed);
                 
-                return true;
-            });
+                // Notify UI
+                NotifyProgress(active->id, segments.GetTotalDownloaded(),
+                               entry.fileSize, speed);
+                NotifySegmentUpdate(active->id, segments.GetSegments());
+                
+                // Update database progress
+                m_database.UpdateProgress(active->id, segments.GetTotalWritten(),
+                                         speed, segments.ToSegmentInfoVector());
+                
+                bytesThisSecond = 0;
+                secondStart = now;
+            }
+            
+            return true;
+        };
         
-        ConnectionPool::Instance().ReleaseHttpClient(std::move(client));
+        bool success = false;
+        if (isFtp) {
+            // Reuse a pooled control connection that is already logged in
+            auto ftp = ConnectionPool::Instance().AcquireFtpClient(
+                ftpUrl.host, ftpUrl.port, ftpUrl.username);
+            ftp->SetSecurity(ftpUrl.implicitTls ? FtpSecurity::Implicit : FtpSecurity::None);
+            ftpConn = ftp.get();
+            
+            bool connected = ftp->IsConnectedTo(ftpUrl.host, ftpUrl.port, ftpUrl.username) ||
+                ftp->Connect(ftpUrl.host, ftpUrl.port,
+                             ftpUrl.username.empty() ? L"anonymous" : ftpUrl.username,
+                             ftpUrl.username.empty() ? L"anonymous@" : ftpUrl.password);
+            
+            if (connected) {
+                // REST to the segment start, abort the transfer at the segment end
+                success = ftp->Download(ftpUrl.path, splitResult.newStart, onData,
+                                        entry.fileSize > 0 ? splitResult.newEnd : -1, gate);
+            }
+            
+            if (!success && !segmentEndReached) {
+                ftp->Disconnect();  // Don't pool a control connection in an unknown state
+            }
+            ConnectionPool::Instance().ReleaseFtpClient(std::move(ftp));
+        } else {
+            // Pooled client, preferably one already connected to the server
+            auto client = ConnectionPool::Instance().AcquireHttpClient(sourceUrl);
+            
+            config.url = sourceUrl;
+            config.userAgent = entry.userAgent;
+            config.referrer = entry.referrer;
+            config.cookies = entry.cookies;
+            config.username = entry.username;
+            config.password = entry.password;
+            config.rangeStart = splitResult.newStart;
+            config.rangeEnd = splitResult.newEnd;
+            // Only a request past byte 0 depends on the data before it; a
+            // server that ignores Range may still answer the first with 200
+            if (splitResult.newStart > 0) {
+                config.ifRange = ResumeEngine::GetRangeValidator(entry);
+            }
+            config.readGate = gate;
+            
+            // Apply proxy
+            auto proxy = ProxyManager::Instance().GetProxyForUrl(config.url);
+            if (proxy.type != ProxyType::None) {
+                config.proxyAddr = proxy.address + L":" + std::to_wstring(proxy.port);
+            }
+            
+            httpConn = client.get();
+            success = client->Get(config, response, onData);
+            
+            ConnectionPool::Instance().ReleaseHttpClient(std::move(client));
+            
+            if (response.statusCode >= 400) {
+                success = false;
+                
+                // Resumed straight from a saved redirect target that is gone:
+                // stop all connections so the worker can re-resolve it
+                int status = response.statusCode;
+                if ((status == 403 || status == 404 || status == 410) && sourceUrl != entry.url) {
+                    LOG_WARN(L"Connection %d: HTTP %d from %s", connectionId, status,
+                             sourceUrl.c_str());
+                    active->sourceExpired.store(true);
+                    active->cancelled.store(true);
+                    break;
+                }
+            }
+        }
+        
+        // Stopping at a split point counts as finishing our (shrunken) segment
+        success = success || segmentEndReached;
         
         if (success || active->cancelled.load()) {
             if (success) {
@@ -536,6 +991,30 @@ void DownloadEngine::ConnectionWorker(const String& downloadId, int connectionId
             }
         }
     }
+    
+    active->runningConnections.fetch_sub(1);
+}
+
+void DownloadEngine::WaitForConnectionBudget(ActiveDownload& active) {
+    auto& scavenger = Scavenger::Instance();
+    int running = active.runningConnections.load();
+    while (running > scavenger.GetConnectionBudget(active.connectionCount)) {
+        if (!active.runningConnections.compare_exchange_weak(running, running - 1)) continue;
+        
+        // Parked: not counted as running, so the budget is always met by
+        // connections that are working. Rejoin when it grows or another
+        // connection exits; leave when there is nothing left to do
+        while (!active.cancelled.load() && m_running.load() && !active.segments.IsComplete()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(constants::SCAVENGER_UPDATE_MS));
+            running = active.runningConnections.load();
+            if (running < scavenger.GetConnectionBudget(active.connectionCount) &&
+                active.runningConnections.compare_exchange_strong(running, running + 1)) {
+                return;
+            }
+        }
+        active.runningConnections.fetch_add(1);
+        return;
+    }
 }
 
 // ─── Pause / Stop / Remove ─────────────────────────────────────────────────
@@ -551,10 +1030,9 @@ bool DownloadEngine::PauseDownload(const String& id) {
     }
     
     // Mark as paused in database even if not active
-    auto entry = m_database.GetEntry(id);
-    if (entry.has_value()) {
-        entry->status = DownloadStatus::Paused;
-        m_database.UpdateEntry(*entry);
+    EntryPatch patch;
+    patch.status = DownloadStatus::Paused;
+    if (m_database.UpdateFields(id, patch)) {
         NotifyPaused(id);
         return true;
     }
@@ -604,15 +1082,18 @@ int DownloadEngine::RemoveCompleted() {
 }
 
 void DownloadEngine::ResumeAll() {
-    auto entries = m_database.GetEntriesByStatus(DownloadStatus::Paused);
-    for (const auto& entry : entries) {
-        StartDownload(entry.id);
+    for (const auto& id : m_database.GetIdsByStatus(DownloadStatus::Paused)) {
+        StartDownload(id);
     }
 }
 
 // ─── Query Interface ───────────────────────────────────────────────────────
-std::vector<DownloadEntry> DownloadEngine::GetAllDownloads() const {
-    return m_database.GetAllEntries();
+std::shared_ptr<const Database::EntryList> DownloadEngine::GetAllDownloads() const {
+    return m_database.GetListSnapshot();
+}
+
+std::vector<String> DownloadEngine::SearchDownloads(const String& query, size_t maxResults) const {
+    return m_database.Search(query, maxResults);
 }
 
 std::optional<DownloadEntry> DownloadEngine::GetDownload(const String& id) const {
@@ -642,7 +1123,7 @@ double DownloadEngine::GetTotalSpeed() const {
 // ─── Probe URL ─────────────────────────────────────────────────────────────
 bool DownloadEngine::ProbeUrl(const String& url, HttpResponseInfo& response,
                                String& suggestedFileName, String& category) {
-    auto client = ConnectionPool::Instance().AcquireHttpClient();
+    auto client = ConnectionPool::Instance().AcquireHttpClient(url);
     
     HttpRequestConfig config;
     config.url = url;
@@ -699,6 +1180,8 @@ void DownloadEngine::NotifyError(const String& id, const String& e)
 void DownloadEngine::NotifyPaused(const String& id)   { NOTIFY_OBSERVERS(OnDownloadPaused, id) }
 void DownloadEngine::NotifyResumed(const String& id)  { NOTIFY_OBSERVERS(OnDownloadResumed, id) }
 void DownloadEngine::NotifyRemoved(const String& id)  { NOTIFY_OBSERVERS(OnDownloadRemoved, id) }
+void DownloadEngine::NotifyChanged(const String& id, const EntryPatch& c)
+    { NOTIFY_OBSERVERS(OnDownloadChanged, id, c) }
 void DownloadEngine::NotifySpeed(double s, int c)     { NOTIFY_OBSERVERS(OnSpeedUpdate, s, c) }
 
 #undef NOTIFY_OBSERVERS
@@ -730,14 +1213,73 @@ void DownloadEngine::SpeedMonitorThread() {
     }
 }
 
+// ─── Checkpoint ────────────────────────────────────────────────────────────
+bool DownloadEngine::Checkpoint(ActiveDownload& active) {
+    // No open file: the worker is probing, or has finished this run and
+    // saves the final state itself
+    Lock fileLock(active.fileMutex);
+    if (active.hFile == INVALID_HANDLE_VALUE) return false;
+    
+    TimePoint start = Clock::now();
+    
+    // Snapshot before flushing: every byte the state claims was written
+    // before the flush started, so the flush covers it
+    std::vector<uint8> state = active.segments.SerializeState();
+    int64 written = active.segments.GetTotalWritten();
+    
+    // Nothing new since the last checkpoint means nothing to flush
+    if (written != active.checkpointedBytes) {
+        // Mapped pages are written back on the OS's schedule; push out the
+        // views touched since the last flush
+        bool flushed = active.mapping ? active.mapping->Flush() : true;
+        
+        // FlushFileBuffers only writes this file's dirty data (and the
+        // device cache), i.e. what arrived since the last checkpoint
+        if (flushed && active.durability != DurabilityMode::None) {
+            flushed = ::FlushFileBuffers(active.hFile) != FALSE;
+        }
+        if (!flushed) {
+            LOG_WARN(L"DownloadEngine: data flush failed for %s (error %lu), keeping previous state",
+                     active.entry.fileName.c_str(), ::GetLastError());
+            return false;
+        }
+    }
+    
+    if (!ResumeEngine::SaveStateSnapshot(active.entry, state,
+                                         active.durability == DurabilityMode::Strict)) {
+        return false;
+    }
+    active.checkpointedBytes = written;
+    
+    double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    ++active.checkpointCount;
+    active.checkpointTotalMs += ms;
+    active.checkpointMaxMs = (std::max)(active.checkpointMaxMs, ms);
+    if (ms >= constants::SLOW_CHECKPOINT_MS) {
+        LOG_WARN(L"DownloadEngine: checkpoint of %s took %.0f ms", active.entry.fileName.c_str(), ms);
+    } else {
+        LOG_DEBUG(L"DownloadEngine: checkpoint of %s took %.1f ms", active.entry.fileName.c_str(), ms);
+    }
+    return true;
+}
+
 void DownloadEngine::StatePersistThread() {
     while (m_running.load()) {
         std::this_thread::sleep_for(std::chrono::milliseconds(constants::SEGMENT_SAVE_INTERVAL_MS));
         
-        RecursiveLock lock(m_downloadsMutex);
-        for (auto& [id, active] : m_activeDownloads) {
+        // Flushes can take seconds on a slow disk; run them outside the
+        // engine lock so starting, pausing and the UI are not held up
+        std::vector<std::shared_ptr<ActiveDownload>> downloads;
+        {
+            RecursiveLock lock(m_downloadsMutex);
+            downloads.reserve(m_activeDownloads.size());
+            for (auto& [id, active] : m_activeDownloads) {
+                downloads.push_back(active);
+            }
+        }
+        for (auto& active : downloads) {
             if (!active->cancelled.load()) {
-                ResumeEngine::SaveState(active->entry, active->segments);
+                Checkpoint(*active);
             }
         }
         
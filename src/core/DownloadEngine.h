@@ -15,6 +15,9 @@
 #include "stdafx.h"
 #include "../util/Database.h"
 #include "SegmentManager.h"
+#include "FileWriter.h"
+#include "MappedFile.h"
+#include "ResumeEngine.h"
 #include "HttpClient.h"
 
 namespace idm {
@@ -35,6 +38,8 @@ public:
     virtual void OnDownloadPaused(const String& /*id*/) {}
     virtual void OnDownloadResumed(const String& /*id*/) {}
     virtual void OnDownloadRemoved(const String& /*id*/) {}
+    // Stored fields changed; 'changes' holds their new values
+    virtual void OnDownloadChanged(const String& /*id*/, const EntryPatch& /*changes*/) {}
     virtual void OnSpeedUpdate(double /*totalSpeed*/, int /*activeCount*/) {}
 };
 
@@ -44,12 +49,30 @@ struct ActiveDownload {
     DownloadEntry                   entry;
     SegmentManager                  segments;
     HANDLE                          hFile{INVALID_HANDLE_VALUE};
+    std::unique_ptr<FileWriter>     writer;         // Write-behind stage for hFile
+    std::unique_ptr<MappedFile>     mapping;        // Set instead of writer in mapped mode
     std::vector<std::thread>        connectionThreads;
     std::atomic<bool>               cancelled{false};
     std::atomic<bool>               paused{false};
+    std::atomic<bool>               resourceChanged{false}; // If-Range answered 200
+    std::atomic<bool>               sourceExpired{false};   // Saved final URL answered 403/404/410
     std::atomic<double>             totalSpeed{0};
     TimePoint                       startTime;
     TimePoint                       lastStateSave;
+    
+    // Checkpoints (StatePersistThread). fileMutex covers hFile, mapping
+    // and these fields, so a checkpoint never flushes a closed handle
+    Mutex                           fileMutex;
+    DurabilityMode                  durability{DurabilityMode::Ordered};
+    int64                           checkpointedBytes{-1};  // Written bytes at the last checkpoint
+    int                             checkpointCount{0};
+    double                          checkpointTotalMs{0};
+    double                          checkpointMaxMs{0};
+    
+    // Background class: the scavenger limits the rate and connections
+    bool                            background{false};
+    int                             connectionCount{0};     // Workers launched
+    std::atomic<int>                runningConnections{0};  // Workers not parked
 };
 
 // ─── Download Engine ───────────────────────────────────────────────────────
@@ -125,11 +148,16 @@ public:
     
     // ─── Query Interface ───────────────────────────────────────────────────
     
-    std::vector<DownloadEntry> GetAllDownloads() const;
+    // Shared snapshot, iterated without locks or copies. List fields only
+    // for downloads not opened yet; GetDownload() has all.
+    std::shared_ptr<const Database::EntryList> GetAllDownloads() const;
     std::optional<DownloadEntry> GetDownload(const String& id) const;
     int GetActiveCount() const;
     double GetTotalSpeed() const;
     
+    // IDs of downloads matching a search by name, URL or host, best first
+    std::vector<String> SearchDownloads(const String& query, size_t maxResults = 0) const;
+    
     // ─── Observer Management ───────────────────────────────────────────────
     
     void AddObserver(IDownloadObserver* observer);
@@ -154,15 +182,37 @@ private:
     // Download worker thread - manages all connections for one download
     void DownloadWorker(const String& id);
     
+    // Request settings (headers, auth, proxy) for one of the entry's URLs
+    HttpRequestConfig MakeRequestConfig(const DownloadEntry& entry, const String& url) const;
+    
+    // Open 'count' connections for the entry ahead of its workers
+    void PrewarmDownload(const DownloadEntry& entry, int count);
+    
+    // Warm connections for the next queued downloads
+    void PrewarmQueue();
+    
+    // HEAD probe: fills size/validators/filename into the entry
+    bool ProbeDownload(ActiveDownload& active);
+    bool ProbeFtpDownload(ActiveDownload& active);
+    
     // Connection worker thread - downloads a single segment
     void ConnectionWorker(const String& downloadId, int connectionId);
     
+    // Park a background download's connection while it has more running
+    // than the scavenger allows
+    void WaitForConnectionBudget(ActiveDownload& active);
+    
     // Speed monitoring thread
     void SpeedMonitorThread();
     
     // State persistence thread (saves segment state periodically)
     void StatePersistThread();
     
+    // Save one download's segment state, flushing its data first as the
+    // durability mode requires. Takes the download's fileMutex; callers
+    // must not hold m_downloadsMutex.
+    bool Checkpoint(ActiveDownload& active);
+    
     // Notify all observers
     void NotifyAdded(const String& id);
     void NotifyStarted(const String& id);
@@ -173,6 +223,7 @@ private:
     void NotifyPaused(const String& id);
     void NotifyResumed(const String& id);
     void NotifyRemoved(const String& id);
+    void NotifyChanged(const String& id, const EntryPatch& changes);
     void NotifySpeed(double totalSpeed, int activeCount);
     
     // State
@@ -10,7 +10,46 @@
 
 namespace idm {
 
-HANDLE FileAssembler::OpenPartialFile(const String& partialPath, int64 fileSize) {
+namespace {
+
+// SetFileValidData needs SE_MANAGE_VOLUME_NAME enabled in the process
+// token. Administrators hold it but it starts disabled; enabling it once
+// lasts for the life of the process.
+bool EnableManageVolumePrivilege() {
+    static const bool enabled = [] {
+        HANDLE hToken = nullptr;
+        if (!::OpenProcessToken(::GetCurrentProcess(),
+                                TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &hToken)) {
+            return false;
+        }
+        TOKEN_PRIVILEGES tp = {};
+        tp.PrivilegeCount = 1;
+        tp.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+        // AdjustTokenPrivileges succeeds with ERROR_NOT_ALL_ASSIGNED when
+        // the token does not hold the privilege at all
+        bool ok = ::LookupPrivilegeValueW(nullptr, SE_MANAGE_VOLUME_NAME,
+                                          &tp.Privileges[0].Luid) &&
+                  ::AdjustTokenPrivileges(hToken, FALSE, &tp, 0, nullptr, nullptr) &&
+                  ::GetLastError() == ERROR_SUCCESS;
+        ::CloseHandle(hToken);
+        return ok;
+    }();
+    return enabled;
+}
+
+// Turn a sparse file back into an ordinary one once it is fully written
+void ClearSparse(HANDLE hFile) {
+    FILE_SET_SPARSE_BUFFER sparse = {};
+    sparse.SetSparse = FALSE;
+    DWORD bytes = 0;
+    ::DeviceIoControl(hFile, FSCTL_SET_SPARSE, &sparse, sizeof(sparse),
+                      nullptr, 0, &bytes, nullptr);
+}
+
+} // anonymous namespace
+
+HANDLE FileAssembler::OpenPartialFile(const String& partialPath, int64 fileSize,
+                                      DWORD extraFlags) {
     // Ensure directory exists
     std::filesystem::path dir = std::filesystem::path(partialPath).parent_path();
     if (!dir.empty()) {
@@ -27,7 +66,7 @@ HANDLE FileAssembler::OpenPartialFile(const String& partialPath, int64 fileSize)
         FILE_SHARE_READ,  // Allow other threads to read for hash verification
         nullptr,
         OPEN_ALWAYS,      // Open existing or create new
-        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS,
+        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS | extraFlags,
         nullptr
     );
     
@@ -48,6 +87,19 @@ HANDLE FileAssembler::OpenPartialFile(const String& partialPath, int64 fileSize)
     return hFile;
 }
 
+uint32 FileAssembler::GetWriteAlignment(const String& path) {
+    uint32 alignment = 4096;
+    
+    wchar_t volume[MAX_PATH] = {};
+    DWORD sectorsPerCluster = 0, bytesPerSector = 0, freeClusters = 0, totalClusters = 0;
+    if (::GetVolumePathNameW(path.c_str(), volume, MAX_PATH) &&
+        ::GetDiskFreeSpaceW(volume, &sectorsPerCluster, &bytesPerSector,
+                            &freeClusters, &totalClusters)) {
+        alignment = (std::max)(alignment, static_cast<uint32>(bytesPerSector));
+    }
+    return alignment;
+}
+
 bool FileAssembler::WriteAtPosition(HANDLE hFile, int64 position,
                                      const uint8* data, size_t length) {
     if (hFile == INVALID_HANDLE_VALUE || !data || length == 0) return false;
@@ -68,7 +120,12 @@ bool FileAssembler::WriteAtPosition(HANDLE hFile, int64 position,
         ov.Offset = static_cast<DWORD>((position + totalWritten) & 0xFFFFFFFF);
         ov.OffsetHigh = static_cast<DWORD>((position + totalWritten) >> 32);
         
-        if (!::WriteFile(hFile, data + totalWritten, toWrite, &bytesWritten, &ov)) {
+        BOOL ok = ::WriteFile(hFile, data + totalWritten, toWrite, &bytesWritten, &ov);
+        if (!ok && ::GetLastError() == ERROR_IO_PENDING) {
+            // Overlapped handle: the write was queued, wait for it here
+            ok = ::GetOverlappedResult(hFile, &ov, &bytesWritten, TRUE);
+        }
+        if (!ok) {
             LOG_ERROR(L"FileAssembler: write failed at position %lld (error %lu)",
                       position + static_cast<int64>(totalWritten), ::GetLastError());
             return false;
@@ -81,7 +138,7 @@ bool FileAssembler::WriteAtPosition(HANDLE hFile, int64 position,
 }
 
 String FileAssembler::Finalize(const String& partialPath, const String& targetPath,
-                                ConflictResolution conflictMode) {
+                                ConflictResolution conflictMode, const CopyProgress& progress) {
     String finalPath = targetPath;
     
     // Handle naming conflicts
@@ -102,17 +159,49 @@ String FileAssembler::Finalize(const String& partialPath, const String& targetPa
         }
     }
     
-    // Rename partial file to final name
-    if (!::MoveFileExW(partialPath.c_str(), finalPath.c_str(),
-                       MOVEFILE_REPLACE_EXISTING | MOVEFILE_COPY_ALLOWED)) {
-        // If move fails (different volume), try copy + delete
-        if (::CopyFileW(partialPath.c_str(), finalPath.c_str(), FALSE)) {
-            ::DeleteFileW(partialPath.c_str());
-        } else {
-            LOG_ERROR(L"FileAssembler: failed to finalize %s -> %s (error %lu)",
-                      partialPath.c_str(), finalPath.c_str(), ::GetLastError());
+    // A sparse partial file is fully written by now; clear the flag so the
+    // finished file is an ordinary one
+    DWORD attrs = ::GetFileAttributesW(partialPath.c_str());
+    if (attrs != INVALID_FILE_ATTRIBUTES && (attrs & FILE_ATTRIBUTE_SPARSE_FILE)) {
+        HANDLE hFile = ::CreateFileW(partialPath.c_str(), GENERIC_WRITE, 0, nullptr,
+                                     OPEN_EXISTING, 0, nullptr);
+        if (hFile != INVALID_HANDLE_VALUE) {
+            ClearSparse(hFile);
+            ::CloseHandle(hFile);
+        }
+    }
+    
+    // Rename partial file to final name. No MOVEFILE_COPY_ALLOWED: across
+    // volumes MoveFileEx would copy silently, with no progress report
+    if (!::MoveFileExW(partialPath.c_str(), finalPath.c_str(), MOVEFILE_REPLACE_EXISTING)) {
+        DWORD error = ::GetLastError();
+        
+        // Only a different volume is worth a full copy; access denied or a
+        // sharing violation would fail the copy as well (or succeed while
+        // leaving the locked partial file behind)
+        if (error != ERROR_NOT_SAME_DEVICE) {
+            LOG_ERROR(L"FileAssembler: failed to rename %s -> %s (error %lu)",
+                      partialPath.c_str(), finalPath.c_str(), error);
+            return L"";
+        }
+        
+        // Block cloning (ReFS) only shares extents within one volume, so a
+        // different volume means the data has to be copied
+        WIN32_FILE_ATTRIBUTE_DATA attrs = {};
+        int64 fileSize = 0;
+        if (::GetFileAttributesExW(partialPath.c_str(), GetFileExInfoStandard, &attrs)) {
+            fileSize = (static_cast<int64>(attrs.nFileSizeHigh) << 32) | attrs.nFileSizeLow;
+        }
+        LOG_INFO(L"FileAssembler: %s is on another volume, copying %lld bytes",
+                 finalPath.c_str(), fileSize);
+        
+        if (!CopyWithProgress(partialPath, finalPath, fileSize, progress) &&
+            !ParallelCopy(partialPath, finalPath, fileSize, progress)) {
+            LOG_ERROR(L"FileAssembler: failed to finalize %s -> %s",
+                      partialPath.c_str(), finalPath.c_str());
             return L"";
         }
+        ::DeleteFileW(partialPath.c_str());
     }
     
     LOG_INFO(L"FileAssembler: finalized %s", finalPath.c_str());
@@ -166,25 +255,182 @@ bool FileAssembler::SetFileTimestamp(const String& filePath, const String& lastM
     return result != FALSE;
 }
 
-bool FileAssembler::PreallocateFile(HANDLE hFile, int64 fileSize) {
+bool FileAssembler::PreallocateFile(HANDLE hFile, int64 fileSize, bool overwriteAll) {
     if (fileSize <= 0) return false;
     
-    LARGE_INTEGER li;
-    li.QuadPart = fileSize;
+    // Extending the file with SetEndOfFile leaves its valid data length at
+    // 0, so the first write near the end makes NTFS zero-fill everything
+    // before it - minutes for a 50GB file. Two ways around that:
+    //   valid-data: reserve the clusters, then move the valid data length
+    //               to EOF (needs SE_MANAGE_VOLUME_NAME). Unwritten ranges
+    //               read back stale disk contents, so only for full copies
+    //   sparse:     unwritten ranges are holes, so nothing is zero-filled
+    // Volumes that support neither (FAT32, exFAT) keep the zero-fill.
+    auto start = Clock::now();
+    const wchar_t* method = L"zero-fill";
     
-    if (!::SetFilePointerEx(hFile, li, nullptr, FILE_BEGIN)) {
+    bool privileged = overwriteAll && EnableManageVolumePrivilege();
+    if (privileged) {
+        // One up-front reservation lets NTFS pick contiguous extents
+        FILE_ALLOCATION_INFO alloc = {};
+        alloc.AllocationSize.QuadPart = fileSize;
+        ::SetFileInformationByHandle(hFile, FileAllocationInfo, &alloc, sizeof(alloc));
+    } else {
+        DWORD bytes = 0;
+        if (::DeviceIoControl(hFile, FSCTL_SET_SPARSE, nullptr, 0, nullptr, 0,
+                              &bytes, nullptr)) {
+            method = L"sparse";
+        }
+    }
+    
+    // By handle, so the file pointer is untouched (and overlapped handles work)
+    FILE_END_OF_FILE_INFO eof = {};
+    eof.EndOfFile.QuadPart = fileSize;
+    if (!::SetFileInformationByHandle(hFile, FileEndOfFileInfo, &eof, sizeof(eof))) {
+        LOG_ERROR(L"FileAssembler: failed to extend file to %lld bytes (error %lu)",
+                  fileSize, ::GetLastError());
         return false;
     }
     
-    if (!::SetEndOfFile(hFile)) {
+    if (privileged) {
+        if (::SetFileValidData(hFile, fileSize)) {
+            method = L"valid-data";
+        } else {
+            LOG_DEBUG(L"FileAssembler: SetFileValidData failed (error %lu)", ::GetLastError());
+        }
+    }
+    
+    double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    LOG_INFO(L"FileAssembler: pre-allocated %lld bytes (%s) in %.1f ms", fileSize, method, ms);
+    return true;
+}
+
+// ─── Cross-Volume Copy ─────────────────────────────────────────────────────
+
+namespace {
+
+DWORD CALLBACK CopyProgressRoutine(LARGE_INTEGER totalSize, LARGE_INTEGER transferred,
+                                   LARGE_INTEGER, LARGE_INTEGER, DWORD, DWORD,
+                                   HANDLE, HANDLE, LPVOID context) {
+    const auto& progress = *static_cast<const FileAssembler::CopyProgress*>(context);
+    if (progress) progress(transferred.QuadPart, totalSize.QuadPart);
+    return PROGRESS_CONTINUE;
+}
+
+} // anonymous namespace
+
+bool FileAssembler::CopyWithProgress(const String& source, const String& target,
+                                     int64 fileSize, const CopyProgress& progress) {
+    // CopyFileEx hands the copy to the storage where it can (ODX offload,
+    // SMB server-side copy) and otherwise copies in the kernel. Large files
+    // skip the cache so a 50GB move does not flush everything else out.
+    DWORD flags = fileSize >= constants::UNBUFFERED_COPY_MIN ? COPY_FILE_NO_BUFFERING : 0;
+    
+    auto start = Clock::now();
+    if (!::CopyFileExW(source.c_str(), target.c_str(), CopyProgressRoutine,
+                       const_cast<CopyProgress*>(&progress), nullptr, flags)) {
+        LOG_WARN(L"FileAssembler: CopyFileEx to %s failed (error %lu)",
+                 target.c_str(), ::GetLastError());
+        ::DeleteFileW(target.c_str());
         return false;
     }
     
-    // Reset pointer to beginning
-    li.QuadPart = 0;
-    ::SetFilePointerEx(hFile, li, nullptr, FILE_BEGIN);
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    LOG_INFO(L"FileAssembler: copied %lld bytes in %.1f s", fileSize, seconds);
+    return true;
+}
+
+bool FileAssembler::ParallelCopy(const String& source, const String& target,
+                                 int64 fileSize, const CopyProgress& progress) {
+    HANDLE hTarget = ::CreateFileW(target.c_str(), GENERIC_WRITE,
+                                   FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+                                   CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (hTarget == INVALID_HANDLE_VALUE) {
+        LOG_ERROR(L"FileAssembler: cannot create %s (error %lu)", target.c_str(), ::GetLastError());
+        return false;
+    }
+    PreallocateFile(hTarget, fileSize, true);  // Every byte gets copied
+    
+    std::atomic<int64> nextOffset{0};
+    std::atomic<int64> copied{0};
+    std::atomic<bool> failed{false};
+    std::atomic<DWORD> error{ERROR_SUCCESS};     // First failure, from its own thread
+    std::atomic<int> running{0};
+    
+    auto fail = [&](DWORD code) {
+        DWORD none = ERROR_SUCCESS;
+        error.compare_exchange_strong(none, code);
+        failed = true;
+    };
+    
+    // Each worker opens its own handles: I/O on one synchronous handle is
+    // serialized by the I/O manager, so shared handles would not overlap
+    auto worker = [&]() {
+        HANDLE hIn = ::CreateFileW(source.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                                   OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        HANDLE hOut = ::CreateFileW(target.c_str(), GENERIC_WRITE,
+                                    FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+                                    OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        std::vector<uint8> buffer(constants::FINALIZE_COPY_CHUNK);
+        
+        if (hIn == INVALID_HANDLE_VALUE || hOut == INVALID_HANDLE_VALUE) fail(::GetLastError());
+        while (!failed.load()) {
+            int64 offset = nextOffset.fetch_add(constants::FINALIZE_COPY_CHUNK);
+            if (offset >= fileSize) break;
+            DWORD length = static_cast<DWORD>(
+                (std::min<int64>)(constants::FINALIZE_COPY_CHUNK, fileSize - offset));
+            
+            OVERLAPPED ov = {};
+            ov.Offset = static_cast<DWORD>(offset & 0xFFFFFFFF);
+            ov.OffsetHigh = static_cast<DWORD>(offset >> 32);
+            DWORD bytesRead = 0;
+            if (!::ReadFile(hIn, buffer.data(), length, &bytesRead, &ov)) {
+                fail(::GetLastError());
+                break;
+            }
+            if (bytesRead != length) {
+                fail(ERROR_HANDLE_EOF);
+                break;
+            }
+            if (!WriteAtPosition(hOut, offset, buffer.data(), length)) {
+                fail(::GetLastError());
+                break;
+            }
+            copied += length;
+        }
+        
+        if (hIn != INVALID_HANDLE_VALUE) ::CloseHandle(hIn);
+        if (hOut != INVALID_HANDLE_VALUE) ::CloseHandle(hOut);
+        --running;
+    };
+    
+    auto start = Clock::now();
+    std::vector<std::thread> threads;
+    running = constants::FINALIZE_COPY_THREADS;
+    for (int i = 0; i < constants::FINALIZE_COPY_THREADS; ++i) {
+        threads.emplace_back(worker);
+    }
+    
+    // Report from this thread so callers never see progress from a worker
+    while (running.load() > 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(250));
+        if (progress) progress(copied.load(), fileSize);
+    }
+    for (auto& t : threads) t.join();
+    
+    // Preallocation may have made the target sparse; it is complete now
+    if (!failed.load()) ClearSparse(hTarget);
+    ::CloseHandle(hTarget);
+    
+    if (failed.load()) {
+        LOG_ERROR(L"FileAssembler: parallel copy to %s failed (error %lu)",
+                  target.c_str(), error.load());
+        ::DeleteFileW(target.c_str());
+        return false;
+    }
     
-    LOG_DEBUG(L"FileAssembler: pre-allocated %lld bytes", fileSize);
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    LOG_INFO(L"FileAssembler: parallel copy of %lld bytes in %.1f s", fileSize, seconds);
     return true;
 }
 
@@ -5,7 +5,9 @@
  * After all segments complete downloading to the partial file (.idmclone),
  * the FileAssembler renames it to the target filename. Since segments
  * are written directly to their correct positions in the partial file
- * using random-access I/O, no actual merging/copying is needed.
+ * using random-access I/O, no actual merging/copying is needed. Writes
+ * reach the file through FileWriter, or through a MappedFile when the
+ * download fits the mapped address-space budget.
  *
  * Post-assembly operations:
  *   - Verify file integrity (checksum if available)
@@ -25,32 +27,59 @@ enum class ConflictResolution {
     Skip            // Cancel if exists
 };
 
+// How FileWriter issues writes to the partial file
+enum class WriteBackend {
+    Synchronous,    // One blocking positioned WriteFile per coalesced run
+    Overlapped      // Batched overlapped writes reaped from a completion port
+};
+
 class FileAssembler {
 public:
+    // (bytes copied, total bytes) while Finalize has to copy across volumes
+    using CopyProgress = std::function<void(int64, int64)>;
+    
     /**
      * Open the partial file for writing. Creates or opens the .idmclone file.
      * The file is pre-allocated to the full size for better disk performance
      * and to ensure space is available.
+     * @param extraFlags FILE_FLAG_OVERLAPPED (WriteBackend::Overlapped) and/or
+     *                   FILE_FLAG_NO_BUFFERING (unbuffered FileWriter)
      */
-    static HANDLE OpenPartialFile(const String& partialPath, int64 fileSize);
+    static HANDLE OpenPartialFile(const String& partialPath, int64 fileSize,
+                                  DWORD extraFlags = 0);
+    
+    /**
+     * Alignment for unbuffered writes to a file on this path's volume: the
+     * sector size, at least 4KB (512-byte emulation drives write 4KB
+     * physical sectors).
+     */
+    static uint32 GetWriteAlignment(const String& path);
     
     /**
      * Write data to a specific position in the partial file.
      * Used by download threads to write their segment data.
      * Thread-safe: uses file-level locking for the write region.
+     * Also accepts an overlapped handle (waits for the write), as long as
+     * the handle is not bound to a completion port.
      */
     static bool WriteAtPosition(HANDLE hFile, int64 position, 
                                 const uint8* data, size_t length);
     
     /**
      * Finalize the download: rename partial to target, verify, clean up.
+     * The partial file normally sits next to the target, so this is a
+     * rename. If the target is on another volume the file is copied:
+     * CopyFileEx first (copy offload / server-side copy where the storage
+     * supports it), then a parallel chunked copy if that fails.
      * @param partialPath   Path to the .idmclone partial file
      * @param targetPath    Final file path
      * @param conflictMode  How to handle existing files
+     * @param progress      Called during a cross-volume copy
      * @return The actual final path (may differ if auto-renamed)
      */
     static String Finalize(const String& partialPath, const String& targetPath,
-                           ConflictResolution conflictMode = ConflictResolution::AutoRename);
+                           ConflictResolution conflictMode = ConflictResolution::AutoRename,
+                           const CopyProgress& progress = nullptr);
     
     /**
      * Generate an auto-renamed path: file.txt -> file(1).txt -> file(2).txt
@@ -64,8 +93,23 @@ public:
     
     /**
      * Pre-allocate file to the specified size (improves write performance).
+     * Avoids the NTFS zero-fill on first write past the valid data length
+     * by making the file sparse. Logs the method and time taken.
+     * @param overwriteAll  Every byte is written before the file is used
+     *                      (a full copy). Only then is the valid data length
+     *                      moved to EOF when the process may (administrators):
+     *                      ranges never written would expose whatever the
+     *                      clusters held before, and a partial download can
+     *                      stop with segments unwritten.
      */
-    static bool PreallocateFile(HANDLE hFile, int64 fileSize);
+    static bool PreallocateFile(HANDLE hFile, int64 fileSize, bool overwriteAll = false);
+    
+private:
+    // Copy fallbacks for Finalize across volumes
+    static bool CopyWithProgress(const String& source, const String& target,
+                                 int64 fileSize, const CopyProgress& progress);
+    static bool ParallelCopy(const String& source, const String& target,
+                             int64 fileSize, const CopyProgress& progress);
 };
 
 } // namespace idm
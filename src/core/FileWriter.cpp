@@ -0,0 +1,602 @@
+/**
+ * @file FileWriter.cpp
+ * @brief Write-behind queue, coalescing and commit reporting
+ */
+
+#include "stdafx.h"
+#include "FileWriter.h"
+#include "../util/Logger.h"
+
+namespace idm {
+
+// ─── Aligned Buffer ────────────────────────────────────────────────────────
+
+FileWriter::AlignedBuffer::AlignedBuffer(AlignedBuffer&& other) noexcept
+    : m_data(other.m_data)
+    , m_capacity(other.m_capacity) {
+    other.m_data = nullptr;
+    other.m_capacity = 0;
+}
+
+FileWriter::AlignedBuffer::~AlignedBuffer() {
+    if (m_data) _aligned_free(m_data);
+}
+
+uint8* FileWriter::AlignedBuffer::Resize(size_t size, size_t alignment) {
+    if (size > m_capacity) {
+        if (m_data) _aligned_free(m_data);
+        m_data = static_cast<uint8*>(_aligned_malloc(size, alignment));
+        m_capacity = m_data ? size : 0;
+    }
+    return m_data;
+}
+
+// ─── Public Interface ──────────────────────────────────────────────────────
+
+FileWriter::FileWriter(HANDLE hFile, CommitCallback onCommit, const FileWriterOptions& options)
+    : m_hFile(hFile)
+    , m_onCommit(std::move(onCommit))
+    , m_options(options) {
+    if (m_options.unbuffered && m_options.alignment == 0) {
+        m_options.alignment = 4096;
+    }
+    if (m_options.backend == WriteBackend::Overlapped) {
+        // A private port: only this writer's completions arrive on it
+        m_port = ::CreateIoCompletionPort(hFile, nullptr, 0, 1);
+        if (!m_port) {
+            LOG_WARN(L"FileWriter: completion port unavailable (error %lu), "
+                     L"using synchronous writes", ::GetLastError());
+        }
+    }
+    m_pending.resize(m_port ? constants::MAX_WRITES_IN_FLIGHT : 1);
+    m_ioEvent = ::CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    m_thread = std::thread(&FileWriter::WriterThread, this);
+}
+
+FileWriter::~FileWriter() {
+    Stop();
+    if (m_port) ::CloseHandle(m_port);
+    if (m_ioEvent) ::CloseHandle(m_ioEvent);
+}
+
+bool FileWriter::Submit(int segmentId, int64 position, const uint8* data, size_t length) {
+    if (!data || length == 0) return true;
+
+    Lock lock(m_mutex);
+
+    // Backpressure: a single chunk larger than the whole budget is still
+    // accepted once the queue is empty, so Submit can never deadlock
+    m_spaceFreed.wait(lock, [&] {
+        return m_stopping || m_failed.load() || m_queuedBytes == 0 ||
+               m_queuedBytes + length <= m_options.maxQueuedBytes;
+    });
+    if (m_stopping || m_failed.load()) return false;
+
+    Chunk chunk;
+    chunk.segmentId = segmentId;
+    chunk.position = position;
+    if (!m_freeBuffers.empty()) {
+        chunk.data = std::move(m_freeBuffers.back());
+        m_freeBuffers.pop_back();
+    }
+    chunk.data.assign(data, data + length);
+
+    m_queuedBytes += length;
+    m_queue.push_back(std::move(chunk));
+    m_workReady.notify_one();
+    return true;
+}
+
+bool FileWriter::Flush() {
+    Lock lock(m_mutex);
+    m_drained.wait(lock, [&] {
+        return (m_queue.empty() && !m_writing) || m_failed.load();
+    });
+    return !m_failed.load();
+}
+
+bool FileWriter::Stop() {
+    {
+        Lock lock(m_mutex);
+        if (!m_thread.joinable()) return !m_failed.load();
+        m_stopping = true;
+    }
+    m_workReady.notify_all();
+    m_spaceFreed.notify_all();
+    m_thread.join();
+    return !m_failed.load();
+}
+
+size_t FileWriter::GetQueuedBytes() const {
+    Lock lock(m_mutex);
+    return m_queuedBytes;
+}
+
+// ─── Writer Thread ─────────────────────────────────────────────────────────
+
+void FileWriter::WriterThread() {
+    std::vector<Chunk> batch;
+
+    while (true) {
+        {
+            Lock lock(m_mutex);
+            m_workReady.wait(lock, [&] { return m_stopping || !m_queue.empty(); });
+
+            // Stop only once everything queued before Stop() has been written
+            if (m_queue.empty()) break;
+
+            batch.swap(m_queue);
+            m_writing = true;
+        }
+
+        size_t batchBytes = 0;
+        for (const auto& chunk : batch) batchBytes += chunk.data.size();
+
+        if (!m_failed.load()) {
+            WriteBatch(batch);
+        }
+
+        {
+            Lock lock(m_mutex);
+            m_queuedBytes -= batchBytes;
+            m_writing = false;
+            for (auto& chunk : batch) {
+                if (m_freeBuffers.size() < 64) {
+                    chunk.data.clear();
+                    m_freeBuffers.push_back(std::move(chunk.data));
+                }
+            }
+            batch.clear();
+        }
+        m_spaceFreed.notify_all();
+        m_drained.notify_all();
+    }
+
+    if (m_options.unbuffered && !m_failed.load()) {
+        WriteHeldTails();
+        ::FlushFileBuffers(m_hFile);
+    }
+
+    m_drained.notify_all();
+}
+
+void FileWriter::WriteBatch(std::vector<Chunk>& batch) {
+    // Chunks from one connection arrive in file order but interleaved with
+    // other connections; sorting puts each segment's run back together
+    std::stable_sort(batch.begin(), batch.end(),
+        [](const Chunk& a, const Chunk& b) { return a.position < b.position; });
+
+    size_t i = 0;
+    while (i < batch.size() && !m_failed.load()) {
+        // Extend the run while chunks are contiguous and the merge stays small
+        size_t runEnd = i + 1;
+        size_t runBytes = batch[i].data.size();
+        while (runEnd < batch.size() &&
+               batch[runEnd].position == batch[runEnd - 1].position +
+                   static_cast<int64>(batch[runEnd - 1].data.size()) &&
+               runBytes + batch[runEnd].data.size() <=
+                   static_cast<size_t>(constants::MAX_COALESCED_WRITE)) {
+            runBytes += batch[runEnd].data.size();
+            ++runEnd;
+        }
+
+        PendingWrite* op = AcquireSlot();
+        if (!op) break;
+
+        Commits commits;
+        for (size_t k = i; k < runEnd; ++k) {
+            int64 bytes = static_cast<int64>(batch[k].data.size());
+            if (!commits.empty() && commits.back().first == batch[k].segmentId) {
+                commits.back().second += bytes;
+            } else {
+                commits.emplace_back(batch[k].segmentId, bytes);
+            }
+        }
+
+        if (m_options.unbuffered) {
+            // Complete the block left over from this position's previous run
+            int64 start = batch[i].position;
+            std::vector<std::pair<const uint8*, size_t>> pieces;
+            auto held = m_heldTails.find(start);
+            if (held != m_heldTails.end()) {
+                start = held->second.position;
+                pieces.emplace_back(held->second.data.data(), held->second.data.size());
+                commits.insert(commits.begin(), held->second.commits.begin(),
+                               held->second.commits.end());
+            }
+            for (size_t k = i; k < runEnd; ++k) {
+                pieces.emplace_back(batch[k].data.data(), batch[k].data.size());
+            }
+
+            bool prepared = PrepareAligned(*op, start, pieces, std::move(commits), false);
+            if (held != m_heldTails.end()) m_heldTails.erase(held);
+            if (!prepared) {
+                MarkFailed();
+                break;
+            }
+        } else {
+            op->position = batch[i].position;
+            op->length = runBytes;
+            op->commits = std::move(commits);
+            op->needsSync = false;
+            op->data = batch[i].data.data();
+            if (runEnd - i > 1) {
+                uint8* dst = op->buffer.Resize(runBytes, 16);
+                if (!dst) {
+                    MarkFailed();
+                    break;
+                }
+                for (size_t k = i; k < runEnd; ++k) {
+                    memcpy(dst, batch[k].data.data(), batch[k].data.size());
+                    dst += batch[k].data.size();
+                }
+                op->data = op->buffer.Data();
+            }
+        }
+
+        if (op->length > 0 && !Dispatch(*op)) break;
+        i = runEnd;
+    }
+
+    // The batch owns the chunk buffers: nothing may stay in flight past here
+    if (m_port) ReapWrites(true);
+}
+
+void FileWriter::WriteHeldTails() {
+    while (!m_heldTails.empty() && !m_failed.load()) {
+        HeldTail tail = std::move(m_heldTails.begin()->second);
+        m_heldTails.erase(m_heldTails.begin());
+
+        PendingWrite* op = AcquireSlot();
+        if (!op) break;
+        if (!PrepareAligned(*op, tail.position, {{tail.data.data(), tail.data.size()}},
+                            std::move(tail.commits), true)) {
+            MarkFailed();
+            break;
+        }
+        if (op->length > 0 && !Dispatch(*op)) break;
+    }
+    if (m_port) ReapWrites(true);
+}
+
+FileWriter::PendingWrite* FileWriter::AcquireSlot() {
+    // Overlapped: wait for a free slot, committing whatever completed meanwhile
+    if (m_port && !ReapWrites(false)) return nullptr;
+    for (auto& op : m_pending) {
+        if (!op.busy) return &op;
+    }
+    return nullptr;
+}
+
+bool FileWriter::Dispatch(PendingWrite& op) {
+    // Wait for the device's turn. Slots this writer still holds go back
+    // first: waiting on them could deadlock the device
+    DiskScheduler::Request request;
+    request.device = m_options.device;
+    request.priority = m_options.priority;
+    request.fileKey = m_options.fileKey;
+    request.position = op.position;
+    request.length = op.length;
+    if (!DiskScheduler::Instance().TryAcquire(request, op.grant)) {
+        if (m_port && !ReapWrites(true)) return false;
+        op.grant = DiskScheduler::Instance().Acquire(request);
+    }
+
+    if (!m_firstWriteDone && m_inFlight == 0) m_firstWriteStart = Clock::now();
+    op.ticket = m_nextTicket++;
+
+    if (m_port && !op.needsSync) {
+        op.written = 0;
+        if (!IssueWrite(op)) {
+            DiskScheduler::Instance().Release(op.grant);
+            MarkFailed();
+            return false;
+        }
+        op.busy = true;
+        ++m_inFlight;
+        return true;
+    }
+
+    bool ok = m_port ? SyncIo(true, op.position, const_cast<uint8*>(op.data), op.length)
+                     : FileAssembler::WriteAtPosition(m_hFile, op.position, op.data, op.length);
+    DiskScheduler::Instance().Release(op.grant);
+    if (!ok) {
+        LOG_ERROR(L"FileWriter: write of %zu bytes at %lld failed", op.length, op.position);
+        MarkFailed();
+        return false;
+    }
+
+    // The last block was padded to a whole sector: cut the file back
+    if (m_options.unbuffered &&
+        op.position + static_cast<int64>(op.length) > m_options.fileSize) {
+        FILE_END_OF_FILE_INFO eof = {};
+        eof.EndOfFile.QuadPart = m_options.fileSize;
+        if (!::SetFileInformationByHandle(m_hFile, FileEndOfFileInfo, &eof, sizeof(eof))) {
+            LOG_ERROR(L"FileWriter: failed to restore file size %lld (error %lu)",
+                      m_options.fileSize, ::GetLastError());
+            MarkFailed();
+            return false;
+        }
+    }
+
+    LogFirstWrite();
+    Complete(op.ticket, op.commits);
+    NoteWritten(op.length);
+    return true;
+}
+
+void FileWriter::Commit(const Commits& commits) {
+    if (!m_onCommit) return;
+    for (const auto& [segmentId, bytes] : commits) {
+        m_onCommit(segmentId, bytes);
+    }
+}
+
+void FileWriter::Complete(uint64 ticket, Commits& commits) {
+    // Commits only say how far a segment got, not where: releasing a run
+    // before an earlier one of the same segment would claim its bytes too.
+    // A run that failed never completes, so nothing after it commits
+    if (ticket != m_nextCommit) {
+        m_finishedEarly.emplace(ticket, std::move(commits));
+        return;
+    }
+    Commit(commits);
+    ++m_nextCommit;
+
+    while (!m_finishedEarly.empty() && m_finishedEarly.begin()->first == m_nextCommit) {
+        Commit(m_finishedEarly.begin()->second);
+        m_finishedEarly.erase(m_finishedEarly.begin());
+        ++m_nextCommit;
+    }
+}
+
+void FileWriter::NoteWritten(size_t bytes) {
+    if (!m_options.unbuffered) return;
+
+    // Unbuffered data skips the page cache but can still sit in the
+    // device's write cache; drain it in steady steps
+    m_bytesSinceFlush += static_cast<int64>(bytes);
+    if (m_bytesSinceFlush >= constants::UNBUFFERED_FLUSH_BYTES) {
+        ::FlushFileBuffers(m_hFile);
+        m_bytesSinceFlush = 0;
+    }
+}
+
+void FileWriter::LogFirstWrite() {
+    if (m_firstWriteDone) return;
+    m_firstWriteDone = true;
+    double ms = std::chrono::duration<double, std::milli>(Clock::now() - m_firstWriteStart).count();
+    LOG_INFO(L"FileWriter: first write completed in %.1f ms", ms);
+}
+
+void FileWriter::MarkFailed() {
+    {
+        // Under the lock so a blocked submitter cannot miss the wakeup
+        Lock lock(m_mutex);
+        m_failed = true;
+    }
+    m_spaceFreed.notify_all();
+    m_drained.notify_all();
+}
+
+// ─── Unbuffered Mode ───────────────────────────────────────────────────────
+
+bool FileWriter::PrepareAligned(PendingWrite& op, int64 start,
+                                const std::vector<std::pair<const uint8*, size_t>>& pieces,
+                                Commits commits, bool force) {
+    const int64 align = m_options.alignment;
+    int64 total = 0;
+    for (const auto& piece : pieces) total += static_cast<int64>(piece.second);
+
+    int64 end = start + total;
+    int64 blockStart = start / align * align;
+    bool atEof = end >= m_options.fileSize;
+    int64 writeEnd = (force || atEof) ? (end + align - 1) / align * align
+                                      : end / align * align;
+
+    // Bytes from keepFrom on do not fill their block yet: hold them back
+    int64 keepFrom = (std::max)(start, (std::min)(end, writeEnd));
+    if (keepFrom < end) {
+        HeldTail tail;
+        tail.position = keepFrom;
+        tail.data.reserve(static_cast<size_t>(end - keepFrom));
+        int64 skip = keepFrom - start;
+        for (const auto& piece : pieces) {
+            int64 size = static_cast<int64>(piece.second);
+            if (skip >= size) {
+                skip -= size;
+                continue;
+            }
+            tail.data.insert(tail.data.end(), piece.first + skip, piece.first + size);
+            skip = 0;
+        }
+        Commits head = TakeCommits(commits, keepFrom - start);
+        tail.commits = std::move(commits);
+        commits = std::move(head);
+        m_heldTails[end] = std::move(tail);
+    }
+
+    op.length = 0;
+    if (writeEnd <= blockStart) return true;
+
+    size_t length = static_cast<size_t>(writeEnd - blockStart);
+    uint8* buffer = op.buffer.Resize(length, static_cast<size_t>(align));
+    if (!buffer) {
+        LOG_ERROR(L"FileWriter: cannot allocate %zu-byte aligned buffer", length);
+        return false;
+    }
+    op.needsSync = false;
+
+    bool headPartial = start > blockStart;
+    bool tailPartial = writeEnd > end && !atEof;
+    if (headPartial || tailPartial) {
+        // Read-modify-write: the rest of these blocks is already on disk,
+        // so no overlapped write may still be changing them
+        if (m_port && !ReapWrites(true)) return false;
+        if (headPartial && !SyncIo(false, blockStart, buffer, static_cast<size_t>(align))) {
+            return false;
+        }
+        int64 lastBlock = writeEnd - align;
+        if (tailPartial && !(headPartial && lastBlock == blockStart) &&
+            !SyncIo(false, lastBlock, buffer + (lastBlock - blockStart), static_cast<size_t>(align))) {
+            return false;
+        }
+        op.needsSync = true;
+    }
+
+    size_t offset = static_cast<size_t>(start - blockStart);
+    int64 remaining = keepFrom - start;
+    for (const auto& piece : pieces) {
+        if (remaining <= 0) break;
+        size_t n = static_cast<size_t>((std::min)(static_cast<int64>(piece.second), remaining));
+        memcpy(buffer + offset, piece.first, n);
+        offset += n;
+        remaining -= static_cast<int64>(n);
+    }
+
+    if (atEof && writeEnd > end) {
+        // Pad the last block; Dispatch cuts the file back to its size
+        memset(buffer + (end - blockStart), 0, static_cast<size_t>(writeEnd - end));
+        op.needsSync = true;
+    }
+
+    op.position = blockStart;
+    op.length = length;
+    op.data = buffer;
+    op.written = 0;
+    op.commits = std::move(commits);
+    return true;
+}
+
+FileWriter::Commits FileWriter::TakeCommits(Commits& commits, int64 bytes) {
+    Commits head;
+    size_t k = 0;
+    while (bytes > 0 && k < commits.size()) {
+        int64 n = (std::min)(bytes, commits[k].second);
+        head.emplace_back(commits[k].first, n);
+        commits[k].second -= n;
+        bytes -= n;
+        if (commits[k].second == 0) ++k;
+    }
+    commits.erase(commits.begin(), commits.begin() + k);
+    return head;
+}
+
+bool FileWriter::SyncIo(bool write, int64 position, uint8* buffer, size_t length) {
+    size_t done = 0;
+    while (done < length) {
+        int64 at = position + static_cast<int64>(done);
+        OVERLAPPED ov = {};
+        ov.Offset = static_cast<DWORD>(at & 0xFFFFFFFF);
+        ov.OffsetHigh = static_cast<DWORD>(at >> 32);
+        // Low bit set: the completion is not queued to the port, we wait
+        // on the event instead
+        ov.hEvent = reinterpret_cast<HANDLE>(reinterpret_cast<ULONG_PTR>(m_ioEvent) | 1);
+
+        DWORD toDo = static_cast<DWORD>(length - done);
+        BOOL ok = write ? ::WriteFile(m_hFile, buffer + done, toDo, nullptr, &ov)
+                        : ::ReadFile(m_hFile, buffer + done, toDo, nullptr, &ov);
+        DWORD transferred = 0;
+        if (ok || ::GetLastError() == ERROR_IO_PENDING) {
+            ok = ::GetOverlappedResult(m_hFile, &ov, &transferred, TRUE);
+        }
+
+        if (!write) {
+            // A block at or past EOF reads short: nothing is on disk there yet
+            if (!ok && ::GetLastError() != ERROR_HANDLE_EOF) {
+                LOG_ERROR(L"FileWriter: read of %lu bytes at %lld failed (error %lu)",
+                          toDo, at, ::GetLastError());
+                return false;
+            }
+            if (!ok) transferred = 0;
+            memset(buffer + done + transferred, 0, length - done - transferred);
+            return true;
+        }
+
+        if (!ok || transferred == 0) {
+            LOG_ERROR(L"FileWriter: write of %lu bytes at %lld failed (error %lu)",
+                      toDo, at, ::GetLastError());
+            return false;
+        }
+        done += transferred;
+    }
+    return true;
+}
+
+// ─── Overlapped Backend ────────────────────────────────────────────────────
+
+bool FileWriter::IssueWrite(PendingWrite& op) {
+    int64 position = op.position + static_cast<int64>(op.written);
+    ZeroMemory(&op.ov, sizeof(op.ov));
+    op.ov.Offset = static_cast<DWORD>(position & 0xFFFFFFFF);
+    op.ov.OffsetHigh = static_cast<DWORD>(position >> 32);
+
+    // A write that completes immediately still queues a completion packet,
+    // so every issued write is finished in ReapWrites
+    DWORD toWrite = static_cast<DWORD>(op.length - op.written);
+    if (!::WriteFile(m_hFile, op.data + op.written, toWrite, nullptr, &op.ov) &&
+        ::GetLastError() != ERROR_IO_PENDING) {
+        LOG_ERROR(L"FileWriter: overlapped write of %lu bytes at %lld failed (error %lu)",
+                  toWrite, position, ::GetLastError());
+        return false;
+    }
+    return true;
+}
+
+bool FileWriter::ReapWrites(bool waitAll) {
+    OVERLAPPED_ENTRY entries[constants::MAX_WRITES_IN_FLIGHT];
+    bool ok = true;
+
+    // Reap until a slot is free, or with waitAll until none are in flight
+    while (m_inFlight > 0 &&
+           (waitAll || m_inFlight == static_cast<int>(m_pending.size()))) {
+        ULONG count = 0;
+        if (!::GetQueuedCompletionStatusEx(m_port, entries, constants::MAX_WRITES_IN_FLIGHT,
+                                           &count, INFINITE, FALSE)) {
+            // Only fails for a broken port; the pending buffers cannot be
+            // reclaimed safely, so this is fatal for the writer
+            LOG_ERROR(L"FileWriter: completion port wait failed (error %lu)", ::GetLastError());
+            MarkFailed();
+            m_inFlight = 0;
+            for (auto& op : m_pending) {
+                if (op.busy) DiskScheduler::Instance().Release(op.grant);
+                op.busy = false;
+            }
+            return false;
+        }
+
+        for (ULONG n = 0; n < count; ++n) {
+            PendingWrite* op = CONTAINING_RECORD(entries[n].lpOverlapped, PendingWrite, ov);
+            DWORD transferred = 0;
+            if (!::GetOverlappedResult(m_hFile, &op->ov, &transferred, FALSE)) {
+                LOG_ERROR(L"FileWriter: write of %zu bytes at %lld failed (error %lu)",
+                          op->length, op->position, ::GetLastError());
+                MarkFailed();
+                ok = false;
+            } else {
+                op->written += transferred;
+                if (op->written < op->length && transferred > 0 && !m_failed.load()) {
+                    // Short write: queue the rest in the same slot
+                    if (IssueWrite(*op)) continue;
+                    MarkFailed();
+                    ok = false;
+                } else if (op->written >= op->length) {
+                    LogFirstWrite();
+                    Complete(op->ticket, op->commits);
+                    NoteWritten(op->length);
+                } else {
+                    LOG_ERROR(L"FileWriter: write at %lld made no progress", op->position);
+                    MarkFailed();
+                    ok = false;
+                }
+            }
+            DiskScheduler::Instance().Release(op->grant);
+            op->busy = false;
+            --m_inFlight;
+        }
+    }
+
+    return ok && !m_failed.load();
+}
+
+} // namespace idm
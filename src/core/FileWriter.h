@@ -0,0 +1,221 @@
+/**
+ * @file FileWriter.h
+ * @brief Write-behind stage between connection threads and the partial file
+ *
+ * Connection threads used to call WriteFile for every received 64KB chunk,
+ * so any disk stall (cache flush, AV scan, slow USB target) stopped the
+ * socket reads and collapsed TCP throughput. A FileWriter owns one partial
+ * file and a writer thread:
+ *
+ *   - Submit() copies a chunk into a recycled buffer and returns at once,
+ *     unless the queue already holds WRITE_BEHIND_QUEUE_BYTES; then it
+ *     blocks until the writer catches up (backpressure to the network)
+ *   - The writer drains the queue in batches, sorts by file offset and
+ *     merges contiguous chunks (one connection's consecutive reads) into
+ *     writes of up to MAX_COALESCED_WRITE bytes
+ *   - After each write, the commit callback reports the bytes per segment,
+ *     which advances SegmentManager's persisted (written) position
+ *
+ * Two backends issue the merged writes (chosen per download):
+ *   - Synchronous: one blocking positioned WriteFile per run
+ *   - Overlapped:  the handle (opened with FILE_FLAG_OVERLAPPED) is bound to
+ *     a private completion port; up to MAX_WRITES_IN_FLIGHT runs are queued
+ *     to the device at once and reaped in bulk with
+ *     GetQueuedCompletionStatusEx. Completions may arrive out of order,
+ *     so a finished run's commits wait until every run issued before it
+ *     has finished too: a segment's written position never covers a hole
+ * Both give the same guarantee as WriteAtPosition: a committed byte is in
+ * the file (or the OS cache), and a failed run is never committed.
+ *
+ * Unbuffered mode (handle opened with FILE_FLAG_NO_BUFFERING) keeps huge
+ * downloads out of the page cache. Every write must then be sector
+ * aligned in offset, length and buffer address, so the writer:
+ *   - builds each run in an aligned buffer and writes whole blocks only
+ *   - holds back a run's unaligned tail (uncommitted) until the next data
+ *     for that position arrives and completes the block
+ *   - read-modify-writes a partial block only when it must: a segment
+ *     resumed mid-block, or tails still held back at Stop()
+ *   - pads the block at end-of-file, then truncates the file back
+ *   - calls FlushFileBuffers every UNBUFFERED_FLUSH_BYTES, so device
+ *     caches drain steadily instead of in one burst at close
+ * SegmentManager splits on aligned boundaries, so in practice every block
+ * belongs to one segment and partial blocks only occur at resume points.
+ *
+ * Each merged write also takes a slot from the DiskScheduler for the
+ * file's device (if one is set), which orders writes across downloads
+ * and caps the device's outstanding I/O.
+ *
+ * A write error latches: later Submit() calls fail, so connections stop
+ * instead of filling the queue with data that cannot be stored.
+ */
+
+#pragma once
+#include "stdafx.h"
+#include "FileAssembler.h"
+#include "DiskScheduler.h"
+
+namespace idm {
+
+struct FileWriterOptions {
+    WriteBackend    backend{WriteBackend::Synchronous};
+    bool            unbuffered{false};  // Handle opened with FILE_FLAG_NO_BUFFERING
+    uint32          alignment{0};       // Unbuffered: sector size (FileAssembler::GetWriteAlignment)
+    int64           fileSize{-1};       // Unbuffered: where the padded last block is cut back
+    size_t          maxQueuedBytes{constants::WRITE_BEHIND_QUEUE_BYTES};
+    
+    // Engine-wide scheduling (DiskScheduler); no device means unscheduled
+    DiskScheduler::Device* device{nullptr};
+    int             priority{0};
+    uint64          fileKey{0};
+};
+
+class FileWriter {
+public:
+    // (segmentId, bytes) for data that has reached the file
+    using CommitCallback = std::function<void(int, int64)>;
+
+    /**
+     * The Overlapped backend requires hFile to be opened overlapped; if the
+     * completion port cannot be created the writer falls back to
+     * synchronous writes. Unbuffered mode needs a known file size.
+     */
+    FileWriter(HANDLE hFile, CommitCallback onCommit,
+               const FileWriterOptions& options = FileWriterOptions());
+    ~FileWriter();
+
+    FileWriter(const FileWriter&) = delete;
+    FileWriter& operator=(const FileWriter&) = delete;
+
+    /**
+     * Queue a chunk for writing at 'position'. The data is copied.
+     * Blocks while the queue is full.
+     * @return false if the writer has failed or been stopped
+     */
+    bool Submit(int segmentId, int64 position, const uint8* data, size_t length);
+
+    /**
+     * Wait until everything submitted so far has been written. In
+     * unbuffered mode, held-back partial blocks stay uncommitted until
+     * their block fills or Stop() is called.
+     * @return false if any write failed
+     */
+    bool Flush();
+
+    /**
+     * Drain the queue (and any held-back partial blocks) and stop the
+     * writer thread. Idempotent.
+     */
+    bool Stop();
+
+    bool HasFailed() const { return m_failed.load(); }
+    WriteBackend GetBackend() const { return m_port ? WriteBackend::Overlapped
+                                                    : WriteBackend::Synchronous; }
+    size_t GetQueuedBytes() const;
+
+private:
+    using Commits = std::vector<std::pair<int, int64>>;   // (segmentId, bytes) in file order
+
+    struct Chunk {
+        int                 segmentId;
+        int64               position;
+        std::vector<uint8>  data;
+    };
+
+    // Heap buffer with a fixed address alignment (unbuffered I/O needs
+    // sector-aligned buffers). Contents are not kept across Resize().
+    class AlignedBuffer {
+    public:
+        AlignedBuffer() = default;
+        AlignedBuffer(AlignedBuffer&& other) noexcept;
+        AlignedBuffer& operator=(AlignedBuffer&&) = delete;
+        ~AlignedBuffer();
+        uint8* Resize(size_t size, size_t alignment);
+        uint8* Data() const { return m_data; }
+    private:
+        uint8*  m_data{nullptr};
+        size_t  m_capacity{0};
+    };
+
+    // One merged write. Buffered runs may point straight into a chunk;
+    // everything else is assembled in 'buffer'
+    struct PendingWrite {
+        OVERLAPPED          ov;             // Completion packets map back via this
+        AlignedBuffer       buffer;
+        const uint8*        data{nullptr};
+        size_t              length{0};
+        size_t              written{0};
+        int64               position{0};
+        Commits             commits;
+        uint64              ticket{0};          // Issue order, for releasing commits
+        DiskScheduler::Grant grant;             // Held from dispatch to completion
+        bool                needsSync{false};   // Partial-block RMW or EOF fix-up
+        bool                busy{false};
+    };
+
+    // Unaligned tail of a run, waiting for the rest of its block
+    struct HeldTail {
+        int64               position;
+        std::vector<uint8>  data;
+        Commits             commits;
+    };
+
+    void WriterThread();
+    void WriteBatch(std::vector<Chunk>& batch);
+    void WriteHeldTails();
+    PendingWrite* AcquireSlot();
+    bool Dispatch(PendingWrite& op);
+    void Commit(const Commits& commits);
+    void Complete(uint64 ticket, Commits& commits);    // Commit in issue order
+    void NoteWritten(size_t bytes);
+    void LogFirstWrite();
+    void MarkFailed();
+
+    // Unbuffered mode: fill 'op' with the whole blocks covering
+    // [start, start + total of pieces), holding back an unaligned tail
+    // unless 'force'. op.length == 0 if nothing can be written yet.
+    bool PrepareAligned(PendingWrite& op, int64 start,
+                        const std::vector<std::pair<const uint8*, size_t>>& pieces,
+                        Commits commits, bool force);
+    static Commits TakeCommits(Commits& commits, int64 bytes);
+
+    // Blocking read or write that never posts to the completion port
+    bool SyncIo(bool write, int64 position, uint8* buffer, size_t length);
+
+    // Overlapped backend
+    bool IssueWrite(PendingWrite& op);
+    bool ReapWrites(bool waitAll);
+
+    HANDLE                  m_hFile;
+    CommitCallback          m_onCommit;
+    FileWriterOptions       m_options;
+
+    mutable Mutex           m_mutex;
+    CondVar                 m_workReady;     // Writer: queue non-empty or stopping
+    CondVar                 m_spaceFreed;    // Submitters: room in the queue
+    CondVar                 m_drained;       // Flush(): nothing queued or in flight
+    std::vector<Chunk>      m_queue;
+    size_t                  m_queuedBytes{0};
+    bool                    m_writing{false};
+    bool                    m_stopping{false};
+    std::atomic<bool>       m_failed{false};
+
+    std::vector<std::vector<uint8>> m_freeBuffers;  // Recycled chunk storage
+
+    // Writer thread only
+    std::vector<PendingWrite> m_pending;            // One slot, or one per in-flight write
+    int                     m_inFlight{0};
+    uint64                  m_nextTicket{0};        // Given to the next dispatched run
+    uint64                  m_nextCommit{0};        // First run not yet committed
+    std::map<uint64, Commits> m_finishedEarly;      // Done, waiting for earlier runs
+    HANDLE                  m_port{nullptr};        // Overlapped backend only
+    HANDLE                  m_ioEvent{nullptr};     // For SyncIo
+    std::map<int64, HeldTail> m_heldTails;          // Unbuffered: keyed by end position
+    int64                   m_bytesSinceFlush{0};   // Unbuffered flush policy
+
+    // First-write latency (shows zero-fill or allocation stalls)
+    TimePoint               m_firstWriteStart;
+    bool                    m_firstWriteDone{false};
+    std::thread             m_thread;
+};
+
+} // namespace idm
@@ -1,152 +1,862 @@
 /**
  * @file FtpClient.cpp
- * @brief FTP client implementation using WinINet
+ * @brief Native FTP/FTPS client implementation over TcpStream
  */
 
 #include "stdafx.h"
 #include "FtpClient.h"
 #include "../util/Logger.h"
+#include "../util/Unicode.h"
 
 namespace idm {
 
-FtpClient::FtpClient() {
-    m_hInternet = ::InternetOpenW(constants::DEFAULT_USER_AGENT,
-        INTERNET_OPEN_TYPE_PRECONFIG, nullptr, nullptr, 0);
-    if (!m_hInternet) {
-        m_lastError = L"Failed to initialize WinINet";
+namespace {
+
+// Days since 1970-01-01 for a proleptic Gregorian date
+int64 DaysFromCivil(int64 y, int m, int d) {
+    y -= m <= 2 ? 1 : 0;
+    int64 era = (y >= 0 ? y : y - 399) / 400;
+    int64 yoe = y - era * 400;
+    int64 doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    int64 doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+// Calendar year of a day count since 1970-01-01
+int64 YearFromDays(int64 z) {
+    z += 719468;
+    int64 era = (z >= 0 ? z : z - 146096) / 146097;
+    int64 doe = z - era * 146097;
+    int64 yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    int64 doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    int64 mp = (5 * doy + 2) / 153;
+    return yoe + era * 400 + (mp >= 10 ? 1 : 0);
+}
+
+SystemTimePoint MakeUtcTime(int64 year, int month, int day, int hour, int minute, int second) {
+    int64 secs = DaysFromCivil(year, month, day) * 86400 + hour * 3600 + minute * 60 + second;
+    return SystemClock::from_time_t(0) + std::chrono::seconds(secs);
+}
+
+// "YYYYMMDDHHMMSS[.sss]" as used by MDTM and the MLSx modify fact
+bool ParseFtpTimestamp(const std::string& text, SystemTimePoint& time) {
+    if (text.size() < 14) return false;
+    for (size_t i = 0; i < 14; ++i) {
+        if (!std::isdigit(static_cast<unsigned char>(text[i]))) return false;
+    }
+    auto field = [&](size_t pos, size_t len) { return std::stoi(text.substr(pos, len)); };
+    int month = field(4, 2), day = field(6, 2);
+    if (month < 1 || month > 12 || day < 1 || day > 31) return false;
+    time = MakeUtcTime(field(0, 4), month, day, field(8, 2), field(10, 2), field(12, 2));
+    return true;
+}
+
+int MonthFromName(const std::string& name) {
+    static const char* const months[] = {
+        "jan", "feb", "mar", "apr", "may", "jun",
+        "jul", "aug", "sep", "oct", "nov", "dec"
+    };
+    if (name.size() != 3) return 0;
+    for (int i = 0; i < 12; ++i) {
+        if (_strnicmp(name.c_str(), months[i], 3) == 0) return i + 1;
+    }
+    return 0;
+}
+
+bool IsAllDigits(const std::string& s) {
+    return !s.empty() && std::all_of(s.begin(), s.end(),
+        [](char c) { return std::isdigit(static_cast<unsigned char>(c)) != 0; });
+}
+
+// Split on whitespace; 'rest' receives the remainder of the line after
+// 'count' tokens (names may contain spaces)
+std::vector<std::string> Tokenize(const std::string& line, size_t count, std::string& rest) {
+    std::vector<std::string> tokens;
+    size_t pos = 0;
+    while (tokens.size() < count) {
+        pos = line.find_first_not_of(" \t", pos);
+        if (pos == std::string::npos) break;
+        size_t end = line.find_first_of(" \t", pos);
+        tokens.push_back(line.substr(pos, end == std::string::npos ? std::string::npos : end - pos));
+        pos = end;
+        if (pos == std::string::npos) break;
+    }
+    rest.clear();
+    if (pos != std::string::npos) {
+        pos = line.find_first_not_of(" \t", pos);
+        if (pos != std::string::npos) rest = line.substr(pos);
     }
+    return tokens;
 }
 
+String BaseName(const String& path) {
+    auto slash = path.find_last_of(L'/');
+    return slash == String::npos ? path : path.substr(slash + 1);
+}
+
+// "229 Entering Extended Passive Mode (|||6446|)"
+uint16 ParseEpsvPort(const std::string& text) {
+    auto open = text.find('(');
+    if (open == std::string::npos || open + 4 >= text.size()) return 0;
+    char delim = text[open + 1];
+    if (text[open + 2] != delim || text[open + 3] != delim) return 0;
+    int port = std::atoi(text.c_str() + open + 4);
+    return port > 0 && port <= 65535 ? static_cast<uint16>(port) : 0;
+}
+
+// "227 Entering Passive Mode (h1,h2,h3,h4,p1,p2)"
+uint16 ParsePasvPort(const std::string& text) {
+    size_t pos = text.find('(');
+    if (pos == std::string::npos) {
+        pos = text.find_first_of("0123456789", 4);
+        if (pos == std::string::npos) return 0;
+    } else {
+        ++pos;
+    }
+    int h1, h2, h3, h4, p1, p2;
+    if (std::sscanf(text.c_str() + pos, "%d,%d,%d,%d,%d,%d", &h1, &h2, &h3, &h4, &p1, &p2) != 6) {
+        return 0;
+    }
+    int port = p1 * 256 + p2;
+    return port > 0 && port <= 65535 ? static_cast<uint16>(port) : 0;
+}
+
+bool IsListingNoise(const String& name) {
+    return name.empty() || name == L"." || name == L"..";
+}
+
+} // anonymous namespace
+
+// ─── FtpReply ──────────────────────────────────────────────────────────────
+String FtpReply::Text() const {
+    std::string joined;
+    for (const auto& line : lines) {
+        if (!joined.empty()) joined += ' ';
+        joined += line;
+    }
+    return Unicode::Utf8ToWide(joined);
+}
+
+// ─── Construction ──────────────────────────────────────────────────────────
+FtpClient::FtpClient() = default;
+
 FtpClient::~FtpClient() {
     Disconnect();
-    if (m_hInternet) {
-        ::InternetCloseHandle(m_hInternet);
-    }
 }
 
+// ─── Connection ────────────────────────────────────────────────────────────
 bool FtpClient::Connect(const String& host, uint16 port,
                          const String& username, const String& password,
-                         bool passiveMode) {
+                         bool /*passiveMode*/) {
     Disconnect();
-    
-    DWORD flags = passiveMode ? INTERNET_FLAG_PASSIVE : 0;
-    
-    m_hConnection = ::InternetConnectW(m_hInternet, host.c_str(), port,
-        username.c_str(), password.c_str(),
-        INTERNET_SERVICE_FTP, flags, 0);
-    
-    if (!m_hConnection) {
-        m_lastError = L"FTP connection failed to " + host;
-        LOG_ERROR(L"FTP: %s (error %lu)", m_lastError.c_str(), ::GetLastError());
-        return false;
-    }
-    
-    LOG_INFO(L"FTP: Connected to %s:%d", host.c_str(), port);
+    m_cancelled.store(false);
+    m_features = FtpFeatures();
+    m_protectData = false;
+
+    if (!m_control.Connect(host, port, m_timeoutSec)) {
+        SetError(L"FTP connection failed to " + host + L": " + m_control.GetLastErrorMessage());
+        return false;
+    }
+
+    if (m_security == FtpSecurity::Implicit && !m_control.StartTls(host, m_verifyCert)) {
+        SetError(L"FTPS handshake failed: " + m_control.GetLastErrorMessage());
+        DropConnection();
+        return false;
+    }
+
+    FtpReply reply;
+    if (!ReadReply(reply) || reply.code != 220) {
+        SetError(L"FTP server not ready: " + reply.Text());
+        DropConnection();
+        return false;
+    }
+
+    if (m_security == FtpSecurity::Explicit) {
+        if (!Command("AUTH TLS", reply) || reply.code != 234) {
+            SetError(L"Server does not support AUTH TLS: " + reply.Text());
+            DropConnection();
+            return false;
+        }
+        if (!m_control.StartTls(host, m_verifyCert)) {
+            SetError(L"FTPS handshake failed: " + m_control.GetLastErrorMessage());
+            DropConnection();
+            return false;
+        }
+    }
+
+    if (!Login(username, password)) {
+        DropConnection();
+        return false;
+    }
+
+    // Some servers only advertise MLST/UTF8 to authenticated users
+    QueryFeatures();
+
+    // Session setup is order-independent and idempotent: pipeline it
+    std::vector<std::string> setup;
+    if (m_control.IsTls()) {
+        setup.push_back("PBSZ 0");
+        setup.push_back("PROT P");
+    }
+    if (m_features.utf8) setup.push_back("OPTS UTF8 ON");
+    setup.push_back("TYPE I");
+
+    std::vector<FtpReply> replies;
+    if (!Pipeline(setup, replies)) {
+        DropConnection();
+        return false;
+    }
+    if (!replies.back().IsSuccess()) {
+        SetError(L"Server rejected binary mode: " + replies.back().Text());
+        DropConnection();
+        return false;
+    }
+    if (m_control.IsTls()) {
+        m_protectData = replies[1].IsSuccess();
+        if (!m_protectData) {
+            LOG_WARN(L"FTP: %s refused PROT P, data channels will be unencrypted", host.c_str());
+        }
+    }
+
+    m_host = host;
+    m_port = port;
+    m_username = username;
+    m_loggedIn = true;
+
+    LOG_INFO(L"FTP: Connected to %s:%d%s", host.c_str(), port,
+             m_control.IsTls() ? L" (TLS)" : L"");
     return true;
 }
 
 void FtpClient::Disconnect() {
-    if (m_hConnection) {
-        ::InternetCloseHandle(m_hConnection);
-        m_hConnection = nullptr;
+    m_data.Close();
+    if (m_loggedIn && m_control.IsOpen()) {
+        // Polite QUIT, but don't hang on an unresponsive server
+        m_control.SetTimeout(2);
+        FtpReply reply;
+        Command("QUIT", reply);
+    }
+    DropConnection();
+}
+
+void FtpClient::DropConnection() {
+    m_data.Close();
+    m_control.Close();
+    m_loggedIn = false;
+    m_protectData = false;
+    m_host.clear();
+    m_port = 0;
+    m_username.clear();
+}
+
+bool FtpClient::IsConnectedTo(const String& host, uint16 port, const String& username) const {
+    return IsConnected() && m_port == port &&
+           _wcsicmp(m_host.c_str(), host.c_str()) == 0 &&
+           m_username == username;
+}
+
+bool FtpClient::Login(const String& username, const String& password) {
+    FtpReply reply;
+    if (!Command("USER " + Unicode::WideToUtf8(username), reply)) return false;
+
+    if (reply.code == 331 || reply.code == 332) {
+        if (!Command("PASS " + Unicode::WideToUtf8(password), reply)) return false;
+    }
+
+    if (!reply.IsSuccess()) {
+        SetError(L"FTP login failed: " + reply.Text());
+        return false;
+    }
+    return true;
+}
+
+void FtpClient::QueryFeatures() {
+    FtpReply reply;
+    if (!Command("FEAT", reply) || reply.code != 211) return;
+
+    // Feature lines sit between the "211-" header and the "211 " trailer
+    for (size_t i = 1; i + 1 < reply.lines.size(); ++i) {
+        std::string feature = reply.lines[i];
+        feature.erase(0, feature.find_first_not_of(' '));
+        std::transform(feature.begin(), feature.end(), feature.begin(),
+            [](char c) { return static_cast<char>(std::toupper(static_cast<unsigned char>(c))); });
+
+        if (feature.compare(0, 4, "MLST") == 0)             m_features.mlst = true;
+        else if (feature == "SIZE")                         m_features.size = true;
+        else if (feature == "MDTM")                         m_features.mdtm = true;
+        else if (feature == "EPSV")                         m_features.epsv = true;
+        else if (feature.compare(0, 11, "REST STREAM") == 0) m_features.restStream = true;
+        else if (feature == "UTF8")                         m_features.utf8 = true;
+        else if (feature.compare(0, 4, "AUTH") == 0 &&
+                 feature.find("TLS") != std::string::npos)  m_features.authTls = true;
+    }
+}
+
+// ─── Control Channel ───────────────────────────────────────────────────────
+bool FtpClient::SendCommand(const std::string& command) {
+    if (command.compare(0, 5, "PASS ") == 0) {
+        LOG_TRACE(L"FTP > PASS ****");
+    } else {
+        LOG_TRACE(L"FTP > %s", Unicode::Utf8ToWide(command).c_str());
+    }
+
+    if (!m_control.SendAll(command + "\r\n")) {
+        SetError(L"FTP control connection lost: " + m_control.GetLastErrorMessage());
+        return false;
+    }
+    return true;
+}
+
+bool FtpClient::ReadReply(FtpReply& reply) {
+    reply = FtpReply();
+
+    std::string line;
+    if (!m_control.ReadLine(line)) {
+        SetError(m_control.TimedOut() ? L"FTP server did not respond"
+                                      : L"FTP control connection lost");
+        return false;
+    }
+    reply.lines.push_back(line);
+
+    if (line.size() < 3 || !IsAllDigits(line.substr(0, 3))) {
+        SetError(L"Malformed FTP reply: " + Unicode::Utf8ToWide(line));
+        return false;
+    }
+
+    // Multi-line reply: "123-first line" ... "123 last line"
+    if (line.size() > 3 && line[3] == '-') {
+        std::string terminator = line.substr(0, 3) + " ";
+        do {
+            if (!m_control.ReadLine(line)) {
+                SetError(L"FTP control connection lost");
+                return false;
+            }
+            reply.lines.push_back(line);
+        } while (line.compare(0, 4, terminator) != 0);
+    }
+
+    reply.code = std::atoi(reply.lines.front().c_str());
+    LOG_TRACE(L"FTP < %s", Unicode::Utf8ToWide(reply.lines.back()).c_str());
+    return true;
+}
+
+bool FtpClient::Command(const std::string& command, FtpReply& reply) {
+    return SendCommand(command) && ReadReply(reply);
+}
+
+bool FtpClient::Pipeline(const std::vector<std::string>& commands, std::vector<FtpReply>& replies) {
+    replies.clear();
+
+    if (m_pipelining && commands.size() > 1) {
+        std::string batch;
+        for (const auto& command : commands) {
+            batch += command;
+            batch += "\r\n";
+        }
+        if (!m_control.SendAll(batch)) {
+            SetError(L"FTP control connection lost: " + m_control.GetLastErrorMessage());
+            return false;
+        }
+
+        for (size_t i = 0; i < commands.size(); ++i) {
+            FtpReply reply;
+            if (!ReadReply(reply)) {
+                // Server choked on the batch; stay sequential from now on
+                LOG_WARN(L"FTP: Pipelined commands failed on %s, disabling pipelining",
+                         m_host.c_str());
+                m_pipelining = false;
+                return false;
+            }
+            replies.push_back(std::move(reply));
+        }
+        return true;
+    }
+
+    for (const auto& command : commands) {
+        FtpReply reply;
+        if (!Command(command, reply)) return false;
+        replies.push_back(std::move(reply));
+    }
+    return true;
+}
+
+bool FtpClient::Noop() {
+    if (!IsConnected()) return false;
+
+    m_control.SetTimeout(5);
+    FtpReply reply;
+    bool alive = SendCommand("NOOP");
+
+    // An aborted RETR may have left its 226/426 behind; skip it
+    for (int i = 0; alive && i < 3; ++i) {
+        alive = ReadReply(reply);
+        bool stale = reply.code == 226 || (reply.code >= 425 && reply.code <= 451);
+        if (!stale) break;
+    }
+    m_control.SetTimeout(m_timeoutSec);
+
+    alive = alive && reply.IsSuccess() && reply.code != 226;
+    if (!alive) {
+        DropConnection();
+    }
+    return alive;
+}
+
+// ─── Data Channel ──────────────────────────────────────────────────────────
+bool FtpClient::OpenDataChannel() {
+    m_data.Close();
+
+    FtpReply passive;
+    if (!Command(m_features.epsv ? "EPSV" : "PASV", passive)) return false;
+    uint16 dataPort = 0;
+
+    if (m_features.epsv) {
+        if (passive.code == 229) dataPort = ParseEpsvPort(passive.lines.back());
+        if (dataPort == 0) {
+            m_features.epsv = false;
+            if (!Command("PASV", passive)) return false;
+        }
+    }
+    if (!m_features.epsv && passive.code == 227) {
+        dataPort = ParsePasvPort(passive.lines.back());
+    }
+
+    if (dataPort == 0) {
+        SetError(L"Server refused passive mode: " + passive.Text());
+        return false;
+    }
+
+    // Connect to the control connection's peer rather than the address in a
+    // 227 reply: servers behind NAT often advertise a private address there
+    String address = m_control.GetPeerAddress();
+    if (!m_data.Connect(address, dataPort, m_timeoutSec)) {
+        SetError(L"Cannot open FTP data connection: " + m_data.GetLastErrorMessage());
+        return false;
+    }
+    return true;
+}
+
+bool FtpClient::StartTransfer(const std::string& command, int64 restartAt) {
+    FtpReply reply;
+
+    // REST must immediately precede the transfer command: some servers
+    // forget the restart marker when PASV/EPSV comes in between
+    if (restartAt > 0) {
+        if (!Command("REST " + std::to_string(restartAt), reply)) {
+            m_data.Close();
+            return false;
+        }
+        if (reply.code != 350) {
+            SetError(L"Server rejected REST " + std::to_wstring(restartAt));
+            m_data.Close();
+            return false;
+        }
+    }
+
+    if (!Command(command, reply)) {
+        m_data.Close();
+        return false;
+    }
+
+    if (!reply.IsPreliminary()) {
+        SetError(L"FTP transfer refused: " + reply.Text());
+        m_data.Close();
+        return false;
+    }
+
+    if (m_protectData && !m_data.StartTls(m_host, m_verifyCert)) {
+        SetError(L"FTPS data channel handshake failed: " + m_data.GetLastErrorMessage());
+        FinishTransfer(true);
+        return false;
+    }
+    return true;
+}
+
+bool FtpClient::ReadDataToEnd(std::string& out) {
+    std::vector<char> buffer(constants::BUFFER_SIZE);
+    for (;;) {
+        if (m_cancelled.load()) return false;
+
+        int n = m_data.Receive(buffer.data(), buffer.size());
+        if (n == 0) return true;
+        if (n < 0) {
+            SetError(L"FTP data connection failed: " + m_data.GetLastErrorMessage());
+            return false;
+        }
+        out.append(buffer.data(), static_cast<size_t>(n));
+    }
+}
+
+bool FtpClient::FinishTransfer(bool aborted) {
+    m_data.Close();
+
+    // After an early close the server answers 426/451 (or 226 if it had
+    // already sent everything); don't wait long for it
+    if (aborted) m_control.SetTimeout(5);
+    FtpReply reply;
+    bool ok = ReadReply(reply);
+    if (aborted) m_control.SetTimeout(m_timeoutSec);
+
+    if (ok) {
+        ok = aborted ? (reply.IsSuccess() || reply.code == 426 || reply.code == 451)
+                     : reply.IsSuccess();
+        if (!ok) SetError(L"FTP transfer failed: " + reply.Text());
+    }
+
+    if (!ok) {
+        // Control channel is out of step with the server; never reuse it
+        DropConnection();
     }
+    return ok;
 }
 
+// ─── File Operations ───────────────────────────────────────────────────────
 bool FtpClient::GetFileInfo(const String& remotePath, FtpFileInfo& info) {
-    if (!m_hConnection) return false;
-    
-    WIN32_FIND_DATAW findData = {};
-    HINTERNET hFind = ::FtpFindFirstFileW(m_hConnection, remotePath.c_str(),
-        &findData, INTERNET_FLAG_RELOAD, 0);
-    
-    if (!hFind) {
-        m_lastError = L"File not found: " + remotePath;
-        return false;
-    }
-    
-    info.fileName = findData.cFileName;
-    info.fileSize = (static_cast<int64>(findData.nFileSizeHigh) << 32) | findData.nFileSizeLow;
-    info.isDirectory = (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
-    info.lastModified = findData.ftLastWriteTime;
-    
-    ::InternetCloseHandle(hFind);
+    if (!IsConnected()) return false;
+
+    std::string path;
+    if (!EncodePath(remotePath, path)) return false;
+
+    info = FtpFileInfo();
+    FtpReply reply;
+
+    if (m_features.mlst) {
+        if (!Command("MLST " + path, reply)) return false;
+
+        // "250-Listing" / " type=file;size=...; /path" / "250 End"
+        if (reply.code == 250 && reply.lines.size() >= 2) {
+            std::string facts = reply.lines[1];
+            facts.erase(0, facts.find_first_not_of(' '));
+            if (ParseMlsxLine(facts, info)) return true;
+        }
+        if (reply.code == 550) {
+            SetError(L"File not found: " + remotePath);
+            return false;
+        }
+    }
+
+    // SIZE + MDTM (RFC 3659); both are answered independently, so pipeline
+    std::vector<FtpReply> replies;
+    if (!Pipeline({ "SIZE " + path, "MDTM " + path }, replies)) return false;
+
+    if (replies[0].code != 213 && replies[1].code != 213) {
+        SetError(L"File not found: " + remotePath);
+        return false;
+    }
+
+    info.fileName = BaseName(remotePath);
+    if (replies[0].code == 213 && replies[0].lines.back().size() > 4) {
+        try { info.fileSize = std::stoll(replies[0].lines.back().substr(4)); }
+        catch (...) { info.fileSize = 0; }
+    }
+    if (replies[1].code == 213 && replies[1].lines.back().size() > 4) {
+        info.hasModifiedTime = ParseFtpTimestamp(replies[1].lines.back().substr(4), info.lastModified);
+    }
     return true;
 }
 
 bool FtpClient::Download(const String& remotePath, int64 startPosition,
-                          DataCallback callback) {
-    if (!m_hConnection || !callback) return false;
-    
-    DWORD flags = FTP_TRANSFER_TYPE_BINARY | INTERNET_FLAG_RELOAD;
-    
-    HINTERNET hFile = ::FtpOpenFileW(m_hConnection, remotePath.c_str(),
-        GENERIC_READ, flags, 0);
-    
-    if (!hFile) {
-        m_lastError = L"Failed to open FTP file: " + remotePath;
-        LOG_ERROR(L"FTP: %s (error %lu)", m_lastError.c_str(), ::GetLastError());
-        return false;
-    }
-    
-    // Seek to resume position if specified
-    if (startPosition > 0) {
-        LONG highPart = static_cast<LONG>(startPosition >> 32);
-        DWORD result = ::InternetSetFilePointer(hFile, 
-            static_cast<LONG>(startPosition & 0xFFFFFFFF),
-            &highPart, FILE_BEGIN, 0);
-        
-        if (result == INVALID_SET_FILE_POINTER && ::GetLastError() != NO_ERROR) {
-            LOG_WARN(L"FTP: Resume not supported, starting from beginning");
-            // Continue from start
-        }
-    }
-    
-    // Read data
+                          DataCallback callback, int64 endPosition,
+                          const ReadGate& gate) {
+    if (!IsConnected() || !callback) return false;
+
+    std::string path;
+    if (!EncodePath(remotePath, path)) return false;
+
+    startPosition = (std::max<int64>)(startPosition, 0);
+    if (!OpenDataChannel()) return false;
+    if (!StartTransfer("RETR " + path, startPosition)) return false;
+
+    // Bytes left before the segment end (-1 = read to EOF)
+    int64 remaining = endPosition >= 0 ? endPosition - startPosition + 1 : -1;
+
     std::vector<uint8> buffer(constants::BUFFER_SIZE);
-    DWORD bytesRead = 0;
-    
-    while (!m_cancelled.load()) {
-        if (!::InternetReadFile(hFile, buffer.data(), 
-                                static_cast<DWORD>(buffer.size()), &bytesRead)) {
-            m_lastError = L"FTP read error";
-            ::InternetCloseHandle(hFile);
-            return false;
+    bool delivered = true;
+
+    while (remaining != 0) {
+        if (m_cancelled.load()) {
+            delivered = false;
+            break;
         }
-        
-        if (bytesRead == 0) break;  // EOF
-        
-        if (!callback(buffer.data(), bytesRead)) {
-            ::InternetCloseHandle(hFile);
-            return false;
+
+        size_t toRead = buffer.size();
+        if (remaining > 0) toRead = static_cast<size_t>((std::min<int64>)(remaining, toRead));
+        if (gate) {
+            toRead = gate.AcquireSome(toRead, m_cancelled);
+            if (toRead == 0) {
+                delivered = false;  // Cancelled while waiting
+                break;
+            }
+        }
+
+        int n = m_data.Receive(buffer.data(), toRead);
+        if (gate && gate.release && n >= 0 && static_cast<size_t>(n) < toRead) {
+            gate.release(toRead - static_cast<size_t>(n));
+        }
+        if (n == 0) break;  // EOF
+        if (n < 0) {
+            SetError(m_data.TimedOut() ? L"FTP data connection timed out" : L"FTP read error");
+            delivered = false;
+            break;
+        }
+
+        size_t deliver = static_cast<size_t>(n);
+        if (remaining > 0 && static_cast<int64>(deliver) > remaining) {
+            deliver = static_cast<size_t>(remaining);
         }
+
+        if (!callback(buffer.data(), deliver)) {
+            delivered = false;
+            break;
+        }
+
+        if (remaining > 0) remaining -= static_cast<int64>(deliver);
     }
-    
-    ::InternetCloseHandle(hFile);
-    return !m_cancelled.load();
+
+    // Closing the data connection before EOF aborts the transfer; the
+    // server's 426 leaves the control connection reusable for the next file
+    bool aborted = !delivered || remaining == 0;
+    bool finished = FinishTransfer(aborted);
+    return delivered && finished && !m_cancelled.load();
+}
+
+bool FtpClient::SupportsRestart() {
+    if (!IsConnected()) return false;
+    if (m_features.restStream) return true;
+
+    // A 350 reply to a non-zero REST means stream-mode restart works;
+    // reset the marker afterwards so the next RETR starts at zero
+    FtpReply reply;
+    if (!Command("REST 1", reply) || reply.code != 350) return false;
+    Command("REST 0", reply);
+    return true;
 }
 
 bool FtpClient::ListDirectory(const String& remotePath, std::vector<FtpFileInfo>& files) {
-    if (!m_hConnection) return false;
-    
     files.clear();
-    WIN32_FIND_DATAW findData = {};
-    
-    HINTERNET hFind = ::FtpFindFirstFileW(m_hConnection, remotePath.c_str(),
-        &findData, INTERNET_FLAG_RELOAD, 0);
-    
-    if (!hFind) return false;
-    
-    do {
+    if (!IsConnected()) return false;
+
+    std::string path;
+    if (!EncodePath(remotePath, path)) return false;
+
+    bool machineListing = m_features.mlst;
+    if (!OpenDataChannel()) return false;
+
+    if (!StartTransfer((machineListing ? "MLSD " : "LIST ") + path)) {
+        if (!machineListing || !IsConnected()) return false;
+
+        // Advertised but refused: retry once with LIST
+        m_features.mlst = false;
+        machineListing = false;
+        if (!OpenDataChannel() || !StartTransfer("LIST " + path)) return false;
+    }
+
+    std::string listing;
+    bool received = ReadDataToEnd(listing);
+    if (!FinishTransfer(!received) || !received) return false;
+
+    size_t pos = 0;
+    while (pos < listing.size()) {
+        size_t end = listing.find('\n', pos);
+        if (end == std::string::npos) end = listing.size();
+        std::string line = listing.substr(pos, end - pos);
+        pos = end + 1;
+
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line.empty()) continue;
+
         FtpFileInfo info;
-        info.fileName = findData.cFileName;
-        info.fileSize = (static_cast<int64>(findData.nFileSizeHigh) << 32) | findData.nFileSizeLow;
-        info.isDirectory = (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
-        info.lastModified = findData.ftLastWriteTime;
-        files.push_back(std::move(info));
-    } while (::InternetFindNextFileW(hFind, &findData));
-    
-    ::InternetCloseHandle(hFind);
+        bool parsed = machineListing ? ParseMlsxLine(line, info) : ParseListLine(line, info);
+        if (parsed && !IsListingNoise(info.fileName)) {
+            files.push_back(std::move(info));
+        }
+    }
     return true;
 }
 
+// ─── Listing Parsers ───────────────────────────────────────────────────────
+bool FtpClient::ParseMlsxLine(const std::string& line, FtpFileInfo& info) {
+    // "fact=value;fact=value; name" — the name follows the first space
+    auto space = line.find(' ');
+    if (space == std::string::npos) return false;
+
+    info = FtpFileInfo();
+    info.fileName = BaseName(Unicode::Utf8ToWide(line.substr(space + 1)));
+
+    std::string facts = line.substr(0, space);
+    size_t pos = 0;
+    while (pos < facts.size()) {
+        size_t end = facts.find(';', pos);
+        if (end == std::string::npos) end = facts.size();
+        std::string fact = facts.substr(pos, end - pos);
+        pos = end + 1;
+
+        auto eq = fact.find('=');
+        if (eq == std::string::npos) continue;
+        std::string key = fact.substr(0, eq);
+        std::string value = fact.substr(eq + 1);
+        std::transform(key.begin(), key.end(), key.begin(),
+            [](char c) { return static_cast<char>(std::tolower(static_cast<unsigned char>(c))); });
+
+        if (key == "type") {
+            if (_stricmp(value.c_str(), "cdir") == 0 || _stricmp(value.c_str(), "pdir") == 0) {
+                return false;
+            }
+            info.isDirectory = _stricmp(value.c_str(), "dir") == 0;
+        } else if (key == "size" || key == "sizd") {
+            try { info.fileSize = std::stoll(value); } catch (...) {}
+        } else if (key == "modify") {
+            info.hasModifiedTime = ParseFtpTimestamp(value, info.lastModified);
+        }
+    }
+
+    return !info.fileName.empty();
+}
+
+bool FtpClient::ParseListLine(const std::string& line, FtpFileInfo& info) {
+    info = FtpFileInfo();
+    std::string rest;
+
+    // DOS/IIS: "01-31-20  09:15PM       <DIR>          name"
+    if (std::isdigit(static_cast<unsigned char>(line[0]))) {
+        auto tokens = Tokenize(line, 3, rest);
+        int month = 0, day = 0, year = 0, hour = 0, minute = 0;
+        char ampm[3] = {};
+        if (tokens.size() < 3 || rest.empty() ||
+            std::sscanf(tokens[0].c_str(), "%d-%d-%d", &month, &day, &year) != 3 ||
+            std::sscanf(tokens[1].c_str(), "%d:%d%2s", &hour, &minute, ampm) < 2) {
+            return false;
+        }
+        if (year < 70) year += 2000;
+        else if (year < 100) year += 1900;
+        if (_stricmp(ampm, "PM") == 0 && hour < 12) hour += 12;
+        if (_stricmp(ampm, "AM") == 0 && hour == 12) hour = 0;
+
+        info.isDirectory = _stricmp(tokens[2].c_str(), "<DIR>") == 0;
+        if (!info.isDirectory) {
+            try { info.fileSize = std::stoll(tokens[2]); } catch (...) { return false; }
+        }
+        if (month >= 1 && month <= 12 && day >= 1 && day <= 31) {
+            info.lastModified = MakeUtcTime(year, month, day, hour, minute, 0);
+            info.hasModifiedTime = true;
+        }
+        info.fileName = Unicode::Utf8ToWide(rest);
+        return true;
+    }
+
+    // Unix: "drwxr-xr-x 2 owner group 4096 Jan 31 21:15 name"
+    // The owner/group columns vary, so anchor on the month name
+    char type = line[0];
+    if (type != '-' && type != 'd' && type != 'l') return false;
+
+    auto tokens = Tokenize(line, 9, rest);
+    size_t monthIndex = 0;
+    for (size_t i = 2; i + 2 < tokens.size(); ++i) {
+        if (MonthFromName(tokens[i]) != 0 && IsAllDigits(tokens[i - 1])) {
+            monthIndex = i;
+            break;
+        }
+    }
+    if (monthIndex == 0) return false;
+
+    // Re-split so the name keeps its internal spacing
+    tokens = Tokenize(line, monthIndex + 3, rest);
+    if (tokens.size() < monthIndex + 3 || rest.empty()) return false;
+
+    info.isDirectory = (type == 'd');
+    try { info.fileSize = std::stoll(tokens[monthIndex - 1]); } catch (...) {}
+
+    if (type == 'l') {
+        auto arrow = rest.find(" -> ");
+        if (arrow != std::string::npos) rest.resize(arrow);
+    }
+    info.fileName = Unicode::Utf8ToWide(rest);
+
+    int month = MonthFromName(tokens[monthIndex]);
+    int day = std::atoi(tokens[monthIndex + 1].c_str());
+    const std::string& yearOrTime = tokens[monthIndex + 2];
+    if (day >= 1 && day <= 31) {
+        int hour = 0, minute = 0;
+        if (std::sscanf(yearOrTime.c_str(), "%d:%d", &hour, &minute) == 2) {
+            // No year: within the last six months, so this year unless
+            // that would put it in the future
+            auto now = SystemClock::now();
+            int64 today = std::chrono::duration_cast<std::chrono::hours>(
+                now - SystemClock::from_time_t(0)).count() / 24;
+            int64 year = YearFromDays(today);
+            info.lastModified = MakeUtcTime(year, month, day, hour, minute, 0);
+            if (info.lastModified > now + std::chrono::hours(24)) {
+                info.lastModified = MakeUtcTime(year - 1, month, day, hour, minute, 0);
+            }
+        } else {
+            info.lastModified = MakeUtcTime(std::atoi(yearOrTime.c_str()), month, day, 0, 0, 0);
+        }
+        info.hasModifiedTime = true;
+    }
+    return !info.fileName.empty();
+}
+
+// ─── URL Parsing ───────────────────────────────────────────────────────────
+bool FtpClient::ParseUrl(const String& url, FtpUrlParts& parts) {
+    if (!Unicode::IsFtpUrl(url)) return false;
+
+    // ftp[s]://[user[:password]@]host[:port]/path
+    parts = FtpUrlParts();
+    parts.implicitTls = _wcsnicmp(url.c_str(), L"ftps://", 7) == 0;
+    parts.port = parts.implicitTls ? 990 : 21;
+
+    size_t start = url.find(L"://") + 3;
+    size_t pathStart = url.find(L'/', start);
+    String authority = url.substr(start, pathStart == String::npos ? String::npos : pathStart - start);
+
+    auto atPos = authority.rfind(L'@');
+    if (atPos != String::npos) {
+        String userInfo = authority.substr(0, atPos);
+        authority = authority.substr(atPos + 1);
+
+        auto colonPos = userInfo.find(L':');
+        parts.username = Unicode::UrlDecode(userInfo.substr(0, colonPos));
+        if (colonPos != String::npos) {
+            parts.password = Unicode::UrlDecode(userInfo.substr(colonPos + 1));
+        }
+    }
+
+    // Bracketed IPv6 literal: [::1]:2121
+    auto bracket = authority.find(L']');
+    auto colonPos = authority.rfind(L':');
+    if (colonPos != String::npos && (bracket == String::npos || colonPos > bracket)) {
+        try { parts.port = static_cast<uint16>(std::stoi(authority.substr(colonPos + 1))); }
+        catch (...) {}
+        authority = authority.substr(0, colonPos);
+    }
+    if (authority.size() > 2 && authority.front() == L'[' && authority.back() == L']') {
+        authority = authority.substr(1, authority.size() - 2);
+    }
+
+    parts.host = authority;
+    parts.path = pathStart == String::npos ? L"/" : Unicode::UrlDecode(url.substr(pathStart));
+    return !parts.host.empty();
+}
+
+// ─── Helpers ───────────────────────────────────────────────────────────────
+bool FtpClient::EncodePath(const String& path, std::string& encoded) {
+    if (path.find_first_of(L"\r\n") != String::npos) {
+        SetError(L"Invalid FTP path: " + path);
+        return false;
+    }
+    encoded = Unicode::WideToUtf8(path);
+    return true;
+}
+
+void FtpClient::Cancel() {
+    m_cancelled.store(true);
+    m_data.Shutdown();
+    m_control.Shutdown();
+}
+
+void FtpClient::SetError(const String& msg) {
+    m_lastError = msg;
+    LOG_ERROR(L"FTP: %s", msg.c_str());
+}
+
 } // namespace idm
@@ -1,73 +1,229 @@
 /**
  * @file FtpClient.h
- * @brief FTP client supporting active and passive modes
+ * @brief Native FTP/FTPS protocol client
  *
- * Uses WinINet's FTP functions (not WinHTTP, which doesn't support FTP).
- * Supports: login, directory listing, file download, resume via REST command,
- * active and passive modes, proxy tunneling.
+ * Speaks RFC 959 directly over TcpStream instead of going through WinINet,
+ * which gives us control over the protocol and lets the client run on any
+ * platform with BSD sockets. Supports:
+ *   - Passive data channels: EPSV (RFC 2428) with PASV fallback
+ *   - Machine listings: MLSD/MLST (RFC 3659), LIST parsing as a fallback
+ *   - SIZE / MDTM / REST STREAM
+ *   - Explicit (AUTH TLS) and implicit (ftps://) FTPS with PROT P
+ *   - Persistent logged-in control connections, reused across files
+ *   - Pipelined command batches where the server tolerates them
+ *
+ * Segmented downloads: each connection issues REST <segment start> before
+ * RETR and closes the data channel once its segment end is reached; the
+ * server answers 426/226 and the control connection stays usable.
+ *
+ * Active mode (PORT/EPRT) is not implemented; data channels are always
+ * opened by the client, which also works through NAT and firewalls.
  */
 
 #pragma once
 #include "stdafx.h"
 #include "HttpClient.h"  // For DataCallback
+#include "TcpStream.h"
 
 namespace idm {
 
+// ─── FTP URL Components ────────────────────────────────────────────────────
+struct FtpUrlParts {
+    String  host;
+    uint16  port{21};
+    String  username;           // Empty = anonymous
+    String  password;
+    String  path;               // URL-decoded remote path
+    bool    implicitTls{false}; // ftps:// (TLS from the first byte, port 990)
+};
+
 struct FtpFileInfo {
-    String  fileName;
-    int64   fileSize{0};
-    bool    isDirectory{false};
-    FILETIME lastModified{};
+    String          fileName;
+    int64           fileSize{0};
+    bool            isDirectory{false};
+    SystemTimePoint lastModified{};     // UTC; epoch if unknown
+    bool            hasModifiedTime{false};
+};
+
+// ─── Server Reply ──────────────────────────────────────────────────────────
+struct FtpReply {
+    int                         code{0};    // 0 = no reply (I/O error)
+    std::vector<std::string>    lines;      // All reply lines, codes included
+
+    bool IsPreliminary() const { return code >= 100 && code < 200; }
+    bool IsSuccess() const { return code >= 200 && code < 300; }
+    bool IsIntermediate() const { return code >= 300 && code < 400; }
+    String Text() const;
+};
+
+// ─── Server Capabilities (from FEAT) ───────────────────────────────────────
+struct FtpFeatures {
+    bool    mlst{false};        // MLST and MLSD
+    bool    size{false};
+    bool    mdtm{false};
+    bool    epsv{true};         // Assumed until the server rejects it
+    bool    restStream{false};
+    bool    utf8{false};
+    bool    authTls{false};
+};
+
+enum class FtpSecurity {
+    None,       // Plain FTP
+    Explicit,   // AUTH TLS on the standard port, fail if unsupported
+    Implicit    // TLS from connect (ftps://, port 990)
 };
 
 class FtpClient {
 public:
     FtpClient();
     ~FtpClient();
-    
+
     FtpClient(const FtpClient&) = delete;
     FtpClient& operator=(const FtpClient&) = delete;
-    
+
     /**
-     * Connect to an FTP server.
+     * Connect and log in. The session stays open until Disconnect().
+     * @param passiveMode  Kept for API compatibility; always passive
      */
     bool Connect(const String& host, uint16 port = 21,
                  const String& username = L"anonymous",
                  const String& password = L"anonymous@",
                  bool passiveMode = true);
-    
+
     /**
-     * Disconnect from the server.
+     * Disconnect from the server (QUIT, then close).
      */
     void Disconnect();
-    
+
     /**
-     * Get file information (size, date).
+     * TLS settings, applied by the next Connect().
+     */
+    void SetSecurity(FtpSecurity mode) { m_security = mode; }
+    void SetVerifyCertificate(bool verify) { m_verifyCert = verify; }
+
+    /**
+     * Allow sending idempotent command batches without waiting for each
+     * reply. Switched off automatically if the server mishandles it.
+     */
+    void SetPipelining(bool enabled) { m_pipelining = enabled; }
+
+    /**
+     * Get file information (size, date) via MLST, or SIZE + MDTM.
      */
     bool GetFileInfo(const String& remotePath, FtpFileInfo& info);
-    
+
     /**
      * Download a file with optional resume position.
+     * @param endPosition  Last byte to deliver (inclusive), -1 = to EOF.
+     *                     The transfer is aborted once it is reached.
+     * @param gate         Optional, consulted before each data read.
      */
     bool Download(const String& remotePath, int64 startPosition,
-                  DataCallback callback);
-    
+                  DataCallback callback, int64 endPosition = -1,
+                  const ReadGate& gate = {});
+
     /**
-     * List directory contents.
+     * Check whether the server accepts REST in stream mode (needed for
+     * resume and for starting a connection in the middle of a file).
+     */
+    bool SupportsRestart();
+
+    /**
+     * Round-trip time of the data connection, during a Download().
+     */
+    bool GetDataRoundTripTime(int64& rttUs) const { return m_data.GetRoundTripTime(rttUs); }
+
+    /**
+     * List directory contents via MLSD, or LIST parsing as a fallback.
+     * "." and ".." are never returned.
      */
     bool ListDirectory(const String& remotePath, std::vector<FtpFileInfo>& files);
-    
+
+    /**
+     * Send NOOP to check that a pooled session is still alive.
+     */
+    bool Noop();
+
     /**
      * Check if connected.
      */
-    bool IsConnected() const { return m_hConnection != nullptr; }
-    
-    void Cancel() { m_cancelled.store(true); }
+    bool IsConnected() const { return m_loggedIn && m_control.IsOpen(); }
+
+    /**
+     * Check if this client holds a logged-in session to the given endpoint.
+     * Used by the ConnectionPool to hand out reusable control connections.
+     */
+    bool IsConnectedTo(const String& host, uint16 port, const String& username) const;
+
+    const FtpFeatures& GetFeatures() const { return m_features; }
+
+    /**
+     * Split an ftp:// or ftps:// URL into host, port, credentials and path.
+     */
+    static bool ParseUrl(const String& url, FtpUrlParts& parts);
+
+    /**
+     * Parse one MLSD/MLST fact line ("type=file;size=1;modify=...; name").
+     */
+    static bool ParseMlsxLine(const std::string& line, FtpFileInfo& info);
+
+    /**
+     * Parse one LIST line in Unix ("-rw-r--r-- 1 u g 123 Jan 01 12:00 f")
+     * or DOS ("01-01-20  12:00PM  123 f") format.
+     */
+    static bool ParseListLine(const std::string& line, FtpFileInfo& info);
+
+    /**
+     * Cancel an in-progress operation (thread-safe).
+     */
+    void Cancel();
+    void Reset() { m_cancelled.store(false); m_lastError.clear(); }
     String GetLastErrorMessage() const { return m_lastError; }
-    
+
 private:
-    HINTERNET           m_hInternet{nullptr};
-    HINTERNET           m_hConnection{nullptr};
+    bool SendCommand(const std::string& command);
+    bool ReadReply(FtpReply& reply);
+    bool Command(const std::string& command, FtpReply& reply);
+
+    // Send a batch of commands, pipelined when allowed, one reply each
+    bool Pipeline(const std::vector<std::string>& commands, std::vector<FtpReply>& replies);
+
+    // Close the control connection without QUIT (state unknown)
+    void DropConnection();
+
+    bool Login(const String& username, const String& password);
+    void QueryFeatures();
+
+    // Negotiate a passive data channel and connect m_data to it
+    bool OpenDataChannel();
+
+    // Send a transfer command (preceded by REST when restarting) and wait
+    // for its 1xx reply, then secure the data channel if PROT P is in effect
+    bool StartTransfer(const std::string& command, int64 restartAt = 0);
+
+    // Read the data channel to EOF into 'out' (listings)
+    bool ReadDataToEnd(std::string& out);
+
+    // Close the data channel and consume the transfer's final reply
+    bool FinishTransfer(bool aborted);
+
+    // Convert a path for the control channel; rejects embedded CR/LF
+    bool EncodePath(const String& path, std::string& encoded);
+    void SetError(const String& msg);
+
+    TcpStream           m_control;
+    TcpStream           m_data;
+    FtpFeatures         m_features;
+    FtpSecurity         m_security{FtpSecurity::None};
+    bool                m_verifyCert{true};
+    bool                m_pipelining{true};
+    bool                m_protectData{false};   // PROT P accepted
+    bool                m_loggedIn{false};
+    int                 m_timeoutSec{constants::DEFAULT_TIMEOUT_SECONDS};
+
+    String              m_host;
+    uint16              m_port{0};
+    String              m_username;
     String              m_lastError;
     std::atomic<bool>   m_cancelled{false};
 };
@@ -0,0 +1,761 @@
+/**
+ * @file FtpMirror.cpp
+ * @brief Parallel recursive FTP mirror jobs
+ */
+
+#include "stdafx.h"
+#include "FtpMirror.h"
+#include "ConnectionPool.h"
+#include "FileAssembler.h"
+#include "SpeedLimiter.h"
+#include "AuthManager.h"
+#include "../util/Database.h"
+#include "../util/Logger.h"
+#include "../util/Unicode.h"
+
+namespace idm {
+
+namespace {
+
+constexpr int64 FILETIME_UNIX_EPOCH = 116444736000000000LL;  // 1970-01-01 in 100ns ticks
+constexpr int64 FILETIME_TICKS_PER_SEC = 10000000LL;
+constexpr int64 MTIME_TOLERANCE_SEC = 2;                     // FAT/exFAT resolution
+
+String JoinRemote(const String& dir, const String& name) {
+    return (dir.empty() || dir.back() == L'/') ? dir + name : dir + L"/" + name;
+}
+
+String NormalizeRemoteDir(String path) {
+    if (path.empty() || path.front() != L'/') path.insert(path.begin(), L'/');
+    while (path.size() > 1 && path.back() == L'/') path.pop_back();
+    return path;
+}
+
+int64 ToUnixSeconds(const SystemTimePoint& time) {
+    return std::chrono::duration_cast<std::chrono::seconds>(
+        time - SystemClock::from_time_t(0)).count();
+}
+
+SystemTimePoint FromUnixSeconds(int64 secs) {
+    return SystemClock::from_time_t(0) + std::chrono::seconds(secs);
+}
+
+} // anonymous namespace
+
+// ─── Singleton ─────────────────────────────────────────────────────────────
+FtpMirror& FtpMirror::Instance() {
+    static FtpMirror instance;
+    return instance;
+}
+
+FtpMirror::~FtpMirror() {
+    Shutdown();
+}
+
+// ─── Lifecycle ─────────────────────────────────────────────────────────────
+void FtpMirror::Initialize(const String& dataDir) {
+    m_stateDir = dataDir + L"\\mirrors";
+
+    std::error_code ec;
+    std::filesystem::create_directories(m_stateDir, ec);
+
+    int loaded = 0;
+    for (const auto& item : std::filesystem::directory_iterator(m_stateDir, ec)) {
+        if (item.path().extension() != L".mirror") continue;
+
+        auto job = LoadState(item.path().wstring());
+        if (!job) {
+            LOG_WARN(L"FtpMirror: ignoring unreadable state file %s", item.path().c_str());
+            continue;
+        }
+
+        Lock lock(m_jobsMutex);
+        m_jobs[job->id] = job;
+        ++loaded;
+    }
+
+    if (loaded > 0) {
+        LOG_INFO(L"FtpMirror: loaded %d mirror job(s)", loaded);
+    }
+}
+
+void FtpMirror::Shutdown() {
+    std::vector<std::shared_ptr<Job>> jobs;
+    {
+        Lock lock(m_jobsMutex);
+        for (const auto& [id, job] : m_jobs) jobs.push_back(job);
+    }
+    for (const auto& job : jobs) {
+        StopJob(job);
+    }
+}
+
+// ─── Job Control ───────────────────────────────────────────────────────────
+String FtpMirror::StartMirror(const String& url, const String& localDir,
+                              const MirrorOptions& options) {
+    auto job = std::make_shared<Job>();
+    if (!FtpClient::ParseUrl(url, job->endpoint) || localDir.empty()) {
+        LOG_ERROR(L"FtpMirror: invalid mirror source %s", url.c_str());
+        return L"";
+    }
+    if (job->endpoint.username.empty()) {
+        if (auto cred = AuthManager::Instance().FindCredential(url)) {
+            job->endpoint.username = cred->username;
+            job->endpoint.password = cred->password;
+        }
+    }
+
+    job->id = DownloadEntry::GenerateId();
+    job->url = url;
+    job->localDir = localDir;
+    job->options = options;
+    job->options.maxSessions = std::clamp(options.maxSessions, 1, constants::MAX_CONNECTIONS);
+    job->endpoint.path = NormalizeRemoteDir(job->endpoint.path);
+
+    job->pendingDirs.push_back(job->endpoint.path);
+    job->knownDirs.insert(job->endpoint.path);
+
+    {
+        Lock lock(m_jobsMutex);
+        m_jobs[job->id] = job;
+    }
+
+    LOG_INFO(L"FtpMirror: job %s mirroring %s into %s with %d session(s)",
+             job->id.c_str(), url.c_str(), localDir.c_str(), job->options.maxSessions);
+    LaunchJob(job);
+    return job->id;
+}
+
+bool FtpMirror::ResumeMirror(const String& jobId) {
+    std::shared_ptr<Job> job;
+    {
+        Lock lock(m_jobsMutex);
+        auto it = m_jobs.find(jobId);
+        if (it == m_jobs.end()) return false;
+        job = it->second;
+    }
+
+    {
+        Lock lock(job->mutex);
+        if (job->status == MirrorStatus::Running) return true;
+
+        // Give failed directories and files another chance
+        for (auto& file : job->files) {
+            if (file.state == FileState::Failed) file.state = FileState::Queued;
+        }
+        job->transferQueue.clear();
+        for (size_t i = 0; i < job->files.size(); ++i) {
+            if (job->files[i].state == FileState::Queued) job->transferQueue.push_back(i);
+        }
+        for (const auto& dir : job->failedDirs) job->pendingDirs.push_back(dir);
+        job->failedDirs.clear();
+    }
+
+    if (job->monitor.joinable()) job->monitor.join();
+    LaunchJob(job);
+    return true;
+}
+
+bool FtpMirror::StopMirror(const String& jobId) {
+    std::shared_ptr<Job> job;
+    {
+        Lock lock(m_jobsMutex);
+        auto it = m_jobs.find(jobId);
+        if (it == m_jobs.end()) return false;
+        job = it->second;
+    }
+    StopJob(job);
+    return true;
+}
+
+bool FtpMirror::RemoveMirror(const String& jobId) {
+    std::shared_ptr<Job> job;
+    {
+        Lock lock(m_jobsMutex);
+        auto it = m_jobs.find(jobId);
+        if (it == m_jobs.end()) return false;
+        job = it->second;
+        m_jobs.erase(it);
+    }
+    StopJob(job);
+
+    ::DeleteFileW(StatePath(jobId).c_str());
+    return true;
+}
+
+void FtpMirror::LaunchJob(const std::shared_ptr<Job>& job) {
+    {
+        Lock lock(job->mutex);
+        job->cancelled.store(false);
+        job->status = MirrorStatus::Running;
+        job->errorMessage.clear();
+        job->lastSave = Clock::now();
+        job->activeWorkers = job->options.maxSessions;
+    }
+
+    job->workers.clear();
+    for (int i = 0; i < job->options.maxSessions; ++i) {
+        job->workers.emplace_back(&FtpMirror::SessionWorker, this, job);
+    }
+    job->monitor = std::thread(&FtpMirror::MonitorThread, this, job);
+}
+
+void FtpMirror::StopJob(const std::shared_ptr<Job>& job) {
+    {
+        Lock lock(job->mutex);
+        job->cancelled.store(true);
+    }
+    job->workAvailable.notify_all();
+
+    // The monitor joins the session workers and writes the final state
+    if (job->monitor.joinable()) job->monitor.join();
+}
+
+// ─── Session Worker ────────────────────────────────────────────────────────
+void FtpMirror::SessionWorker(std::shared_ptr<Job> job) {
+    std::unique_ptr<FtpClient> ftp;
+
+    for (;;) {
+        String dir;
+        size_t fileIndex = 0;
+        MirrorFile file;
+        bool haveFile = false;
+
+        {
+            Lock lock(job->mutex);
+
+            // Idle until there is work, or until no listing is in flight that
+            // could still produce some
+            job->workAvailable.wait(lock, [&] {
+                return job->cancelled.load() || !job->pendingDirs.empty() ||
+                       !job->transferQueue.empty() || job->listingDirs.empty();
+            });
+
+            if (job->cancelled.load()) break;
+
+            // Listing first: it discovers the work the other sessions need
+            if (!job->pendingDirs.empty()) {
+                dir = job->pendingDirs.front();
+                job->pendingDirs.pop_front();
+                job->listingDirs.insert(dir);
+            } else if (!job->transferQueue.empty()) {
+                fileIndex = job->transferQueue.front();
+                job->transferQueue.pop_front();
+                file = job->files[fileIndex];
+                haveFile = true;
+            } else {
+                break;  // Tree fully walked and every transfer handed out
+            }
+        }
+
+        if (!haveFile) {
+            bool listed = ListOne(*job, ftp, dir);
+
+            Lock lock(job->mutex);
+            job->listingDirs.erase(dir);
+            if (listed) {
+                job->listedDirs.insert(dir);
+            } else if (job->cancelled.load()) {
+                job->pendingDirs.push_front(dir);  // Saved for resume
+            } else {
+                job->failedDirs.push_back(dir);
+            }
+        } else {
+            bool transferred = TransferOne(*job, ftp, file);
+
+            Lock lock(job->mutex);
+            if (transferred) {
+                job->files[fileIndex].state = FileState::Done;
+            } else if (!job->cancelled.load()) {
+                job->files[fileIndex].state = FileState::Failed;
+            }
+        }
+        job->workAvailable.notify_all();
+    }
+
+    if (ftp) {
+        ConnectionPool::Instance().ReleaseFtpClient(std::move(ftp));
+    }
+
+    {
+        Lock lock(job->mutex);
+        --job->activeWorkers;
+    }
+    job->workAvailable.notify_all();
+}
+
+bool FtpMirror::EnsureSession(Job& job, std::unique_ptr<FtpClient>& ftp) {
+    const auto& ep = job.endpoint;
+
+    if (!ftp) {
+        ftp = ConnectionPool::Instance().AcquireFtpClient(ep.host, ep.port, ep.username);
+    }
+    if (ftp->IsConnectedTo(ep.host, ep.port, ep.username)) return true;
+
+    ftp->SetSecurity(ep.implicitTls ? FtpSecurity::Implicit : FtpSecurity::None);
+    if (ftp->Connect(ep.host, ep.port,
+                     ep.username.empty() ? L"anonymous" : ep.username,
+                     ep.username.empty() ? L"anonymous@" : ep.password)) {
+        return true;
+    }
+
+    Lock lock(job.mutex);
+    job.errorMessage = ftp->GetLastErrorMessage();
+    return false;
+}
+
+bool FtpMirror::ListOne(Job& job, std::unique_ptr<FtpClient>& ftp, const String& remoteDir) {
+    std::vector<FtpFileInfo> entries;
+
+    bool listed = EnsureSession(job, ftp) && ftp->ListDirectory(remoteDir, entries);
+    if (!listed && !job.cancelled.load()) {
+        // A pooled session may have timed out between jobs: one fresh retry
+        listed = EnsureSession(job, ftp) && ftp->ListDirectory(remoteDir, entries);
+    }
+    if (!listed) {
+        if (!job.cancelled.load()) {
+            Lock lock(job.mutex);
+            job.errorMessage = L"Cannot list " + remoteDir + L": " + ftp->GetLastErrorMessage();
+            LOG_WARN(L"FtpMirror: %s", job.errorMessage.c_str());
+        }
+        return false;
+    }
+
+    // Compare against the local tree outside the job lock
+    std::vector<String> subdirs;
+    std::vector<MirrorFile> changed;
+    int skipped = 0;
+
+    for (const auto& entry : entries) {
+        if (entry.fileName.find(L'/') != String::npos) continue;
+
+        String child = JoinRemote(remoteDir, entry.fileName);
+        if (entry.isDirectory) {
+            subdirs.push_back(child);
+        } else if (IsUpToDate(LocalPathFor(job, child), entry, job.options.preserveTimes)) {
+            ++skipped;
+        } else {
+            MirrorFile file;
+            file.remotePath = child;
+            file.size = entry.fileSize;
+            file.modified = entry.lastModified;
+            file.hasModified = entry.hasModifiedTime;
+            changed.push_back(std::move(file));
+        }
+    }
+
+    Lock lock(job.mutex);
+    for (auto& subdir : subdirs) {
+        if (job.knownDirs.insert(subdir).second) {
+            job.pendingDirs.push_back(std::move(subdir));
+        }
+    }
+    for (auto& file : changed) {
+        job.transferQueue.push_back(job.files.size());
+        job.files.push_back(std::move(file));
+    }
+    job.filesSkipped += skipped;
+    return true;
+}
+
+bool FtpMirror::TransferOne(Job& job, std::unique_ptr<FtpClient>& ftp, MirrorFile file) {
+    String localPath = LocalPathFor(job, file.remotePath);
+    String partialPath = localPath + L".idmclone";
+
+    std::error_code ec;
+    std::filesystem::create_directories(std::filesystem::path(localPath).parent_path(), ec);
+
+    if (!EnsureSession(job, ftp)) return false;
+
+    // Resume a partial file left by an earlier run
+    int64 startAt = 0;
+    WIN32_FILE_ATTRIBUTE_DATA attr = {};
+    if (::GetFileAttributesExW(partialPath.c_str(), GetFileExInfoStandard, &attr)) {
+        int64 partialSize = (static_cast<int64>(attr.nFileSizeHigh) << 32) | attr.nFileSizeLow;
+        if (partialSize > 0 && partialSize <= file.size && ftp->SupportsRestart()) {
+            startAt = partialSize;
+        }
+    }
+
+    HANDLE hFile = ::CreateFileW(partialPath.c_str(), GENERIC_WRITE, FILE_SHARE_READ,
+        nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        Lock lock(job.mutex);
+        job.errorMessage = L"Cannot create " + partialPath;
+        return false;
+    }
+
+    // Drop anything past the resume point
+    LARGE_INTEGER li;
+    li.QuadPart = startAt;
+    ::SetFilePointerEx(hFile, li, nullptr, FILE_BEGIN);
+    ::SetEndOfFile(hFile);
+
+    int64 position = startAt;
+    job.bytesDone.fetch_add(startAt);
+
+    // Paced limiting happens before each read (see DownloadEngine)
+    auto& limiter = SpeedLimiter::Instance();
+    const bool paced = limiter.IsPacing();
+    ReadGate gate;
+    if (paced) {
+        gate.acquire = [&limiter](size_t wanted) { return limiter.RequestBytes(wanted); };
+        gate.release = [&limiter](size_t unused) { limiter.ReturnBytes(unused); };
+    }
+
+    auto onData = [&](const uint8* data, size_t length) -> bool {
+        if (job.cancelled.load()) return false;
+
+        size_t offset = 0;
+        while (offset < length) {
+            size_t permitted = paced ? length - offset : limiter.RequestBytes(length - offset);
+            if (permitted == 0) permitted = length - offset;
+
+            if (!FileAssembler::WriteAtPosition(hFile, position, data + offset, permitted)) {
+                return false;
+            }
+            position += static_cast<int64>(permitted);
+            offset += permitted;
+            job.bytesDone.fetch_add(static_cast<int64>(permitted));
+            job.bytesThisSecond.fetch_add(static_cast<int64>(permitted));
+        }
+        return true;
+    };
+
+    bool downloaded = ftp->Download(file.remotePath, startAt, onData, -1, gate);
+    ::CloseHandle(hFile);
+
+    if (!downloaded || position != file.size) {
+        // Only finished files count toward bytesDone; the partial file
+        // is picked up again by the next attempt
+        job.bytesDone.fetch_sub(position);
+        if (!job.cancelled.load()) {
+            Lock lock(job.mutex);
+            job.errorMessage = L"Transfer failed for " + file.remotePath + L": " +
+                (downloaded ? L"size mismatch" : ftp->GetLastErrorMessage());
+            LOG_WARN(L"FtpMirror: %s", job.errorMessage.c_str());
+        }
+        return false;
+    }
+
+    if (!::MoveFileExW(partialPath.c_str(), localPath.c_str(), MOVEFILE_REPLACE_EXISTING)) {
+        job.bytesDone.fetch_sub(position);
+        Lock lock(job.mutex);
+        job.errorMessage = L"Cannot replace " + localPath;
+        return false;
+    }
+
+    // The next run compares against these times
+    if (job.options.preserveTimes && file.hasModified) {
+        SetLocalFileTime(localPath, file.modified);
+    }
+    return true;
+}
+
+// ─── Monitor ───────────────────────────────────────────────────────────────
+void FtpMirror::MonitorThread(std::shared_ptr<Job> job) {
+    auto secondStart = Clock::now();
+
+    for (;;) {
+        bool finished;
+        {
+            Lock lock(job->mutex);
+            finished = job->workAvailable.wait_for(lock,
+                std::chrono::milliseconds(constants::SPEED_SAMPLE_INTERVAL_MS),
+                [&] { return job->activeWorkers == 0; });
+        }
+
+        auto now = Clock::now();
+        double elapsed = std::chrono::duration<double>(now - secondStart).count();
+        if (elapsed >= 1.0) {
+            job->speed.store(job->bytesThisSecond.exchange(0) / elapsed);
+            secondStart = now;
+        }
+
+        if (finished) break;
+
+        if (now - job->lastSave >= std::chrono::milliseconds(constants::SEGMENT_SAVE_INTERVAL_MS)) {
+            SaveState(*job);
+            job->lastSave = now;
+        }
+    }
+
+    for (auto& worker : job->workers) {
+        if (worker.joinable()) worker.join();
+    }
+    job->workers.clear();
+
+    MirrorStatus status;
+    {
+        Lock lock(job->mutex);
+        bool anyFailed = !job->failedDirs.empty() ||
+            std::any_of(job->files.begin(), job->files.end(),
+                        [](const MirrorFile& f) { return f.state == FileState::Failed; });
+
+        if (job->cancelled.load()) status = MirrorStatus::Stopped;
+        else if (anyFailed) status = MirrorStatus::Error;
+        else status = MirrorStatus::Complete;
+
+        job->status = status;
+        job->speed.store(0);
+    }
+
+    SaveState(*job);
+
+    MirrorProgress progress = MakeProgress(*job);
+    LOG_INFO(L"FtpMirror: job %s %s: %d dirs, %d/%d files transferred, %d up to date, %d failed",
+             job->id.c_str(),
+             status == MirrorStatus::Stopped ? L"stopped" :
+             status == MirrorStatus::Complete ? L"complete" : L"finished with errors",
+             progress.directoriesListed, progress.filesDone, progress.filesQueued,
+             progress.filesSkipped, progress.filesFailed);
+}
+
+// ─── Progress ──────────────────────────────────────────────────────────────
+std::optional<MirrorProgress> FtpMirror::GetProgress(const String& jobId) const {
+    std::shared_ptr<Job> job;
+    {
+        Lock lock(m_jobsMutex);
+        auto it = m_jobs.find(jobId);
+        if (it == m_jobs.end()) return std::nullopt;
+        job = it->second;
+    }
+    return MakeProgress(*job);
+}
+
+std::vector<MirrorProgress> FtpMirror::GetAllJobs() const {
+    std::vector<std::shared_ptr<Job>> jobs;
+    {
+        Lock lock(m_jobsMutex);
+        for (const auto& [id, job] : m_jobs) jobs.push_back(job);
+    }
+
+    std::vector<MirrorProgress> result;
+    result.reserve(jobs.size());
+    for (const auto& job : jobs) {
+        result.push_back(MakeProgress(*job));
+    }
+    return result;
+}
+
+MirrorProgress FtpMirror::MakeProgress(const Job& job) const {
+    Lock lock(job.mutex);
+
+    MirrorProgress progress;
+    progress.jobId = job.id;
+    progress.url = job.url;
+    progress.localDir = job.localDir;
+    progress.status = job.status;
+    progress.directoriesListed = static_cast<int>(job.listedDirs.size());
+    progress.directoriesPending = static_cast<int>(job.pendingDirs.size() + job.listingDirs.size());
+    progress.directoriesFailed = static_cast<int>(job.failedDirs.size());
+    progress.filesQueued = static_cast<int>(job.files.size());
+    progress.filesSkipped = job.filesSkipped;
+
+    for (const auto& file : job.files) {
+        progress.bytesQueued += file.size;
+        if (file.state == FileState::Done) ++progress.filesDone;
+        else if (file.state == FileState::Failed) ++progress.filesFailed;
+    }
+
+    progress.bytesDone = job.bytesDone.load();
+    progress.speed = job.speed.load();
+    progress.errorMessage = job.errorMessage;
+    return progress;
+}
+
+// ─── Local Tree ────────────────────────────────────────────────────────────
+String FtpMirror::LocalPathFor(const Job& job, const String& remotePath) const {
+    // Path relative to the mirrored root, one sanitized component at a time
+    const String& root = job.endpoint.path;
+    String relative = remotePath.substr((std::min)(root.size(), remotePath.size()));
+
+    String local = job.localDir;
+    for (const auto& part : Unicode::Split(relative, L'/')) {
+        if (part.empty() || part == L"." || part == L"..") continue;
+        local += L"\\" + Unicode::SanitizeFilename(part);
+    }
+    return local;
+}
+
+bool FtpMirror::IsUpToDate(const String& localPath, const FtpFileInfo& remote, bool compareTimes) {
+    WIN32_FILE_ATTRIBUTE_DATA attr = {};
+    if (!::GetFileAttributesExW(localPath.c_str(), GetFileExInfoStandard, &attr)) return false;
+    if (attr.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) return false;
+
+    int64 localSize = (static_cast<int64>(attr.nFileSizeHigh) << 32) | attr.nFileSizeLow;
+    if (localSize != remote.fileSize) return false;
+    if (!compareTimes || !remote.hasModifiedTime) return true;
+
+    ULARGE_INTEGER ticks;
+    ticks.LowPart = attr.ftLastWriteTime.dwLowDateTime;
+    ticks.HighPart = attr.ftLastWriteTime.dwHighDateTime;
+    int64 localSecs = (static_cast<int64>(ticks.QuadPart) - FILETIME_UNIX_EPOCH) / FILETIME_TICKS_PER_SEC;
+
+    return std::llabs(localSecs - ToUnixSeconds(remote.lastModified)) <= MTIME_TOLERANCE_SEC;
+}
+
+bool FtpMirror::SetLocalFileTime(const String& path, const SystemTimePoint& time) {
+    ULARGE_INTEGER ticks;
+    ticks.QuadPart = static_cast<ULONGLONG>(ToUnixSeconds(time) * FILETIME_TICKS_PER_SEC + FILETIME_UNIX_EPOCH);
+
+    FILETIME ft;
+    ft.dwLowDateTime = ticks.LowPart;
+    ft.dwHighDateTime = ticks.HighPart;
+
+    HANDLE hFile = ::CreateFileW(path.c_str(), FILE_WRITE_ATTRIBUTES,
+        FILE_SHARE_READ, nullptr, OPEN_EXISTING, 0, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE) return false;
+
+    BOOL result = ::SetFileTime(hFile, nullptr, nullptr, &ft);
+    ::CloseHandle(hFile);
+    return result != FALSE;
+}
+
+// ─── State Persistence ─────────────────────────────────────────────────────
+String FtpMirror::StatePath(const String& jobId) const {
+    return m_stateDir + L"\\" + jobId + L".mirror";
+}
+
+bool FtpMirror::SaveState(const Job& job) const {
+    if (m_stateDir.empty()) return false;
+
+    // Snapshot under the lock, write without it
+    std::ostringstream out;
+    {
+        Lock lock(job.mutex);
+
+        auto put = [&](const char* key, const String& value) {
+            out << key << '=' << Unicode::WideToUtf8(value) << '\n';
+        };
+
+        out << "IDMCLONE_MIRROR_V1\n";
+        put("id", job.id);
+        put("url", job.url);
+        put("localDir", job.localDir);
+        out << "maxSessions=" << job.options.maxSessions << '\n';
+        out << "preserveTimes=" << (job.options.preserveTimes ? 1 : 0) << '\n';
+        out << "skipped=" << job.filesSkipped << '\n';
+        out << "---\n";
+
+        for (const auto& dir : job.listedDirs) put("listed", dir);
+
+        // In-flight and failed listings are redone on resume
+        for (const auto& dir : job.listingDirs) put("dir", dir);
+        for (const auto& dir : job.pendingDirs) put("dir", dir);
+        for (const auto& dir : job.failedDirs) put("dir", dir);
+
+        // state,size,mtime(-1 = unknown),path
+        for (const auto& file : job.files) {
+            out << "file=" << static_cast<int>(file.state) << ','
+                << file.size << ','
+                << (file.hasModified ? ToUnixSeconds(file.modified) : -1) << ','
+                << Unicode::WideToUtf8(file.remotePath) << '\n';
+        }
+        out << "END_MIRROR\n";
+    }
+
+    String path = StatePath(job.id);
+    String tempPath = path + L".tmp";
+    {
+        std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) {
+            LOG_ERROR(L"FtpMirror: cannot write %s", tempPath.c_str());
+            return false;
+        }
+        file << out.str();
+        if (!file.good()) return false;
+    }
+
+    return ::MoveFileExW(tempPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING) != FALSE;
+}
+
+std::shared_ptr<FtpMirror::Job> FtpMirror::LoadState(const String& statePath) const {
+    std::ifstream file(statePath, std::ios::binary);
+    if (!file.is_open()) return nullptr;
+
+    std::string line;
+    if (!std::getline(file, line) || line != "IDMCLONE_MIRROR_V1") return nullptr;
+
+    auto job = std::make_shared<Job>();
+    bool complete = false;
+
+    try {
+        while (std::getline(file, line)) {
+            if (line == "END_MIRROR") {
+                complete = true;
+                break;
+            }
+            auto eq = line.find('=');
+            if (eq == std::string::npos) continue;
+
+            std::string key = line.substr(0, eq);
+            std::string value = line.substr(eq + 1);
+
+            if (key == "id") job->id = Unicode::Utf8ToWide(value);
+            else if (key == "url") job->url = Unicode::Utf8ToWide(value);
+            else if (key == "localDir") job->localDir = Unicode::Utf8ToWide(value);
+            else if (key == "maxSessions") job->options.maxSessions = std::stoi(value);
+            else if (key == "preserveTimes") job->options.preserveTimes = (value == "1");
+            else if (key == "skipped") job->filesSkipped = std::stoi(value);
+            else if (key == "listed") {
+                String dir = Unicode::Utf8ToWide(value);
+                job->listedDirs.insert(dir);
+                job->knownDirs.insert(dir);
+            } else if (key == "dir") {
+                String dir = Unicode::Utf8ToWide(value);
+                if (job->knownDirs.insert(dir).second) job->pendingDirs.push_back(dir);
+            } else if (key == "file") {
+                int state = 0;
+                long long size = 0, mtime = -1;
+                int consumed = 0;
+                if (std::sscanf(value.c_str(), "%d,%lld,%lld,%n", &state, &size, &mtime, &consumed) < 3 ||
+                    consumed == 0) {
+                    continue;
+                }
+
+                MirrorFile mf;
+                mf.state = static_cast<FileState>(state);
+                mf.size = size;
+                mf.hasModified = mtime >= 0;
+                if (mf.hasModified) mf.modified = FromUnixSeconds(mtime);
+                mf.remotePath = Unicode::Utf8ToWide(value.substr(static_cast<size_t>(consumed)));
+                job->files.push_back(std::move(mf));
+            }
+        }
+    } catch (const std::exception& e) {
+        LOG_ERROR(L"FtpMirror: state load failed: %S", e.what());
+        return nullptr;
+    }
+
+    if (!complete || job->id.empty() || !FtpClient::ParseUrl(job->url, job->endpoint)) {
+        return nullptr;
+    }
+    if (job->endpoint.username.empty()) {
+        if (auto cred = AuthManager::Instance().FindCredential(job->url)) {
+            job->endpoint.username = cred->username;
+            job->endpoint.password = cred->password;
+        }
+    }
+    job->endpoint.path = NormalizeRemoteDir(job->endpoint.path);
+    job->options.maxSessions = std::clamp(job->options.maxSessions, 1, constants::MAX_CONNECTIONS);
+
+    int64 doneBytes = 0;
+    bool anyFailed = false;
+    for (size_t i = 0; i < job->files.size(); ++i) {
+        const auto& mf = job->files[i];
+        if (mf.state == FileState::Done) doneBytes += mf.size;
+        else if (mf.state == FileState::Queued) job->transferQueue.push_back(i);
+        else anyFailed = true;
+    }
+    job->bytesDone.store(doneBytes);
+
+    if (!job->pendingDirs.empty() || !job->transferQueue.empty()) {
+        job->status = MirrorStatus::Stopped;
+    } else {
+        job->status = anyFailed ? MirrorStatus::Error : MirrorStatus::Complete;
+    }
+    return job;
+}
+
+} // namespace idm
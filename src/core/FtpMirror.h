@@ -0,0 +1,185 @@
+/**
+ * @file FtpMirror.h
+ * @brief Parallel recursive FTP directory mirroring
+ *
+ * A mirror job walks a remote directory tree and brings a local directory
+ * up to date with it:
+ *   1. Listing: directories are listed (MLSD/LIST) by several sessions in
+ *      parallel; each listing feeds new subdirectories back into the queue
+ *   2. Compare: remote files whose size and modification time match the
+ *      local copy are skipped, everything else is queued for transfer.
+ *      Without preserveTimes the local times are never stamped, so only
+ *      the size is compared
+ *   3. Transfer: queued files are fetched by the same bounded set of FTP
+ *      sessions, each keeping its control connection logged in between
+ *      files. Partial files resume with REST.
+ *
+ * Listing and transfer overlap: a session prefers listing work so the
+ * queue fills early, and picks up transfers whenever no directory is
+ * waiting.
+ *
+ * Job state (listed directories, pending directories, queued files) is
+ * saved to <dataDir>\mirrors\<jobId>.mirror. A stopped or interrupted job
+ * resumes from that file without re-listing the directories it already
+ * walked.
+ */
+
+#pragma once
+#include "stdafx.h"
+#include "FtpClient.h"
+
+namespace idm {
+
+struct MirrorOptions {
+    int     maxSessions{4};         // Concurrent FTP sessions (listing + transfer)
+    bool    preserveTimes{true};    // Stamp local files with the remote mtime;
+                                    // off: up to date means same size
+};
+
+enum class MirrorStatus {
+    Running,
+    Stopped,        // Cancelled or interrupted; resumable
+    Complete,
+    Error           // Finished, but some directories or files failed
+};
+
+struct MirrorProgress {
+    String          jobId;
+    String          url;
+    String          localDir;
+    MirrorStatus    status{MirrorStatus::Stopped};
+
+    int             directoriesListed{0};
+    int             directoriesPending{0};
+    int             directoriesFailed{0};
+
+    int             filesQueued{0};         // New or changed, needing transfer
+    int             filesDone{0};
+    int             filesFailed{0};
+    int             filesSkipped{0};        // Already up to date locally
+
+    int64           bytesQueued{0};
+    int64           bytesDone{0};
+    double          speed{0};               // bytes/sec over the last second
+    String          errorMessage;           // Last error seen
+};
+
+class FtpMirror {
+public:
+    static FtpMirror& Instance();
+
+    FtpMirror(const FtpMirror&) = delete;
+    FtpMirror& operator=(const FtpMirror&) = delete;
+
+    /**
+     * Load saved jobs from <dataDir>\mirrors. Loaded jobs are Stopped
+     * (or Complete) until ResumeMirror() is called.
+     */
+    void Initialize(const String& dataDir);
+
+    /**
+     * Stop all running jobs and save their state.
+     */
+    void Shutdown();
+
+    /**
+     * Start mirroring an ftp:// or ftps:// directory URL into localDir.
+     * @return The job ID, or empty on invalid input
+     */
+    String StartMirror(const String& url, const String& localDir,
+                       const MirrorOptions& options = MirrorOptions());
+
+    /**
+     * Continue a stopped job from its saved state.
+     */
+    bool ResumeMirror(const String& jobId);
+
+    /**
+     * Stop a running job. Its state is kept for ResumeMirror().
+     */
+    bool StopMirror(const String& jobId);
+
+    /**
+     * Stop (if running) and forget a job, deleting its state file.
+     */
+    bool RemoveMirror(const String& jobId);
+
+    std::optional<MirrorProgress> GetProgress(const String& jobId) const;
+    std::vector<MirrorProgress> GetAllJobs() const;
+
+private:
+    FtpMirror() = default;
+    ~FtpMirror();
+
+    enum class FileState : uint8 { Queued = 0, Done = 1, Failed = 2 };
+
+    struct MirrorFile {
+        String          remotePath;
+        int64           size{0};
+        SystemTimePoint modified{};
+        bool            hasModified{false};
+        FileState       state{FileState::Queued};
+    };
+
+    struct Job {
+        String                  id;
+        String                  url;
+        String                  localDir;
+        MirrorOptions           options;
+        FtpUrlParts             endpoint;
+
+        mutable Mutex           mutex;
+        CondVar                 workAvailable;
+        std::atomic<bool>       cancelled{false};
+        MirrorStatus            status{MirrorStatus::Stopped};
+
+        std::deque<String>      pendingDirs;    // Waiting to be listed
+        std::set<String>        listingDirs;    // Being listed right now
+        std::set<String>        listedDirs;     // Done; never re-listed on resume
+        std::vector<String>     failedDirs;
+        std::set<String>        knownDirs;      // All of the above, for dedup
+
+        std::vector<MirrorFile> files;          // Queued for transfer (any state)
+        std::deque<size_t>      transferQueue;  // Indexes into 'files'
+        int                     filesSkipped{0};
+
+        std::atomic<int64>      bytesDone{0};
+        std::atomic<int64>      bytesThisSecond{0};
+        std::atomic<double>     speed{0};
+        String                  errorMessage;
+
+        std::vector<std::thread> workers;
+        int                     activeWorkers{0};
+        std::thread             monitor;
+        TimePoint               lastSave;
+    };
+
+    void LaunchJob(const std::shared_ptr<Job>& job);
+    void StopJob(const std::shared_ptr<Job>& job);
+
+    // Session worker: lists directories and transfers files until the job
+    // runs out of work or is cancelled
+    void SessionWorker(std::shared_ptr<Job> job);
+
+    // Once a second: speed sampling, periodic state save, completion
+    void MonitorThread(std::shared_ptr<Job> job);
+
+    bool EnsureSession(Job& job, std::unique_ptr<FtpClient>& ftp);
+    bool ListOne(Job& job, std::unique_ptr<FtpClient>& ftp, const String& remoteDir);
+    bool TransferOne(Job& job, std::unique_ptr<FtpClient>& ftp, MirrorFile file);
+
+    String LocalPathFor(const Job& job, const String& remotePath) const;
+    static bool IsUpToDate(const String& localPath, const FtpFileInfo& remote, bool compareTimes);
+    static bool SetLocalFileTime(const String& path, const SystemTimePoint& time);
+
+    MirrorProgress MakeProgress(const Job& job) const;
+    bool SaveState(const Job& job) const;
+    std::shared_ptr<Job> LoadState(const String& statePath) const;
+    String StatePath(const String& jobId) const;
+
+    String                                      m_stateDir;
+    mutable Mutex                               m_jobsMutex;
+    std::map<String, std::shared_ptr<Job>>      m_jobs;
+};
+
+} // namespace idm
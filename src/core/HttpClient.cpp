@@ -18,6 +18,11 @@
 #include "HttpClient.h"
 #include "../util/Logger.h"
 #include "../util/Unicode.h"
+#include <mstcpip.h>
+
+#ifndef WINHTTP_OPTION_CONNECTION_STATS_V0
+#define WINHTTP_OPTION_CONNECTION_STATS_V0 141
+#endif
 
 namespace idm {
 
@@ -61,6 +66,8 @@ HttpClient::HttpClient(HttpClient&& other) noexcept
     : m_hSession(other.m_hSession)
     , m_hConnect(other.m_hConnect)
     , m_hRequest(other.m_hRequest)
+    , m_origin(std::move(other.m_origin))
+    , m_lastUsed(other.m_lastUsed)
     , m_lastError(std::move(other.m_lastError))
     , m_lastErrorCode(other.m_lastErrorCode)
 {
@@ -78,6 +85,8 @@ HttpClient& HttpClient::operator=(HttpClient&& other) noexcept {
         m_hSession = other.m_hSession;
         m_hConnect = other.m_hConnect;
         m_hRequest = other.m_hRequest;
+        m_origin = std::move(other.m_origin);
+        m_lastUsed = other.m_lastUsed;
         m_lastError = std::move(other.m_lastError);
         m_lastErrorCode = other.m_lastErrorCode;
         m_cancelled.store(other.m_cancelled.load());
@@ -119,6 +128,35 @@ void HttpClient::Cancel() {
     }
 }
 
+String HttpClient::OriginOf(const String& url) {
+    URL_COMPONENTS parts = {};
+    parts.dwStructSize = sizeof(parts);
+    wchar_t hostName[256] = {};
+    parts.lpszHostName = hostName;
+    parts.dwHostNameLength = _countof(hostName);
+    
+    if (!::WinHttpCrackUrl(url.c_str(), static_cast<DWORD>(url.length()), 0, &parts)) {
+        return L"";
+    }
+    
+    String origin = String(parts.nScheme == INTERNET_SCHEME_HTTPS ? L"https://" : L"http://") +
+                    hostName + L":" + std::to_wstring(parts.nPort);
+    std::transform(origin.begin(), origin.end(), origin.begin(), ::towlower);
+    return origin;
+}
+
+bool HttpClient::GetRoundTripTime(int64& rttUs) const {
+    if (!m_hRequest) return false;
+    
+    TCP_INFO_v0 info = {};
+    DWORD size = sizeof(info);
+    if (!::WinHttpQueryOption(m_hRequest, WINHTTP_OPTION_CONNECTION_STATS_V0, &info, &size)) {
+        return false;
+    }
+    rttUs = info.RttUs;
+    return rttUs > 0;
+}
+
 void HttpClient::Reset() {
     m_cancelled.store(false);
     m_lastError.clear();
@@ -163,6 +201,8 @@ bool HttpClient::ExecuteRequest(const HttpRequestConfig& config,
     INTERNET_PORT port = urlComponents.nPort;
     
     response.finalUrl = config.url;
+    m_origin = OriginOf(config.url);
+    m_lastUsed = Clock::now();
     
     // Set proxy if configured
     if (!config.proxyAddr.empty()) {
@@ -237,6 +277,12 @@ bool HttpClient::ExecuteRequest(const HttpRequestConfig& config,
     String rangeHeader = config.GetRangeHeader();
     if (!rangeHeader.empty()) {
         headers += L"Range: " + rangeHeader + L"\r\n";
+        
+        // Conditional range: server answers 206 if the validator still
+        // matches, or 200 with the full (new) entity if the file changed
+        if (!config.ifRange.empty()) {
+            headers += L"If-Range: " + config.ifRange + L"\r\n";
+        }
     }
     
     // Custom headers from config
@@ -345,6 +391,10 @@ bool HttpClient::ExecuteRequest(const HttpRequestConfig& config,
             
             // Read in chunks up to buffer size
             DWORD toRead = (std::min)(bytesAvailable, static_cast<DWORD>(buffer.size()));
+            if (config.readGate) {
+                toRead = static_cast<DWORD>(config.readGate.AcquireSome(toRead, m_cancelled));
+                if (toRead == 0) break;  // Cancelled while waiting
+            }
             
             if (!::WinHttpReadData(m_hRequest, buffer.data(), toRead, &bytesRead)) {
                 if (!m_cancelled.load()) {
@@ -352,6 +402,9 @@ bool HttpClient::ExecuteRequest(const HttpRequestConfig& config,
                 }
                 return false;
             }
+            if (config.readGate && config.readGate.release && bytesRead < toRead) {
+                config.readGate.release(toRead - bytesRead);
+            }
             
             if (bytesRead == 0) break;  // Connection closed
             
@@ -368,6 +421,7 @@ bool HttpClient::ExecuteRequest(const HttpRequestConfig& config,
         return false;
     }
     
+    m_lastUsed = Clock::now();
     return true;
 }
 
@@ -48,6 +48,26 @@ struct HttpResponseInfo {
     String GetDispositionFilename() const;
 };
 
+// ─── Read Gate ─────────────────────────────────────────────────────────────
+// Consulted before each body read, so a rate limit holds data back in the
+// socket rather than in our buffers. acquire(n) may block, and returns how
+// many of the n bytes to read now (0: none yet, ask again); release(n)
+// hands back the part of that grant the read did not fill.
+struct ReadGate {
+    std::function<size_t(size_t wanted)> acquire;
+    std::function<void(size_t unused)>   release;
+    
+    explicit operator bool() const { return static_cast<bool>(acquire); }
+    
+    // A grant of at least one byte, so every byte read has been charged;
+    // 0 only once 'cancelled' is set
+    size_t AcquireSome(size_t wanted, const std::atomic<bool>& cancelled) const {
+        size_t granted = 0;
+        while (granted == 0 && !cancelled.load()) granted = acquire(wanted);
+        return granted;
+    }
+};
+
 // ─── HTTP Request Configuration ────────────────────────────────────────────
 struct HttpRequestConfig {
     String              url;
@@ -64,6 +84,7 @@ struct HttpRequestConfig {
     // Range request parameters
     int64               rangeStart{-1};           // -1 = no range
     int64               rangeEnd{-1};             // -1 = to end
+    String              ifRange;                  // Validator for If-Range (ETag or HTTP date)
     
     // Proxy
     String              proxyAddr;                // host:port
@@ -76,6 +97,7 @@ struct HttpRequestConfig {
     int                 timeoutReceive{60};       // seconds
     bool                verifySSL{true};
     bool                followRedirects{true};
+    ReadGate            readGate;                 // Optional, paces body reads
     
     // Build Range header string
     String GetRangeHeader() const {
@@ -128,6 +150,26 @@ public:
     bool Post(const HttpRequestConfig& config, HttpResponseInfo& response,
               DataCallback callback);
     
+    /**
+     * The kernel's smoothed round-trip time of the connection serving the
+     * current request, in microseconds. Only valid while a request is in
+     * progress (e.g. from its DataCallback); needs Windows 10 1809+.
+     */
+    bool GetRoundTripTime(int64& rttUs) const;
+    
+    /**
+     * "scheme://host:port" of the last request, and when it finished.
+     * WinHTTP keeps that connection open in this client's session, so a
+     * pooled client is warm for its origin for a while.
+     */
+    String GetOrigin() const { return m_origin; }
+    TimePoint GetLastUsed() const { return m_lastUsed; }
+    
+    /**
+     * "scheme://host:port" of a URL (lowercase), empty if it won't parse.
+     */
+    static String OriginOf(const String& url);
+    
     /**
      * Get the last error message.
      */
@@ -162,6 +204,8 @@ private:
     HINTERNET           m_hSession{nullptr};
     HINTERNET           m_hConnect{nullptr};
     HINTERNET           m_hRequest{nullptr};
+    String              m_origin;                 // Of the last request
+    TimePoint           m_lastUsed;
     String              m_lastError;
     DWORD               m_lastErrorCode{0};
     std::atomic<bool>   m_cancelled{false};
@@ -0,0 +1,175 @@
+/**
+ * @file MappedFile.cpp
+ * @brief Windowed file mapping with a shared address-space budget
+ */
+
+#include "stdafx.h"
+#include "MappedFile.h"
+#include "../util/Logger.h"
+
+namespace idm {
+
+std::atomic<int64> MappedFile::s_reservedBytes{0};
+
+namespace {
+
+// A mapped page that cannot be read in or backed (disk full, network
+// volume gone) raises EXCEPTION_IN_PAGE_ERROR instead of returning an
+// error. No C++ objects in here: __try cannot unwind them.
+bool GuardedCopy(void* dst, const void* src, size_t length) {
+    __try {
+        memcpy(dst, src, length);
+        return true;
+    } __except (GetExceptionCode() == EXCEPTION_IN_PAGE_ERROR
+                    ? EXCEPTION_EXECUTE_HANDLER : EXCEPTION_CONTINUE_SEARCH) {
+        return false;
+    }
+}
+
+} // anonymous namespace
+
+std::unique_ptr<MappedFile> MappedFile::Open(HANDLE hFile, int64 fileSize, int64 budgetBytes) {
+    if (hFile == INVALID_HANDLE_VALUE || fileSize <= 0 || budgetBytes <= 0) return nullptr;
+
+    // Reserve whole views: that is the address space the file can end up using
+    int64 viewCount = (fileSize + constants::MAPPED_VIEW_SIZE - 1) / constants::MAPPED_VIEW_SIZE;
+    int64 reserve = viewCount * constants::MAPPED_VIEW_SIZE;
+    if (reserve > budgetBytes) return nullptr;
+
+    int64 current = s_reservedBytes.load();
+    do {
+        if (current + reserve > budgetBytes) {
+            LOG_DEBUG(L"MappedFile: budget exhausted (%lld of %lld bytes reserved)",
+                      current, budgetBytes);
+            return nullptr;
+        }
+    } while (!s_reservedBytes.compare_exchange_weak(current, current + reserve));
+
+    HANDLE hMapping = ::CreateFileMappingW(hFile, nullptr, PAGE_READWRITE,
+                                           static_cast<DWORD>(fileSize >> 32),
+                                           static_cast<DWORD>(fileSize & 0xFFFFFFFF),
+                                           nullptr);
+    if (!hMapping) {
+        LOG_WARN(L"MappedFile: CreateFileMapping failed (error %lu), using buffered writes",
+                 ::GetLastError());
+        s_reservedBytes -= reserve;
+        return nullptr;
+    }
+
+    return std::unique_ptr<MappedFile>(new MappedFile(hMapping, fileSize, reserve));
+}
+
+MappedFile::MappedFile(HANDLE hMapping, int64 fileSize, int64 reservedBytes)
+    : m_hMapping(hMapping)
+    , m_fileSize(fileSize)
+    , m_reservedBytes(reservedBytes)
+    , m_views(static_cast<size_t>(reservedBytes / constants::MAPPED_VIEW_SIZE), nullptr)
+    , m_dirty(m_views.size()) {
+}
+
+MappedFile::~MappedFile() {
+    Flush();
+    for (uint8* view : m_views) {
+        if (view) ::UnmapViewOfFile(view);
+    }
+    ::CloseHandle(m_hMapping);
+    s_reservedBytes -= m_reservedBytes;
+}
+
+uint8* MappedFile::ViewAt(int64 position, size_t& available) {
+    size_t index = static_cast<size_t>(position / constants::MAPPED_VIEW_SIZE);
+    int64 viewBase = static_cast<int64>(index) * constants::MAPPED_VIEW_SIZE;
+    int64 viewSize = (std::min)(constants::MAPPED_VIEW_SIZE, m_fileSize - viewBase);
+
+    uint8* view = nullptr;
+    {
+        Lock lock(m_viewsMutex);
+        view = m_views[index];
+        if (!view) {
+            view = static_cast<uint8*>(::MapViewOfFile(
+                m_hMapping, FILE_MAP_WRITE,
+                static_cast<DWORD>(viewBase >> 32),
+                static_cast<DWORD>(viewBase & 0xFFFFFFFF),
+                static_cast<SIZE_T>(viewSize)));
+            if (!view) {
+                LOG_ERROR(L"MappedFile: MapViewOfFile at %lld failed (error %lu)",
+                          viewBase, ::GetLastError());
+                return nullptr;
+            }
+            m_views[index] = view;
+        }
+    }
+
+    available = static_cast<size_t>(viewBase + viewSize - position);
+    return view + (position - viewBase);
+}
+
+bool MappedFile::Write(int64 position, const uint8* data, size_t length) {
+    if (position < 0 || position + static_cast<int64>(length) > m_fileSize) return false;
+
+    TimePoint start = Clock::now();
+
+    // A chunk may straddle two views
+    size_t done = 0;
+    while (done < length) {
+        size_t available = 0;
+        uint8* dst = ViewAt(position + static_cast<int64>(done), available);
+        if (!dst) return false;
+
+        size_t n = (std::min)(available, length - done);
+        if (!GuardedCopy(dst, data + done, n)) {
+            LOG_ERROR(L"MappedFile: in-page error writing at %lld",
+                      position + static_cast<int64>(done));
+            return false;
+        }
+        m_dirty[static_cast<size_t>((position + static_cast<int64>(done)) /
+                                    constants::MAPPED_VIEW_SIZE)].store(true);
+        done += n;
+    }
+
+    // First-write latency includes mapping the view and faulting the pages
+    if (!m_firstWriteDone.exchange(true)) {
+        double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        LOG_INFO(L"MappedFile: first write completed in %.1f ms", ms);
+    }
+    return true;
+}
+
+bool MappedFile::Read(int64 position, uint8* out, size_t length) {
+    if (position < 0 || position + static_cast<int64>(length) > m_fileSize) return false;
+
+    size_t done = 0;
+    while (done < length) {
+        size_t available = 0;
+        uint8* src = ViewAt(position + static_cast<int64>(done), available);
+        if (!src) return false;
+
+        size_t n = (std::min)(available, length - done);
+        if (!GuardedCopy(out + done, src, n)) return false;
+        done += n;
+    }
+    return true;
+}
+
+bool MappedFile::Flush() {
+    std::vector<uint8*> views;
+    {
+        Lock lock(m_viewsMutex);
+        views = m_views;
+    }
+
+    // Clear the flag before flushing: a write racing with the flush marks
+    // the view again and is picked up next time
+    bool ok = true;
+    for (size_t i = 0; i < views.size(); ++i) {
+        if (!views[i] || !m_dirty[i].exchange(false)) continue;
+        if (!::FlushViewOfFile(views[i], 0)) {
+            LOG_ERROR(L"MappedFile: FlushViewOfFile failed (error %lu)", ::GetLastError());
+            m_dirty[i].store(true);
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+} // namespace idm
@@ -0,0 +1,88 @@
+/**
+ * @file MappedFile.h
+ * @brief Memory-mapped partial file for downloads that fit the address budget
+ *
+ * In mapped mode the .idmclone file is backed by a file mapping and
+ * connections copy received data straight into it at their segment offset;
+ * there is no write syscall per chunk and no write-behind queue. The file is
+ * mapped in MAPPED_VIEW_SIZE windows, each created the first time a write
+ * touches it.
+ *
+ * All mapped downloads share one address-space budget (Options\MappedBudgetMB).
+ * Open() reserves the whole file against it up front and returns nullptr
+ * when it does not fit, so very large files (or too many at once) fall back
+ * to FileWriter without ever being partly mapped.
+ *
+ * Dirty pages are written back by the OS on its own schedule; Flush() forces
+ * out the views written since the previous Flush() and is called at the
+ * segment checkpoints and on close.
+ * Completed regions can be read back in-process with Read() without going
+ * through the file.
+ */
+
+#pragma once
+#include "stdafx.h"
+
+namespace idm {
+
+class MappedFile {
+public:
+    /**
+     * Map an open partial file of 'fileSize' bytes (the file is extended
+     * if shorter). The handle must stay open while the mapping exists.
+     * @param budgetBytes Total address space allowed for all mapped files
+     * @return nullptr if the size is unknown, the budget is exhausted or
+     *         the mapping cannot be created
+     */
+    static std::unique_ptr<MappedFile> Open(HANDLE hFile, int64 fileSize, int64 budgetBytes);
+
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    /**
+     * Copy data into the mapping at 'position'. Thread-safe for disjoint
+     * ranges. Fails (instead of faulting) if the page cannot be backed,
+     * e.g. the volume is full or was removed.
+     */
+    bool Write(int64 position, const uint8* data, size_t length);
+
+    /**
+     * Copy a region back out. Only meaningful for bytes already written.
+     */
+    bool Read(int64 position, uint8* out, size_t length);
+
+    /**
+     * Write back the views touched since the last Flush(). Like
+     * FlushViewOfFile this starts the writes; FlushFileBuffers on the file
+     * handle waits for them to reach the disk.
+     */
+    bool Flush();
+
+    int64 GetFileSize() const { return m_fileSize; }
+
+    // Address space currently reserved by all mapped files
+    static int64 GetReservedBytes() { return s_reservedBytes.load(); }
+
+private:
+    MappedFile(HANDLE hMapping, int64 fileSize, int64 reservedBytes);
+
+    // Pointer to 'position' inside its view (mapping the view on first
+    // use) and the bytes left in that view
+    uint8* ViewAt(int64 position, size_t& available);
+
+    HANDLE                  m_hMapping;
+    int64                   m_fileSize;
+    int64                   m_reservedBytes;
+
+    Mutex                   m_viewsMutex;
+    std::vector<uint8*>     m_views;        // Index = position / MAPPED_VIEW_SIZE
+    std::vector<std::atomic<bool>> m_dirty; // Per view: written since the last Flush()
+
+    std::atomic<bool>       m_firstWriteDone{false};
+
+    static std::atomic<int64> s_reservedBytes;
+};
+
+} // namespace idm
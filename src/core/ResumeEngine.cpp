@@ -68,12 +68,75 @@ bool ResumeEngine::ValidateResume(HttpClient& client, DownloadEntry& entry) {
     return true;
 }
 
+String ResumeEngine::GetRangeValidator(const DownloadEntry& entry) {
+    // If-Range requires a strong comparison (RFC 9110 §13.1.5)
+    if (!entry.etag.empty() && entry.etag.compare(0, 2, L"W/") != 0) {
+        return entry.etag;
+    }
+    return entry.lastModified;
+}
+
+bool ResumeEngine::IsResourceChanged(const HttpRequestConfig& config,
+                                     const HttpResponseInfo& response) {
+    // A 200 to a request from byte 0 is the whole entity either way
+    if (config.ifRange.empty() || config.rangeStart <= 0) return false;
+    return response.statusCode == 200;
+}
+
+void ResumeEngine::DiscardPartialState(DownloadEntry& entry) {
+    CleanupPartialFiles(entry);
+    
+    entry.downloadedBytes = 0;
+    entry.segments.clear();
+    entry.etag.clear();
+    entry.lastModified.clear();
+    
+    LOG_WARN(L"ResumeEngine: discarded partial state for %s (file changed on server)",
+             entry.fileName.c_str());
+}
+
 bool ResumeEngine::SaveState(const DownloadEntry& entry, const SegmentManager& segments) {
     // Save segment state to binary file
     String segPath = entry.SegmentPath();
     return segments.SaveState(segPath);
 }
 
+bool ResumeEngine::SaveStateSnapshot(const DownloadEntry& entry,
+                                     const std::vector<uint8>& state, bool durable) {
+    String segPath = entry.SegmentPath();
+    
+    if (!durable) {
+        std::ofstream file(segPath, std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) return false;
+        file.write(reinterpret_cast<const char*>(state.data()), state.size());
+        file.flush();
+        return file.good();
+    }
+    
+    String tempPath = segPath + L".tmp";
+    HANDLE hFile = ::CreateFileW(tempPath.c_str(), GENERIC_WRITE, 0, nullptr,
+                                 CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        LOG_ERROR(L"ResumeEngine: cannot create %s (error %lu)", tempPath.c_str(), ::GetLastError());
+        return false;
+    }
+    
+    DWORD written = 0;
+    bool ok = ::WriteFile(hFile, state.data(), static_cast<DWORD>(state.size()), &written, nullptr) &&
+              written == state.size() &&
+              ::FlushFileBuffers(hFile);
+    ::CloseHandle(hFile);
+    
+    if (!ok || !::MoveFileExW(tempPath.c_str(), segPath.c_str(),
+                              MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+        LOG_ERROR(L"ResumeEngine: failed to save state for %s (error %lu)",
+                  entry.fileName.c_str(), ::GetLastError());
+        ::DeleteFileW(tempPath.c_str());
+        return false;
+    }
+    return true;
+}
+
 bool ResumeEngine::RestoreState(DownloadEntry& entry, SegmentManager& segments) {
     String segPath = entry.SegmentPath();
     
@@ -98,8 +161,9 @@ void ResumeEngine::CleanupPartialFiles(const DownloadEntry& entry) {
     // Remove the partial download file
     std::filesystem::remove(entry.PartialPath(), ec);
     
-    // Remove the segment state file
+    // Remove the segment state file (and a strict-mode temporary)
     std::filesystem::remove(entry.SegmentPath(), ec);
+    std::filesystem::remove(entry.SegmentPath() + L".tmp", ec);
     
     LOG_DEBUG(L"ResumeEngine: cleaned up partial files for %s", entry.fileName.c_str());
 }
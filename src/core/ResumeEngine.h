@@ -4,6 +4,11 @@
  *
  * Handles: pause/resume, crash recovery, server validation on resume,
  * automatic retry with configurable attempts and delays.
+ *
+ * Resume validation is folded into the segment requests themselves:
+ * every ranged GET carries an If-Range header with the stored validator.
+ * A 206 confirms the partial data is still good; a 200 means the file
+ * changed on the server and the partial state must be discarded.
  */
 
 #pragma once
@@ -14,6 +19,15 @@ namespace idm {
 
 class SegmentManager;
 class HttpClient;
+struct HttpRequestConfig;
+struct HttpResponseInfo;
+
+// How a checkpoint orders partial-file data against the .seg file
+enum class DurabilityMode {
+    None,       // Save state only; after a power loss it may claim unwritten bytes
+    Ordered,    // Flush data written since the last checkpoint, then save state
+    Strict      // Ordered, and the .seg file is replaced atomically and flushed
+};
 
 class ResumeEngine {
 public:
@@ -23,12 +37,41 @@ public:
      */
     static bool ValidateResume(HttpClient& client, DownloadEntry& entry);
     
+    /**
+     * Get the validator to send in If-Range for ranged requests.
+     * Prefers a strong ETag; weak ETags are not allowed in If-Range,
+     * so those fall back to Last-Modified. Empty if neither is known.
+     */
+    static String GetRangeValidator(const DownloadEntry& entry);
+    
+    /**
+     * Check whether a conditional ranged request found the file changed.
+     * True when If-Range was sent from a position past byte 0 and the
+     * server replied 200 (full entity) instead of 206 (partial content).
+     */
+    static bool IsResourceChanged(const HttpRequestConfig& config,
+                                  const HttpResponseInfo& response);
+    
+    /**
+     * Throw away the partial file, the .seg file and the stored validators
+     * so the download can restart cleanly from byte zero.
+     */
+    static void DiscardPartialState(DownloadEntry& entry);
+    
     /**
      * Save download state for crash recovery.
      * Writes segment positions to the .seg file and updates the database.
      */
     static bool SaveState(const DownloadEntry& entry, const SegmentManager& segments);
     
+    /**
+     * Write a snapshot from SegmentManager::SerializeState() to the .seg
+     * file. Durable: written to a temporary file, flushed and renamed over
+     * the old one, so the state is never torn and survives a power loss.
+     */
+    static bool SaveStateSnapshot(const DownloadEntry& entry, const std::vector<uint8>& state,
+                                  bool durable);
+    
     /**
      * Restore download state from disk.
      * Loads the .seg file and validates segment boundaries.
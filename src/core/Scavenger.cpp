@@ -0,0 +1,160 @@
+/**
+ * @file Scavenger.cpp
+ * @brief Delay-based rate controller for background downloads
+ */
+
+#include "stdafx.h"
+#include "Scavenger.h"
+#include "../util/Logger.h"
+#include "../util/Unicode.h"
+
+namespace idm {
+
+namespace {
+
+// Weight of the newest sample in the achieved-rate moving average
+constexpr double ACHIEVED_EWMA_WEIGHT = 0.25;
+
+double ElapsedMs(TimePoint since, TimePoint now) {
+    return std::chrono::duration<double, std::milli>(now - since).count();
+}
+
+} // anonymous namespace
+
+Scavenger& Scavenger::Instance() {
+    static Scavenger instance;
+    return instance;
+}
+
+Scavenger::Scavenger() {
+    m_lastUpdate = Clock::now();
+    m_lastSample = m_lastUpdate;
+
+    // Paced, so rate changes take effect on the next grant without bursts
+    m_limiter.SetPacing(true);
+    m_limiter.SetLimit(constants::SCAVENGER_START_RATE);
+    m_limiter.Enable(true);
+}
+
+// ─── Limiting ──────────────────────────────────────────────────────────────
+
+size_t Scavenger::RequestBytes(size_t bytes) {
+    size_t granted = m_limiter.RequestBytes(bytes);
+    m_grantedBytes.fetch_add(static_cast<int64>(granted));
+    return granted;
+}
+
+void Scavenger::ReturnBytes(size_t bytes) {
+    m_limiter.ReturnBytes(bytes);
+    m_grantedBytes.fetch_sub(static_cast<int64>(bytes));
+}
+
+int Scavenger::GetConnectionBudget(int requested) const {
+    int64 rate = m_rate.load();
+    int budget = static_cast<int>((rate + constants::SCAVENGER_CONNECTION_RATE - 1) /
+                                  constants::SCAVENGER_CONNECTION_RATE);
+    return (std::clamp)(budget, 1, (std::max)(requested, 1));
+}
+
+// ─── Delay Samples ─────────────────────────────────────────────────────────
+
+void Scavenger::AddRttSample(const String& host, int64 rttUs) {
+    if (rttUs <= 0) return;
+    TimePoint now = Clock::now();
+
+    Lock lock(m_mutex);
+
+    // A quiet spell (no background downloads running) restarts the ramp;
+    // the base delays are kept
+    if (ElapsedMs(m_lastSample, now) >= constants::SCAVENGER_IDLE_MS) {
+        m_recentDelays.clear();
+        m_achievedBps = 0;
+        m_grantedBytes.store(0);
+        m_lastUpdate = now;
+        m_rate.store(constants::SCAVENGER_START_RATE);
+        m_limiter.SetRate(constants::SCAVENGER_START_RATE);
+    }
+    m_lastSample = now;
+
+    // Base delay: minimum over the last few minutes, so a route change
+    // is picked up but a long congested spell is not mistaken for it
+    auto found = m_paths.find(host);
+    if (found == m_paths.end()) {
+        double historyMs = constants::SCAVENGER_BASE_HISTORY * 60000.0;
+        for (auto it = m_paths.begin(); it != m_paths.end();) {
+            it = ElapsedMs(it->second.minuteStart, now) >= historyMs ? m_paths.erase(it) : std::next(it);
+        }
+        found = m_paths.emplace(host, Path{}).first;
+    }
+    Path& path = found->second;
+    if (path.minuteMinima.empty() || ElapsedMs(path.minuteStart, now) >= 60000) {
+        path.minuteMinima.push_back(rttUs);
+        path.minuteStart = now;
+        if (path.minuteMinima.size() > static_cast<size_t>(constants::SCAVENGER_BASE_HISTORY)) {
+            path.minuteMinima.pop_front();
+        }
+    } else {
+        path.minuteMinima.back() = (std::min)(path.minuteMinima.back(), rttUs);
+    }
+    int64 baseDelay = *std::min_element(path.minuteMinima.begin(), path.minuteMinima.end());
+
+    // Current delay: minimum of the last few, which filters out one-off
+    // spikes (delayed ACKs, a retransmit) but not a standing queue
+    m_recentDelays.push_back(rttUs - baseDelay);
+    if (m_recentDelays.size() > static_cast<size_t>(constants::SCAVENGER_CURRENT_FILTER)) {
+        m_recentDelays.pop_front();
+    }
+    m_currentDelay = *std::min_element(m_recentDelays.begin(), m_recentDelays.end());
+
+    if (ElapsedMs(m_lastUpdate, now) >= constants::SCAVENGER_UPDATE_MS) {
+        Update(now);
+    }
+}
+
+// ─── Controller ────────────────────────────────────────────────────────────
+
+void Scavenger::Update(TimePoint now) {
+    double elapsedMs = ElapsedMs(m_lastUpdate, now);
+    m_lastUpdate = now;
+
+    double achieved = m_grantedBytes.exchange(0) * 1000.0 / elapsedMs;
+    m_achievedBps = m_achievedBps == 0
+        ? achieved : m_achievedBps + ACHIEVED_EWMA_WEIGHT * (achieved - m_achievedBps);
+
+    // 1 with an empty queue, 0 at the target, negative above it
+    double offTarget = static_cast<double>(constants::SCAVENGER_TARGET_US - m_currentDelay) /
+                       constants::SCAVENGER_TARGET_US;
+    double rate = static_cast<double>(m_rate.load());
+
+    if (offTarget >= 0) {
+        double step = (std::min)(elapsedMs / constants::SCAVENGER_RAMP_MS, 1.0);
+        rate += offTarget * (std::max)(rate, static_cast<double>(constants::SCAVENGER_START_RATE)) * step;
+        rate = (std::min)(rate, (std::max)(static_cast<double>(constants::SCAVENGER_START_RATE),
+                                           2 * m_achievedBps));
+    } else {
+        rate *= 1 + constants::SCAVENGER_DECREASE * (std::max)(offTarget, -1.0);
+    }
+    rate = (std::max)(rate, static_cast<double>(constants::SCAVENGER_MIN_RATE));
+
+    m_rate.store(static_cast<int64>(rate));
+    m_limiter.SetRate(static_cast<int64>(rate));
+
+    bool yielding = rate <= 2.0 * constants::SCAVENGER_MIN_RATE;
+    if (yielding != m_yielding) {
+        m_yielding = yielding;
+        LOG_DEBUG(L"Scavenger: %s (queuing delay %lld ms, %s/s)",
+                  yielding ? L"yielding to other traffic" : L"link idle, ramping up",
+                  m_currentDelay / 1000, Unicode::FormatFileSize(static_cast<int64>(rate)).c_str());
+    }
+}
+
+Scavenger::Stats Scavenger::GetStats() const {
+    Lock lock(m_mutex);
+    Stats stats;
+    stats.rateBps = m_rate.load();
+    stats.queuingDelayUs = m_currentDelay;
+    stats.yielding = m_yielding;
+    return stats;
+}
+
+} // namespace idm
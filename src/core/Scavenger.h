@@ -0,0 +1,99 @@
+/**
+ * @file Scavenger.h
+ * @brief Background download class that only uses idle bandwidth
+ *
+ * Background downloads (prefetches, queues marked as background) must
+ * never compete with interactive traffic. They are limited by a
+ * delay-based controller in the spirit of LEDBAT (RFC 6817):
+ *
+ *   - Background connections report the kernel's smoothed TCP RTT every
+ *     SCAVENGER_SAMPLE_MS. Each host keeps a base delay: the minimum RTT
+ *     over the last SCAVENGER_BASE_HISTORY minutes (per-minute minima)
+ *   - Queuing delay = sample - base delay of its host; the current delay
+ *     is the minimum of the last SCAVENGER_CURRENT_FILTER of those
+ *   - Every SCAVENGER_UPDATE_MS the rate moves in proportion to how far
+ *     the current delay is from SCAVENGER_TARGET_US: up to doubling per
+ *     SCAVENGER_RAMP_MS below target, down to halving per step above it
+ *   - The rate never goes below SCAVENGER_MIN_RATE or above twice what
+ *     background downloads actually achieved, so an app-limited transfer
+ *     can't bank headroom
+ *
+ * Any other traffic that fills the bottleneck queue - a browser, a video
+ * call, or our own normal downloads - inflates the RTT, and the scavenger
+ * backs off to near zero within a second; it ramps up again once the
+ * queue drains.
+ *
+ * The rate drives a paced SpeedLimiter of its own (on top of the global
+ * limit) and the number of connections a background download may run.
+ */
+
+#pragma once
+#include "stdafx.h"
+#include "SpeedLimiter.h"
+
+namespace idm {
+
+class Scavenger {
+public:
+    struct Stats {
+        int64       rateBps{0};
+        int64       queuingDelayUs{0};  // Current (filtered) queuing delay
+        bool        yielding{false};    // Backed off to the minimum rate
+    };
+
+    static Scavenger& Instance();
+
+    Scavenger(const Scavenger&) = delete;
+    Scavenger& operator=(const Scavenger&) = delete;
+
+    /**
+     * Permission to transfer 'bytes' background bytes. Blocks until the
+     * next paced slot; returns how many bytes may go now.
+     */
+    size_t RequestBytes(size_t bytes);
+
+    /**
+     * Give back granted bytes that were not transferred.
+     */
+    void ReturnBytes(size_t bytes);
+
+    /**
+     * Report the smoothed RTT of a background connection to 'host'.
+     */
+    void AddRttSample(const String& host, int64 rttUs);
+
+    /**
+     * Connections a background download that asked for 'requested' may
+     * run at the current rate (at least 1).
+     */
+    int GetConnectionBudget(int requested) const;
+
+    Stats GetStats() const;
+
+private:
+    Scavenger();
+
+    // Base delay of one remote host
+    struct Path {
+        std::deque<int64>   minuteMinima;   // Newest at the back
+        TimePoint           minuteStart;
+    };
+
+    // Move the rate toward the delay target. Caller holds m_mutex.
+    void Update(TimePoint now);
+
+    SpeedLimiter            m_limiter;
+    std::atomic<int64>      m_rate{constants::SCAVENGER_START_RATE};
+    std::atomic<int64>      m_grantedBytes{0};  // Since the last update
+
+    mutable Mutex           m_mutex;
+    std::map<String, Path>  m_paths;
+    std::deque<int64>       m_recentDelays;     // Queuing delays, newest at the back
+    int64                   m_currentDelay{0};
+    double                  m_achievedBps{0};
+    TimePoint               m_lastUpdate;
+    TimePoint               m_lastSample;
+    bool                    m_yielding{false};
+};
+
+} // namespace idm
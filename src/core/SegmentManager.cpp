@@ -35,6 +35,7 @@ void SegmentManager::Initialize(int64 fileSize, int maxConnections, int64 minSeg
         seg.startByte = 0;
         seg.endByte = INT64_MAX;  // Will be adjusted when we know the size
         seg.currentPos = 0;
+        seg.writtenPos = 0;
         seg.connectionId = -1;
         seg.status = SegmentStatus::Pending;
         seg.speed = 0;
@@ -49,6 +50,7 @@ void SegmentManager::Initialize(int64 fileSize, int maxConnections, int64 minSeg
         seg.startByte = 0;
         seg.endByte = fileSize - 1;
         seg.currentPos = 0;
+        seg.writtenPos = 0;
         seg.connectionId = -1;
         seg.status = SegmentStatus::Pending;
         seg.speed = 0;
@@ -72,6 +74,7 @@ bool SegmentManager::LoadState(const std::vector<SegmentInfo>& segments) {
         seg.startByte = info.startByte;
         seg.endByte = info.endByte;
         seg.currentPos = info.startByte + info.downloadedBytes;
+        seg.writtenPos = seg.currentPos;
         seg.connectionId = -1;  // All connections reset on resume
         seg.status = info.complete ? SegmentStatus::Complete : SegmentStatus::Pending;
         seg.speed = 0;
@@ -175,6 +178,20 @@ void SegmentManager::UpdateProgress(int segmentId, int64 bytesWritten, double sp
     }
 }
 
+void SegmentManager::CommitWritten(int segmentId, int64 bytes) {
+    RecursiveLock lock(m_mutex);
+    
+    for (auto& seg : m_segments) {
+        if (seg.id == segmentId) {
+            seg.writtenPos += bytes;
+            if (seg.writtenPos > seg.endByte) {
+                seg.writtenPos = seg.endByte + 1;
+            }
+            return;
+        }
+    }
+}
+
 // ─── Mark Segment Complete ─────────────────────────────────────────────────
 void SegmentManager::MarkComplete(int segmentId) {
     RecursiveLock lock(m_mutex);
@@ -229,6 +246,18 @@ std::vector<Segment> SegmentManager::GetSegments() const {
     return m_segments;
 }
 
+bool SegmentManager::GetSegment(int segmentId, Segment& segment) const {
+    RecursiveLock lock(m_mutex);
+    
+    for (const auto& seg : m_segments) {
+        if (seg.id == segmentId) {
+            segment = seg;
+            return true;
+        }
+    }
+    return false;
+}
+
 std::vector<SegmentInfo> SegmentManager::ToSegmentInfoVector() const {
     RecursiveLock lock(m_mutex);
     
@@ -239,9 +268,9 @@ std::vector<SegmentInfo> SegmentManager::ToSegmentInfoVector() const {
         SegmentInfo info;
         info.startByte = seg.startByte;
         info.endByte = seg.endByte;
-        info.downloadedBytes = seg.DownloadedBytes();
+        info.downloadedBytes = seg.WrittenBytes();
         info.connectionId = seg.connectionId;
-        info.complete = (seg.status == SegmentStatus::Complete);
+        info.complete = (seg.status == SegmentStatus::Complete && seg.writtenPos >= seg.currentPos);
         result.push_back(info);
     }
     
@@ -259,6 +288,16 @@ int64 SegmentManager::GetTotalDownloaded() const {
     return total;
 }
 
+int64 SegmentManager::GetTotalWritten() const {
+    RecursiveLock lock(m_mutex);
+    
+    int64 total = 0;
+    for (const auto& seg : m_segments) {
+        total += seg.WrittenBytes();
+    }
+    return total;
+}
+
 int64 SegmentManager::GetFileSize() const {
     RecursiveLock lock(m_mutex);
     return m_fileSize;
@@ -307,6 +346,13 @@ int SegmentManager::GetMaxConnections() const {
     return m_maxConnections;
 }
 
+void SegmentManager::SetSplitAlignment(int64 alignment) {
+    RecursiveLock lock(m_mutex);
+    // Sector sizes and BUFFER_SIZE are powers of two: the larger is a
+    // multiple of the smaller
+    m_splitAlignment = (std::max)(static_cast<int64>(constants::BUFFER_SIZE), alignment);
+}
+
 // ─── Find Largest Active Segment ───────────────────────────────────────────
 int SegmentManager::FindLargestActiveSegment() const {
     // No lock needed - caller holds m_mutex
@@ -360,10 +406,12 @@ int SegmentManager::SplitSegment(int segmentIdx) {
     
     int64 splitPoint = parent.currentPos + (remaining / 2);
     
-    // Align to BUFFER_SIZE boundary for I/O efficiency
-    splitPoint = (splitPoint / constants::BUFFER_SIZE) * constants::BUFFER_SIZE;
+    // Align for I/O efficiency (and for unbuffered writes, correctness:
+    // every sector then belongs to exactly one segment)
+    splitPoint = (splitPoint / m_splitAlignment) * m_splitAlignment;
     if (splitPoint <= parent.currentPos) {
-        splitPoint = parent.currentPos + m_minSegmentSize;
+        splitPoint = (parent.currentPos + m_minSegmentSize + m_splitAlignment - 1) /
+                     m_splitAlignment * m_splitAlignment;
     }
     if (splitPoint > parent.endByte - m_minSegmentSize) {
         return -1;  // Would create too-small second half
@@ -375,6 +423,7 @@ int SegmentManager::SplitSegment(int segmentIdx) {
     newSeg.startByte = splitPoint;
     newSeg.endByte = parent.endByte;
     newSeg.currentPos = splitPoint;
+    newSeg.writtenPos = splitPoint;
     newSeg.connectionId = -1;
     newSeg.status = SegmentStatus::Pending;
     newSeg.speed = 0;
@@ -395,34 +444,50 @@ int SegmentManager::SplitSegment(int segmentIdx) {
 }
 
 // ─── State Persistence ─────────────────────────────────────────────────────
-bool SegmentManager::SaveState(const String& filePath) const {
+std::vector<uint8> SegmentManager::SerializeState() const {
     RecursiveLock lock(m_mutex);
     
+    std::vector<uint8> state;
+    auto put = [&state](const void* data, size_t size) {
+        const uint8* bytes = static_cast<const uint8*>(data);
+        state.insert(state.end(), bytes, bytes + size);
+    };
+    
+    // Header
+    uint32 magic = 0x53454749; // "SEGI"
+    uint32 version = 1;
+    int64 fileSize = m_fileSize;
+    uint32 segCount = static_cast<uint32>(m_segments.size());
+    
+    put(&magic, sizeof(magic));
+    put(&version, sizeof(version));
+    put(&fileSize, sizeof(fileSize));
+    put(&segCount, sizeof(segCount));
+    
+    // Segments
+    for (const auto& seg : m_segments) {
+        put(&seg.id, sizeof(seg.id));
+        put(&seg.startByte, sizeof(seg.startByte));
+        put(&seg.endByte, sizeof(seg.endByte));
+        // Only bytes that reached the file count as downloaded
+        put(&seg.writtenPos, sizeof(seg.writtenPos));
+        bool written = seg.writtenPos >= seg.currentPos;
+        uint8 status = static_cast<uint8>(
+            seg.status == SegmentStatus::Complete && !written ? SegmentStatus::Active : seg.status);
+        put(&status, sizeof(status));
+    }
+    
+    return state;
+}
+
+bool SegmentManager::SaveState(const String& filePath) const {
+    std::vector<uint8> state = SerializeState();
+    
     try {
         std::ofstream file(filePath, std::ios::binary | std::ios::trunc);
         if (!file.is_open()) return false;
         
-        // Header
-        uint32 magic = 0x53454749; // "SEGI"
-        uint32 version = 1;
-        int64 fileSize = m_fileSize;
-        uint32 segCount = static_cast<uint32>(m_segments.size());
-        
-        file.write(reinterpret_cast<const char*>(&magic), sizeof(magic));
-        file.write(reinterpret_cast<const char*>(&version), sizeof(version));
-        file.write(reinterpret_cast<const char*>(&fileSize), sizeof(fileSize));
-        file.write(reinterpret_cast<const char*>(&segCount), sizeof(segCount));
-        
-        // Segments
-        for (const auto& seg : m_segments) {
-            file.write(reinterpret_cast<const char*>(&seg.id), sizeof(seg.id));
-            file.write(reinterpret_cast<const char*>(&seg.startByte), sizeof(seg.startByte));
-            file.write(reinterpret_cast<const char*>(&seg.endByte), sizeof(seg.endByte));
-            file.write(reinterpret_cast<const char*>(&seg.currentPos), sizeof(seg.currentPos));
-            uint8 status = static_cast<uint8>(seg.status);
-            file.write(reinterpret_cast<const char*>(&status), sizeof(status));
-        }
-        
+        file.write(reinterpret_cast<const char*>(state.data()), state.size());
         file.flush();
         return true;
     }
@@ -463,6 +528,7 @@ bool SegmentManager::LoadStateFromFile(const String& filePath) {
             file.read(reinterpret_cast<char*>(&seg.currentPos), sizeof(seg.currentPos));
             file.read(reinterpret_cast<char*>(&status), sizeof(status));
             
+            seg.writtenPos = seg.currentPos;
             seg.status = static_cast<SegmentStatus>(status);
             seg.connectionId = -1;
             seg.speed = 0;
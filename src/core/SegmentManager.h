@@ -43,7 +43,8 @@ struct Segment {
     int                 id;             // Segment index
     int64               startByte;      // Start position in file
     int64               endByte;        // End position (inclusive)
-    int64               currentPos;     // Current download position
+    int64               currentPos;     // Current download position (received)
+    int64               writtenPos;     // Bytes before this are on disk (persisted)
     int                 connectionId;   // Owning connection (-1 = unassigned)
     SegmentStatus       status;
     TimePoint           lastActivity;   // For detecting stalled connections
@@ -56,6 +57,7 @@ struct Segment {
         int64 total = TotalBytes();
         return total > 0 ? static_cast<double>(DownloadedBytes()) / total * 100.0 : 0.0;
     }
+    int64 WrittenBytes() const { return writtenPos - startByte; }
     bool IsComplete() const { return currentPos > endByte; }
 };
 
@@ -107,6 +109,14 @@ public:
      */
     void UpdateProgress(int segmentId, int64 bytesWritten, double speed);
     
+    /**
+     * Record that bytes handed to the write-behind stage have reached the
+     * partial file. Persisted state only ever covers written bytes, so a
+     * resume never trusts data that was still queued in memory. The bytes
+     * extend the written prefix, so commits must arrive in file order.
+     */
+    void CommitWritten(int segmentId, int64 bytes);
+    
     /**
      * Mark a segment as complete.
      * This triggers redistribution: if the completing connection can
@@ -130,6 +140,12 @@ public:
      */
     std::vector<Segment> GetSegments() const;
     
+    /**
+     * Get a single segment by ID (cheaper than copying the whole map
+     * on every received chunk). Returns false if the ID is unknown.
+     */
+    bool GetSegment(int segmentId, Segment& segment) const;
+    
     /**
      * Convert to SegmentInfo vector for database storage.
      */
@@ -139,6 +155,7 @@ public:
      * Get overall progress.
      */
     int64 GetTotalDownloaded() const;
+    int64 GetTotalWritten() const;
     int64 GetFileSize() const;
     double GetOverallProgress() const;
     
@@ -163,10 +180,23 @@ public:
     void SetMaxConnections(int maxConn);
     int GetMaxConnections() const;
     
+    /**
+     * Alignment for new split points (unbuffered writes need sector-aligned
+     * segment boundaries). Splits are always at least BUFFER_SIZE aligned.
+     */
+    void SetSplitAlignment(int64 alignment);
+    
     /**
      * Save segment state to disk for crash recovery.
      */
     bool SaveState(const String& filePath) const;
+    
+    /**
+     * The .seg file contents as of now. Checkpoints take this before
+     * flushing the data file, so the state never claims bytes the flush
+     * did not cover.
+     */
+    std::vector<uint8> SerializeState() const;
     bool LoadStateFromFile(const String& filePath);
     
 private:
@@ -184,6 +214,7 @@ private:
     int64                       m_fileSize{-1};
     int                         m_maxConnections{8};
     int64                       m_minSegmentSize{constants::MIN_SEGMENT_SIZE};
+    int64                       m_splitAlignment{constants::BUFFER_SIZE};
     int                         m_nextSegmentId{0};
 };
 
@@ -13,6 +13,10 @@
 #undef max
 #endif
 
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+
 namespace idm {
 
 SpeedLimiter& SpeedLimiter::Instance() {
@@ -20,70 +24,202 @@ SpeedLimiter& SpeedLimiter::Instance() {
     return instance;
 }
 
+thread_local SpeedLimiter::ThreadCache SpeedLimiter::t_cache;
+
+int64 SpeedLimiter::NowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        Clock::now().time_since_epoch()).count();
+}
+
 void SpeedLimiter::SetLimit(int64 bytesPerSecond) {
     Lock lock(m_mutex);
     m_limitBps.store(bytesPerSecond);
-    m_burstCapacity = static_cast<double>(bytesPerSecond * 2);
-    m_tokens = m_burstCapacity;
-    m_lastRefill = Clock::now();
+    m_burstCapacity.store(bytesPerSecond * 2);
+    m_tokens.store(bytesPerSecond * 2);
+    m_lastRefillNs.store(NowNs());
+    m_pacerNextNs.store(NowNs());
+    m_generation.fetch_add(1);
+}
+
+void SpeedLimiter::SetRate(int64 bytesPerSecond) {
+    int64 previous = m_limitBps.exchange(bytesPerSecond);
+    m_burstCapacity.store(bytesPerSecond * 2);
+    
+    // Slots already reserved at the old rate are rescaled to the new one,
+    // so a rate that comes up from near zero is not stuck behind them
+    if (previous > 0 && bytesPerSecond > 0) {
+        int64 now = NowNs();
+        int64 next = m_pacerNextNs.load();
+        if (next > now) {
+            int64 backlog = static_cast<int64>(static_cast<double>(next - now) * previous / bytesPerSecond);
+            m_pacerNextNs.compare_exchange_strong(next, now + backlog);
+        }
+    }
+}
+
+void SpeedLimiter::SetPacing(bool pacing) {
+    Lock lock(m_mutex);
+    m_pacing.store(pacing);
+    m_pacerNextNs.store(NowNs());
+    m_generation.fetch_add(1);
 }
 
 size_t SpeedLimiter::RequestBytes(size_t bytes) {
     if (!IsActive() || bytes == 0) return bytes;
+    if (m_pacing.load()) return Pace(bytes, m_limitBps.load());
     
-    Lock lock(m_mutex);
+    // Fast path: spend from this thread's cache
+    ThreadCache& cache = t_cache;
+    uint64 generation = m_generation.load(std::memory_order_acquire);
+    if (cache.owner != this || cache.generation != generation) {
+        cache.owner = this;
+        cache.tokens = 0;
+        cache.generation = generation;
+    }
+    int64 want = static_cast<int64>(bytes);
+    if (cache.tokens >= want) {
+        cache.tokens -= want;
+        return bytes;
+    }
     
+    while (IsActive()) {
+        int64 limit = m_limitBps.load();
+        if (limit <= 0) break;
+        
+        // Borrow what this request is missing plus a batch for the next ones
+        int64 batch = std::clamp<int64>(limit / 200, 1024, constants::SPEED_LIMIT_BATCH_MAX);
+        cache.tokens += Borrow(want - cache.tokens + batch);
+        if (cache.tokens > 0) {
+            int64 permitted = std::min(cache.tokens, want);
+            cache.tokens -= permitted;
+            return static_cast<size_t>(permitted);
+        }
+        
+        // Pool empty: sleep about as long as the rate needs to cover this
+        // request, but not so long that the connection stalls visibly
+        int64 sleepMs = std::clamp<int64>(want * 1000 / limit, 1, constants::SPEED_LIMIT_MAX_SLEEP_MS);
+        std::this_thread::sleep_for(std::chrono::milliseconds(sleepMs));
+        
+        if (m_generation.load() != cache.generation) {
+            cache.tokens = 0;
+            cache.generation = m_generation.load();
+        }
+    }
+    return bytes;
+}
+
+void SpeedLimiter::ReturnBytes(size_t bytes) {
     int64 limit = m_limitBps.load();
+    if (!IsActive() || bytes == 0 || limit <= 0) return;
+    
+    if (m_pacing.load()) {
+        // Pull the clock back by the time those bytes were charged
+        m_pacerNextNs.fetch_sub(static_cast<int64>(bytes) * 1000000000 / limit);
+    } else if (t_cache.owner == this && t_cache.generation == m_generation.load()) {
+        t_cache.tokens += static_cast<int64>(bytes);
+    }
+}
+
+// ─── Pacing ────────────────────────────────────────────────────────────────
+
+size_t SpeedLimiter::Pace(size_t bytes, int64 limit) {
     if (limit <= 0) return bytes;
     
-    auto now = Clock::now();
-    double elapsed = std::chrono::duration<double>(now - m_lastRefill).count();
-    m_lastRefill = now;
+    int64 grant = std::clamp<int64>(limit * constants::PACING_QUANTUM_US / 1000000,
+                                    constants::PACING_MIN_GRANT, constants::PACING_MAX_GRANT);
+    grant = std::min(grant, static_cast<int64>(bytes));
+    int64 cost = grant * 1000000000 / limit;
     
-    m_tokens += elapsed * limit;
-    if (m_tokens > m_burstCapacity) {
-        m_tokens = m_burstCapacity;
-    }
+    // Reserve the next slot. A clock that has fallen behind (idle limiter)
+    // only catches up by the burst allowance.
+    int64 now = NowNs();
+    int64 burstNs = constants::PACING_BURST_MS * 1000000;
+    int64 next = m_pacerNextNs.load();
+    int64 start;
+    do {
+        start = std::max(next, now - burstNs);
+    } while (!m_pacerNextNs.compare_exchange_weak(next, start + cost));
     
-    if (m_tokens >= static_cast<double>(bytes)) {
-        m_tokens -= static_cast<double>(bytes);
-        return bytes;
-    }
+    if (start > now) SleepUntilNs(start);
+    return static_cast<size_t>(grant);
+}
+
+void SpeedLimiter::SleepUntilNs(int64 deadline) {
+    // One high-resolution waitable timer per thread (Windows 10 1803+).
+    // Without it the wait falls back to sleep_for, at scheduler tick
+    // granularity.
+    struct Timer {
+        HANDLE handle;
+        Timer() : handle(::CreateWaitableTimerExW(nullptr, nullptr,
+                             CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS)) {}
+        ~Timer() { if (handle) ::CloseHandle(handle); }
+    };
+    static thread_local Timer t_timer;
     
-    if (m_tokens > 0) {
-        size_t permitted = static_cast<size_t>(m_tokens);
-        m_tokens = 0;
-        if (permitted > 0) return permitted;
+    int64 spinNs = constants::PACING_SPIN_US * 1000;
+    int64 wait = deadline - NowNs() - spinNs;
+    if (wait > 0) {
+        LARGE_INTEGER due;
+        due.QuadPart = -(wait / 100);  // Relative, in 100 ns units
+        if (t_timer.handle &&
+            ::SetWaitableTimerEx(t_timer.handle, &due, 0, nullptr, nullptr, nullptr, 0)) {
+            ::WaitForSingleObject(t_timer.handle, INFINITE);
+        } else {
+            std::this_thread::sleep_for(std::chrono::nanoseconds(wait));
+        }
     }
     
-    double neededTokens = static_cast<double>(bytes);
-    double sleepTime = neededTokens / limit;
-    
-    sleepTime = sleepTime < 0.1 ? sleepTime : 0.1;
+    // Timer wakeups are late by up to their resolution; spin the rest
+    while (NowNs() < deadline) std::this_thread::yield();
+}
+
+// ─── Token bucket ──────────────────────────────────────────────────────────
+
+int64 SpeedLimiter::Borrow(int64 want) {
+    Refill(m_limitBps.load());
     
-    lock.unlock();
-    std::this_thread::sleep_for(std::chrono::milliseconds(
-        static_cast<int>(sleepTime * 1000)));
-    lock.lock();
+    int64 available = m_tokens.load();
+    while (available > 0) {
+        int64 take = std::min(available, want);
+        if (m_tokens.compare_exchange_weak(available, available - take)) return take;
+    }
+    return 0;
+}
+
+void SpeedLimiter::Refill(int64 limit) {
+    if (limit <= 0) return;
     
-    auto afterSleep = Clock::now();
-    double sleptFor = std::chrono::duration<double>(afterSleep - m_lastRefill).count();
-    m_lastRefill = afterSleep;
+    int64 now = NowNs();
+    int64 last = m_lastRefillNs.load();
     
-    m_tokens += sleptFor * limit;
-    if (m_tokens > m_burstCapacity) m_tokens = m_burstCapacity;
+    // At most 10 s of credit, and never more than keeps elapsed * limit
+    // within int64 (limits above ~922 MB/s would overflow at 10 s)
+    int64 maxElapsed = std::min<int64>(10LL * 1000000000, INT64_MAX / limit);
+    int64 elapsed = std::min<int64>(now - last, maxElapsed);
+    int64 add = elapsed * limit / 1000000000;
     
-    double minVal = m_tokens < static_cast<double>(bytes) ? m_tokens : static_cast<double>(bytes);
-    size_t permitted = static_cast<size_t>(minVal);
-    m_tokens -= static_cast<double>(permitted);
+    // Advance the clock only by the time the whole tokens stand for, so
+    // the remainder carries into the next refill; a clamped gap is dropped
+    // whole, even if it bought nothing. Losing the race means another
+    // thread has just refilled.
+    bool clamped = now - last > elapsed;
+    if (add <= 0 && !clamped) return;
+    int64 advance = clamped ? now - last : add * 1000000000 / limit;
+    if (!m_lastRefillNs.compare_exchange_strong(last, last + advance)) return;
+    if (add <= 0) return;
     
-    return permitted > 0 ? permitted : 1;
+    int64 burst = m_burstCapacity.load();
+    int64 tokens = m_tokens.load();
+    while (!m_tokens.compare_exchange_weak(tokens, std::min(tokens + add, burst))) {
+    }
 }
 
 void SpeedLimiter::Reset() {
     Lock lock(m_mutex);
-    m_tokens = m_burstCapacity;
-    m_lastRefill = Clock::now();
+    m_tokens.store(m_burstCapacity.load());
+    m_lastRefillNs.store(NowNs());
+    m_pacerNextNs.store(NowNs());
+    m_generation.fetch_add(1);
 }
 
 } // namespace idm
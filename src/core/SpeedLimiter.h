@@ -7,6 +7,31 @@
  * - Each byte downloaded consumes one token
  * - When the bucket is empty, downloads sleep until tokens are available
  * - Burst capacity allows short speed spikes for better utilization
+ *
+ * The bucket is shared by every connection, so it is built to be taken
+ * from without a lock:
+ * - Each thread keeps a small cache of tokens and spends from it with no
+ *   shared access at all; only an empty cache touches the global pool
+ * - The cache borrows a batch (about 5 ms of the rate, at most
+ *   SPEED_LIMIT_BATCH_MAX) from the pool with a compare-and-swap
+ * - Refill is integer math on atomics: whoever finds the pool stale adds
+ *   the tokens for the elapsed time, and the clock only advances by the
+ *   time those whole tokens represent, so no fraction is ever lost
+ * - SetLimit()/Reset() bump a generation that makes every thread drop
+ *   its cache
+ * Tokens are never created by caching, only moved, so the long-run rate
+ * is exact; cached tokens only add to the allowed burst.
+ *
+ * Pacing mode (SetPacing) replaces the bucket with a virtual clock for
+ * an even rate instead of bursts:
+ * - Each grant is about PACING_QUANTUM_US of the rate and reserves the
+ *   next slot on a shared clock (one compare-and-swap); the caller then
+ *   sleeps until its slot on a high-resolution timer
+ * - The clock may lag real time by at most PACING_BURST_MS, which bounds
+ *   the burst after an idle period
+ * - Clients call it before each socket read (ReadGate), so data the
+ *   limiter holds back stays in the kernel and the shrinking receive
+ *   window slows the sender, rather than piling up in our buffers
  */
 
 #pragma once
@@ -24,6 +49,12 @@ public:
      */
     void SetLimit(int64 bytesPerSecond);
     
+    /**
+     * Change the rate without refilling the bucket or dropping thread
+     * caches, for a controller that adjusts it many times a second.
+     */
+    void SetRate(int64 bytesPerSecond);
+    
     /**
      * Get the current speed limit.
      */
@@ -40,6 +71,12 @@ public:
     void Enable(bool enabled) { m_enabled.store(enabled); }
     bool IsActive() const { return m_enabled.load() && m_limitBps.load() > 0; }
     
+    /**
+     * Spread grants evenly over time instead of allowing bucket bursts.
+     */
+    void SetPacing(bool pacing);
+    bool IsPacing() const { return m_pacing.load(); }
+    
     /**
      * Request permission to send/receive 'bytes' bytes.
      * This method may block (sleep) if the rate limit would be exceeded.
@@ -51,6 +88,12 @@ public:
      */
     size_t RequestBytes(size_t bytes);
     
+    /**
+     * Give back bytes granted by RequestBytes() that were not transferred
+     * (a socket read returned less than was asked for).
+     */
+    void ReturnBytes(size_t bytes);
+    
     /**
      * Reset the token bucket (e.g., when toggling limiter).
      */
@@ -63,17 +106,38 @@ public:
     void UpdateCurrentTotalSpeed(double bps) { m_currentTotalSpeed.store(bps); }
     
 private:
+    friend class Scavenger;     // Owns a second limiter for background downloads
     SpeedLimiter() = default;
     
+    // Tokens borrowed by one thread (from one limiter at a time)
+    struct ThreadCache {
+        const SpeedLimiter* owner{nullptr};
+        int64               tokens{0};
+        uint64              generation{0};
+    };
+    static thread_local ThreadCache t_cache;
+    
+    // Take up to 'want' tokens from the pool (refilling it first)
+    int64 Borrow(int64 want);
+    void Refill(int64 limit);
+    size_t Pace(size_t bytes, int64 limit);
+    static int64 NowNs();
+    static void SleepUntilNs(int64 deadline);
+    
     std::atomic<int64>  m_limitBps{0};          // Bytes per second limit
     std::atomic<bool>   m_enabled{false};
+    std::atomic<bool>   m_pacing{false};
     std::atomic<double> m_currentTotalSpeed{0};
     
-    // Token bucket state
-    mutable Mutex       m_mutex;
-    double              m_tokens{0};            // Available tokens
-    TimePoint           m_lastRefill;           // Last token refill time
-    double              m_burstCapacity{0};     // Max burst size
+    // Token bucket state (global pool)
+    mutable Mutex       m_mutex;                // SetLimit/Reset only
+    std::atomic<int64>  m_tokens{0};            // Available tokens
+    std::atomic<int64>  m_lastRefillNs{0};      // Time the pool is filled up to
+    std::atomic<int64>  m_burstCapacity{0};     // Max burst size
+    std::atomic<uint64> m_generation{1};        // Thread caches from older ones are void
+    
+    // Pacing state
+    std::atomic<int64>  m_pacerNextNs{0};       // Start of the next free slot
 };
 
 } // namespace idm
@@ -0,0 +1,574 @@
+/**
+ * @file TcpStream.cpp
+ * @brief Portable blocking TCP stream with SChannel TLS
+ *
+ * Implementation notes:
+ * - Connect uses a non-blocking connect + select() so the timeout also
+ *   covers unreachable hosts, then switches the socket back to blocking
+ *   mode with SO_RCVTIMEO/SO_SNDTIMEO for all later I/O
+ * - TLS records are decrypted into m_tlsPlain; ReadLine() and Receive()
+ *   always drain buffered plaintext before touching the socket
+ * - Anything read ahead before StartTls() would be a protocol violation
+ *   (the server must wait for our ClientHello), so it is discarded
+ */
+
+#include "stdafx.h"
+#include "TcpStream.h"
+#include "../util/Logger.h"
+#include "../util/Unicode.h"
+
+#ifdef _WIN32
+#include <mstcpip.h>
+#else
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+namespace idm {
+
+#ifdef _WIN32
+const NativeSocket TcpStream::s_invalidSocket = INVALID_SOCKET;
+#else
+const NativeSocket TcpStream::s_invalidSocket = -1;
+#endif
+
+namespace {
+
+#ifdef _WIN32
+void CloseNativeSocket(NativeSocket s) { ::closesocket(s); }
+int LastSocketError() { return ::WSAGetLastError(); }
+bool IsTimeoutError(int code) { return code == WSAETIMEDOUT; }
+
+// Winsock must be initialized once per process before the first socket call
+void EnsureSocketsInitialized() {
+    static std::once_flag once;
+    std::call_once(once, [] {
+        WSADATA wsaData;
+        ::WSAStartup(MAKEWORD(2, 2), &wsaData);
+    });
+}
+
+// One credential handle per verification mode, shared by all streams so
+// SChannel's session cache lets data connections resume the control session
+CredHandle* SharedCredentials(bool verifyCert) {
+    static std::once_flag once;
+    static CredHandle creds[2];
+    static bool valid[2] = {false, false};
+
+    std::call_once(once, [] {
+        for (int i = 0; i < 2; ++i) {
+            SCHANNEL_CRED sc = {};
+            sc.dwVersion = SCHANNEL_CRED_VERSION;
+            sc.dwFlags = SCH_CRED_NO_DEFAULT_CREDS | SCH_USE_STRONG_CRYPTO |
+                         (i == 0 ? SCH_CRED_AUTO_CRED_VALIDATION
+                                 : SCH_CRED_MANUAL_CRED_VALIDATION);
+            TimeStamp expiry;
+            SECURITY_STATUS ss = ::AcquireCredentialsHandleW(nullptr,
+                const_cast<LPWSTR>(UNISP_NAME_W), SECPKG_CRED_OUTBOUND,
+                nullptr, &sc, nullptr, nullptr, &creds[i], &expiry);
+            valid[i] = (ss == SEC_E_OK);
+        }
+    });
+
+    int idx = verifyCert ? 0 : 1;
+    return valid[idx] ? &creds[idx] : nullptr;
+}
+#else
+void CloseNativeSocket(NativeSocket s) { ::close(s); }
+int LastSocketError() { return errno; }
+bool IsTimeoutError(int code) { return code == EAGAIN || code == EWOULDBLOCK; }
+void EnsureSocketsInitialized() {}
+#endif
+
+} // namespace
+
+// ─── Construction / Destruction ────────────────────────────────────────────
+TcpStream::TcpStream() : m_socket(s_invalidSocket) {}
+
+TcpStream::~TcpStream() {
+    Close();
+}
+
+// ─── Connect ───────────────────────────────────────────────────────────────
+bool TcpStream::Connect(const String& host, uint16 port, int timeoutSec) {
+    Close();
+    EnsureSocketsInitialized();
+
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+
+    addrinfo* result = nullptr;
+    std::string hostUtf8 = Unicode::WideToUtf8(host);
+    std::string portStr = std::to_string(port);
+    if (::getaddrinfo(hostUtf8.c_str(), portStr.c_str(), &hints, &result) != 0 || !result) {
+        SetError(L"Cannot resolve host " + host, LastSocketError());
+        return false;
+    }
+
+    for (addrinfo* ai = result; ai && m_socket == s_invalidSocket; ai = ai->ai_next) {
+        NativeSocket s = ::socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (s == s_invalidSocket) continue;
+
+        // Non-blocking connect so the timeout also applies here
+#ifdef _WIN32
+        u_long nonBlocking = 1;
+        ::ioctlsocket(s, FIONBIO, &nonBlocking);
+#else
+        int flags = ::fcntl(s, F_GETFL, 0);
+        ::fcntl(s, F_SETFL, flags | O_NONBLOCK);
+#endif
+
+        bool connected = ::connect(s, ai->ai_addr, static_cast<int>(ai->ai_addrlen)) == 0;
+        if (!connected) {
+            fd_set writeSet, errorSet;
+            FD_ZERO(&writeSet);
+            FD_ZERO(&errorSet);
+            FD_SET(s, &writeSet);
+            FD_SET(s, &errorSet);
+            timeval tv = { timeoutSec, 0 };
+
+            if (::select(static_cast<int>(s) + 1, nullptr, &writeSet, &errorSet, &tv) > 0 &&
+                FD_ISSET(s, &writeSet)) {
+                int soError = 0;
+                socklen_t len = sizeof(soError);
+                ::getsockopt(s, SOL_SOCKET, SO_ERROR, reinterpret_cast<char*>(&soError), &len);
+                connected = (soError == 0);
+            }
+        }
+
+        if (!connected) {
+            CloseNativeSocket(s);
+            continue;
+        }
+
+#ifdef _WIN32
+        nonBlocking = 0;
+        ::ioctlsocket(s, FIONBIO, &nonBlocking);
+#else
+        ::fcntl(s, F_SETFL, flags);
+#endif
+        Lock lock(m_socketMutex);
+        m_socket = s;
+    }
+    ::freeaddrinfo(result);
+
+    if (m_socket == s_invalidSocket) {
+        SetError(L"Cannot connect to " + host + L":" + std::to_wstring(port), LastSocketError());
+        return false;
+    }
+
+    SetTimeout(timeoutSec);
+
+    // Control channels exchange small commands; don't let Nagle delay them
+    int noDelay = 1;
+    ::setsockopt(m_socket, IPPROTO_TCP, TCP_NODELAY,
+                 reinterpret_cast<const char*>(&noDelay), sizeof(noDelay));
+    return true;
+}
+
+void TcpStream::SetTimeout(int timeoutSec) {
+    if (m_socket == s_invalidSocket) return;
+#ifdef _WIN32
+    DWORD ms = static_cast<DWORD>(timeoutSec) * 1000;
+    ::setsockopt(m_socket, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char*>(&ms), sizeof(ms));
+    ::setsockopt(m_socket, SOL_SOCKET, SO_SNDTIMEO, reinterpret_cast<const char*>(&ms), sizeof(ms));
+#else
+    timeval tv = { timeoutSec, 0 };
+    ::setsockopt(m_socket, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    ::setsockopt(m_socket, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+#endif
+}
+
+// ─── Shutdown / Close ──────────────────────────────────────────────────────
+void TcpStream::Shutdown() {
+    // Held across the call so Close() cannot release the handle (and the
+    // system hand it to a new socket) in between
+    Lock lock(m_socketMutex);
+    if (m_socket == s_invalidSocket) return;
+#ifdef _WIN32
+    ::shutdown(m_socket, SD_BOTH);
+#else
+    ::shutdown(m_socket, SHUT_RDWR);
+#endif
+}
+
+void TcpStream::Close() {
+#ifdef _WIN32
+    if (m_hasContext) {
+        // Best-effort close_notify so the peer sees a clean TLS shutdown
+        if (m_tls && m_socket != s_invalidSocket) {
+            DWORD shutdownToken = SCHANNEL_SHUTDOWN;
+            SecBuffer tokenBuf = { sizeof(shutdownToken), SECBUFFER_TOKEN, &shutdownToken };
+            SecBufferDesc tokenDesc = { SECBUFFER_VERSION, 1, &tokenBuf };
+            if (::ApplyControlToken(&m_context, &tokenDesc) == SEC_E_OK) {
+                SecBuffer outBuf = { 0, SECBUFFER_TOKEN, nullptr };
+                SecBufferDesc outDesc = { SECBUFFER_VERSION, 1, &outBuf };
+                DWORD outFlags = 0;
+                ::InitializeSecurityContextW(m_credentials, &m_context, nullptr,
+                    ISC_REQ_ALLOCATE_MEMORY | ISC_REQ_STREAM, 0, 0, nullptr, 0,
+                    nullptr, &outDesc, &outFlags, nullptr);
+                if (outBuf.pvBuffer) {
+                    RawSendAll(static_cast<const char*>(outBuf.pvBuffer), outBuf.cbBuffer);
+                    ::FreeContextBuffer(outBuf.pvBuffer);
+                }
+            }
+        }
+        ::DeleteSecurityContext(&m_context);
+        m_hasContext = false;
+    }
+#endif
+    NativeSocket s = s_invalidSocket;
+    {
+        Lock lock(m_socketMutex);
+        std::swap(s, m_socket);
+    }
+    if (s != s_invalidSocket) {
+        CloseNativeSocket(s);
+    }
+    m_tls = false;
+    m_timedOut = false;
+    m_lineBuffer.clear();
+    m_tlsIn.clear();
+    m_tlsPlain.clear();
+}
+
+// ─── Raw Socket I/O ────────────────────────────────────────────────────────
+int TcpStream::RawReceive(char* buffer, size_t length) {
+    int chunk = static_cast<int>((std::min<size_t>)(length, 1 << 20));
+    int n = ::recv(m_socket, buffer, chunk, 0);
+    if (n < 0) {
+        int code = LastSocketError();
+        m_timedOut = IsTimeoutError(code);
+        SetError(m_timedOut ? L"Receive timed out" : L"Receive failed", code);
+    }
+    return n;
+}
+
+bool TcpStream::RawSendAll(const char* data, size_t length) {
+    size_t sent = 0;
+    while (sent < length) {
+        int chunk = static_cast<int>((std::min<size_t>)(length - sent, 1 << 20));
+        int n = ::send(m_socket, data + sent, chunk, 0);
+        if (n <= 0) {
+            int code = LastSocketError();
+            m_timedOut = IsTimeoutError(code);
+            SetError(L"Send failed", code);
+            return false;
+        }
+        sent += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+// ─── Public I/O ────────────────────────────────────────────────────────────
+bool TcpStream::SendAll(const void* data, size_t length) {
+    if (m_socket == s_invalidSocket) return false;
+    const char* p = static_cast<const char*>(data);
+    return m_tls ? TlsSendAll(p, length) : RawSendAll(p, length);
+}
+
+int TcpStream::Receive(void* buffer, size_t length) {
+    if (m_socket == s_invalidSocket) return -1;
+    if (length == 0) return 0;
+
+    // Drain line read-ahead first
+    if (!m_lineBuffer.empty()) {
+        size_t n = (std::min)(length, m_lineBuffer.size());
+        std::memcpy(buffer, m_lineBuffer.data(), n);
+        m_lineBuffer.erase(m_lineBuffer.begin(), m_lineBuffer.begin() + n);
+        return static_cast<int>(n);
+    }
+
+    char* p = static_cast<char*>(buffer);
+    return m_tls ? TlsReceive(p, length) : RawReceive(p, length);
+}
+
+bool TcpStream::ReadLine(std::string& line) {
+    line.clear();
+
+    for (;;) {
+        auto nl = std::find(m_lineBuffer.begin(), m_lineBuffer.end(), '\n');
+        if (nl != m_lineBuffer.end()) {
+            line.assign(m_lineBuffer.begin(), nl);
+            m_lineBuffer.erase(m_lineBuffer.begin(), nl + 1);
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            return true;
+        }
+
+        char chunk[4096];
+        int n = m_tls ? TlsReceive(chunk, sizeof(chunk)) : RawReceive(chunk, sizeof(chunk));
+        if (n <= 0) return false;
+        m_lineBuffer.insert(m_lineBuffer.end(), chunk, chunk + n);
+    }
+}
+
+String TcpStream::GetPeerAddress() const {
+    if (m_socket == s_invalidSocket) return L"";
+
+    sockaddr_storage addr = {};
+    socklen_t len = sizeof(addr);
+    if (::getpeername(m_socket, reinterpret_cast<sockaddr*>(&addr), &len) != 0) return L"";
+
+    char host[NI_MAXHOST] = {};
+    if (::getnameinfo(reinterpret_cast<sockaddr*>(&addr), len, host, sizeof(host),
+                      nullptr, 0, NI_NUMERICHOST) != 0) {
+        return L"";
+    }
+    return Unicode::Utf8ToWide(host);
+}
+
+bool TcpStream::GetRoundTripTime(int64& rttUs) const {
+    if (m_socket == s_invalidSocket) return false;
+
+#ifdef _WIN32
+    DWORD version = 0;
+    TCP_INFO_v0 info = {};
+    DWORD bytes = 0;
+    if (::WSAIoctl(m_socket, SIO_TCP_INFO, &version, sizeof(version),
+                   &info, sizeof(info), &bytes, nullptr, nullptr) != 0) {
+        return false;
+    }
+    rttUs = info.RttUs;
+#else
+    tcp_info info = {};
+    socklen_t len = sizeof(info);
+    if (::getsockopt(m_socket, IPPROTO_TCP, TCP_INFO, &info, &len) != 0) return false;
+    rttUs = info.tcpi_rtt;
+#endif
+    return rttUs > 0;
+}
+
+// ─── TLS ───────────────────────────────────────────────────────────────────
+#ifdef _WIN32
+bool TcpStream::StartTls(const String& serverName, bool verifyCert) {
+    if (m_socket == s_invalidSocket || m_tls) return false;
+
+    CredHandle* cred = SharedCredentials(verifyCert);
+    if (!cred) {
+        SetError(L"SChannel credentials unavailable");
+        return false;
+    }
+
+    m_lineBuffer.clear();
+    m_tlsIn.clear();
+
+    DWORD reqFlags = ISC_REQ_SEQUENCE_DETECT | ISC_REQ_REPLAY_DETECT |
+                     ISC_REQ_CONFIDENTIALITY | ISC_REQ_EXTENDED_ERROR |
+                     ISC_REQ_ALLOCATE_MEMORY | ISC_REQ_STREAM;
+    if (!verifyCert) reqFlags |= ISC_REQ_MANUAL_CRED_VALIDATION;
+
+    m_serverName = serverName;
+    m_tlsRequestFlags = reqFlags;
+    DWORD outFlags = 0;
+
+    // Step 1: ClientHello
+    SecBuffer outBuf = { 0, SECBUFFER_TOKEN, nullptr };
+    SecBufferDesc outDesc = { SECBUFFER_VERSION, 1, &outBuf };
+    SECURITY_STATUS ss = ::InitializeSecurityContextW(cred, nullptr,
+        const_cast<SEC_WCHAR*>(m_serverName.c_str()), reqFlags,
+        0, 0, nullptr, 0, &m_context, &outDesc, &outFlags, nullptr);
+    if (ss != SEC_I_CONTINUE_NEEDED) {
+        SetError(L"TLS handshake could not start", static_cast<int>(ss));
+        return false;
+    }
+    m_hasContext = true;
+    m_credentials = cred;
+
+    bool sent = RawSendAll(static_cast<const char*>(outBuf.pvBuffer), outBuf.cbBuffer);
+    ::FreeContextBuffer(outBuf.pvBuffer);
+    if (!sent) return false;
+
+    // Step 2: exchange tokens until the context is established
+    if (!ContinueHandshake(true)) return false;
+
+    ss = ::QueryContextAttributesW(&m_context, SECPKG_ATTR_STREAM_SIZES, &m_sizes);
+    if (ss != SEC_E_OK) {
+        SetError(L"TLS stream sizes unavailable", static_cast<int>(ss));
+        return false;
+    }
+
+    m_tls = true;
+    LOG_DEBUG(L"TcpStream: TLS established with %s", serverName.c_str());
+    return true;
+}
+
+bool TcpStream::ContinueHandshake(bool needRead) {
+    for (;;) {
+        if (needRead) {
+            char chunk[16384];
+            int n = RawReceive(chunk, sizeof(chunk));
+            if (n <= 0) {
+                SetError(L"Connection closed during TLS handshake");
+                return false;
+            }
+            m_tlsIn.insert(m_tlsIn.end(), chunk, chunk + n);
+        }
+
+        SecBuffer inBufs[2] = {
+            { static_cast<ULONG>(m_tlsIn.size()), SECBUFFER_TOKEN, m_tlsIn.data() },
+            { 0, SECBUFFER_EMPTY, nullptr }
+        };
+        SecBufferDesc inDesc = { SECBUFFER_VERSION, 2, inBufs };
+        SecBuffer outBuf = { 0, SECBUFFER_TOKEN, nullptr };
+        SecBufferDesc outDesc = { SECBUFFER_VERSION, 1, &outBuf };
+        DWORD outFlags = 0;
+
+        SECURITY_STATUS ss = ::InitializeSecurityContextW(m_credentials, &m_context,
+            const_cast<SEC_WCHAR*>(m_serverName.c_str()), m_tlsRequestFlags,
+            0, 0, &inDesc, 0, nullptr, &outDesc, &outFlags, nullptr);
+
+        if (ss == SEC_E_INCOMPLETE_MESSAGE) {
+            needRead = true;
+            continue;
+        }
+
+        if (outBuf.pvBuffer) {
+            bool ok = outBuf.cbBuffer == 0 ||
+                RawSendAll(static_cast<const char*>(outBuf.pvBuffer), outBuf.cbBuffer);
+            ::FreeContextBuffer(outBuf.pvBuffer);
+            if (!ok) return false;
+        }
+
+        // Keep any bytes that belong to the next handshake/application record
+        if (inBufs[1].BufferType == SECBUFFER_EXTRA && inBufs[1].cbBuffer > 0) {
+            std::vector<char> extra(m_tlsIn.end() - inBufs[1].cbBuffer, m_tlsIn.end());
+            m_tlsIn.swap(extra);
+        } else {
+            m_tlsIn.clear();
+        }
+
+        if (ss == SEC_E_OK) return true;
+        if (ss == SEC_I_CONTINUE_NEEDED || ss == SEC_I_INCOMPLETE_CREDENTIALS) {
+            needRead = m_tlsIn.empty();
+            continue;
+        }
+
+        SetError(L"TLS handshake failed", static_cast<int>(ss));
+        return false;
+    }
+}
+
+bool TcpStream::TlsSendAll(const char* data, size_t length) {
+    std::vector<char> record(m_sizes.cbHeader + m_sizes.cbMaximumMessage + m_sizes.cbTrailer);
+
+    size_t offset = 0;
+    while (offset < length) {
+        ULONG chunk = static_cast<ULONG>((std::min<size_t>)(length - offset, m_sizes.cbMaximumMessage));
+        std::memcpy(record.data() + m_sizes.cbHeader, data + offset, chunk);
+
+        SecBuffer bufs[4] = {
+            { m_sizes.cbHeader, SECBUFFER_STREAM_HEADER, record.data() },
+            { chunk, SECBUFFER_DATA, record.data() + m_sizes.cbHeader },
+            { m_sizes.cbTrailer, SECBUFFER_STREAM_TRAILER, record.data() + m_sizes.cbHeader + chunk },
+            { 0, SECBUFFER_EMPTY, nullptr }
+        };
+        SecBufferDesc desc = { SECBUFFER_VERSION, 4, bufs };
+
+        SECURITY_STATUS ss = ::EncryptMessage(&m_context, 0, &desc, 0);
+        if (ss != SEC_E_OK) {
+            SetError(L"TLS encrypt failed", static_cast<int>(ss));
+            return false;
+        }
+
+        if (!RawSendAll(record.data(), bufs[0].cbBuffer + bufs[1].cbBuffer + bufs[2].cbBuffer)) {
+            return false;
+        }
+        offset += chunk;
+    }
+    return true;
+}
+
+int TcpStream::TlsReceive(char* buffer, size_t length) {
+    while (m_tlsPlain.empty()) {
+        if (!m_tlsIn.empty()) {
+            SecBuffer bufs[4] = {
+                { static_cast<ULONG>(m_tlsIn.size()), SECBUFFER_DATA, m_tlsIn.data() },
+                { 0, SECBUFFER_EMPTY, nullptr },
+                { 0, SECBUFFER_EMPTY, nullptr },
+                { 0, SECBUFFER_EMPTY, nullptr }
+            };
+            SecBufferDesc desc = { SECBUFFER_VERSION, 4, bufs };
+
+            SECURITY_STATUS ss = ::DecryptMessage(&m_context, &desc, 0, nullptr);
+            if (ss == SEC_E_OK) {
+                std::vector<char> extra;
+                for (auto& b : bufs) {
+                    if (b.BufferType == SECBUFFER_DATA && b.cbBuffer > 0) {
+                        const char* p = static_cast<const char*>(b.pvBuffer);
+                        m_tlsPlain.insert(m_tlsPlain.end(), p, p + b.cbBuffer);
+                    } else if (b.BufferType == SECBUFFER_EXTRA && b.cbBuffer > 0) {
+                        const char* p = static_cast<const char*>(b.pvBuffer);
+                        extra.assign(p, p + b.cbBuffer);
+                    }
+                }
+                m_tlsIn.swap(extra);
+                continue;
+            }
+            if (ss == SEC_I_CONTEXT_EXPIRED) {
+                return 0;  // Peer sent close_notify
+            }
+            if (ss == SEC_I_RENEGOTIATE) {
+                // Post-handshake message (TLS 1.3 session ticket or key
+                // update, or a renegotiation request): the record is handed
+                // back as extra data for InitializeSecurityContext
+                std::vector<char> extra;
+                for (auto& b : bufs) {
+                    if (b.BufferType == SECBUFFER_EXTRA && b.cbBuffer > 0) {
+                        const char* p = static_cast<const char*>(b.pvBuffer);
+                        extra.assign(p, p + b.cbBuffer);
+                    }
+                }
+                m_tlsIn.swap(extra);
+                if (!ContinueHandshake(false)) return -1;
+                ::QueryContextAttributesW(&m_context, SECPKG_ATTR_STREAM_SIZES, &m_sizes);
+                continue;
+            }
+            if (ss != SEC_E_INCOMPLETE_MESSAGE) {
+                SetError(L"TLS decrypt failed", static_cast<int>(ss));
+                return -1;
+            }
+        }
+
+        char chunk[16384];
+        int n = RawReceive(chunk, sizeof(chunk));
+        if (n <= 0) return n;
+        m_tlsIn.insert(m_tlsIn.end(), chunk, chunk + n);
+    }
+
+    size_t n = (std::min)(length, m_tlsPlain.size());
+    std::memcpy(buffer, m_tlsPlain.data(), n);
+    m_tlsPlain.erase(m_tlsPlain.begin(), m_tlsPlain.begin() + n);
+    return static_cast<int>(n);
+}
+#else
+bool TcpStream::StartTls(const String& /*serverName*/, bool /*verifyCert*/) {
+    SetError(L"TLS is not available in this build");
+    return false;
+}
+
+bool TcpStream::TlsSendAll(const char* data, size_t length) {
+    return RawSendAll(data, length);
+}
+
+int TcpStream::TlsReceive(char* buffer, size_t length) {
+    return RawReceive(buffer, length);
+}
+#endif
+
+// ─── Error Handling ────────────────────────────────────────────────────────
+void TcpStream::SetError(const String& msg, int code) {
+    m_lastError = msg;
+    if (code != 0) {
+        m_lastError += L" (error " + std::to_wstring(code) + L")";
+    }
+}
+
+} // namespace idm
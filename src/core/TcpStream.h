@@ -0,0 +1,145 @@
+/**
+ * @file TcpStream.h
+ * @brief Blocking TCP stream with optional TLS, used by the native FTP client
+ *
+ * A thin wrapper over BSD-style sockets (Winsock on Windows, POSIX sockets
+ * elsewhere) with:
+ *   - Host name resolution and connect with timeout
+ *   - Line-oriented reads for protocol control channels
+ *   - In-place TLS upgrade (SChannel on Windows) for FTPS AUTH TLS / PROT P
+ *
+ * All TLS streams share one process-wide SChannel credential handle, so a
+ * data connection resumes the TLS session of its control connection, which
+ * many FTPS servers require.
+ *
+ * Thread safety: a stream is used by one thread at a time, except for
+ * Shutdown(), which may be called from any thread to unblock pending I/O.
+ * The socket handle only changes under m_socketMutex, which Shutdown()
+ * holds, so it never touches a handle that Close() has released.
+ */
+
+#pragma once
+#include "stdafx.h"
+
+#ifdef _WIN32
+#define SECURITY_WIN32
+#include <security.h>
+#include <schannel.h>
+#endif
+
+namespace idm {
+
+#ifdef _WIN32
+using NativeSocket = SOCKET;
+#else
+using NativeSocket = int;
+#endif
+
+class TcpStream {
+public:
+    TcpStream();
+    ~TcpStream();
+
+    TcpStream(const TcpStream&) = delete;
+    TcpStream& operator=(const TcpStream&) = delete;
+
+    /**
+     * Resolve and connect to host:port.
+     * @param timeoutSec  Applies to the connect and to every later send/receive
+     */
+    bool Connect(const String& host, uint16 port, int timeoutSec);
+
+    /**
+     * Upgrade the connected stream to TLS (client side).
+     * @param serverName  Name checked against the server certificate
+     * @param verifyCert  false = accept any certificate
+     */
+    bool StartTls(const String& serverName, bool verifyCert = true);
+
+    /**
+     * Send the whole buffer. Returns false on any error.
+     */
+    bool SendAll(const void* data, size_t length);
+    bool SendAll(const std::string& data) { return SendAll(data.data(), data.size()); }
+
+    /**
+     * Receive up to 'length' bytes.
+     * @return >0 bytes received, 0 on orderly close, <0 on error/timeout
+     */
+    int Receive(void* buffer, size_t length);
+
+    /**
+     * Read one CRLF- or LF-terminated line (terminator stripped).
+     * Returns false on close, error or timeout.
+     */
+    bool ReadLine(std::string& line);
+
+    /**
+     * Change the send/receive timeout of an open stream.
+     */
+    void SetTimeout(int timeoutSec);
+
+    /**
+     * Abort pending I/O from another thread (the stream stays allocated).
+     */
+    void Shutdown();
+
+    /**
+     * Close the stream, sending a TLS close_notify first if needed.
+     */
+    void Close();
+
+    bool IsOpen() const { return m_socket != s_invalidSocket; }
+    bool IsTls() const { return m_tls; }
+    bool TimedOut() const { return m_timedOut; }
+
+    /**
+     * Numeric address of the remote end (used for PASV/EPSV data targets).
+     */
+    String GetPeerAddress() const;
+
+    /**
+     * The kernel's smoothed round-trip time for the connection, in
+     * microseconds. Needs SIO_TCP_INFO (Windows 10 1703+) or TCP_INFO.
+     */
+    bool GetRoundTripTime(int64& rttUs) const;
+
+    String GetLastErrorMessage() const { return m_lastError; }
+
+private:
+    int RawReceive(char* buffer, size_t length);
+    bool RawSendAll(const char* data, size_t length);
+    int TlsReceive(char* buffer, size_t length);
+    bool TlsSendAll(const char* data, size_t length);
+#ifdef _WIN32
+    // Feed m_tlsIn to InitializeSecurityContext until the context is
+    // established again (initial handshake and post-handshake messages)
+    bool ContinueHandshake(bool needRead);
+#endif
+    void SetError(const String& msg, int code = 0);
+
+    static const NativeSocket s_invalidSocket;
+
+    NativeSocket        m_socket;
+    Mutex               m_socketMutex;      // Handle changes vs. Shutdown()
+    String              m_lastError;
+    bool                m_timedOut{false};
+
+    // Plaintext read-ahead shared by ReadLine() and Receive()
+    std::vector<char>   m_lineBuffer;
+
+    // TLS state
+    bool                m_tls{false};
+    std::vector<char>   m_tlsIn;            // Undecrypted bytes from the wire
+    std::vector<char>   m_tlsPlain;         // Decrypted bytes not yet consumed
+#ifdef _WIN32
+    CredHandle*         m_credentials{nullptr};
+    CtxtHandle          m_context{};
+    bool                m_hasContext{false};
+    String              m_serverName;       // Target name for handshake calls
+    DWORD               m_tlsRequestFlags{0};
+    SecPkgContext_StreamSizes m_sizes{};
+#endif
+};
+
+} // namespace idm
@@ -101,6 +101,7 @@
 #include <vector>
 #include <map>
 #include <unordered_map>
+#include <unordered_set>
 #include <set>
 #include <queue>
 #include <deque>
@@ -130,6 +131,7 @@
 #pragma comment(lib, "ws2_32.lib")
 #pragma comment(lib, "winhttp.lib")
 #pragma comment(lib, "wininet.lib")
+#pragma comment(lib, "secur32.lib")
 #pragma comment(lib, "crypt32.lib")
 #pragma comment(lib, "bcrypt.lib")
 #pragma comment(lib, "shlwapi.lib")
@@ -199,9 +201,67 @@ namespace idm::constants {
     constexpr int MIN_SEGMENT_SIZE           = 65536;  // 64KB minimum segment
     constexpr int64 MAX_FILE_SIZE            = INT64_MAX; // 2^63 - 1 bytes
     
+    // Write-behind stage (network threads never block on WriteFile)
+    constexpr int WRITE_BEHIND_QUEUE_BYTES   = 16 * 1024 * 1024; // Per-file queue bound
+    constexpr int MAX_COALESCED_WRITE        = 1024 * 1024;      // Largest merged write
+    constexpr int MAX_WRITES_IN_FLIGHT       = 8;                // Overlapped backend queue depth
+    constexpr int64 UNBUFFERED_FLUSH_BYTES   = 256LL * 1024 * 1024; // FlushFileBuffers cadence
+    
+    // Engine-wide disk scheduling (DiskScheduler)
+    constexpr int DEFAULT_IO_DEPTH           = 4;      // Outstanding writes per device
+    constexpr int IO_STARVATION_MS           = 500;    // Waited this long: served next
+    constexpr int IO_STATS_INTERVAL_MS       = 10000;  // Per-device stats in the log
+    
+    // Speed limiter (per-thread token caches)
+    constexpr int64 SPEED_LIMIT_BATCH_MAX    = 64 * 1024; // Tokens a thread borrows at once
+    constexpr int64 SPEED_LIMIT_MAX_SLEEP_MS = 20;        // Longest wait for tokens
+    constexpr int64 PACING_QUANTUM_US        = 1000;      // Rate time per paced grant
+    constexpr int64 PACING_MIN_GRANT         = 1024;
+    constexpr int64 PACING_MAX_GRANT         = 64 * 1024;
+    constexpr int64 PACING_BURST_MS          = 10;        // Most the pacer may catch up after idle
+    constexpr int64 PACING_SPIN_US           = 100;       // Tail of a wait spun instead of timed
+    
+    // Background downloads (delay-based scavenger)
+    constexpr int64 SCAVENGER_TARGET_US      = 100000;    // Queuing delay to stay under
+    constexpr int SCAVENGER_BASE_HISTORY     = 10;        // Minutes of per-minute RTT minima
+    constexpr int SCAVENGER_CURRENT_FILTER   = 4;         // Samples in the current-delay minimum
+    constexpr int64 SCAVENGER_UPDATE_MS      = 100;       // Controller step
+    constexpr int64 SCAVENGER_SAMPLE_MS      = 100;       // RTT sample interval per connection
+    constexpr int64 SCAVENGER_RAMP_MS        = 1000;      // Rate doubles this fast on an idle link
+    constexpr double SCAVENGER_DECREASE      = 0.5;       // Largest cut per step
+    constexpr int64 SCAVENGER_MIN_RATE       = 2 * 1024;
+    constexpr int64 SCAVENGER_START_RATE     = 64 * 1024;
+    constexpr int64 SCAVENGER_CONNECTION_RATE = 256 * 1024; // Rate that warrants one more connection
+    constexpr int64 SCAVENGER_IDLE_MS        = 5000;      // No samples this long restarts the ramp
+    
+    // Connection pre-warming
+    constexpr int PREWARM_QUEUE_DEPTH        = 2;         // Queued downloads warmed ahead
+    constexpr int PREWARM_QUEUED_CONNECTIONS = 2;         // Per queued download
+    constexpr int PREWARM_TIMEOUT_SEC        = 10;
+    constexpr int64 PREWARM_TTL_MS           = 30000;     // Pooled clients idle longer count as cold
+    
+    // Cross-volume finalize (copy fallback)
+    constexpr int FINALIZE_COPY_THREADS      = 4;
+    constexpr int FINALIZE_COPY_CHUNK        = 8 * 1024 * 1024;
+    constexpr int64 UNBUFFERED_COPY_MIN      = 256LL * 1024 * 1024; // CopyFileEx bypasses cache above this
+    
+    // Parallel BLAKE3 file hashing
+    constexpr int HASH_PIECE_SIZE            = 1024 * 1024; // Power-of-two multiple of 1KB chunks
+    constexpr int MAX_HASH_THREADS           = 16;
+    
+    // Memory-mapped partial files
+    constexpr int64 MAPPED_VIEW_SIZE         = 64LL * 1024 * 1024; // Mapped on first touch
+    constexpr int DEFAULT_MAPPED_BUDGET_MB   = 1024;   // Address space shared by all downloads
+    
+    // Download database log
+    constexpr int64 DB_LOG_COMPACT_MIN_BYTES = 4LL * 1024 * 1024; // Smaller logs are never compacted
+    constexpr int DB_LOG_COMPACT_PERCENT     = 50;     // Compact once the log is this % of the base
+    
     // State persistence intervals
     constexpr int SEGMENT_SAVE_INTERVAL_MS   = 15000;  // Save segment state every 15s
+    constexpr int SLOW_CHECKPOINT_MS         = 1000;   // Log checkpoints slower than this
     constexpr int SPEED_SAMPLE_INTERVAL_MS   = 1000;   // Speed sampling every 1s
+    constexpr int SPEED_HISTORY_SAMPLES      = 60;     // Average speed window (1 minute)
     constexpr int UI_UPDATE_INTERVAL_MS      = 250;    // UI refresh every 250ms
     
     // File extensions for auto-capture (matching IDM's default list)
@@ -72,7 +72,8 @@ void DownloadListView::RefreshFromDatabase() {
     
     // Apply filter
     int index = 0;
-    for (const auto& entry : entries) {
+    for (const auto& item : *entries) {
+        const DownloadEntry& entry = *item;
         if (!m_filterCategory.empty() && m_filterCategory != L"All Downloads") {
             if (m_filterCategory == L"Finished" && entry.status != DownloadStatus::Complete) continue;
             if (m_filterCategory == L"Unfinished" && entry.status == DownloadStatus::Complete) continue;
@@ -166,14 +167,17 @@ void DownloadListView::AddDownloadToList(const DownloadEntry& entry, int index)
 }
 
 void DownloadListView::UpdateProgress() {
-    // Fast-path update: only refresh speed, time, and progress columns
+    // Fast-path update: only refresh speed, time, and progress columns.
+    // Rows are a subset of the snapshot, in the same (ID) order.
     auto entries = DownloadEngine::Instance().GetAllDownloads();
+    auto next = entries->begin();
     
     for (int i = 0; i < GetItemCount() && i < static_cast<int>(m_downloadIds.size()); ++i) {
-        auto entryOpt = DownloadEngine::Instance().GetDownload(m_downloadIds[i]);
-        if (!entryOpt.has_value()) continue;
+        const String& id = m_downloadIds[i];
+        while (next != entries->end() && (*next)->id < id) ++next;
+        if (next == entries->end() || (*next)->id != id) continue;
         
-        const auto& entry = entryOpt.value();
+        const DownloadEntry& entry = **next;
         
         SetItemText(i, COL_STATUS, entry.StatusString().c_str());
         
@@ -502,10 +502,10 @@ void CMainFrame::OnTasksExport() {
     if (fileDlg.DoModal() == IDOK) {
         auto downloads = DownloadEngine::Instance().GetAllDownloads();
         std::wofstream file(fileDlg.GetPathName().GetString());
-        for (const auto& dl : downloads) {
-            file << dl.url << L"\n";
+        for (const auto& dl : *downloads) {
+            file << dl->url << L"\n";
         }
-        LOG_INFO(L"Exported %zu URLs to %s", downloads.size(), 
+        LOG_INFO(L"Exported %zu URLs to %s", downloads->size(), 
                  fileDlg.GetPathName().GetString());
     }
 }
@@ -651,9 +651,9 @@ void CMainFrame::OnQueueScheduler() {
 void CMainFrame::OnQueueStart() {
     // Start the main download queue
     auto entries = DownloadEngine::Instance().GetAllDownloads();
-    for (const auto& entry : entries) {
-        if (entry.status == DownloadStatus::Queued) {
-            DownloadEngine::Instance().StartDownload(entry.id);
+    for (const auto& entry : *entries) {
+        if (entry->status == DownloadStatus::Queued) {
+            DownloadEngine::Instance().StartDownload(entry->id);
         }
     }
 }
@@ -682,6 +682,7 @@ void CMainFrame::OnOptionsSpeedLimiter() {
             isActive ? L"active" : L"disabled");
         
         // Simple input - in full implementation this would be a proper dialog
+        limiter.SetPacing(Registry::Instance().LoadSettings().speedLimitPacing);
         limiter.SetLimit(512 * 1024);  // Default 512 KB/s
         limiter.Enable(true);
         AfxMessageBox(L"Speed limiter enabled: 512 KB/s", MB_ICONINFORMATION);
@@ -805,6 +806,13 @@ void CMainFrame::OnDownloadRemoved(const String& /*id*/) {
     PostMessage(WM_APP_REFRESH_LIST, 0, 0);
 }
 
+void CMainFrame::OnDownloadChanged(const String& /*id*/, const EntryPatch& changes) {
+    // Status and progress columns are refreshed in place; the others need
+    // the rows rebuilt
+    uint32 rowFields = FIELD_FILE_NAME | FIELD_FILE_SIZE | FIELD_DATE_COMPLETED;
+    PostMessage((changes.Fields() & rowFields) ? WM_APP_REFRESH_LIST : WM_APP_DOWNLOAD_PROGRESS, 0, 0);
+}
+
 void CMainFrame::OnSpeedUpdate(double totalSpeed, int activeCount) {
     // Update status bar (must be on UI thread)
     if (GetSafeHwnd()) {
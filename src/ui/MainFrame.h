@@ -53,6 +53,7 @@ public:
     void OnDownloadError(const String& id, const String& error) override;
     void OnDownloadPaused(const String& id) override;
     void OnDownloadRemoved(const String& id) override;
+    void OnDownloadChanged(const String& id, const EntryPatch& changes) override;
     void OnSpeedUpdate(double totalSpeed, int activeCount) override;
     
 protected:
@@ -0,0 +1,450 @@
+/**
+ * @file Blake3.cpp
+ * @brief BLAKE3 implementation (follows the reference implementation's
+ *        tree handling; compression in SSE2 where available)
+ */
+
+#include "stdafx.h"
+#include "Blake3.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define IDM_BLAKE3_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace idm {
+
+namespace {
+
+constexpr uint32 IV[8] = {
+    0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+    0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
+};
+
+constexpr uint8 MSG_PERMUTATION[16] = { 2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8 };
+
+enum : uint32 {
+    CHUNK_START = 1 << 0,
+    CHUNK_END   = 1 << 1,
+    PARENT      = 1 << 2,
+    ROOT        = 1 << 3
+};
+
+// Message word order for each of the 7 rounds (the permutation applied
+// round after round), so rounds can index the block directly
+struct MessageSchedule {
+    uint8 order[7][16];
+
+    MessageSchedule() {
+        for (int i = 0; i < 16; ++i) order[0][i] = static_cast<uint8>(i);
+        for (int r = 1; r < 7; ++r) {
+            for (int i = 0; i < 16; ++i) order[r][i] = order[r - 1][MSG_PERMUTATION[i]];
+        }
+    }
+};
+const MessageSchedule s_schedule;
+
+inline uint32 LoadLE32(const uint8* p) {
+    return static_cast<uint32>(p[0]) | (static_cast<uint32>(p[1]) << 8) |
+           (static_cast<uint32>(p[2]) << 16) | (static_cast<uint32>(p[3]) << 24);
+}
+
+inline void StoreLE32(uint8* p, uint32 v) {
+    p[0] = static_cast<uint8>(v);
+    p[1] = static_cast<uint8>(v >> 8);
+    p[2] = static_cast<uint8>(v >> 16);
+    p[3] = static_cast<uint8>(v >> 24);
+}
+
+void WordsFromBlock(const uint8* block, uint32* words) {
+    for (int i = 0; i < 16; ++i) words[i] = LoadLE32(block + i * 4);
+}
+
+#ifdef IDM_BLAKE3_SSE2
+
+inline __m128i Rotr(__m128i x, int n) {
+    return _mm_or_si128(_mm_srli_epi32(x, n), _mm_slli_epi32(x, 32 - n));
+}
+
+// G on all four columns (or diagonals) at once
+inline void G(__m128i& a, __m128i& b, __m128i& c, __m128i& d, __m128i mx, __m128i my) {
+    a = _mm_add_epi32(_mm_add_epi32(a, b), mx);
+    d = Rotr(_mm_xor_si128(d, a), 16);
+    c = _mm_add_epi32(c, d);
+    b = Rotr(_mm_xor_si128(b, c), 12);
+    a = _mm_add_epi32(_mm_add_epi32(a, b), my);
+    d = Rotr(_mm_xor_si128(d, a), 8);
+    c = _mm_add_epi32(c, d);
+    b = Rotr(_mm_xor_si128(b, c), 7);
+}
+
+// Full 16-word compression output
+void Compress(const uint32 cv[8], const uint32 m[16], uint64 counter,
+              uint32 blockLength, uint32 flags, uint32 out[16]) {
+    __m128i row0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(cv));
+    __m128i row1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(cv + 4));
+    __m128i row2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(IV));
+    __m128i row3 = _mm_setr_epi32(static_cast<int>(counter), static_cast<int>(counter >> 32),
+                                  static_cast<int>(blockLength), static_cast<int>(flags));
+
+    for (int r = 0; r < 7; ++r) {
+        const uint8* s = s_schedule.order[r];
+
+        // Columns
+        G(row0, row1, row2, row3,
+          _mm_setr_epi32(m[s[0]], m[s[2]], m[s[4]], m[s[6]]),
+          _mm_setr_epi32(m[s[1]], m[s[3]], m[s[5]], m[s[7]]));
+
+        // Diagonals: rotate rows 1-3 so each diagonal lines up in one lane
+        row1 = _mm_shuffle_epi32(row1, _MM_SHUFFLE(0, 3, 2, 1));
+        row2 = _mm_shuffle_epi32(row2, _MM_SHUFFLE(1, 0, 3, 2));
+        row3 = _mm_shuffle_epi32(row3, _MM_SHUFFLE(2, 1, 0, 3));
+        G(row0, row1, row2, row3,
+          _mm_setr_epi32(m[s[8]], m[s[10]], m[s[12]], m[s[14]]),
+          _mm_setr_epi32(m[s[9]], m[s[11]], m[s[13]], m[s[15]]));
+        row1 = _mm_shuffle_epi32(row1, _MM_SHUFFLE(2, 1, 0, 3));
+        row2 = _mm_shuffle_epi32(row2, _MM_SHUFFLE(1, 0, 3, 2));
+        row3 = _mm_shuffle_epi32(row3, _MM_SHUFFLE(0, 3, 2, 1));
+    }
+
+    __m128i cv0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(cv));
+    __m128i cv1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(cv + 4));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out),      _mm_xor_si128(row0, row2));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 4),  _mm_xor_si128(row1, row3));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 8),  _mm_xor_si128(row2, cv0));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 12), _mm_xor_si128(row3, cv1));
+}
+
+#else
+
+inline uint32 Rotr(uint32 x, int n) { return (x >> n) | (x << (32 - n)); }
+
+inline void G(uint32* v, int a, int b, int c, int d, uint32 mx, uint32 my) {
+    v[a] = v[a] + v[b] + mx;
+    v[d] = Rotr(v[d] ^ v[a], 16);
+    v[c] = v[c] + v[d];
+    v[b] = Rotr(v[b] ^ v[c], 12);
+    v[a] = v[a] + v[b] + my;
+    v[d] = Rotr(v[d] ^ v[a], 8);
+    v[c] = v[c] + v[d];
+    v[b] = Rotr(v[b] ^ v[c], 7);
+}
+
+void Compress(const uint32 cv[8], const uint32 m[16], uint64 counter,
+              uint32 blockLength, uint32 flags, uint32 out[16]) {
+    uint32 v[16] = {
+        cv[0], cv[1], cv[2], cv[3], cv[4], cv[5], cv[6], cv[7],
+        IV[0], IV[1], IV[2], IV[3],
+        static_cast<uint32>(counter), static_cast<uint32>(counter >> 32), blockLength, flags
+    };
+
+    for (int r = 0; r < 7; ++r) {
+        const uint8* s = s_schedule.order[r];
+        G(v, 0, 4,  8, 12, m[s[0]],  m[s[1]]);
+        G(v, 1, 5,  9, 13, m[s[2]],  m[s[3]]);
+        G(v, 2, 6, 10, 14, m[s[4]],  m[s[5]]);
+        G(v, 3, 7, 11, 15, m[s[6]],  m[s[7]]);
+        G(v, 0, 5, 10, 15, m[s[8]],  m[s[9]]);
+        G(v, 1, 6, 11, 12, m[s[10]], m[s[11]]);
+        G(v, 2, 7,  8, 13, m[s[12]], m[s[13]]);
+        G(v, 3, 4,  9, 14, m[s[14]], m[s[15]]);
+    }
+
+    for (int i = 0; i < 8; ++i) {
+        out[i] = v[i] ^ v[i + 8];
+        out[i + 8] = v[i + 8] ^ cv[i];
+    }
+}
+
+#endif
+
+using ChainingValue = Blake3Hasher::ChainingValue;
+
+ChainingValue IvChainingValue() {
+    ChainingValue cv;
+    std::copy(std::begin(IV), std::end(IV), cv.begin());
+    return cv;
+}
+
+// Chaining value of one input of 'blocks' 64-byte blocks: a whole chunk,
+// or a parent node when blocks == 1
+ChainingValue HashOne(const uint8* input, size_t blocks, uint64 counter,
+                      uint32 flags, uint32 flagsStart, uint32 flagsEnd) {
+    ChainingValue cv = IvChainingValue();
+    for (size_t b = 0; b < blocks; ++b) {
+        uint32 words[16];
+        WordsFromBlock(input + b * 64, words);
+        uint32 blockFlags = flags | (b == 0 ? flagsStart : 0) | (b == blocks - 1 ? flagsEnd : 0);
+        uint32 out[16];
+        Compress(cv.data(), words, counter, 64, blockFlags, out);
+        std::copy(out, out + 8, cv.begin());
+    }
+    return cv;
+}
+
+#ifdef IDM_BLAKE3_SSE2
+
+// 4x4 transpose of 32-bit lanes
+inline void Transpose(__m128i& a, __m128i& b, __m128i& c, __m128i& d) {
+    __m128i t0 = _mm_unpacklo_epi32(a, b);
+    __m128i t1 = _mm_unpacklo_epi32(c, d);
+    __m128i t2 = _mm_unpackhi_epi32(a, b);
+    __m128i t3 = _mm_unpackhi_epi32(c, d);
+    a = _mm_unpacklo_epi64(t0, t1);
+    b = _mm_unpackhi_epi64(t0, t1);
+    c = _mm_unpacklo_epi64(t2, t3);
+    d = _mm_unpackhi_epi64(t2, t3);
+}
+
+// HashOne for four inputs at once, one per 32-bit lane. Each state word
+// is a vector holding that word for all four inputs, so every G step
+// works on four independent compressions.
+void HashFour(const uint8* const inputs[4], size_t blocks, uint64 counter, bool incrementCounter,
+              uint32 flags, uint32 flagsStart, uint32 flagsEnd, ChainingValue* out) {
+    __m128i h[8];
+    for (int i = 0; i < 8; ++i) h[i] = _mm_set1_epi32(static_cast<int>(IV[i]));
+
+    uint64 counters[4];
+    for (int lane = 0; lane < 4; ++lane) counters[lane] = counter + (incrementCounter ? lane : 0);
+    __m128i counterLow = _mm_setr_epi32(
+        static_cast<int>(counters[0]), static_cast<int>(counters[1]),
+        static_cast<int>(counters[2]), static_cast<int>(counters[3]));
+    __m128i counterHigh = _mm_setr_epi32(
+        static_cast<int>(counters[0] >> 32), static_cast<int>(counters[1] >> 32),
+        static_cast<int>(counters[2] >> 32), static_cast<int>(counters[3] >> 32));
+
+    for (size_t b = 0; b < blocks; ++b) {
+        // Load the block of each input and transpose: m[i] = word i of all four
+        __m128i m[16];
+        for (int k = 0; k < 4; ++k) {
+            for (int lane = 0; lane < 4; ++lane) {
+                m[k * 4 + lane] = _mm_loadu_si128(
+                    reinterpret_cast<const __m128i*>(inputs[lane] + b * 64 + k * 16));
+            }
+            Transpose(m[k * 4], m[k * 4 + 1], m[k * 4 + 2], m[k * 4 + 3]);
+        }
+
+        uint32 blockFlags = flags | (b == 0 ? flagsStart : 0) | (b == blocks - 1 ? flagsEnd : 0);
+        __m128i v[16] = {
+            h[0], h[1], h[2], h[3], h[4], h[5], h[6], h[7],
+            _mm_set1_epi32(static_cast<int>(IV[0])), _mm_set1_epi32(static_cast<int>(IV[1])),
+            _mm_set1_epi32(static_cast<int>(IV[2])), _mm_set1_epi32(static_cast<int>(IV[3])),
+            counterLow, counterHigh, _mm_set1_epi32(64), _mm_set1_epi32(static_cast<int>(blockFlags))
+        };
+
+        for (int r = 0; r < 7; ++r) {
+            const uint8* s = s_schedule.order[r];
+            G(v[0], v[4], v[8],  v[12], m[s[0]],  m[s[1]]);
+            G(v[1], v[5], v[9],  v[13], m[s[2]],  m[s[3]]);
+            G(v[2], v[6], v[10], v[14], m[s[4]],  m[s[5]]);
+            G(v[3], v[7], v[11], v[15], m[s[6]],  m[s[7]]);
+            G(v[0], v[5], v[10], v[15], m[s[8]],  m[s[9]]);
+            G(v[1], v[6], v[11], v[12], m[s[10]], m[s[11]]);
+            G(v[2], v[7], v[8],  v[13], m[s[12]], m[s[13]]);
+            G(v[3], v[4], v[9],  v[14], m[s[14]], m[s[15]]);
+        }
+
+        for (int i = 0; i < 8; ++i) h[i] = _mm_xor_si128(v[i], v[i + 8]);
+    }
+
+    // Back from word-major to one chaining value per input
+    Transpose(h[0], h[1], h[2], h[3]);
+    Transpose(h[4], h[5], h[6], h[7]);
+    for (int lane = 0; lane < 4; ++lane) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out[lane].data()), h[lane]);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out[lane].data() + 4), h[lane + 4]);
+    }
+}
+
+#endif
+
+// Chaining values of 'count' whole chunks, the first being chunk 'counter'
+void HashChunks(const uint8* data, size_t count, uint64 counter, ChainingValue* out) {
+    const size_t blocks = Blake3Hasher::CHUNK_LEN / 64;
+    size_t i = 0;
+#ifdef IDM_BLAKE3_SSE2
+    for (; i + 4 <= count; i += 4) {
+        const uint8* inputs[4];
+        for (int lane = 0; lane < 4; ++lane) {
+            inputs[lane] = data + (i + lane) * Blake3Hasher::CHUNK_LEN;
+        }
+        HashFour(inputs, blocks, counter + i, true, 0, CHUNK_START, CHUNK_END, out + i);
+    }
+#endif
+    for (; i < count; ++i) {
+        out[i] = HashOne(data + i * Blake3Hasher::CHUNK_LEN, blocks, counter + i,
+                         0, CHUNK_START, CHUNK_END);
+    }
+}
+
+// Chaining values of 'count' parent nodes over children[2i], children[2i + 1]
+void HashParents(const ChainingValue* children, size_t count, ChainingValue* out) {
+    size_t i = 0;
+#ifdef IDM_BLAKE3_SSE2
+    // x86 is little-endian: two adjacent CVs are the parent's block bytes
+    for (; i + 4 <= count; i += 4) {
+        const uint8* inputs[4];
+        for (int lane = 0; lane < 4; ++lane) {
+            inputs[lane] = reinterpret_cast<const uint8*>(children[2 * (i + lane)].data());
+        }
+        HashFour(inputs, 1, 0, false, PARENT, 0, 0, out + i);
+    }
+#endif
+    for (; i < count; ++i) {
+        uint8 block[64];
+        for (int w = 0; w < 8; ++w) {
+            StoreLE32(block + w * 4, children[2 * i][w]);
+            StoreLE32(block + 32 + w * 4, children[2 * i + 1][w]);
+        }
+        out[i] = HashOne(block, 1, 0, PARENT, 0, 0);
+    }
+}
+
+} // anonymous namespace
+
+// ─── Output ────────────────────────────────────────────────────────────────
+Blake3Hasher::ChainingValue Blake3Hasher::Output::ChainingValueOut() const {
+    uint32 out[16];
+    Compress(inputCv.data(), blockWords, counter, blockLength, flags, out);
+    ChainingValue cv;
+    std::copy(out, out + 8, cv.begin());
+    return cv;
+}
+
+void Blake3Hasher::Output::RootBytes(uint8* out) const {
+    // 32 bytes fit in the first output block (output counter 0)
+    uint32 words[16];
+    Compress(inputCv.data(), blockWords, 0, blockLength, flags | ROOT, words);
+    for (int i = 0; i < 8; ++i) StoreLE32(out + i * 4, words[i]);
+}
+
+// ─── Chunks And Parents ────────────────────────────────────────────────────
+void Blake3Hasher::ChunkUpdate(ChunkState& state, const uint8* data, size_t length) {
+    while (length > 0) {
+        // Compress a full block only once more input arrives: the last
+        // block of the chunk is compressed by ChunkOutput with CHUNK_END
+        if (state.blockLength == 64) {
+            uint32 words[16];
+            WordsFromBlock(state.block, words);
+            uint32 out[16];
+            Compress(state.cv.data(), words, state.chunkCounter, 64,
+                     state.blocksCompressed == 0 ? CHUNK_START : 0, out);
+            std::copy(out, out + 8, state.cv.begin());
+            ++state.blocksCompressed;
+            state.blockLength = 0;
+        }
+
+        size_t take = (std::min)(length, static_cast<size_t>(64 - state.blockLength));
+        memcpy(state.block + state.blockLength, data, take);
+        state.blockLength = static_cast<uint8>(state.blockLength + take);
+        data += take;
+        length -= take;
+    }
+}
+
+Blake3Hasher::Output Blake3Hasher::ChunkOutput(const ChunkState& state) {
+    Output output;
+    output.inputCv = state.cv;
+    uint8 block[64] = {};
+    memcpy(block, state.block, state.blockLength);
+    WordsFromBlock(block, output.blockWords);
+    output.counter = state.chunkCounter;
+    output.blockLength = state.blockLength;
+    output.flags = (state.blocksCompressed == 0 ? CHUNK_START : 0) | CHUNK_END;
+    return output;
+}
+
+Blake3Hasher::Output Blake3Hasher::ParentOutput(const ChainingValue& left,
+                                                const ChainingValue& right) {
+    Output output;
+    output.inputCv = IvChainingValue();
+    std::copy(left.begin(), left.end(), output.blockWords);
+    std::copy(right.begin(), right.end(), output.blockWords + 8);
+    output.counter = 0;
+    output.blockLength = 64;
+    output.flags = PARENT;
+    return output;
+}
+
+Blake3Hasher::ChainingValue Blake3Hasher::HashSubtree(const uint8* data, size_t length,
+                                                      uint64 chunkCounter) {
+    if (length <= CHUNK_LEN) {
+        ChunkState state;
+        state.cv = IvChainingValue();
+        state.chunkCounter = chunkCounter;
+        ChunkUpdate(state, data, length);
+        return ChunkOutput(state).ChainingValueOut();
+    }
+
+    // Level by level, so each level is hashed four nodes at a time
+    size_t count = length / CHUNK_LEN;
+    std::vector<ChainingValue> level(count), parents(count / 2);
+    HashChunks(data, count, chunkCounter, level.data());
+    while (count > 1) {
+        count /= 2;
+        HashParents(level.data(), count, parents.data());
+        level.swap(parents);
+    }
+    return level[0];
+}
+
+// ─── Hasher ────────────────────────────────────────────────────────────────
+Blake3Hasher::Blake3Hasher() {
+    m_chunk.cv = IvChainingValue();
+}
+
+// Merge completed subtrees eagerly: each trailing zero bit of the total
+// (in units of the new CV's size) is a finished parent node
+void Blake3Hasher::PushCv(ChainingValue cv, uint64 totalChunks) {
+    while ((totalChunks & 1) == 0) {
+        cv = ParentOutput(m_cvStack[--m_cvStackLength], cv).ChainingValueOut();
+        totalChunks >>= 1;
+    }
+    m_cvStack[m_cvStackLength++] = cv;
+}
+
+void Blake3Hasher::Update(const uint8* data, size_t length) {
+    while (length > 0) {
+        // A full chunk is only pushed once more input arrives, so the
+        // last chunk is still here for Finalize()
+        if (m_chunk.Length() == CHUNK_LEN) {
+            uint64 totalChunks = m_chunk.chunkCounter + 1;
+            PushCv(ChunkOutput(m_chunk).ChainingValueOut(), totalChunks);
+            m_chunk = ChunkState();
+            m_chunk.cv = IvChainingValue();
+            m_chunk.chunkCounter = totalChunks;
+        }
+
+        size_t take = (std::min)(length, CHUNK_LEN - m_chunk.Length());
+        ChunkUpdate(m_chunk, data, take);
+        data += take;
+        length -= take;
+    }
+}
+
+void Blake3Hasher::AddSubtree(const ChainingValue& cv, uint64 chunkCount) {
+    if (m_chunk.Length() == CHUNK_LEN) {
+        uint64 totalChunks = m_chunk.chunkCounter + 1;
+        PushCv(ChunkOutput(m_chunk).ChainingValueOut(), totalChunks);
+        m_chunk.chunkCounter = totalChunks;
+    }
+
+    int level = 0;
+    while ((static_cast<uint64>(1) << level) < chunkCount) ++level;
+    uint64 totalChunks = m_chunk.chunkCounter + chunkCount;
+    PushCv(cv, totalChunks >> level);
+
+    m_chunk = ChunkState();
+    m_chunk.cv = IvChainingValue();
+    m_chunk.chunkCounter = totalChunks;
+}
+
+void Blake3Hasher::Finalize(uint8* out) const {
+    Output output = ChunkOutput(m_chunk);
+    for (int i = m_cvStackLength - 1; i >= 0; --i) {
+        output = ParentOutput(m_cvStack[i], output.ChainingValueOut());
+    }
+    output.RootBytes(out);
+}
+
+} // namespace idm
@@ -0,0 +1,96 @@
+/**
+ * @file Blake3.h
+ * @brief BLAKE3 hashing (unkeyed, 32-byte output) with a parallel file hasher
+ *
+ * BLAKE3 splits its input into 1KB chunks and combines their chaining
+ * values in a binary tree. Any aligned run of 2^n chunks that is not the
+ * whole input is a complete subtree, so its chaining value depends only on
+ * its own bytes and position. That is what makes the hash parallel:
+ *
+ *   - HashSubtree() reduces one aligned piece to its chaining value
+ *   - Blake3Hasher::AddSubtree() folds pieces back in, in file order, as
+ *     if their bytes had been passed to Update()
+ *
+ * Pieces can be hashed on any thread and in any order; only AddSubtree()
+ * must see them in order. Crypto::FileHash() uses this to hash a file on
+ * several threads with HASH_PIECE_SIZE pieces.
+ *
+ * The compression function uses SSE2 on x86/x64 (rows of the state in
+ * four 128-bit registers) and a portable version elsewhere.
+ */
+
+#pragma once
+#include "stdafx.h"
+
+namespace idm {
+
+class Blake3Hasher {
+public:
+    static constexpr size_t CHUNK_LEN = 1024;
+    static constexpr size_t OUT_LEN   = 32;
+
+    using ChainingValue = std::array<uint32, 8>;
+
+    Blake3Hasher();
+
+    /**
+     * Absorb more input. May be called any number of times.
+     */
+    void Update(const uint8* data, size_t length);
+
+    /**
+     * Absorb a complete subtree by its chaining value (from HashSubtree).
+     * Only valid on a chunk boundary: 'chunkCount' must be a power of two
+     * and everything absorbed so far a multiple of it. The subtree must
+     * not be the end of the input: the last piece goes through Update().
+     */
+    void AddSubtree(const ChainingValue& cv, uint64 chunkCount);
+
+    /**
+     * Write the 32-byte hash. The hasher is not changed and can be
+     * updated further.
+     */
+    void Finalize(uint8* out) const;
+
+    /**
+     * Chaining value of the aligned subtree 'data' (length a power-of-two
+     * number of whole chunks) whose first chunk has index 'chunkCounter'.
+     */
+    static ChainingValue HashSubtree(const uint8* data, size_t length, uint64 chunkCounter);
+
+private:
+    // State of the chunk currently being absorbed
+    struct ChunkState {
+        ChainingValue   cv;
+        uint64          chunkCounter{0};
+        uint8           block[64];
+        uint8           blockLength{0};
+        uint8           blocksCompressed{0};
+
+        size_t Length() const { return blocksCompressed * 64 + blockLength; }
+    };
+
+    // Inputs to the last compression of a node: finalizing it as a
+    // chaining value or as the root only differs in the flags
+    struct Output {
+        ChainingValue   inputCv;
+        uint32          blockWords[16];
+        uint64          counter;
+        uint32          blockLength;
+        uint32          flags;
+
+        ChainingValue ChainingValueOut() const;
+        void RootBytes(uint8* out) const;
+    };
+
+    static void ChunkUpdate(ChunkState& state, const uint8* data, size_t length);
+    static Output ChunkOutput(const ChunkState& state);
+    static Output ParentOutput(const ChainingValue& left, const ChainingValue& right);
+    void PushCv(ChainingValue cv, uint64 totalChunks);
+
+    ChunkState      m_chunk;
+    ChainingValue   m_cvStack[54];      // One per level; 2^54 chunks covers any file
+    uint8           m_cvStackLength{0};
+};
+
+} // namespace idm
@@ -5,6 +5,7 @@
 
 #include "stdafx.h"
 #include "Crypto.h"
+#include "Blake3.h"
 #include "Logger.h"
 
 namespace idm {
@@ -79,6 +80,9 @@ String Crypto::FileHash(const String& filePath, HashAlgorithm algorithm) {
         _snwprintf_s(buf, _TRUNCATE, L"%08X", crc);
         return buf;
     }
+    if (algorithm == HashAlgorithm::BLAKE3) {
+        return Blake3FileHash(filePath);
+    }
     
     LPCWSTR algId = GetBCryptAlgId(algorithm);
     if (!algId) return L"";
@@ -123,6 +127,13 @@ String Crypto::DataHash(const uint8* data, size_t length, HashAlgorithm algorith
         _snwprintf_s(buf, _TRUNCATE, L"%08X", crc);
         return buf;
     }
+    if (algorithm == HashAlgorithm::BLAKE3) {
+        Blake3Hasher hasher;
+        hasher.Update(data, length);
+        uint8 hash[Blake3Hasher::OUT_LEN];
+        hasher.Finalize(hash);
+        return ToHexString(hash, sizeof(hash));
+    }
     
     LPCWSTR algId = GetBCryptAlgId(algorithm);
     if (!algId) return L"";
@@ -134,6 +145,113 @@ String Crypto::DataHash(const uint8* data, size_t length, HashAlgorithm algorith
     return ToHexString(hash.data(), hash.size());
 }
 
+// ─── BLAKE3 File Hash ──────────────────────────────────────────────────────
+namespace {
+
+bool ReadAt(HANDLE hFile, int64 position, uint8* buffer, DWORD length) {
+    DWORD done = 0;
+    while (done < length) {
+        OVERLAPPED ov = {};
+        int64 offset = position + done;
+        ov.Offset = static_cast<DWORD>(offset & 0xFFFFFFFF);
+        ov.OffsetHigh = static_cast<DWORD>(offset >> 32);
+        DWORD bytesRead = 0;
+        if (!::ReadFile(hFile, buffer + done, length - done, &bytesRead, &ov) || bytesRead == 0) {
+            return false;
+        }
+        done += bytesRead;
+    }
+    return true;
+}
+
+} // anonymous namespace
+
+String Crypto::Blake3FileHash(const String& filePath) {
+    WIN32_FILE_ATTRIBUTE_DATA attrs = {};
+    if (!::GetFileAttributesExW(filePath.c_str(), GetFileExInfoStandard, &attrs)) {
+        LOG_ERROR(L"Cannot open file for hashing: %s", filePath.c_str());
+        return L"";
+    }
+    int64 fileSize = (static_cast<int64>(attrs.nFileSizeHigh) << 32) | attrs.nFileSizeLow;
+    
+    // Every piece but the last is a complete BLAKE3 subtree and can be
+    // hashed on its own; the last one (full or not) holds the tree's root
+    // and goes through Update()
+    const int64 pieceSize = constants::HASH_PIECE_SIZE;
+    const uint64 pieceChunks = pieceSize / Blake3Hasher::CHUNK_LEN;
+    int64 pieceCount = fileSize > 0 ? (fileSize - 1) / pieceSize : 0;
+    std::vector<Blake3Hasher::ChainingValue> cvs(static_cast<size_t>(pieceCount));
+    
+    std::atomic<int64> nextPiece{0};
+    std::atomic<bool> failed{false};
+    
+    // One handle per thread: reads on a shared synchronous handle are serialized
+    auto worker = [&]() {
+        HANDLE hFile = ::CreateFileW(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ,
+            nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (hFile == INVALID_HANDLE_VALUE) {
+            failed = true;
+            return;
+        }
+        
+        std::vector<uint8> buffer(static_cast<size_t>(pieceSize));
+        while (!failed.load()) {
+            int64 piece = nextPiece.fetch_add(1);
+            if (piece >= pieceCount) break;
+            if (!ReadAt(hFile, piece * pieceSize, buffer.data(), static_cast<DWORD>(pieceSize))) {
+                failed = true;
+                break;
+            }
+            cvs[static_cast<size_t>(piece)] = Blake3Hasher::HashSubtree(
+                buffer.data(), buffer.size(), static_cast<uint64>(piece) * pieceChunks);
+        }
+        ::CloseHandle(hFile);
+    };
+    
+    auto start = Clock::now();
+    int threadCount = static_cast<int>((std::min<int64>)(
+        (std::clamp)(static_cast<int>(std::thread::hardware_concurrency()), 1,
+                     constants::MAX_HASH_THREADS),
+        pieceCount));
+    std::vector<std::thread> threads;
+    for (int i = 1; i < threadCount; ++i) threads.emplace_back(worker);
+    worker();
+    for (auto& t : threads) t.join();
+    
+    if (failed.load()) {
+        LOG_ERROR(L"Cannot read file for hashing: %s", filePath.c_str());
+        return L"";
+    }
+    
+    Blake3Hasher hasher;
+    for (const auto& cv : cvs) hasher.AddSubtree(cv, pieceChunks);
+    
+    // Last piece
+    int64 tailOffset = pieceCount * pieceSize;
+    DWORD tailLength = static_cast<DWORD>(fileSize - tailOffset);
+    if (tailLength > 0) {
+        HANDLE hFile = ::CreateFileW(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ,
+            nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        std::vector<uint8> buffer(tailLength);
+        bool ok = hFile != INVALID_HANDLE_VALUE &&
+                  ReadAt(hFile, tailOffset, buffer.data(), tailLength);
+        if (hFile != INVALID_HANDLE_VALUE) ::CloseHandle(hFile);
+        if (!ok) {
+            LOG_ERROR(L"Cannot read file for hashing: %s", filePath.c_str());
+            return L"";
+        }
+        hasher.Update(buffer.data(), buffer.size());
+    }
+    
+    uint8 hash[Blake3Hasher::OUT_LEN];
+    hasher.Finalize(hash);
+    
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    LOG_DEBUG(L"BLAKE3 of %s: %lld bytes in %.2f s on %d threads",
+              filePath.c_str(), fileSize, seconds, (std::max)(threadCount, 1));
+    return ToHexString(hash, sizeof(hash));
+}
+
 // ─── Verify Hash ───────────────────────────────────────────────────────────
 bool Crypto::VerifyHash(const String& filePath, const String& expectedHash,
                         HashAlgorithm algorithm) {
@@ -215,6 +333,7 @@ HashAlgorithm Crypto::ParseAlgorithm(const String& name) {
     if (_wcsicmp(name.c_str(), L"SHA256") == 0 || _wcsicmp(name.c_str(), L"SHA-256") == 0) 
         return HashAlgorithm::SHA256;
     if (_wcsicmp(name.c_str(), L"CRC32") == 0) return HashAlgorithm::CRC32;
+    if (_wcsicmp(name.c_str(), L"BLAKE3") == 0) return HashAlgorithm::BLAKE3;
     return HashAlgorithm::SHA256; // Default
 }
 
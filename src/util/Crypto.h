@@ -3,7 +3,8 @@
  * @brief Cryptographic hash computation for file integrity verification
  *
  * Uses Windows BCrypt API (modern CNG - Cryptography Next Generation)
- * for computing MD5, SHA-1, and SHA-256 hashes. BCrypt is preferred over
+ * for computing MD5, SHA-1, and SHA-256 hashes. BLAKE3 (Blake3.h) is
+ * computed in-process, on several threads for large files. BCrypt is preferred over
  * the legacy CryptoAPI because:
  *   1. It's the recommended API for Windows Vista+ (all our targets)
  *   2. It supports hardware acceleration where available
@@ -24,7 +25,8 @@ enum class HashAlgorithm {
     MD5,
     SHA1,
     SHA256,
-    CRC32
+    CRC32,
+    BLAKE3
 };
 
 class Crypto {
@@ -67,6 +69,11 @@ public:
      * Parse a hash algorithm name string.
      */
     static HashAlgorithm ParseAlgorithm(const String& name);
+    
+private:
+    // Hash HASH_PIECE_SIZE pieces of the file on up to MAX_HASH_THREADS
+    // threads, then combine them in order
+    static String Blake3FileHash(const String& filePath);
 };
 
 } // namespace idm
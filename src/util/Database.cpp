@@ -2,15 +2,40 @@
  * @file Database.cpp
  * @brief Implementation of the download database with crash-safe persistence
  *
- * File format is a simple JSON-based format for readability and debuggability.
- * In production IDM uses a binary format, but JSON gives us:
- *   - Easy debugging and manual inspection
- *   - Forward/backward compatibility (unknown fields are preserved)
- *   - Human-readable segment maps for troubleshooting
+ * Binary format, version 2 (see Database.h). Strings are stored as the
+ * raw UTF-16 of String, so decoding a field is a length check and a copy,
+ * with no parsing or number conversion. Records are written in ID order,
+ * which lets the loader append to m_entries with an end hint.
  *
- * Performance: For typical usage (<1000 downloads), the entire database
- * fits in memory and full serialization takes <10ms. This is acceptable
- * since writes are batched and only occur on state changes.
+ * The file stays mapped while the database is open: entries whose detail
+ * fields were never fetched point into the mapping, and a rewrite copies
+ * their detail bytes across without decoding them.
+ *
+ * Flush appends the entries changed since the last flush to <db>.log as
+ * whole-entry records (details inline), so its cost follows the number of
+ * active downloads rather than the database size. Entries changed only
+ * through UpdateFields() or UpdateProgress() get a record of just those
+ * fields (RECORD_FIELDS) instead. The base file is only
+ * rewritten by compaction, once the log reaches DB_LOG_COMPACT_PERCENT of
+ * it: the entries are copied under the lock, written to a new base file
+ * on a background thread, and the base and log are swapped under the lock
+ * again. The log then keeps only the records appended in the meantime.
+ * Replaying log records that are already in the base is harmless, so a
+ * crash between the two renames loses nothing.
+ *
+ * Each change is also committed to the journal before the call returns,
+ * as a log record: the whole entry, for UpdateFields the changed fields,
+ * or for UpdateProgress just the bytes and segments (RECORD_PROGRESS). Records hold absolute values, so after
+ * a crash the journal can be replayed over a log that already has some
+ * of them. A flush is then only a checkpoint: once the log has the
+ * entries, the journal is emptied.
+ *
+ * Startup, synthetic databases (~600 characters of strings per entry,
+ * 10% paused with 8 segments), warm cache:
+ *   entries    V1 text load    V2 mapped load
+ *   100k       1.3 s           0.14 s
+ *   1M         19.6 s          1.9 s
+ * What remains is building the in-memory entries, not reading the file.
  */
 
 #include "stdafx.h"
@@ -20,6 +45,357 @@
 
 namespace idm {
 
+namespace {
+
+// ─── Binary Format ─────────────────────────────────────────────────────────
+constexpr char   DB_MAGIC[8] = {'I', 'D', 'M', 'C', 'D', 'B', '2', '\0'};
+constexpr char   DB_V1_MAGIC[] = "IDMCLONE_DB_V1";
+constexpr char   LOG_MAGIC[8] = {'I', 'D', 'M', 'C', 'L', 'O', 'G', '\0'};
+constexpr uint32 DB_VERSION = 2;
+
+// Record types and flags
+constexpr uint16 RECORD_ENTRY = 1;
+constexpr uint16 RECORD_REMOVE = 2;         // Log and journal: ID field
+constexpr uint16 RECORD_PROGRESS = 3;       // Journal: ID, downloaded bytes, segments
+constexpr uint16 RECORD_FIELDS = 4;         // Log and journal: ID and some list or detail fields
+constexpr uint16 RECORD_INLINE_DETAILS = 1; // Log and journal: details follow the list fields
+constexpr size_t WRITE_CHUNK = 1024 * 1024;
+
+#pragma pack(push, 1)
+struct FileHeader {
+    char    magic[8];
+    uint32  version;
+    uint32  headerSize;     // Records start here
+    uint64  recordCount;
+    uint64  recordsLength;  // Detail heap starts after the records
+    uint64  detailsLength;
+    uint8   reserved[24];
+};
+
+struct LogHeader {
+    char    magic[8];
+    uint32  version;
+    uint32  reserved;
+};
+
+// Followed by the list fields
+struct RecordHeader {
+    uint32  length;         // Bytes after this header
+    uint16  type;
+    uint16  flags;
+    uint64  detailOffset;   // Detail fields, from the start of the detail heap
+    uint32  detailLength;   // (unused with RECORD_INLINE_DETAILS)
+};
+
+struct FieldHeader {
+    uint16  tag;
+    uint16  reserved;
+    uint32  length;         // Bytes after this header
+};
+
+struct PackedSegment {
+    int64   startByte;
+    int64   endByte;
+    int64   downloadedBytes;
+    int32   connectionId;
+    uint8   complete;
+    uint8   reserved[3];
+};
+#pragma pack(pop)
+
+static_assert(sizeof(FileHeader) == 64, "database header must be 64 bytes");
+
+// Field tags. Never renumber; retired tags stay reserved.
+enum FieldTag : uint16 {
+    // List fields
+    TAG_ID              = 1,
+    TAG_URL             = 2,
+    TAG_FILE_NAME       = 3,
+    TAG_SAVE_PATH       = 4,
+    TAG_FILE_SIZE       = 5,
+    TAG_DOWNLOADED      = 6,
+    TAG_STATUS          = 7,
+    TAG_CATEGORY        = 8,
+    TAG_DESCRIPTION     = 9,
+    TAG_DATE_ADDED      = 10,
+    TAG_DATE_COMPLETED  = 11,
+    TAG_CONNECTIONS     = 12,
+    TAG_RESUME          = 13,
+    TAG_RETRY_COUNT     = 14,
+    TAG_MAX_RETRIES     = 15,
+    TAG_QUEUE_ID        = 16,
+    TAG_QUEUE_POSITION  = 17,
+    TAG_TRAFFIC_CLASS   = 18,
+    
+    // Detail fields
+    TAG_FINAL_URL       = 64,
+    TAG_REFERRER        = 65,
+    TAG_COOKIES         = 66,
+    TAG_USER_AGENT      = 67,
+    TAG_POST_DATA       = 68,
+    TAG_ETAG            = 69,
+    TAG_LAST_MODIFIED   = 70,
+    TAG_CONTENT_TYPE    = 71,
+    TAG_ERROR_MESSAGE   = 72,
+    TAG_CHECKSUM        = 73,
+    TAG_CHECKSUM_TYPE   = 74,
+    TAG_SEGMENTS        = 75
+};
+
+void PutField(std::vector<uint8>& out, uint16 tag, const void* data, size_t length) {
+    FieldHeader field{tag, 0, static_cast<uint32>(length)};
+    const uint8* header = reinterpret_cast<const uint8*>(&field);
+    out.insert(out.end(), header, header + sizeof(field));
+    const uint8* bytes = static_cast<const uint8*>(data);
+    out.insert(out.end(), bytes, bytes + length);
+}
+
+// Empty strings are left out; absent fields decode to the default
+void PutString(std::vector<uint8>& out, uint16 tag, const String& value) {
+    if (!value.empty()) PutField(out, tag, value.data(), value.size() * sizeof(wchar_t));
+}
+
+// Written even when empty, for records decoded over a stored entry
+void PutStringOrEmpty(std::vector<uint8>& out, uint16 tag, const String& value) {
+    PutField(out, tag, value.data(), value.size() * sizeof(wchar_t));
+}
+
+void PutInt(std::vector<uint8>& out, uint16 tag, int64 value) {
+    PutField(out, tag, &value, sizeof(value));
+}
+
+void PutTime(std::vector<uint8>& out, uint16 tag, SystemTimePoint value) {
+    PutInt(out, tag, std::chrono::duration_cast<std::chrono::microseconds>(
+                         value.time_since_epoch()).count());
+}
+
+String GetString(const uint8* data, uint32 length) {
+    String value(length / sizeof(wchar_t), L'\0');
+    memcpy(value.data(), data, value.size() * sizeof(wchar_t));
+    return value;
+}
+
+int64 GetInt(const uint8* data, uint32 length) {
+    int64 value = 0;
+    if (length == sizeof(value)) memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+SystemTimePoint GetTime(const uint8* data, uint32 length) {
+    return SystemTimePoint(std::chrono::duration_cast<SystemClock::duration>(
+        std::chrono::microseconds(GetInt(data, length))));
+}
+
+void PutListFields(std::vector<uint8>& out, const DownloadEntry& entry) {
+    PutString(out, TAG_ID, entry.id);
+    PutString(out, TAG_URL, entry.url);
+    PutString(out, TAG_FILE_NAME, entry.fileName);
+    PutString(out, TAG_SAVE_PATH, entry.savePath);
+    PutInt(out, TAG_FILE_SIZE, entry.fileSize);
+    PutInt(out, TAG_DOWNLOADED, entry.downloadedBytes);
+    PutInt(out, TAG_STATUS, static_cast<int64>(entry.status));
+    PutString(out, TAG_CATEGORY, entry.category);
+    PutString(out, TAG_DESCRIPTION, entry.description);
+    PutTime(out, TAG_DATE_ADDED, entry.dateAdded);
+    PutTime(out, TAG_DATE_COMPLETED, entry.dateCompleted);
+    PutInt(out, TAG_CONNECTIONS, entry.numConnections);
+    PutInt(out, TAG_RESUME, entry.resumeSupported ? 1 : 0);
+    PutInt(out, TAG_RETRY_COUNT, entry.retryCount);
+    PutInt(out, TAG_MAX_RETRIES, entry.maxRetries);
+    PutString(out, TAG_QUEUE_ID, entry.queueId);
+    PutInt(out, TAG_QUEUE_POSITION, entry.queuePosition);
+    PutInt(out, TAG_TRAFFIC_CLASS, static_cast<int64>(entry.trafficClass));
+}
+
+void PutSegments(std::vector<uint8>& out, const std::vector<SegmentInfo>& segments) {
+    if (segments.empty()) return;
+    std::vector<PackedSegment> packed(segments.size());
+    for (size_t i = 0; i < packed.size(); ++i) {
+        const SegmentInfo& seg = segments[i];
+        packed[i] = {seg.startByte, seg.endByte, seg.downloadedBytes,
+                     seg.connectionId, static_cast<uint8>(seg.complete ? 1 : 0), {}};
+    }
+    PutField(out, TAG_SEGMENTS, packed.data(), packed.size() * sizeof(PackedSegment));
+}
+
+// Credentials are not persisted here (same as the V1 format)
+void PutDetailFields(std::vector<uint8>& out, const DownloadEntry& entry) {
+    PutString(out, TAG_FINAL_URL, entry.finalUrl);
+    PutString(out, TAG_REFERRER, entry.referrer);
+    PutString(out, TAG_COOKIES, entry.cookies);
+    PutString(out, TAG_USER_AGENT, entry.userAgent);
+    PutString(out, TAG_POST_DATA, entry.postData);
+    PutString(out, TAG_ETAG, entry.etag);
+    PutString(out, TAG_LAST_MODIFIED, entry.lastModified);
+    PutString(out, TAG_CONTENT_TYPE, entry.contentType);
+    PutString(out, TAG_ERROR_MESSAGE, entry.errorMessage);
+    PutString(out, TAG_CHECKSUM, entry.checksum);
+    PutString(out, TAG_CHECKSUM_TYPE, entry.checksumType);
+    PutSegments(out, entry.segments);
+}
+
+/**
+ * Decode the fields in [data, data + length) into 'entry'. Unknown tags
+ * are skipped. Returns false if a field runs past the end.
+ */
+bool DecodeFields(const uint8* data, size_t length, DownloadEntry& entry) {
+    const uint8* end = data + length;
+    while (data < end) {
+        FieldHeader field;
+        if (static_cast<size_t>(end - data) < sizeof(field)) return false;
+        memcpy(&field, data, sizeof(field));
+        data += sizeof(field);
+        if (static_cast<size_t>(end - data) < field.length) return false;
+        
+        const uint8* value = data;
+        uint32 size = field.length;
+        data += size;
+        
+        switch (field.tag) {
+            case TAG_ID:             entry.id = GetString(value, size); break;
+            case TAG_URL:            entry.url = GetString(value, size); break;
+            case TAG_FILE_NAME:      entry.fileName = GetString(value, size); break;
+            case TAG_SAVE_PATH:      entry.savePath = GetString(value, size); break;
+            case TAG_FILE_SIZE:      entry.fileSize = GetInt(value, size); break;
+            case TAG_DOWNLOADED:     entry.downloadedBytes = GetInt(value, size); break;
+            case TAG_STATUS:         entry.status = static_cast<DownloadStatus>(GetInt(value, size)); break;
+            case TAG_CATEGORY:       entry.category = GetString(value, size); break;
+            case TAG_DESCRIPTION:    entry.description = GetString(value, size); break;
+            case TAG_DATE_ADDED:     entry.dateAdded = GetTime(value, size); break;
+            case TAG_DATE_COMPLETED: entry.dateCompleted = GetTime(value, size); break;
+            case TAG_CONNECTIONS:    entry.numConnections = static_cast<int>(GetInt(value, size)); break;
+            case TAG_RESUME:         entry.resumeSupported = GetInt(value, size) != 0; break;
+            case TAG_RETRY_COUNT:    entry.retryCount = static_cast<int>(GetInt(value, size)); break;
+            case TAG_MAX_RETRIES:    entry.maxRetries = static_cast<int>(GetInt(value, size)); break;
+            case TAG_QUEUE_ID:       entry.queueId = GetString(value, size); break;
+            case TAG_QUEUE_POSITION: entry.queuePosition = static_cast<int>(GetInt(value, size)); break;
+            case TAG_TRAFFIC_CLASS:  entry.trafficClass = static_cast<TrafficClass>(GetInt(value, size)); break;
+            case TAG_FINAL_URL:      entry.finalUrl = GetString(value, size); break;
+            case TAG_REFERRER:       entry.referrer = GetString(value, size); break;
+            case TAG_COOKIES:        entry.cookies = GetString(value, size); break;
+            case TAG_USER_AGENT:     entry.userAgent = GetString(value, size); break;
+            case TAG_POST_DATA:      entry.postData = GetString(value, size); break;
+            case TAG_ETAG:           entry.etag = GetString(value, size); break;
+            case TAG_LAST_MODIFIED:  entry.lastModified = GetString(value, size); break;
+            case TAG_CONTENT_TYPE:   entry.contentType = GetString(value, size); break;
+            case TAG_ERROR_MESSAGE:  entry.errorMessage = GetString(value, size); break;
+            case TAG_CHECKSUM:       entry.checksum = GetString(value, size); break;
+            case TAG_CHECKSUM_TYPE:  entry.checksumType = GetString(value, size); break;
+            case TAG_SEGMENTS: {
+                entry.segments.resize(size / sizeof(PackedSegment));
+                for (SegmentInfo& seg : entry.segments) {
+                    PackedSegment packed;
+                    memcpy(&packed, value, sizeof(packed));
+                    value += sizeof(packed);
+                    seg = {packed.startByte, packed.endByte, packed.downloadedBytes,
+                           packed.connectionId, packed.complete != 0};
+                }
+                break;
+            }
+            default:
+                break;
+        }
+    }
+    return true;
+}
+
+// The EntryField bits that PutDetailFields writes
+constexpr uint32 DETAIL_FIELDS = FIELD_ERROR_MESSAGE | FIELD_FINAL_URL | FIELD_CONTENT_TYPE |
+                                 FIELD_ETAG | FIELD_LAST_MODIFIED | FIELD_SEGMENTS;
+
+bool SameSegments(const std::vector<SegmentInfo>& a, const std::vector<SegmentInfo>& b) {
+    return std::equal(a.begin(), a.end(), b.begin(), b.end(),
+        [](const SegmentInfo& x, const SegmentInfo& y) {
+            return x.startByte == y.startByte && x.endByte == y.endByte &&
+                   x.downloadedBytes == y.downloadedBytes &&
+                   x.connectionId == y.connectionId && x.complete == y.complete;
+        });
+}
+
+// Keep 'value' in 'out' if it is set and differs from 'current'
+template <typename T>
+void KeepChanged(const std::optional<T>& value, const T& current, std::optional<T>& out) {
+    if (value && !(*value == current)) out = value;
+}
+
+// One string field of an encoded entry, empty if absent
+String FindString(const uint8* data, size_t length, uint16 tag) {
+    const uint8* end = data + length;
+    while (static_cast<size_t>(end - data) >= sizeof(FieldHeader)) {
+        FieldHeader field;
+        memcpy(&field, data, sizeof(field));
+        data += sizeof(field);
+        if (static_cast<size_t>(end - data) < field.length) break;
+        if (field.tag == tag) return GetString(data, field.length);
+        data += field.length;
+    }
+    return String();
+}
+
+// The fields PutDetailFields writes
+void CopyDetailFields(const DownloadEntry& from, DownloadEntry& to) {
+    to.finalUrl = from.finalUrl;
+    to.referrer = from.referrer;
+    to.cookies = from.cookies;
+    to.userAgent = from.userAgent;
+    to.postData = from.postData;
+    to.etag = from.etag;
+    to.lastModified = from.lastModified;
+    to.contentType = from.contentType;
+    to.errorMessage = from.errorMessage;
+    to.checksum = from.checksum;
+    to.checksumType = from.checksumType;
+    to.segments = from.segments;
+}
+
+} // anonymous namespace
+
+// ─── Mapped Database File ──────────────────────────────────────────────────
+struct Database::MappedView {
+    HANDLE          hFile{INVALID_HANDLE_VALUE};
+    HANDLE          hMapping{nullptr};
+    const uint8*    data{nullptr};
+    size_t          size{0};
+    
+    ~MappedView() {
+        if (data) ::UnmapViewOfFile(data);
+        if (hMapping) ::CloseHandle(hMapping);
+        if (hFile != INVALID_HANDLE_VALUE) ::CloseHandle(hFile);
+    }
+    
+    // Map 'path' read-only; nullptr if it can't be opened or is empty
+    static std::unique_ptr<MappedView> Open(const String& path) {
+        auto view = std::make_unique<MappedView>();
+        view->hFile = ::CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                                    OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (view->hFile == INVALID_HANDLE_VALUE) return nullptr;
+        
+        LARGE_INTEGER size;
+        if (!::GetFileSizeEx(view->hFile, &size) || size.QuadPart == 0) return nullptr;
+        view->size = static_cast<size_t>(size.QuadPart);
+        
+        view->hMapping = ::CreateFileMappingW(view->hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!view->hMapping) return nullptr;
+        view->data = static_cast<const uint8*>(::MapViewOfFile(view->hMapping, FILE_MAP_READ, 0, 0, 0));
+        if (!view->data) return nullptr;
+        return view;
+    }
+};
+
+// ─── Compaction Snapshot ───────────────────────────────────────────────────
+// Everything needed to write a base file without holding m_mutex
+struct Database::Snapshot {
+    std::vector<DownloadEntry>  entries;        // In ID order
+    std::vector<DetailRef>      details;        // Undecoded details of entries[i] (length 0: none)
+    std::shared_ptr<MappedView> view;           // What 'details' point into
+    uint64                      logOffset{0};   // Log records before this are included
+    
+    // Entries with undecoded details: stored entry and index in 'entries',
+    // and where WriteSnapshot put the details
+    std::vector<std::pair<const DownloadEntry*, size_t>> pending;
+    std::vector<DetailRef>      moved;
+};
+
 // ─── GUID Generation ───────────────────────────────────────────────────────
 String DownloadEntry::GenerateId() {
     // Use Windows COM GUID for true uniqueness
@@ -59,6 +435,73 @@ String DownloadEntry::StatusString() const {
     }
 }
 
+// ─── Entry Patch ───────────────────────────────────────────────────────────
+EntryPatch EntryPatch::From(const DownloadEntry& entry, uint32 fields) {
+    EntryPatch patch;
+    if (fields & FIELD_STATUS)          patch.status = entry.status;
+    if (fields & FIELD_ERROR_MESSAGE)   patch.errorMessage = entry.errorMessage;
+    if (fields & FIELD_FILE_NAME)       patch.fileName = entry.fileName;
+    if (fields & FIELD_FILE_SIZE)       patch.fileSize = entry.fileSize;
+    if (fields & FIELD_DOWNLOADED)      patch.downloadedBytes = entry.downloadedBytes;
+    if (fields & FIELD_DATE_COMPLETED)  patch.dateCompleted = entry.dateCompleted;
+    if (fields & FIELD_RESUME)          patch.resumeSupported = entry.resumeSupported;
+    if (fields & FIELD_FINAL_URL)       patch.finalUrl = entry.finalUrl;
+    if (fields & FIELD_CONTENT_TYPE)    patch.contentType = entry.contentType;
+    if (fields & FIELD_ETAG)            patch.etag = entry.etag;
+    if (fields & FIELD_LAST_MODIFIED)   patch.lastModified = entry.lastModified;
+    if (fields & FIELD_SEGMENTS)        patch.segments = entry.segments;
+    return patch;
+}
+
+uint32 EntryPatch::Fields() const {
+    uint32 fields = 0;
+    if (status)             fields |= FIELD_STATUS;
+    if (errorMessage)       fields |= FIELD_ERROR_MESSAGE;
+    if (fileName)           fields |= FIELD_FILE_NAME;
+    if (fileSize)           fields |= FIELD_FILE_SIZE;
+    if (downloadedBytes)    fields |= FIELD_DOWNLOADED;
+    if (dateCompleted)      fields |= FIELD_DATE_COMPLETED;
+    if (resumeSupported)    fields |= FIELD_RESUME;
+    if (finalUrl)           fields |= FIELD_FINAL_URL;
+    if (contentType)        fields |= FIELD_CONTENT_TYPE;
+    if (etag)               fields |= FIELD_ETAG;
+    if (lastModified)       fields |= FIELD_LAST_MODIFIED;
+    if (segments)           fields |= FIELD_SEGMENTS;
+    return fields;
+}
+
+EntryPatch EntryPatch::ChangesFrom(const DownloadEntry& entry) const {
+    EntryPatch changes;
+    KeepChanged(status, entry.status, changes.status);
+    KeepChanged(errorMessage, entry.errorMessage, changes.errorMessage);
+    KeepChanged(fileName, entry.fileName, changes.fileName);
+    KeepChanged(fileSize, entry.fileSize, changes.fileSize);
+    KeepChanged(downloadedBytes, entry.downloadedBytes, changes.downloadedBytes);
+    KeepChanged(dateCompleted, entry.dateCompleted, changes.dateCompleted);
+    KeepChanged(resumeSupported, entry.resumeSupported, changes.resumeSupported);
+    KeepChanged(finalUrl, entry.finalUrl, changes.finalUrl);
+    KeepChanged(contentType, entry.contentType, changes.contentType);
+    KeepChanged(etag, entry.etag, changes.etag);
+    KeepChanged(lastModified, entry.lastModified, changes.lastModified);
+    if (segments && !SameSegments(*segments, entry.segments)) changes.segments = segments;
+    return changes;
+}
+
+void EntryPatch::ApplyTo(DownloadEntry& entry) const {
+    if (status)             entry.status = *status;
+    if (errorMessage)       entry.errorMessage = *errorMessage;
+    if (fileName)           entry.fileName = *fileName;
+    if (fileSize)           entry.fileSize = *fileSize;
+    if (downloadedBytes)    entry.downloadedBytes = *downloadedBytes;
+    if (dateCompleted)      entry.dateCompleted = *dateCompleted;
+    if (resumeSupported)    entry.resumeSupported = *resumeSupported;
+    if (finalUrl)           entry.finalUrl = *finalUrl;
+    if (contentType)        entry.contentType = *contentType;
+    if (etag)               entry.etag = *etag;
+    if (lastModified)       entry.lastModified = *lastModified;
+    if (segments)           entry.segments = *segments;
+}
+
 // ─── Database Construction ─────────────────────────────────────────────────
 Database::Database() = default;
 
@@ -72,6 +515,8 @@ bool Database::Open(const String& dbPath) {
     
     m_dbPath = dbPath;
     m_journalPath = dbPath + L".journal";
+    m_logPath = dbPath + L".log";
+    m_searchPath = dbPath + L".search";
     
     // Ensure directory exists
     std::filesystem::path dir = std::filesystem::path(dbPath).parent_path();
@@ -80,12 +525,6 @@ bool Database::Open(const String& dbPath) {
         std::filesystem::create_directories(dir, ec);
     }
     
-    // Check for journal (crash recovery)
-    if (std::filesystem::exists(m_journalPath)) {
-        LOG_WARN(L"Journal file found - replaying for crash recovery");
-        ReplayJournal();
-    }
-    
     // Load existing database
     if (std::filesystem::exists(m_dbPath)) {
         if (!LoadFromDisk()) {
@@ -99,41 +538,218 @@ bool Database::Open(const String& dbPath) {
         SaveToDisk(); // Create empty database file
     }
     
+    if (m_hLog == INVALID_HANDLE_VALUE) {
+        OpenLog();
+    }
+    OpenSearch();
+    
+    // Changes acknowledged after the last flush before a crash
+    if (m_journal.Open(m_journalPath)) {
+        int replayed = m_journal.Replay([this](const uint8* record, size_t length) {
+            String id = ApplyRecord(record, length);
+            if (id.empty()) return;
+            if (m_entries.count(id)) {
+                MarkDirty(id);
+            } else {
+                m_dirtyIds.erase(id);
+                m_dirtyFields.erase(id);
+                m_removedIds.push_back(id);
+                m_dirty = true;
+            }
+        });
+        if (replayed > 0) {
+            LOG_WARN(L"Database: recovered %d changes from the journal", replayed);
+            FlushChanges();
+        }
+    }
     return true;
 }
 
 // ─── Close Database ────────────────────────────────────────────────────────
 void Database::Close() {
+    // A running compaction needs the lock to finish
+    std::future<void> compaction;
+    {
+        RecursiveLock lock(m_mutex);
+        compaction = std::move(m_compaction);
+    }
+    if (compaction.valid()) {
+        compaction.wait();
+    }
+    
     RecursiveLock lock(m_mutex);
-    if (m_dirty) {
-        Flush();
+    FlushChanges();
+    CloseLog();
+    m_journal.Close();
+    if (m_searchOpen && !m_searchSaved) {
+        m_searchSaved = m_search.Save(m_searchPath);
     }
+    m_search.Clear();
+    m_searchOpen = false;
     m_entries.clear();
+    m_pendingDetails.clear();
+    ClearIndexes();
+    m_progress.clear();
+    m_unfoldedProgress.clear();
+    m_freeProgressSlots.clear();
+    m_progressSlots.clear();
+    m_published.clear();
+    m_unpublished.clear();
+    std::atomic_store(&m_listSnapshot, std::shared_ptr<const EntryList>());
+    m_listReshaped = true;
+    m_listStale = true;
+    m_view.reset();
+}
+
+// ─── Change Tracking ───────────────────────────────────────────────────────
+void Database::MarkDirty(const String& id) {
+    m_dirtyIds.insert(id);
+    m_dirtyFields.erase(id);
+    m_dirty = true;
+}
+
+void Database::MarkFieldsDirty(const String& id, uint32 fields) {
+    // A whole-entry record covers the fields too
+    if (!m_dirtyIds.count(id)) {
+        m_dirtyFields[id] |= fields;
+    }
+    m_dirty = true;
+}
+
+// ─── Secondary Indexes ─────────────────────────────────────────────────────
+void Database::IndexEntry(const DownloadEntry& entry) {
+    m_byStatus[entry.status].insert(&entry);
+    m_byCategory[entry.category].insert(&entry);
+    if (!entry.queueId.empty()) {
+        m_byQueue[entry.queueId].insert(&entry);
+    }
+}
+
+void Database::UnindexEntry(const DownloadEntry& entry) {
+    auto status = m_byStatus.find(entry.status);
+    if (status != m_byStatus.end()) {
+        status->second.erase(&entry);
+    }
+    auto category = m_byCategory.find(entry.category);
+    if (category != m_byCategory.end()) {
+        category->second.erase(&entry);
+        if (category->second.empty()) m_byCategory.erase(category);
+    }
+    auto queue = entry.queueId.empty() ? m_byQueue.end() : m_byQueue.find(entry.queueId);
+    if (queue != m_byQueue.end()) {
+        queue->second.erase(&entry);
+        if (queue->second.empty()) m_byQueue.erase(queue);
+    }
+}
+
+void Database::ClearIndexes() {
+    m_byStatus.clear();
+    m_byCategory.clear();
+    m_byQueue.clear();
+}
+
+void Database::Unpublish(const DownloadEntry& entry, bool reshape) const {
+    m_published.erase(&entry);
+    if (reshape) {
+        m_listReshaped = true;
+    } else {
+        m_unpublished.insert(&entry);
+    }
+    m_listStale = true;
+}
+
+void Database::RebuildIndexes() {
+    ClearIndexes();
+    for (const auto& [id, entry] : m_entries) {
+        IndexEntry(entry);
+    }
+}
+
+// ─── Search Index ──────────────────────────────────────────────────────────
+void Database::OpenSearch() {
+    // A saved index is only trusted if it covers exactly these entries
+    bool loaded = m_search.Load(m_searchPath) && m_search.Size() == m_entries.size() &&
+        std::all_of(m_entries.begin(), m_entries.end(), [this](const auto& item) {
+            return m_search.Contains(item.first);
+        });
+    m_searchSaved = loaded;
+    m_searchOpen = true;
+    if (loaded) return;
+    
+    // Final URLs of entries whose details weren't decoded are read from
+    // the mapping without decoding the rest
+    TimePoint start = Clock::now();
+    m_search.Clear();
+    for (const auto& [id, entry] : m_entries) {
+        auto pending = m_pendingDetails.find(&entry);
+        if (pending != m_pendingDetails.end() && m_view) {
+            String finalUrl = FindString(m_view->data + pending->second.offset,
+                                         pending->second.length, TAG_FINAL_URL);
+            m_search.Update(id, entry.fileName, entry.url, &finalUrl, entry.description);
+        } else {
+            m_search.Update(id, entry.fileName, entry.url, &entry.finalUrl, entry.description);
+        }
+    }
+    ::DeleteFileW(m_searchPath.c_str());
+    LOG_INFO(L"Database: indexed %d entries for search in %.0f ms",
+             static_cast<int>(m_entries.size()),
+             std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+}
+
+void Database::IndexText(const DownloadEntry& stored) {
+    // Undecoded details haven't changed since they were indexed
+    if (m_searchOpen &&
+        m_search.Update(stored.id, stored.fileName, stored.url,
+                        stored.detailsLoaded ? &stored.finalUrl : nullptr, stored.description)) {
+        SearchChanged();
+    }
+}
+
+void Database::UnindexText(const String& id) {
+    if (m_searchOpen && m_search.Remove(id)) {
+        SearchChanged();
+    }
+}
+
+void Database::SearchChanged() {
+    if (m_searchSaved) {
+        ::DeleteFileW(m_searchPath.c_str());
+        m_searchSaved = false;
+    }
 }
 
 // ─── Add Entry ─────────────────────────────────────────────────────────────
 String Database::AddEntry(DownloadEntry& entry) {
     RecursiveLock lock(m_mutex);
+    FoldProgress();
     
     if (entry.id.empty()) {
         entry.id = DownloadEntry::GenerateId();
     }
     
-    m_entries[entry.id] = entry;
-    m_dirty = true;
-    
-    // Write journal for crash safety
-    WriteJournal(entry, L"ADD");
+    auto [it, added] = m_entries.try_emplace(entry.id);
+    DownloadEntry& stored = it->second;
+    if (!added) UnindexEntry(stored);
+    Unpublish(stored, added);
+    stored = entry;
+    IndexEntry(stored);
+    IndexText(stored);
+    m_pendingDetails.erase(&stored);
+    MarkDirty(entry.id);
+    uint64 sequence = JournalRecord(RECORD_ENTRY, stored);
     
     LOG_INFO(L"Database: added entry %s (%s)", 
              entry.id.c_str(), entry.fileName.c_str());
     
+    lock.unlock();
+    m_journal.Commit(sequence);
     return entry.id;
 }
 
 // ─── Update Entry ──────────────────────────────────────────────────────────
 bool Database::UpdateEntry(const DownloadEntry& entry) {
     RecursiveLock lock(m_mutex);
+    FoldProgress();
     
     auto it = m_entries.find(entry.id);
     if (it == m_entries.end()) {
@@ -141,46 +757,191 @@ bool Database::UpdateEntry(const DownloadEntry& entry) {
         return false;
     }
     
-    it->second = entry;
-    m_dirty = true;
+    DownloadEntry& stored = it->second;
+    UnindexEntry(stored);
+    Unpublish(stored);
+    if (entry.detailsLoaded) {
+        stored = entry;
+        m_pendingDetails.erase(&stored);
+    } else {
+        // A list copy from GetAllEntries(): the stored details stay, decoded or not
+        DownloadEntry updated = entry;
+        CopyDetailFields(stored, updated);
+        updated.detailsLoaded = stored.detailsLoaded;
+        stored = std::move(updated);
+    }
+    IndexEntry(stored);
+    IndexText(stored);
+    MarkDirty(entry.id);
+    uint64 sequence = JournalRecord(RECORD_ENTRY, stored);
     
+    lock.unlock();
+    m_journal.Commit(sequence);
     return true;
 }
 
+// ─── Patch Entry ───────────────────────────────────────────────────────────
+bool Database::UpdateFields(const String& id, const EntryPatch& patch) {
+    RecursiveLock lock(m_mutex);
+    FoldProgress();
+    
+    auto it = m_entries.find(id);
+    if (it == m_entries.end()) {
+        LOG_WARN(L"Database: update failed - entry %s not found", id.c_str());
+        return false;
+    }
+    
+    // Detail fields are compared with, and later written over, the
+    // decoded details rather than the mapped ones
+    DownloadEntry& stored = it->second;
+    if ((patch.Fields() & DETAIL_FIELDS) && !stored.detailsLoaded) {
+        LoadDetails(stored, stored);
+        m_pendingDetails.erase(&stored);
+    }
+    
+    EntryPatch changes = patch.ChangesFrom(stored);
+    uint32 fields = changes.Fields();
+    if (fields == 0) return true;
+    
+    if (fields & FIELD_STATUS) UnindexEntry(stored);
+    Unpublish(stored);
+    changes.ApplyTo(stored);
+    if (fields & FIELD_STATUS) IndexEntry(stored);
+    if (fields & (FIELD_FILE_NAME | FIELD_FINAL_URL)) IndexText(stored);
+    MarkFieldsDirty(id, fields);
+    uint64 sequence = JournalFields(stored, fields);
+    
+    lock.unlock();
+    m_journal.Commit(sequence);
+    if (m_changeListener) {
+        m_changeListener(id, changes);
+    }
+    return true;
+}
+
+void Database::SetChangeListener(ChangeListener listener) {
+    RecursiveLock lock(m_mutex);
+    m_changeListener = std::move(listener);
+}
+
 // ─── Fast Progress Update ──────────────────────────────────────────────────
 bool Database::UpdateProgress(const String& id, int64 downloadedBytes,
                               double speed, const std::vector<SegmentInfo>& segments) {
     RecursiveLock lock(m_mutex);
     
-    auto it = m_entries.find(id);
-    if (it == m_entries.end()) return false;
+    ProgressSlot* slot = FindProgressSlot(id);
+    if (!slot) return false;
+    
+    // The entry itself is left alone until someone reads or saves it
+    if (!slot->unfolded) {
+        slot->unfolded = true;
+        m_unfoldedProgress.push_back(static_cast<uint32>(slot - m_progress.data()));
+    }
+    slot->downloadedBytes = downloadedBytes;
+    slot->currentSpeed = speed;
+    slot->segments = segments;  // Same size as before: no allocation
+    slot->AddSpeed(speed);
+    m_listStale = true;
     
-    auto& entry = it->second;
-    entry.downloadedBytes = downloadedBytes;
-    entry.currentSpeed = speed;
-    entry.segments = segments;
+    MarkFieldsDirty(id, FIELD_DOWNLOADED | FIELD_SEGMENTS);
+    uint64 sequence = JournalProgress(id, *slot);
     
-    // Update speed history (keep last 60 samples = 60 seconds at 1Hz)
-    entry.speedHistory.push_back(speed);
-    if (entry.speedHistory.size() > 60) {
-        entry.speedHistory.pop_front();
+    lock.unlock();
+    m_journal.Commit(sequence);
+    return true;
+}
+
+// ─── Progress Table ────────────────────────────────────────────────────────
+void Database::ProgressSlot::AddSpeed(double speed) {
+    if (count == samples.size()) {
+        sum -= samples[next];
+    } else {
+        ++count;
     }
+    samples[next] = speed;
+    sum += speed;
     
-    // Calculate average speed
-    if (!entry.speedHistory.empty()) {
-        double sum = 0;
-        for (double s : entry.speedHistory) sum += s;
-        entry.averageSpeed = sum / entry.speedHistory.size();
+    // Re-add once per lap so rounding errors in the running sum don't build up
+    next = (next + 1) % samples.size();
+    if (next == 0) {
+        sum = std::accumulate(samples.begin(), samples.end(), 0.0);
+    }
+}
+
+Database::ProgressSlot* Database::FindProgressSlot(const String& id) {
+    auto found = m_progressSlots.find(id);
+    if (found != m_progressSlots.end()) {
+        return &m_progress[found->second];
     }
     
-    m_dirty = true;
-    return true;
+    auto it = m_entries.find(id);
+    if (it == m_entries.end()) return nullptr;
+    
+    uint32 index;
+    if (!m_freeProgressSlots.empty()) {
+        index = m_freeProgressSlots.back();
+        m_freeProgressSlots.pop_back();
+    } else {
+        index = static_cast<uint32>(m_progress.size());
+        m_progress.emplace_back();
+    }
+    // Folding writes the segments over the entry's, so its details must
+    // not be left to decode from the mapping later
+    DownloadEntry& entry = it->second;
+    if (!entry.detailsLoaded) {
+        LoadDetails(entry, entry);
+        m_pendingDetails.erase(&entry);
+    }
+    
+    ProgressSlot& slot = m_progress[index];
+    slot.entry = &entry;
+    slot.unfolded = false;
+    slot.next = 0;
+    slot.count = 0;
+    slot.sum = 0;
+    m_progressSlots.emplace(id, index);
+    return &slot;
+}
+
+void Database::ReleaseProgressSlot(const String& id) {
+    auto found = m_progressSlots.find(id);
+    if (found == m_progressSlots.end()) return;
+    // Progress not folded yet goes with the entry
+    ProgressSlot& slot = m_progress[found->second];
+    slot.entry = nullptr;
+    slot.unfolded = false;
+    m_freeProgressSlots.push_back(found->second);
+    m_progressSlots.erase(found);
+}
+
+void Database::FoldProgress() const {
+    for (uint32 index : m_unfoldedProgress) {
+        ProgressSlot& slot = m_progress[index];
+        if (!slot.unfolded) continue;  // Released since
+        
+        DownloadEntry& entry = *slot.entry;
+        Unpublish(entry);
+        entry.downloadedBytes = slot.downloadedBytes;
+        entry.currentSpeed = slot.currentSpeed;
+        entry.averageSpeed = slot.AverageSpeed();
+        entry.segments = slot.segments;
+        slot.unfolded = false;
+    }
+    m_unfoldedProgress.clear();
 }
 
 // ─── Remove Entry ──────────────────────────────────────────────────────────
 bool Database::RemoveEntry(const String& id, bool deleteFiles) {
     RecursiveLock lock(m_mutex);
+    uint64 sequence = 0;
+    if (!RemoveLocked(id, deleteFiles, sequence)) return false;
     
+    lock.unlock();
+    m_journal.Commit(sequence);
+    return true;
+}
+
+bool Database::RemoveLocked(const String& id, bool deleteFiles, uint64& sequence) {
     auto it = m_entries.find(id);
     if (it == m_entries.end()) return false;
     
@@ -201,24 +962,39 @@ bool Database::RemoveEntry(const String& id, bool deleteFiles) {
     LOG_INFO(L"Database: removed entry %s (%s)", 
              id.c_str(), it->second.fileName.c_str());
     
+    m_pendingDetails.erase(&it->second);
+    UnindexEntry(it->second);
+    Unpublish(it->second, true);
+    ReleaseProgressSlot(id);
+    UnindexText(id);
     m_entries.erase(it);
+    m_dirtyIds.erase(id);
+    m_dirtyFields.erase(id);
+    m_removedIds.push_back(id);
     m_dirty = true;
     
+    DownloadEntry removed;
+    removed.id = id;
+    sequence = JournalRecord(RECORD_REMOVE, removed);
     return true;
 }
 
 // ─── Query Methods ─────────────────────────────────────────────────────────
 std::optional<DownloadEntry> Database::GetEntry(const String& id) const {
     RecursiveLock lock(m_mutex);
+    FoldProgress();
     auto it = m_entries.find(id);
     if (it != m_entries.end()) {
-        return it->second;
+        DownloadEntry entry = it->second;
+        LoadDetails(it->second, entry);
+        return entry;
     }
     return std::nullopt;
 }
 
 std::vector<DownloadEntry> Database::GetAllEntries() const {
     RecursiveLock lock(m_mutex);
+    FoldProgress();
     std::vector<DownloadEntry> result;
     result.reserve(m_entries.size());
     for (const auto& [id, entry] : m_entries) {
@@ -227,35 +1003,127 @@ std::vector<DownloadEntry> Database::GetAllEntries() const {
     return result;
 }
 
+std::shared_ptr<const Database::EntryList> Database::GetListSnapshot() const {
+    if (!m_listStale) {
+        return std::atomic_load(&m_listSnapshot);
+    }
+    
+    RecursiveLock lock(m_mutex);
+    if (!m_listStale) return m_listSnapshot;
+    FoldProgress();
+    
+    // Unchanged entries are shared with the previous snapshot
+    std::shared_ptr<EntryList> list;
+    if (m_listSnapshot && !m_listReshaped) {
+        // Same IDs as before: replace just the changed ones
+        list = std::make_shared<EntryList>(*m_listSnapshot);
+        for (const DownloadEntry* entry : m_unpublished) {
+            auto pos = std::lower_bound(list->begin(), list->end(), entry->id,
+                [](const std::shared_ptr<const DownloadEntry>& item, const String& id) {
+                    return item->id < id;
+                });
+            *pos = m_published[entry] = std::make_shared<const DownloadEntry>(*entry);
+        }
+    } else {
+        list = std::make_shared<EntryList>();
+        list->reserve(m_entries.size());
+        for (const auto& [id, entry] : m_entries) {
+            auto& published = m_published[&entry];
+            if (!published) published = std::make_shared<const DownloadEntry>(entry);
+            list->push_back(published);
+        }
+    }
+    
+    m_unpublished.clear();
+    m_listReshaped = false;
+    std::atomic_store(&m_listSnapshot, std::shared_ptr<const EntryList>(std::move(list)));
+    m_listStale = false;
+    return m_listSnapshot;
+}
+
 std::vector<DownloadEntry> Database::GetEntriesByStatus(DownloadStatus status) const {
     RecursiveLock lock(m_mutex);
+    FoldProgress();
     std::vector<DownloadEntry> result;
-    for (const auto& [id, entry] : m_entries) {
-        if (entry.status == status) {
-            result.push_back(entry);
-        }
+    auto found = m_byStatus.find(status);
+    if (found == m_byStatus.end()) return result;
+    
+    result.reserve(found->second.size());
+    for (const DownloadEntry* entry : found->second) {
+        result.push_back(*entry);
+        LoadDetails(*entry, result.back());
     }
     return result;
 }
 
 std::vector<DownloadEntry> Database::GetEntriesByCategory(const String& category) const {
     RecursiveLock lock(m_mutex);
+    FoldProgress();
     std::vector<DownloadEntry> result;
-    for (const auto& [id, entry] : m_entries) {
-        if (entry.category == category) {
-            result.push_back(entry);
-        }
+    auto found = m_byCategory.find(category);
+    if (found == m_byCategory.end()) return result;
+    
+    result.reserve(found->second.size());
+    for (const DownloadEntry* entry : found->second) {
+        result.push_back(*entry);
+        LoadDetails(*entry, result.back());
     }
     return result;
 }
 
-int Database::GetCountByStatus(DownloadStatus status) const {
+std::vector<String> Database::GetIdsByStatus(DownloadStatus status) const {
     RecursiveLock lock(m_mutex);
-    int count = 0;
-    for (const auto& [id, entry] : m_entries) {
-        if (entry.status == status) ++count;
+    std::vector<String> result;
+    auto found = m_byStatus.find(status);
+    if (found != m_byStatus.end()) {
+        result.reserve(found->second.size());
+        for (const DownloadEntry* entry : found->second) result.push_back(entry->id);
+    }
+    return result;
+}
+
+std::vector<String> Database::GetIdsByCategory(const String& category) const {
+    RecursiveLock lock(m_mutex);
+    std::vector<String> result;
+    auto found = m_byCategory.find(category);
+    if (found != m_byCategory.end()) {
+        result.reserve(found->second.size());
+        for (const DownloadEntry* entry : found->second) result.push_back(entry->id);
     }
-    return count;
+    return result;
+}
+
+std::vector<String> Database::GetQueueIds(const String& queueId) const {
+    RecursiveLock lock(m_mutex);
+    std::vector<String> result;
+    auto found = m_byQueue.find(queueId);
+    if (found != m_byQueue.end()) {
+        result.reserve(found->second.size());
+        for (const DownloadEntry* entry : found->second) result.push_back(entry->id);
+    }
+    return result;
+}
+
+void Database::ForEachByStatus(DownloadStatus status,
+                               const std::function<void(const DownloadEntry&)>& visit) const {
+    RecursiveLock lock(m_mutex);
+    FoldProgress();
+    auto found = m_byStatus.find(status);
+    if (found == m_byStatus.end()) return;
+    for (const DownloadEntry* entry : found->second) {
+        visit(*entry);
+    }
+}
+
+std::vector<String> Database::Search(const String& query, size_t maxResults) const {
+    RecursiveLock lock(m_mutex);
+    return m_search.Search(query, maxResults);
+}
+
+int Database::GetCountByStatus(DownloadStatus status) const {
+    RecursiveLock lock(m_mutex);
+    auto found = m_byStatus.find(status);
+    return found != m_byStatus.end() ? static_cast<int>(found->second.size()) : 0;
 }
 
 int Database::GetTotalCount() const {
@@ -266,12 +1134,26 @@ int Database::GetTotalCount() const {
 // ─── Flush to Disk ─────────────────────────────────────────────────────────
 bool Database::Flush() {
     RecursiveLock lock(m_mutex);
-    if (!m_dirty) return true;
+    if (!FlushChanges()) return false;
+    
+    // Fold the log into the base file once it's a sizable part of it
+    uint64 baseBytes = m_view ? m_view->size : 0;
+    uint64 threshold = (std::max)(static_cast<uint64>(constants::DB_LOG_COMPACT_MIN_BYTES),
+                                  baseBytes * constants::DB_LOG_COMPACT_PERCENT / 100);
+    if (!m_compacting && m_logBytes >= threshold) {
+        StartCompaction();
+    }
+    return true;
+}
+
+bool Database::FlushChanges() {
+    if (!m_dirty && !m_rewrite) return true;
+    FoldProgress();
     
-    bool result = SaveToDisk();
+    bool result = m_rewrite && !m_compacting ? SaveToDisk() : AppendLog();
     if (result) {
         m_dirty = false;
-        CleanJournal();
+        m_journal.Reset();  // Everything journaled is in the log now
     }
     return result;
 }
@@ -287,89 +1169,474 @@ int Database::RemoveCompleted(bool deleteFiles) {
         }
     }
     
+    // One commit for the lot
+    uint64 sequence = 0;
     for (const auto& id : toRemove) {
-        RemoveEntry(id, deleteFiles);
+        RemoveLocked(id, deleteFiles, sequence);
     }
     
+    lock.unlock();
+    m_journal.Commit(sequence);
     return static_cast<int>(toRemove.size());
 }
 
 // ─── Disk I/O: Save ────────────────────────────────────────────────────────
 bool Database::SaveToDisk() {
+    // Changes go to the log first, so replaying it over the new base file
+    // after a crash can't roll anything back
+    if (m_hLog != INVALID_HANDLE_VALUE && !AppendLog()) return false;
+    
+    auto snapshot = TakeSnapshot();
+    if (!WriteSnapshot(*snapshot) || !InstallSnapshot(*snapshot)) return false;
+    
+    m_dirtyIds.clear();
+    m_dirtyFields.clear();
+    m_removedIds.clear();
+    m_rewrite = false;
+    return true;
+}
+
+// ─── Compaction ────────────────────────────────────────────────────────────
+void Database::StartCompaction() {
+    // Caller holds m_mutex and has just appended the log
+    m_compacting = true;
+    LOG_DEBUG(L"Database: compacting (%llu byte log)", m_logBytes);
+    
+    m_compaction = std::async(std::launch::async, [this, snapshot = TakeSnapshot()]() {
+        bool written = WriteSnapshot(*snapshot);
+        
+        RecursiveLock lock(m_mutex);
+        if (!written || !InstallSnapshot(*snapshot)) {
+            LOG_WARN(L"Database: compaction failed, keeping the log");
+        }
+        m_compacting = false;
+    });
+}
+
+std::unique_ptr<Database::Snapshot> Database::TakeSnapshot() const {
+    FoldProgress();
+    auto snapshot = std::make_unique<Snapshot>();
+    snapshot->view = m_view;
+    snapshot->logOffset = m_logBytes;
+    snapshot->entries.reserve(m_entries.size());
+    snapshot->details.reserve(m_entries.size());
+    
+    for (const auto& [id, entry] : m_entries) {
+        auto pending = m_pendingDetails.find(&entry);
+        if (pending != m_pendingDetails.end()) {
+            snapshot->pending.emplace_back(&entry, snapshot->entries.size());
+            snapshot->details.push_back(pending->second);
+        } else {
+            snapshot->details.push_back({0, 0});
+        }
+        snapshot->entries.push_back(entry);
+    }
+    return snapshot;
+}
+
+bool Database::WriteSnapshot(Snapshot& snapshot) const {
     // Write to a temporary file first, then atomic rename
     // This prevents corruption if the process is killed during write
     String tempPath = m_dbPath + L".tmp";
     
-    try {
-        std::wofstream file(tempPath, std::ios::out | std::ios::trunc);
-        if (!file.is_open()) {
-            LOG_ERROR(L"Failed to open database temp file for writing");
-            return false;
+    // Undecoded details are copied from the mapping; without it they'd be lost
+    if (!snapshot.pending.empty() && !snapshot.view) {
+        LOG_ERROR(L"Database: %s is not mapped, not saving", m_dbPath.c_str());
+        return false;
+    }
+    
+    HANDLE hFile = ::CreateFileW(tempPath.c_str(), GENERIC_WRITE, 0, nullptr,
+                                 CREATE_ALWAYS, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        LOG_ERROR(L"Failed to open database temp file for writing (error %lu)", ::GetLastError());
+        return false;
+    }
+    
+    std::vector<uint8> buffer;
+    buffer.reserve(WRITE_CHUNK + 64 * 1024);
+    uint64 written = 0;
+    bool ok = true;
+    
+    auto writeBuffer = [&]() {
+        DWORD done = 0;
+        ok = ok && ::WriteFile(hFile, buffer.data(), static_cast<DWORD>(buffer.size()), &done, nullptr) &&
+             done == buffer.size();
+        written += buffer.size();
+        buffer.clear();
+    };
+    
+    // Pass 1: header placeholder and records. Detail lengths come from a
+    // scratch encoding, so the heap can be streamed in pass 2.
+    FileHeader header{};
+    memcpy(header.magic, DB_MAGIC, sizeof(DB_MAGIC));
+    header.version = DB_VERSION;
+    header.headerSize = sizeof(FileHeader);
+    header.recordCount = snapshot.entries.size();
+    buffer.resize(sizeof(FileHeader));
+    
+    snapshot.moved.clear();
+    snapshot.moved.reserve(snapshot.pending.size());
+    std::vector<uint8> scratch;
+    
+    for (size_t i = 0; i < snapshot.entries.size(); ++i) {
+        uint32 detailLength = snapshot.details[i].length;
+        if (detailLength > 0) {
+            snapshot.moved.push_back({header.detailsLength, detailLength});
+        } else {
+            scratch.clear();
+            PutDetailFields(scratch, snapshot.entries[i]);
+            detailLength = static_cast<uint32>(scratch.size());
         }
         
-        // Simple text-based format: one entry per block, delimited by markers
-        file << L"IDMCLONE_DB_V1\n";
-        file << L"ENTRY_COUNT=" << m_entries.size() << L"\n";
-        file << L"---\n";
-        
-        for (const auto& [id, entry] : m_entries) {
-            file << L"BEGIN_ENTRY\n";
-            file << L"id=" << entry.id << L"\n";
-            file << L"url=" << entry.url << L"\n";
-            file << L"finalUrl=" << entry.finalUrl << L"\n";
-            file << L"fileName=" << entry.fileName << L"\n";
-            file << L"savePath=" << entry.savePath << L"\n";
-            file << L"fileSize=" << entry.fileSize << L"\n";
-            file << L"downloadedBytes=" << entry.downloadedBytes << L"\n";
-            file << L"status=" << static_cast<int>(entry.status) << L"\n";
-            file << L"category=" << entry.category << L"\n";
-            file << L"description=" << entry.description << L"\n";
-            file << L"referrer=" << entry.referrer << L"\n";
-            file << L"userAgent=" << entry.userAgent << L"\n";
-            file << L"numConnections=" << entry.numConnections << L"\n";
-            file << L"resumeSupported=" << (entry.resumeSupported ? 1 : 0) << L"\n";
-            file << L"etag=" << entry.etag << L"\n";
-            file << L"lastModified=" << entry.lastModified << L"\n";
-            file << L"errorMessage=" << entry.errorMessage << L"\n";
-            file << L"retryCount=" << entry.retryCount << L"\n";
-            file << L"queueId=" << entry.queueId << L"\n";
-            file << L"checksum=" << entry.checksum << L"\n";
-            file << L"checksumType=" << entry.checksumType << L"\n";
-            
-            // Segments
-            file << L"segmentCount=" << entry.segments.size() << L"\n";
-            for (const auto& seg : entry.segments) {
-                file << L"seg=" << seg.startByte << L"," 
-                     << seg.endByte << L"," 
-                     << seg.downloadedBytes << L","
-                     << seg.connectionId << L","
-                     << (seg.complete ? 1 : 0) << L"\n";
-            }
-            
-            file << L"END_ENTRY\n";
+        SerializeEntry(snapshot.entries[i], header.detailsLength, detailLength, buffer);
+        header.detailsLength += detailLength;
+        if (buffer.size() >= WRITE_CHUNK) writeBuffer();
+    }
+    writeBuffer();
+    header.recordsLength = written - sizeof(FileHeader);
+    
+    // Pass 2: detail heap, in the same order. Undecoded details are copied
+    // as they are.
+    for (size_t i = 0; i < snapshot.entries.size(); ++i) {
+        const DetailRef& ref = snapshot.details[i];
+        if (ref.length > 0) {
+            const uint8* details = snapshot.view->data + ref.offset;
+            buffer.insert(buffer.end(), details, details + ref.length);
+        } else {
+            PutDetailFields(buffer, snapshot.entries[i]);
         }
-        
-        file << L"END_DB\n";
-        file.close();
-        
-        // Atomic rename (on Windows, MoveFileEx with REPLACE_EXISTING)
-        if (!::MoveFileExW(tempPath.c_str(), m_dbPath.c_str(), 
-                           MOVEFILE_REPLACE_EXISTING)) {
-            // Fallback: delete then rename
-            ::DeleteFileW(m_dbPath.c_str());
-            ::MoveFileW(tempPath.c_str(), m_dbPath.c_str());
+        if (buffer.size() >= WRITE_CHUNK) writeBuffer();
+    }
+    writeBuffer();
+    ok = ok && written == sizeof(FileHeader) + header.recordsLength + header.detailsLength;
+    
+    buffer.assign(reinterpret_cast<const uint8*>(&header),
+                  reinterpret_cast<const uint8*>(&header) + sizeof(header));
+    LARGE_INTEGER start{};
+    ok = ok && ::SetFilePointerEx(hFile, start, nullptr, FILE_BEGIN);
+    writeBuffer();
+    ok = ok && ::FlushFileBuffers(hFile);
+    ::CloseHandle(hFile);
+    
+    if (!ok) {
+        LOG_ERROR(L"Database save failed (error %lu)", ::GetLastError());
+        ::DeleteFileW(tempPath.c_str());
+        return false;
+    }
+    
+    uint64 heapStart = sizeof(FileHeader) + header.recordsLength;
+    for (DetailRef& ref : snapshot.moved) {
+        ref.offset += heapStart;
+    }
+    return true;
+}
+
+bool Database::InstallSnapshot(Snapshot& snapshot) {
+    String tempPath = m_dbPath + L".tmp";
+    
+    // A mapped file can't be replaced, so the old view goes first
+    snapshot.view.reset();
+    m_view.reset();
+    if (!::MoveFileExW(tempPath.c_str(), m_dbPath.c_str(),
+                       MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+        LOG_ERROR(L"Database: cannot replace %s (error %lu)", m_dbPath.c_str(), ::GetLastError());
+        ::DeleteFileW(tempPath.c_str());
+        m_view = MappedView::Open(m_dbPath);
+        return false;
+    }
+    
+    // Entries still undecoded (not changed or removed since the snapshot)
+    // now point into the new file
+    m_view = MappedView::Open(m_dbPath);
+    for (size_t k = 0; k < snapshot.pending.size(); ++k) {
+        auto pending = m_pendingDetails.find(snapshot.pending[k].first);
+        if (pending != m_pendingDetails.end()) {
+            pending->second = snapshot.moved[k];
         }
-        
-        return true;
     }
-    catch (const std::exception& e) {
-        LOG_ERROR(L"Database save failed: %S", e.what());
+    if (!m_view && !m_pendingDetails.empty()) {
+        LOG_ERROR(L"Database: cannot map %s (error %lu)", m_dbPath.c_str(), ::GetLastError());
+    }
+    
+    // The log up to the snapshot is in the base file now
+    return TrimLog(snapshot.logOffset);
+}
+
+// ─── Record Log ────────────────────────────────────────────────────────────
+bool Database::OpenLog() {
+    m_hLog = ::CreateFileW(m_logPath.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ,
+                           nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (m_hLog == INVALID_HANDLE_VALUE) {
+        LOG_ERROR(L"Database: cannot open log %s (error %lu)", m_logPath.c_str(), ::GetLastError());
         return false;
     }
+    
+    if (m_logBytes < sizeof(LogHeader)) {
+        LogHeader header{};
+        memcpy(header.magic, LOG_MAGIC, sizeof(LOG_MAGIC));
+        header.version = DB_VERSION;
+        DWORD written = 0;
+        LARGE_INTEGER start{};
+        if (!::SetFilePointerEx(m_hLog, start, nullptr, FILE_BEGIN) ||
+            !::WriteFile(m_hLog, &header, sizeof(header), &written, nullptr)) {
+            LOG_ERROR(L"Database: cannot write log header (error %lu)", ::GetLastError());
+            CloseLog();
+            return false;
+        }
+        m_logBytes = sizeof(header);
+    }
+    
+    // Cut a torn record left by a crash, so appends follow the last good one
+    LARGE_INTEGER end;
+    end.QuadPart = static_cast<LONGLONG>(m_logBytes);
+    ::SetFilePointerEx(m_hLog, end, nullptr, FILE_BEGIN);
+    ::SetEndOfFile(m_hLog);
+    return true;
+}
+
+void Database::CloseLog() {
+    if (m_hLog != INVALID_HANDLE_VALUE) {
+        ::CloseHandle(m_hLog);
+        m_hLog = INVALID_HANDLE_VALUE;
+    }
+}
+
+bool Database::AppendLog() {
+    if (m_dirtyIds.empty() && m_dirtyFields.empty() && m_removedIds.empty()) return true;
+    if (m_hLog == INVALID_HANDLE_VALUE && !OpenLog()) return false;
+    
+    std::vector<uint8> buffer;
+    for (const String& id : m_removedIds) {
+        DownloadEntry removed;
+        removed.id = id;
+        SerializeLogRecord(RECORD_REMOVE, removed, nullptr, 0, buffer);
+    }
+    for (const String& id : m_dirtyIds) {
+        auto it = m_entries.find(id);
+        if (it != m_entries.end() && !SerializeStored(RECORD_ENTRY, it->second, buffer)) {
+            return false;
+        }
+    }
+    for (const auto& [id, fields] : m_dirtyFields) {
+        auto it = m_entries.find(id);
+        if (it != m_entries.end()) {
+            SerializeFields(it->second, fields, buffer);
+        }
+    }
+    
+    LARGE_INTEGER end;
+    end.QuadPart = static_cast<LONGLONG>(m_logBytes);
+    DWORD written = 0;
+    bool ok = ::SetFilePointerEx(m_hLog, end, nullptr, FILE_BEGIN) &&
+              ::WriteFile(m_hLog, buffer.data(), static_cast<DWORD>(buffer.size()), &written, nullptr) &&
+              written == buffer.size() &&
+              ::FlushFileBuffers(m_hLog);
+    if (!ok) {
+        // Don't leave part of a record for the next append to follow
+        LOG_ERROR(L"Database: log append failed (error %lu)", ::GetLastError());
+        ::SetFilePointerEx(m_hLog, end, nullptr, FILE_BEGIN);
+        ::SetEndOfFile(m_hLog);
+        return false;
+    }
+    
+    m_logBytes += buffer.size();
+    m_dirtyIds.clear();
+    m_dirtyFields.clear();
+    m_removedIds.clear();
+    return true;
+}
+
+bool Database::TrimLog(uint64 offset) {
+    // Records appended after 'offset' (during a compaction) are kept
+    std::vector<uint8> tail;
+    if (m_hLog != INVALID_HANDLE_VALUE && offset < m_logBytes) {
+        tail.resize(static_cast<size_t>(m_logBytes - offset));
+        LARGE_INTEGER start;
+        start.QuadPart = static_cast<LONGLONG>(offset);
+        DWORD read = 0;
+        if (!::SetFilePointerEx(m_hLog, start, nullptr, FILE_BEGIN) ||
+            !::ReadFile(m_hLog, tail.data(), static_cast<DWORD>(tail.size()), &read, nullptr) ||
+            read != tail.size()) {
+            LOG_ERROR(L"Database: cannot read log tail (error %lu)", ::GetLastError());
+            return false;
+        }
+    }
+    
+    // Write the new log beside the old one, then swap
+    String tempPath = m_logPath + L".tmp";
+    HANDLE hFile = ::CreateFileW(tempPath.c_str(), GENERIC_WRITE, 0, nullptr,
+                                 CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        LOG_ERROR(L"Database: cannot create %s (error %lu)", tempPath.c_str(), ::GetLastError());
+        return false;
+    }
+    
+    LogHeader header{};
+    memcpy(header.magic, LOG_MAGIC, sizeof(LOG_MAGIC));
+    header.version = DB_VERSION;
+    DWORD written = 0;
+    bool ok = ::WriteFile(hFile, &header, sizeof(header), &written, nullptr) &&
+              (tail.empty() ||
+               ::WriteFile(hFile, tail.data(), static_cast<DWORD>(tail.size()), &written, nullptr)) &&
+              ::FlushFileBuffers(hFile);
+    ::CloseHandle(hFile);
+    
+    CloseLog();
+    if (!ok || !::MoveFileExW(tempPath.c_str(), m_logPath.c_str(),
+                              MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+        LOG_ERROR(L"Database: cannot replace %s (error %lu)", m_logPath.c_str(), ::GetLastError());
+        ::DeleteFileW(tempPath.c_str());
+        OpenLog();
+        return false;
+    }
+    
+    m_logBytes = sizeof(header) + tail.size();
+    return OpenLog();
+}
+
+bool Database::ReplayLog() {
+    m_logBytes = 0;
+    auto log = MappedView::Open(m_logPath);
+    if (!log) return true;
+    
+    // An unreadable log is set aside rather than replayed or overwritten
+    LogHeader header{};
+    if (log->size >= sizeof(header)) {
+        memcpy(&header, log->data, sizeof(header));
+    }
+    if (memcmp(header.magic, LOG_MAGIC, sizeof(LOG_MAGIC)) != 0) {
+        LOG_ERROR(L"Database: %s is not a database log, moving it aside", m_logPath.c_str());
+        log.reset();
+        ::MoveFileExW(m_logPath.c_str(), (m_logPath + L".bad").c_str(), MOVEFILE_REPLACE_EXISTING);
+        return true;
+    }
+    
+    size_t pos = sizeof(header);
+    int replayed = 0;
+    while (log->size - pos >= sizeof(RecordHeader)) {
+        RecordHeader record;
+        memcpy(&record, log->data + pos, sizeof(record));
+        size_t length = sizeof(record) + record.length;
+        if (record.length > log->size - pos - sizeof(record)) break;
+        
+        if (!ApplyRecord(log->data + pos, length).empty()) ++replayed;
+        pos += length;
+    }
+    
+    if (pos != log->size) {
+        LOG_WARN(L"Database: dropping %llu bytes of torn log records",
+                 static_cast<uint64>(log->size - pos));
+    }
+    LOG_INFO(L"Database: replayed %d log records", replayed);
+    m_logBytes = pos;
+    return true;
 }
 
 // ─── Disk I/O: Load ────────────────────────────────────────────────────────
 bool Database::LoadFromDisk() {
+    auto view = MappedView::Open(m_dbPath);
+    if (!view) {
+        LOG_ERROR(L"Cannot map database file (error %lu)", ::GetLastError());
+        return false;
+    }
+    
+    size_t v1MagicLength = sizeof(DB_V1_MAGIC) - 1;
+    if (view->size >= v1MagicLength && memcmp(view->data, DB_V1_MAGIC, v1MagicLength) == 0) {
+        view.reset();
+        return MigrateFromV1();
+    }
+    return LoadBinary(std::move(view)) && ReplayLog();
+}
+
+bool Database::LoadBinary(std::shared_ptr<MappedView> view) {
+    FileHeader header;
+    if (view->size < sizeof(header)) {
+        LOG_ERROR(L"Database file is truncated (%llu bytes)", static_cast<uint64>(view->size));
+        return false;
+    }
+    memcpy(&header, view->data, sizeof(header));
+    
+    if (memcmp(header.magic, DB_MAGIC, sizeof(DB_MAGIC)) != 0) {
+        LOG_ERROR(L"Invalid database format");
+        return false;
+    }
+    if (header.version > DB_VERSION) {
+        LOG_ERROR(L"Database version %u is newer than this build supports (%u)",
+                  header.version, DB_VERSION);
+        return false;
+    }
+    if (header.headerSize < sizeof(header) || header.headerSize > view->size ||
+        header.recordsLength > view->size - header.headerSize ||
+        header.detailsLength > view->size - header.headerSize - header.recordsLength) {
+        LOG_ERROR(L"Database file is truncated (%llu bytes)", static_cast<uint64>(view->size));
+        return false;
+    }
+    
+    // Only the records are read here; the detail heap is touched on demand
+    const uint8* base = view->data;
+    size_t pos = header.headerSize;
+    size_t end = pos + static_cast<size_t>(header.recordsLength);
+    uint64 heapStart = end;
+    m_pendingDetails.reserve(static_cast<size_t>(
+        (std::min)(header.recordCount, header.recordsLength / sizeof(RecordHeader))));
+    
+    while (end - pos >= sizeof(RecordHeader)) {
+        RecordHeader record;
+        memcpy(&record, base + pos, sizeof(record));
+        size_t length = sizeof(record) + record.length;
+        if (record.length > end - pos - sizeof(record)) break;
+        
+        DownloadEntry entry = DeserializeEntry(base + pos, length);
+        pos += length;
+        if (entry.id.empty()) continue;
+        
+        bool hasDetails = record.detailLength > 0;
+        if (hasDetails && (record.detailOffset > header.detailsLength ||
+                           record.detailLength > header.detailsLength - record.detailOffset)) {
+            LOG_WARN(L"Database: details of %s are out of range", entry.id.c_str());
+            hasDetails = false;
+        }
+        entry.detailsLoaded = !hasDetails;
+        
+        // Records are in ID order, so this appends
+        size_t count = m_entries.size();
+        auto it = m_entries.emplace_hint(m_entries.end(), entry.id, std::move(entry));
+        if (hasDetails && m_entries.size() > count) {
+            m_pendingDetails[&it->second] = {heapStart + record.detailOffset, record.detailLength};
+        }
+    }
+    
+    if (pos != end) {
+        LOG_WARN(L"Database: damaged record at offset %llu, kept %d entries",
+                 static_cast<uint64>(pos), static_cast<int>(m_entries.size()));
+        m_rewrite = true;
+    }
+    
+    m_view = std::move(view);
+    RebuildIndexes();
+    m_listReshaped = true;
+    m_listStale = true;
+    return true;
+}
+
+bool Database::MigrateFromV1() {
+    if (!LoadTextV1()) return false;
+    
+    String backupPath = m_dbPath + L".v1.bak";
+    if (!::CopyFileW(m_dbPath.c_str(), backupPath.c_str(), FALSE)) {
+        LOG_WARN(L"Database: cannot back up V1 database (error %lu)", ::GetLastError());
+    }
+    
+    m_rewrite = true;
+    if (Flush()) {
+        LOG_INFO(L"Database: converted %d entries to format V%u",
+                 static_cast<int>(m_entries.size()), DB_VERSION);
+    }
+    return true;
+}
+
+// Version 1: the text format used before the binary one
+bool Database::LoadTextV1() {
     try {
         std::wifstream file(m_dbPath);
         if (!file.is_open()) return false;
@@ -435,6 +1702,7 @@ bool Database::LoadFromDisk() {
             else if (key == L"errorMessage") currentEntry.errorMessage = value;
             else if (key == L"retryCount") currentEntry.retryCount = std::stoi(value);
             else if (key == L"queueId") currentEntry.queueId = value;
+            else if (key == L"trafficClass") currentEntry.trafficClass = static_cast<TrafficClass>(std::stoi(value));
             else if (key == L"checksum") currentEntry.checksum = value;
             else if (key == L"checksumType") currentEntry.checksumType = value;
             else if (key == L"seg") {
@@ -450,6 +1718,9 @@ bool Database::LoadFromDisk() {
             }
         }
         
+        RebuildIndexes();
+        m_listReshaped = true;
+        m_listStale = true;
         return true;
     }
     catch (const std::exception& e) {
@@ -458,44 +1729,205 @@ bool Database::LoadFromDisk() {
     }
 }
 
-// ─── Journal Operations ────────────────────────────────────────────────────
-bool Database::WriteJournal(const DownloadEntry& entry, const String& operation) {
-    try {
-        std::wofstream journal(m_journalPath, std::ios::out | std::ios::app);
-        if (!journal.is_open()) return false;
-        
-        journal << operation << L"|" << entry.id << L"|" 
-                << entry.fileName << L"\n";
-        journal.flush();
-        return true;
+// ─── Journal ───────────────────────────────────────────────────────────────
+uint64 Database::JournalRecord(uint16 type, const DownloadEntry& stored) {
+    std::vector<uint8> record;
+    if (!SerializeStored(type, stored, record)) return 0;
+    return m_journal.Append(record);
+}
+
+uint64 Database::JournalFields(const DownloadEntry& stored, uint32 fields) {
+    std::vector<uint8> record;
+    SerializeFields(stored, fields, record);
+    return m_journal.Append(record);
+}
+
+uint64 Database::JournalProgress(const String& id, const ProgressSlot& slot) {
+    std::vector<uint8> record(sizeof(RecordHeader));
+    PutString(record, TAG_ID, id);
+    PutInt(record, TAG_DOWNLOADED, slot.downloadedBytes);
+    PutSegments(record, slot.segments);
+    
+    RecordHeader header{};
+    header.length = static_cast<uint32>(record.size() - sizeof(header));
+    header.type = RECORD_PROGRESS;
+    memcpy(record.data(), &header, sizeof(header));
+    return m_journal.Append(record);
+}
+
+String Database::ApplyRecord(const uint8* data, size_t length) {
+    DownloadEntry entry = DeserializeEntry(data, length);
+    if (entry.id.empty()) return entry.id;
+    RecordHeader record;
+    memcpy(&record, data, sizeof(record));
+    
+    String id = entry.id;
+    auto it = m_entries.find(id);
+    if (record.type == RECORD_PROGRESS) {
+        if (it == m_entries.end()) return String();
+        DownloadEntry& stored = it->second;
+        Unpublish(stored);
+        LoadDetails(stored, stored);
+        m_pendingDetails.erase(&stored);
+        stored.downloadedBytes = entry.downloadedBytes;
+        stored.segments = std::move(entry.segments);
+        return id;
     }
-    catch (...) {
-        return false;
+    if (record.type == RECORD_FIELDS) {
+        // Decoded over the stored entry, so only the fields present change
+        if (it == m_entries.end()) return String();
+        DownloadEntry& stored = it->second;
+        UnindexEntry(stored);
+        Unpublish(stored);
+        LoadDetails(stored, stored);
+        m_pendingDetails.erase(&stored);
+        DecodeFields(data + sizeof(record), record.length, stored);
+        IndexEntry(stored);
+        IndexText(stored);
+        return id;
+    }
+    
+    if (it != m_entries.end()) {
+        m_pendingDetails.erase(&it->second);
+        UnindexEntry(it->second);
+        Unpublish(it->second, record.type == RECORD_REMOVE);
+    }
+    if (record.type == RECORD_REMOVE) {
+        if (it != m_entries.end()) {
+            ReleaseProgressSlot(id);
+            UnindexText(id);
+            m_entries.erase(it);
+        }
+    } else if (it != m_entries.end()) {
+        it->second = std::move(entry);
+        IndexEntry(it->second);
+        IndexText(it->second);
+    } else {
+        DownloadEntry& added = m_entries.emplace(id, std::move(entry)).first->second;
+        IndexEntry(added);
+        IndexText(added);
+        Unpublish(added, true);
     }
+    return id;
 }
 
-bool Database::ReplayJournal() {
-    // For our simple implementation, we just ensure the main DB is 
-    // re-saved after loading. The journal serves as a flag that a
-    // write was in progress.
-    LOG_INFO(L"Journal replay: triggering full database resave");
+// ─── Detail Fields ─────────────────────────────────────────────────────────
+void Database::LoadDetails(const DownloadEntry& stored, DownloadEntry& entry) const {
+    if (entry.detailsLoaded) return;
+    
+    auto pending = m_pendingDetails.find(&stored);
+    if (pending == m_pendingDetails.end()) {
+        entry.detailsLoaded = true;
+    } else if (m_view) {
+        DecodeFields(m_view->data + pending->second.offset, pending->second.length, entry);
+        entry.detailsLoaded = true;
+    }
+}
+
+// ─── Serialization ─────────────────────────────────────────────────────────
+void Database::SerializeEntry(const DownloadEntry& entry, uint64 detailOffset,
+                              uint32 detailLength, std::vector<uint8>& out) const {
+    size_t start = out.size();
+    out.resize(start + sizeof(RecordHeader));
+    PutListFields(out, entry);
+    
+    RecordHeader record{};
+    record.length = static_cast<uint32>(out.size() - start - sizeof(record));
+    record.type = RECORD_ENTRY;
+    record.detailOffset = detailOffset;
+    record.detailLength = detailLength;
+    memcpy(out.data() + start, &record, sizeof(record));
+}
+
+bool Database::SerializeStored(uint16 type, const DownloadEntry& stored,
+                               std::vector<uint8>& out) const {
+    const uint8* details = nullptr;
+    uint32 detailLength = 0;
+    auto pending = m_pendingDetails.find(&stored);
+    if (type == RECORD_ENTRY && pending != m_pendingDetails.end()) {
+        if (!m_view) {
+            LOG_ERROR(L"Database: %s is not mapped, not saving", m_dbPath.c_str());
+            return false;
+        }
+        details = m_view->data + pending->second.offset;
+        detailLength = pending->second.length;
+    }
+    SerializeLogRecord(type, stored, details, detailLength, out);
     return true;
 }
 
-void Database::CleanJournal() {
-    std::error_code ec;
-    std::filesystem::remove(m_journalPath, ec);
+void Database::SerializeLogRecord(uint16 type, const DownloadEntry& entry, const uint8* details,
+                                  uint32 detailLength, std::vector<uint8>& out) const {
+    size_t start = out.size();
+    out.resize(start + sizeof(RecordHeader));
+    
+    if (type == RECORD_REMOVE) {
+        PutString(out, TAG_ID, entry.id);
+    } else {
+        PutListFields(out, entry);
+        if (details) {
+            out.insert(out.end(), details, details + detailLength);
+        } else {
+            PutDetailFields(out, entry);
+        }
+    }
+    
+    RecordHeader record{};
+    record.length = static_cast<uint32>(out.size() - start - sizeof(record));
+    record.type = type;
+    record.flags = type == RECORD_ENTRY ? RECORD_INLINE_DETAILS : 0;
+    memcpy(out.data() + start, &record, sizeof(record));
 }
 
-// ─── Serialization (for future binary format) ──────────────────────────────
-std::vector<uint8> Database::SerializeEntry(const DownloadEntry& /*entry*/) const {
-    // Reserved for binary format implementation
-    return {};
+void Database::SerializeFields(const DownloadEntry& entry, uint32 fields,
+                               std::vector<uint8>& out) const {
+    size_t start = out.size();
+    out.resize(start + sizeof(RecordHeader));
+    
+    // Selected fields are present even when empty: decoding over the
+    // stored entry then clears them
+    PutString(out, TAG_ID, entry.id);
+    if (fields & FIELD_STATUS)          PutInt(out, TAG_STATUS, static_cast<int64>(entry.status));
+    if (fields & FIELD_ERROR_MESSAGE)   PutStringOrEmpty(out, TAG_ERROR_MESSAGE, entry.errorMessage);
+    if (fields & FIELD_FILE_NAME)       PutStringOrEmpty(out, TAG_FILE_NAME, entry.fileName);
+    if (fields & FIELD_FILE_SIZE)       PutInt(out, TAG_FILE_SIZE, entry.fileSize);
+    if (fields & FIELD_DOWNLOADED)      PutInt(out, TAG_DOWNLOADED, entry.downloadedBytes);
+    if (fields & FIELD_DATE_COMPLETED)  PutTime(out, TAG_DATE_COMPLETED, entry.dateCompleted);
+    if (fields & FIELD_RESUME)          PutInt(out, TAG_RESUME, entry.resumeSupported ? 1 : 0);
+    if (fields & FIELD_FINAL_URL)       PutStringOrEmpty(out, TAG_FINAL_URL, entry.finalUrl);
+    if (fields & FIELD_CONTENT_TYPE)    PutStringOrEmpty(out, TAG_CONTENT_TYPE, entry.contentType);
+    if (fields & FIELD_ETAG)            PutStringOrEmpty(out, TAG_ETAG, entry.etag);
+    if (fields & FIELD_LAST_MODIFIED)   PutStringOrEmpty(out, TAG_LAST_MODIFIED, entry.lastModified);
+    if (fields & FIELD_SEGMENTS) {
+        if (entry.segments.empty()) {
+            PutField(out, TAG_SEGMENTS, nullptr, 0);
+        } else {
+            PutSegments(out, entry.segments);
+        }
+    }
+    
+    RecordHeader record{};
+    record.length = static_cast<uint32>(out.size() - start - sizeof(record));
+    record.type = RECORD_FIELDS;
+    memcpy(out.data() + start, &record, sizeof(record));
 }
 
-DownloadEntry Database::DeserializeEntry(const uint8* /*data*/, size_t /*length*/) const {
-    // Reserved for binary format implementation
-    return {};
+DownloadEntry Database::DeserializeEntry(const uint8* data, size_t length) const {
+    // Anything but a valid record yields an entry with an empty ID. For a
+    // removal only the ID is set, for a progress or fields record only
+    // the fields it holds.
+    DownloadEntry entry;
+    RecordHeader record;
+    if (length < sizeof(record)) return entry;
+    memcpy(&record, data, sizeof(record));
+    
+    if ((record.type != RECORD_ENTRY && record.type != RECORD_REMOVE &&
+         record.type != RECORD_PROGRESS && record.type != RECORD_FIELDS) ||
+        record.length > length - sizeof(record) ||
+        !DecodeFields(data + sizeof(record), record.length, entry)) {
+        entry.id.clear();
+    }
+    return entry;
 }
 
 } // namespace idm
@@ -11,23 +11,44 @@
  *   3. Append-only inserts (new downloads)
  *   4. Occasional deletes (user removes completed downloads)
  *
- * The database file format:
- *   [Header: 64 bytes]
+ * The database file format (version 2):
+ *   [Header: 64 bytes]          magic, version, record count, region sizes
  *   [Record 1: variable length]
  *   [Record 2: variable length]
  *   ...
+ *   [Detail heap]
  *
  * Each record is self-describing with a length prefix and type tag,
- * enabling forward compatibility when fields are added.
+ * enabling forward compatibility when fields are added. Its fields are
+ * tagged and length-prefixed too (unknown tags are skipped), split in
+ * two groups:
  *
- * For crash safety, we use a write-ahead approach: changes are first
- * written to a .journal file, then applied to the main database,
- * then the journal is deleted. On startup, if a journal exists,
- * it's replayed to recover from a crash during write.
+ *   - List fields, in the record: what the download list shows and the
+ *     engine scans (id, names, sizes, status, queue). Decoded at startup.
+ *   - Detail fields, in the detail heap: request metadata, validators,
+ *     error text, segment map. Left in the memory-mapped file and decoded
+ *     the first time the entry is fetched on its own, so startup neither
+ *     reads nor parses the strings nobody looks at.
+ *
+ * Version 1 databases (the "IDMCLONE_DB_V1" text format) are converted
+ * on first load; the old file is kept as <db>.v1.bak.
+ *
+ * Every change is also committed to <db>.journal (see Journal.h) before
+ * the call returns. Flushes append the changed entries to <db>.log and
+ * empty the journal; on startup the log is replayed over the base file
+ * and the journal over both. A background compaction folds the log back
+ * into the base file when it grows.
+ *
+ * The search index (see SearchIndex.h) is kept in step with the entries
+ * and saved to <db>.search on Close. The file is deleted as soon as the
+ * index changes, so one that exists always matches the base file and log
+ * it was saved with; otherwise the index is rebuilt on Open.
  */
 
 #pragma once
 #include "stdafx.h"
+#include "Journal.h"
+#include "SearchIndex.h"
 
 namespace idm {
 
@@ -43,6 +64,12 @@ enum class DownloadStatus : int {
     Merging      = 7    // Assembling segments
 };
 
+// ─── Traffic Class ─────────────────────────────────────────────────────────
+enum class TrafficClass : int {
+    Normal       = 0,
+    Background   = 1    // Only uses idle bandwidth (Scavenger)
+};
+
 // ─── Segment State ─────────────────────────────────────────────────────────
 struct SegmentInfo {
     int64   startByte;      // Start position in the file
@@ -118,6 +145,7 @@ struct DownloadEntry {
     // Queue association
     String              queueId;
     int                 queuePosition;
+    TrafficClass        trafficClass;   // Background queues also run as Background
     
     // Integrity
     String              checksum;       // Expected hash (if known)
@@ -125,8 +153,11 @@ struct DownloadEntry {
     
     // Speed tracking
     double              currentSpeed;   // bytes/sec
-    double              averageSpeed;
-    std::deque<double>  speedHistory;   // Last 60 seconds of speed samples
+    double              averageSpeed;   // Over the last SPEED_HISTORY_SAMPLES samples
+    
+    // False for entries from Database::GetAllEntries() whose detail fields
+    // (request metadata, validators, segments) were not decoded yet
+    bool                detailsLoaded;
     
     // Constructor with sensible defaults
     DownloadEntry() 
@@ -138,8 +169,10 @@ struct DownloadEntry {
         , retryCount(0)
         , maxRetries(constants::DEFAULT_RETRY_COUNT)
         , queuePosition(-1)
+        , trafficClass(TrafficClass::Normal)
         , currentSpeed(0.0)
         , averageSpeed(0.0) 
+        , detailsLoaded(true)
     {
         dateAdded = SystemClock::now();
     }
@@ -172,16 +205,69 @@ struct DownloadEntry {
     }
 };
 
+// ─── Entry Patch ───────────────────────────────────────────────────────────
+// Fields that Database::UpdateFields() can change, as bit flags
+enum EntryField : uint32 {
+    FIELD_STATUS            = 1 << 0,
+    FIELD_ERROR_MESSAGE     = 1 << 1,
+    FIELD_FILE_NAME         = 1 << 2,
+    FIELD_FILE_SIZE         = 1 << 3,
+    FIELD_DOWNLOADED        = 1 << 4,
+    FIELD_DATE_COMPLETED    = 1 << 5,
+    FIELD_RESUME            = 1 << 6,
+    FIELD_FINAL_URL         = 1 << 7,
+    FIELD_CONTENT_TYPE      = 1 << 8,
+    FIELD_ETAG              = 1 << 9,
+    FIELD_LAST_MODIFIED     = 1 << 10,
+    FIELD_SEGMENTS          = 1 << 11
+};
+
+// A change to some fields of an entry. Only the fields that are set are
+// written; the rest of the stored entry stays as it is.
+struct EntryPatch {
+    std::optional<DownloadStatus>           status;
+    std::optional<String>                   errorMessage;
+    std::optional<String>                   fileName;
+    std::optional<int64>                    fileSize;
+    std::optional<int64>                    downloadedBytes;
+    std::optional<SystemTimePoint>          dateCompleted;
+    std::optional<bool>                     resumeSupported;
+    std::optional<String>                   finalUrl;
+    std::optional<String>                   contentType;
+    std::optional<String>                   etag;
+    std::optional<String>                   lastModified;
+    std::optional<std::vector<SegmentInfo>> segments;
+    
+    // The given fields (EntryField bits) of 'entry'
+    static EntryPatch From(const DownloadEntry& entry, uint32 fields);
+    
+    // EntryField bits of the fields that are set
+    uint32 Fields() const;
+    
+    // The fields whose value differs from 'entry'
+    EntryPatch ChangesFrom(const DownloadEntry& entry) const;
+    
+    void ApplyTo(DownloadEntry& entry) const;
+};
+
 // ─── Database Class ────────────────────────────────────────────────────────
 class Database {
 public:
+    // Entries in ID order, as GetAllEntries() returns them. Never changed
+    // once published.
+    using EntryList = std::vector<std::shared_ptr<const DownloadEntry>>;
+    
+    // Called after UpdateFields() changed an entry, with only the fields
+    // that changed, on the calling thread and without the lock
+    using ChangeListener = std::function<void(const String& id, const EntryPatch& changes)>;
+    
     Database();
     ~Database();
     
     /**
      * Open or create the download database at the specified path.
      * If the database exists, all entries are loaded into memory.
-     * If a journal file exists, it's replayed for crash recovery.
+     * Changes left in the journal by a crash are recovered.
      */
     bool Open(const String& dbPath);
     
@@ -202,9 +288,24 @@ public:
      */
     bool UpdateEntry(const DownloadEntry& entry);
     
+    /**
+     * Apply a patch to an existing entry. Fields equal to the stored value
+     * are dropped; the others are journaled and flushed on their own,
+     * without the rest of the entry, and passed to the change listener.
+     */
+    bool UpdateFields(const String& id, const EntryPatch& patch);
+    
+    /**
+     * Set the listener for UpdateFields() changes. Set it before the
+     * database is used from other threads.
+     */
+    void SetChangeListener(ChangeListener listener);
+    
     /**
      * Update only the progress fields (bytes downloaded, speed, segments).
      * This is a fast path used during active downloads to minimize I/O.
+     * The values wait in the progress table and reach the entry the next
+     * time it is read or saved.
      */
     bool UpdateProgress(const String& id, int64 downloadedBytes,
                         double speed, const std::vector<SegmentInfo>& segments);
@@ -216,25 +317,65 @@ public:
     bool RemoveEntry(const String& id, bool deleteFiles = false);
     
     /**
-     * Get a single entry by ID.
+     * Get a single entry by ID, with all fields.
      */
     std::optional<DownloadEntry> GetEntry(const String& id) const;
     
     /**
-     * Get all entries, optionally filtered by status or category.
+     * Get all entries, for listing. Detail fields are only filled in for
+     * entries that were already opened (detailsLoaded); use GetEntry()
+     * for the rest. Passing such an entry back to UpdateEntry() keeps the
+     * stored details.
      */
     std::vector<DownloadEntry> GetAllEntries() const;
+    
+    /**
+     * The same, as a shared snapshot to iterate without the lock. Lock-free
+     * unless entries changed since the last snapshot; then only those are
+     * copied into a new one. A snapshot can be kept as long as needed:
+     * writers never wait for its readers.
+     */
+    std::shared_ptr<const EntryList> GetListSnapshot() const;
+    
+    /**
+     * Get entries filtered by status or category, with all fields.
+     */
     std::vector<DownloadEntry> GetEntriesByStatus(DownloadStatus status) const;
     std::vector<DownloadEntry> GetEntriesByCategory(const String& category) const;
     
     /**
-     * Get count of entries by status.
+     * IDs of the entries with a status or in a category, in no particular
+     * order, and of the entries in a queue by queue position. Read from
+     * the secondary indexes; no entry is copied.
+     */
+    std::vector<String> GetIdsByStatus(DownloadStatus status) const;
+    std::vector<String> GetIdsByCategory(const String& category) const;
+    std::vector<String> GetQueueIds(const String& queueId) const;
+    
+    /**
+     * Call 'visit' for each entry with the status, under the lock. Detail
+     * fields may not be loaded (see GetAllEntries); 'visit' must not
+     * change the database.
+     */
+    void ForEachByStatus(DownloadStatus status,
+                         const std::function<void(const DownloadEntry&)>& visit) const;
+    
+    /**
+     * IDs of the entries whose file name, URL, final URL, description or
+     * host match every term of 'query' (token prefix or substring), best
+     * match first. 'maxResults' 0 returns all.
+     */
+    std::vector<String> Search(const String& query, size_t maxResults = 0) const;
+    
+    /**
+     * Get count of entries by status. Constant time.
      */
     int GetCountByStatus(DownloadStatus status) const;
     int GetTotalCount() const;
     
     /**
-     * Flush all in-memory changes to disk.
+     * Fold the changes since the last flush into the log and empty the
+     * journal. Changes are durable without it; this keeps replay short.
      */
     bool Flush();
     
@@ -244,19 +385,172 @@ public:
     int RemoveCompleted(bool deleteFiles = false);
     
 private:
-    bool LoadFromDisk();
-    bool SaveToDisk();
-    bool WriteJournal(const DownloadEntry& entry, const String& operation);
-    bool ReplayJournal();
-    void CleanJournal();
+    struct MappedView;
+    struct Snapshot;
+    
+    // Where the undecoded detail fields of an entry sit in m_view
+    struct DetailRef {
+        uint64  offset;
+        uint32  length;
+    };
+    
+    // Queue index order: queue position, then ID
+    struct QueueOrder {
+        bool operator()(const DownloadEntry* a, const DownloadEntry* b) const {
+            if (a->queuePosition != b->queuePosition) return a->queuePosition < b->queuePosition;
+            return a->id < b->id;
+        }
+    };
+    
+    using EntrySet = std::unordered_set<const DownloadEntry*>;
+    
+    // Per-second state of a download that reports progress. Kept in a
+    // dense table apart from the entry, so a progress update finds it by
+    // hash instead of walking m_entries, and averages the speed over a
+    // fixed ring instead of a deque. The latest progress waits here and
+    // is folded into the entry when the entry is next read or saved.
+    struct ProgressSlot {
+        DownloadEntry*  entry;          // In m_entries
+        bool            unfolded;       // Progress newer than the entry's
+        int64           downloadedBytes;
+        double          currentSpeed;
+        std::vector<SegmentInfo> segments;
+        uint32          next;           // Ring position of the next sample
+        uint32          count;
+        double          sum;            // Of the samples in the ring
+        std::array<double, constants::SPEED_HISTORY_SAMPLES> samples;
+        
+        void AddSpeed(double speed);
+        double AverageSpeed() const { return count > 0 ? sum / count : 0.0; }
+    };
     
-    // Serialization helpers
-    std::vector<uint8> SerializeEntry(const DownloadEntry& entry) const;
+    bool LoadFromDisk();
+    bool LoadBinary(std::shared_ptr<MappedView> view);
+    bool LoadTextV1();
+    bool MigrateFromV1();
+    bool FlushChanges();
+    bool SaveToDisk();      // Full rewrite of the base file
+    void MarkDirty(const String& id);
+    void MarkFieldsDirty(const String& id, uint32 fields);
+    bool RemoveLocked(const String& id, bool deleteFiles, uint64& sequence);
+    
+    // Progress table. Slots are taken on the first progress update and
+    // given back when the entry is removed.
+    ProgressSlot* FindProgressSlot(const String& id);
+    void ReleaseProgressSlot(const String& id);
+    void FoldProgress() const;  // Before entries are read, changed or saved
+    
+    // Secondary indexes. Every entry in m_entries is indexed; an entry is
+    // unindexed before its status, category, queue or position changes.
+    void IndexEntry(const DownloadEntry& entry);
+    void UnindexEntry(const DownloadEntry& entry);
+    void ClearIndexes();
+    void RebuildIndexes();  // After a bulk load
+    
+    // Search index upkeep. IndexText is a no-op unless the searchable text
+    // changed; the index is only maintained once OpenSearch has run.
+    void OpenSearch();
+    void IndexText(const DownloadEntry& stored);
+    void UnindexText(const String& id);
+    void SearchChanged();   // Delete the saved index, now stale
+    
+    // Drop the published copy of an entry about to change; 'reshape' if
+    // it was just added or is about to be removed
+    void Unpublish(const DownloadEntry& entry, bool reshape = false) const;
+    
+    // Compaction: snapshot under the lock, write without it, install under it
+    void StartCompaction();
+    std::unique_ptr<Snapshot> TakeSnapshot() const;
+    bool WriteSnapshot(Snapshot& snapshot) const;
+    bool InstallSnapshot(Snapshot& snapshot);
+    
+    // Record log
+    bool OpenLog();         // Positioned at m_logBytes
+    void CloseLog();
+    bool AppendLog();       // Changed and removed entries since the last append
+    bool TrimLog(uint64 offset);
+    bool ReplayLog();
+    
+    // Journal a change made under the lock; commit the returned sequence
+    // number after unlocking
+    uint64 JournalRecord(uint16 type, const DownloadEntry& stored);
+    uint64 JournalFields(const DownloadEntry& stored, uint32 fields);
+    uint64 JournalProgress(const String& id, const ProgressSlot& slot);
+    
+    // Apply a log or journal record to m_entries. Returns the entry's ID,
+    // empty if the record is invalid or changes nothing.
+    String ApplyRecord(const uint8* data, size_t length);
+    
+    // Decode the pending detail fields of 'stored' into 'entry', a copy of
+    // it (or itself). No-op if there are none.
+    void LoadDetails(const DownloadEntry& stored, DownloadEntry& entry) const;
+    
+    // Serialization helpers. A record holds the list fields and where the
+    // entry's detail fields sit in the detail heap.
+    void SerializeEntry(const DownloadEntry& entry, uint64 detailOffset,
+                        uint32 detailLength, std::vector<uint8>& out) const;
+    
+    // Log records carry the details inline; 'details' are raw detail
+    // fields to copy instead of encoding the entry's own (nullptr to encode)
+    void SerializeLogRecord(uint16 type, const DownloadEntry& entry, const uint8* details,
+                            uint32 detailLength, std::vector<uint8>& out) const;
     DownloadEntry DeserializeEntry(const uint8* data, size_t length) const;
     
+    // A log record of an entry in m_entries, with its details still in
+    // m_view if they were never decoded
+    bool SerializeStored(uint16 type, const DownloadEntry& stored, std::vector<uint8>& out) const;
+    
+    // A record of just the given fields (EntryField bits) of an entry
+    void SerializeFields(const DownloadEntry& entry, uint32 fields, std::vector<uint8>& out) const;
+    
     String                              m_dbPath;
     String                              m_journalPath;
+    String                              m_logPath;
     std::map<String, DownloadEntry>     m_entries;     // ID -> Entry
+    std::shared_ptr<MappedView>         m_view;        // Current base file
+    
+    // Entries (in m_entries) whose detail fields are still in m_view
+    std::unordered_map<const DownloadEntry*, DetailRef> m_pendingDetails;
+    
+    // Secondary indexes over m_entries
+    std::map<DownloadStatus, EntrySet>                  m_byStatus;
+    std::unordered_map<String, EntrySet>                m_byCategory;
+    std::unordered_map<String, std::set<const DownloadEntry*, QueueOrder>> m_byQueue;
+    
+    // List snapshot (std::atomic_load/store) and the per-entry copies it
+    // shares; an entry without one has changed since
+    mutable std::shared_ptr<const EntryList>            m_listSnapshot;
+    mutable std::unordered_map<const DownloadEntry*, std::shared_ptr<const DownloadEntry>> m_published;
+    mutable EntrySet                                    m_unpublished;  // Changed since the snapshot
+    mutable bool                                        m_listReshaped{true}; // Entries added or removed
+    mutable std::atomic<bool>                           m_listStale{true};
+    
+    // Progress table; slots with progress not folded into their entry yet
+    mutable std::vector<ProgressSlot>                   m_progress;
+    mutable std::vector<uint32>                         m_unfoldedProgress;
+    std::vector<uint32>                                 m_freeProgressSlots;
+    std::unordered_map<String, uint32>                  m_progressSlots; // ID -> index in m_progress
+    
+    // Changes not in the log yet: whole entries, single fields of others
+    std::set<String>                    m_dirtyIds;
+    std::map<String, uint32>            m_dirtyFields; // ID -> EntryField bits
+    std::vector<String>                 m_removedIds;
+    
+    ChangeListener                      m_changeListener;
+    
+    // Full-text search
+    SearchIndex                         m_search;
+    String                              m_searchPath;
+    bool                                m_searchOpen{false};
+    bool                                m_searchSaved{false}; // m_searchPath matches m_search
+    
+    HANDLE                              m_hLog{INVALID_HANDLE_VALUE};
+    uint64                              m_logBytes{0}; // Valid length of the log
+    std::future<void>                   m_compaction;
+    bool                                m_compacting{false};
+    bool                                m_rewrite{false}; // Base file needs a full rewrite
+    Journal                             m_journal;
+    
     mutable RecursiveMutex              m_mutex;
     bool                                m_dirty{false};
 };
@@ -0,0 +1,251 @@
+/**
+ * @file Journal.cpp
+ * @brief Write-ahead journal with group commit
+ */
+
+#include "stdafx.h"
+#include "Journal.h"
+#include "Crypto.h"
+#include "Logger.h"
+
+namespace idm {
+
+namespace {
+
+constexpr char   JOURNAL_MAGIC[8] = {'I', 'D', 'M', 'C', 'J', 'N', 'L', '\0'};
+constexpr uint32 JOURNAL_VERSION = 1;
+
+#pragma pack(push, 1)
+struct JournalHeader {
+    char    magic[8];
+    uint32  version;
+    uint32  reserved;
+};
+
+// Followed by 'length' record bytes
+struct FrameHeader {
+    uint32  length;
+    uint32  crc;            // CRC32 of the record bytes
+};
+#pragma pack(pop)
+
+} // anonymous namespace
+
+Journal::~Journal() {
+    Close();
+}
+
+// ─── Open / Close ──────────────────────────────────────────────────────────
+
+bool Journal::Open(const String& path) {
+    Close();
+    Lock lock(m_mutex);
+    m_path = path;
+    m_hFile = ::CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ,
+                            nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (m_hFile == INVALID_HANDLE_VALUE) {
+        LOG_ERROR(L"Journal: cannot open %s (error %lu)", path.c_str(), ::GetLastError());
+        return false;
+    }
+
+    JournalHeader header{};
+    DWORD read = 0;
+    if (!::ReadFile(m_hFile, &header, sizeof(header), &read, nullptr) || read != sizeof(header) ||
+        memcmp(header.magic, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC)) != 0) {
+        if (read > 0) {
+            LOG_WARN(L"Journal: %s has no readable records, starting over", path.c_str());
+        }
+        return WriteHeader();
+    }
+
+    LARGE_INTEGER size{};
+    ::GetFileSizeEx(m_hFile, &size);
+    m_fileBytes = static_cast<uint64>(size.QuadPart);
+    return true;
+}
+
+void Journal::Close() {
+    Lock lock(m_mutex);
+    m_committed.wait(lock, [this] { return !m_committing; });
+    if (m_hFile == INVALID_HANDLE_VALUE) return;
+
+    ::CloseHandle(m_hFile);
+    m_hFile = INVALID_HANDLE_VALUE;
+    m_buffer.clear();
+    m_doneSeq = m_appendedSeq;
+    m_committed.notify_all();
+
+    if (m_stats.commits > 0) {
+        LOG_INFO(L"Journal: %llu records in %llu commits (%.1f per commit), "
+                 L"commit avg %.2f ms, max %.2f ms",
+                 m_stats.records, m_stats.commits,
+                 static_cast<double>(m_stats.records) / m_stats.commits,
+                 m_stats.totalCommitMs / m_stats.commits, m_stats.maxCommitMs);
+    }
+}
+
+bool Journal::WriteHeader() {
+    // Caller holds m_mutex
+    JournalHeader header{};
+    memcpy(header.magic, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC));
+    header.version = JOURNAL_VERSION;
+
+    LARGE_INTEGER start{};
+    DWORD written = 0;
+    if (!::SetFilePointerEx(m_hFile, start, nullptr, FILE_BEGIN) ||
+        !::WriteFile(m_hFile, &header, sizeof(header), &written, nullptr) ||
+        !::SetEndOfFile(m_hFile) || !::FlushFileBuffers(m_hFile)) {
+        LOG_ERROR(L"Journal: cannot write %s (error %lu)", m_path.c_str(), ::GetLastError());
+        ::CloseHandle(m_hFile);
+        m_hFile = INVALID_HANDLE_VALUE;
+        return false;
+    }
+    m_fileBytes = sizeof(header);
+    return true;
+}
+
+// ─── Replay ────────────────────────────────────────────────────────────────
+
+int Journal::Replay(const std::function<void(const uint8* record, size_t length)>& apply) {
+    Lock lock(m_mutex);
+    if (m_hFile == INVALID_HANDLE_VALUE || m_fileBytes <= sizeof(JournalHeader)) return 0;
+
+    std::vector<uint8> data(static_cast<size_t>(m_fileBytes - sizeof(JournalHeader)));
+    LARGE_INTEGER start;
+    start.QuadPart = sizeof(JournalHeader);
+    DWORD read = 0;
+    if (!::SetFilePointerEx(m_hFile, start, nullptr, FILE_BEGIN) ||
+        !::ReadFile(m_hFile, data.data(), static_cast<DWORD>(data.size()), &read, nullptr) ||
+        read != data.size()) {
+        LOG_ERROR(L"Journal: cannot read %s (error %lu)", m_path.c_str(), ::GetLastError());
+        return 0;
+    }
+
+    size_t pos = 0;
+    int replayed = 0;
+    while (data.size() - pos >= sizeof(FrameHeader)) {
+        FrameHeader frame;
+        memcpy(&frame, data.data() + pos, sizeof(frame));
+        const uint8* record = data.data() + pos + sizeof(frame);
+        if (frame.length > data.size() - pos - sizeof(frame) ||
+            Crypto::DataCRC32(record, frame.length) != frame.crc) {
+            break;
+        }
+        apply(record, frame.length);
+        pos += sizeof(frame) + frame.length;
+        ++replayed;
+    }
+
+    if (pos != data.size()) {
+        LOG_WARN(L"Journal: dropping %llu bytes of torn or corrupt records",
+                 static_cast<uint64>(data.size() - pos));
+        LARGE_INTEGER end;
+        end.QuadPart = static_cast<LONGLONG>(sizeof(JournalHeader) + pos);
+        ::SetFilePointerEx(m_hFile, end, nullptr, FILE_BEGIN);
+        ::SetEndOfFile(m_hFile);
+        m_fileBytes = sizeof(JournalHeader) + pos;
+    }
+    if (replayed > 0) {
+        LOG_INFO(L"Journal: replayed %d records", replayed);
+    }
+    return replayed;
+}
+
+// ─── Append / Commit ───────────────────────────────────────────────────────
+
+uint64 Journal::Append(const std::vector<uint8>& record) {
+    Lock lock(m_mutex);
+    if (m_hFile == INVALID_HANDLE_VALUE) return 0;
+
+    FrameHeader frame{static_cast<uint32>(record.size()),
+                      Crypto::DataCRC32(record.data(), record.size())};
+    const uint8* header = reinterpret_cast<const uint8*>(&frame);
+    m_buffer.insert(m_buffer.end(), header, header + sizeof(frame));
+    m_buffer.insert(m_buffer.end(), record.begin(), record.end());
+    return ++m_appendedSeq;
+}
+
+bool Journal::Commit(uint64 sequence) {
+    Lock lock(m_mutex);
+    while (m_doneSeq < sequence) {
+        if (m_committing) {
+            // Another writer is flushing; ours is in this batch or the next
+            m_committed.wait(lock);
+            continue;
+        }
+
+        // Lead a commit of everything buffered so far
+        m_committing = true;
+        std::vector<uint8> batch;
+        batch.swap(m_buffer);
+        uint64 first = m_doneSeq + 1;
+        uint64 last = m_appendedSeq;
+        LARGE_INTEGER offset;
+        offset.QuadPart = static_cast<LONGLONG>(m_fileBytes);
+        lock.unlock();
+
+        TimePoint start = Clock::now();
+        DWORD written = 0;
+        bool ok = ::SetFilePointerEx(m_hFile, offset, nullptr, FILE_BEGIN) &&
+                  ::WriteFile(m_hFile, batch.data(), static_cast<DWORD>(batch.size()), &written, nullptr) &&
+                  written == batch.size() &&
+                  ::FlushFileBuffers(m_hFile);
+        if (!ok) {
+            // Don't leave part of a frame for the next commit to follow
+            LOG_ERROR(L"Journal: commit failed (error %lu)", ::GetLastError());
+            ::SetFilePointerEx(m_hFile, offset, nullptr, FILE_BEGIN);
+            ::SetEndOfFile(m_hFile);
+        }
+        double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+        lock.lock();
+        if (ok) {
+            m_fileBytes += batch.size();
+            m_stats.records += last - first + 1;
+            m_stats.commits++;
+            m_stats.bytes += batch.size();
+            m_stats.totalCommitMs += ms;
+            m_stats.maxCommitMs = (std::max)(m_stats.maxCommitMs, ms);
+        } else {
+            m_failedFirst = first;
+            m_failedLast = last;
+        }
+        if (m_buffer.empty()) {
+            batch.clear();
+            m_buffer.swap(batch);   // Keep the capacity
+        }
+        m_doneSeq = last;
+        m_committing = false;
+        m_committed.notify_all();
+    }
+    return sequence < m_failedFirst || sequence > m_failedLast;
+}
+
+// ─── Checkpoint ────────────────────────────────────────────────────────────
+
+bool Journal::Reset() {
+    Lock lock(m_mutex);
+    m_committed.wait(lock, [this] { return !m_committing; });
+    if (m_hFile == INVALID_HANDLE_VALUE) return false;
+
+    m_buffer.clear();
+    m_doneSeq = m_appendedSeq;
+    m_committed.notify_all();
+    if (m_fileBytes == sizeof(JournalHeader)) return true;
+
+    LARGE_INTEGER end;
+    end.QuadPart = sizeof(JournalHeader);
+    if (!::SetFilePointerEx(m_hFile, end, nullptr, FILE_BEGIN) || !::SetEndOfFile(m_hFile)) {
+        LOG_ERROR(L"Journal: cannot truncate %s (error %lu)", m_path.c_str(), ::GetLastError());
+        return false;
+    }
+    m_fileBytes = sizeof(JournalHeader);
+    return true;
+}
+
+Journal::Stats Journal::GetStats() const {
+    Lock lock(m_mutex);
+    return m_stats;
+}
+
+} // namespace idm
@@ -0,0 +1,99 @@
+/**
+ * @file Journal.h
+ * @brief Write-ahead journal with group commit
+ *
+ * Every Database mutation is appended here as one record and committed
+ * before the call returns, so a crash between flushes loses nothing that
+ * was acknowledged. The journal doesn't know what a record means; the
+ * Database applies them in order on Open (Replay) and drops them once
+ * its own files hold the same state (Reset, at each flush).
+ *
+ * File layout:
+ *   [Header: 16 bytes]     magic, version
+ *   [Frame: length, CRC32, record bytes]
+ *   ...
+ *
+ * Replay stops at the first frame that is cut short or fails its CRC;
+ * frames are only ever appended, so that is where a crash interrupted a
+ * write, and the rest is cut off.
+ *
+ * Group commit: Append only copies the frame into a buffer. The first
+ * caller to reach Commit writes and flushes everything buffered so far
+ * with one FlushFileBuffers; callers arriving meanwhile wait and are
+ * usually covered by that write or the next one. Throughput thus grows
+ * with the number of concurrent writers instead of being one flush each.
+ */
+
+#pragma once
+#include "stdafx.h"
+
+namespace idm {
+
+class Journal {
+public:
+    struct Stats {
+        uint64  records{0};         // Committed
+        uint64  commits{0};         // Flushes to disk
+        uint64  bytes{0};
+        double  totalCommitMs{0};   // Write + flush time of all commits
+        double  maxCommitMs{0};
+    };
+
+    Journal() = default;
+    ~Journal();
+
+    Journal(const Journal&) = delete;
+    Journal& operator=(const Journal&) = delete;
+
+    /**
+     * Open or create the journal. An unreadable file (wrong magic, or the
+     * old text journal) is started over. Call Replay next.
+     */
+    bool Open(const String& path);
+    void Close();
+
+    /**
+     * Pass every intact record to 'apply', oldest first. Cuts off a torn
+     * or corrupt tail. Returns the number of records.
+     */
+    int Replay(const std::function<void(const uint8* record, size_t length)>& apply);
+
+    /**
+     * Buffer a record. Returns its sequence number for Commit.
+     */
+    uint64 Append(const std::vector<uint8>& record);
+
+    /**
+     * Wait until the record 'sequence' is on disk, writing it (and any
+     * other buffered records) if no commit is under way. Returns false if
+     * its write failed; the change then reaches disk with the next flush.
+     */
+    bool Commit(uint64 sequence);
+
+    /**
+     * Drop all records, committed or not: the caller has persisted the
+     * state they describe. Waits for a commit under way.
+     */
+    bool Reset();
+
+    Stats GetStats() const;
+
+private:
+    bool WriteHeader();
+
+    String              m_path;
+    HANDLE              m_hFile{INVALID_HANDLE_VALUE};
+    uint64              m_fileBytes{0};     // Valid length on disk
+
+    mutable Mutex       m_mutex;
+    CondVar             m_committed;
+    std::vector<uint8>  m_buffer;           // Frames not written yet
+    uint64              m_appendedSeq{0};
+    uint64              m_doneSeq{0};       // Written or failed
+    uint64              m_failedFirst{1};   // Sequence range of the last failed commit
+    uint64              m_failedLast{0};
+    bool                m_committing{false};
+    Stats               m_stats;
+};
+
+} // namespace idm
@@ -202,6 +202,14 @@ Registry::AppSettings Registry::LoadSettings() {
     s.httpProxyPort       = static_cast<int>(ReadInt(opts, L"HttpProxyPort", 0));
     s.socksPort           = static_cast<int>(ReadInt(opts, L"SocksPort", 0));
     s.socksType           = static_cast<int>(ReadInt(opts, L"SocksType", 5));
+    s.writeBackend        = static_cast<int>(ReadInt(opts, L"WriteBackend", 0));
+    s.mappedBudgetMB      = static_cast<int>(ReadInt(opts, L"MappedBudgetMB",
+                                                     constants::DEFAULT_MAPPED_BUDGET_MB));
+    s.unbufferedMinMB     = static_cast<int>(ReadInt(opts, L"UnbufferedMinMB", 0));
+    s.durabilityMode      = static_cast<int>(ReadInt(opts, L"DurabilityMode", 1));
+    s.ioDepthPerDevice    = static_cast<int>(ReadInt(opts, L"IoDepthPerDevice",
+                                                     constants::DEFAULT_IO_DEPTH));
+    s.speedLimitPacing    = ReadBool(opts, L"SpeedLimitPacing", true);
     
     // Get default save directory (My Documents\Downloads if not set)
     wchar_t docsPath[MAX_PATH];
@@ -237,6 +245,12 @@ void Registry::SaveSettings(const AppSettings& s) {
     WriteInt(opts, L"HttpProxyPort", s.httpProxyPort);
     WriteInt(opts, L"SocksPort", s.socksPort);
     WriteInt(opts, L"SocksType", s.socksType);
+    WriteInt(opts, L"WriteBackend", s.writeBackend);
+    WriteInt(opts, L"MappedBudgetMB", s.mappedBudgetMB);
+    WriteInt(opts, L"UnbufferedMinMB", s.unbufferedMinMB);
+    WriteInt(opts, L"DurabilityMode", s.durabilityMode);
+    WriteInt(opts, L"IoDepthPerDevice", s.ioDepthPerDevice);
+    WriteBool(opts, L"SpeedLimitPacing", s.speedLimitPacing);
     WriteString(opts, L"DefaultSaveDir", s.defaultSaveDir);
     WriteString(opts, L"TempDir", s.tempDir);
     WriteString(opts, L"FileTypes", s.fileTypes);
@@ -69,6 +69,16 @@ public:
         String  socksAddr;
         int     socksPort            = 0;
         int     socksType            = 5;  // 4 or 5
+        
+        // Disk I/O (read when each download starts)
+        int     writeBackend         = 0;  // 0=Synchronous, 1=Overlapped (IOCP)
+        int     mappedBudgetMB       = constants::DEFAULT_MAPPED_BUDGET_MB; // 0=Never map
+        int     unbufferedMinMB      = 0;  // 0=Off; larger files bypass the page cache
+        int     durabilityMode       = 1;  // 0=None, 1=Ordered, 2=Strict (DurabilityMode)
+        int     ioDepthPerDevice     = constants::DEFAULT_IO_DEPTH; // 0=Unscheduled
+        
+        // Speed limiter
+        bool    speedLimitPacing     = true;  // Even grants instead of token-bucket bursts
     };
     
     AppSettings LoadSettings();
@@ -0,0 +1,552 @@
+/**
+ * @file SearchIndex.cpp
+ * @brief Inverted index for searching downloads by name, URL and host
+ */
+
+#include "stdafx.h"
+#include "SearchIndex.h"
+#include "Crypto.h"
+#include "Logger.h"
+#include <cwctype>
+
+namespace idm {
+
+namespace {
+
+constexpr char   SEARCH_MAGIC[8] = {'I', 'D', 'M', 'C', 'S', 'R', 'C', '\0'};
+constexpr uint32 SEARCH_VERSION = 1;
+
+#pragma pack(push, 1)
+struct SearchHeader {
+    char    magic[8];
+    uint32  version;
+    uint32  docCount;
+    uint32  tokenCount;
+    uint32  trigramCount;
+    uint32  crc;            // CRC32 of everything after the header
+    uint32  reserved;
+};
+#pragma pack(pop)
+
+static_assert(sizeof(SearchHeader) == 32, "search index header must be 32 bytes");
+
+// Document text: the fields in this order, separated
+enum DocField { DOC_FILE_NAME, DOC_URL, DOC_FINAL_URL, DOC_DESCRIPTION, DOC_FIELDS };
+constexpr wchar_t FIELD_SEPARATOR = L'\x1f';
+
+// Where a token was found (posting flags)
+constexpr uint8 FLAG_FILE_NAME   = 1 << 0;
+constexpr uint8 FLAG_URL         = 1 << 1;
+constexpr uint8 FLAG_FINAL_URL   = 1 << 2;
+constexpr uint8 FLAG_DESCRIPTION = 1 << 3;
+constexpr uint8 FLAG_HOST        = 1 << 4;
+
+// Ranking: field weight times match kind
+constexpr uint8 MATCH_SUBSTRING = 1;
+constexpr uint8 MATCH_PREFIX    = 2;
+constexpr uint8 MATCH_TOKEN     = 3;
+constexpr uint8 MAX_FIELD_WEIGHT = 8;
+
+// Rebuild postings once this many dead documents outnumber the live ones
+constexpr size_t MIN_DEAD_DOCS = 1024;
+
+uint8 FieldWeight(uint8 flags) {
+    if (flags & FLAG_FILE_NAME) return 8;
+    if (flags & FLAG_HOST) return 6;
+    if (flags & FLAG_DESCRIPTION) return 4;
+    return 2;
+}
+
+uint8 FieldFlag(int field) {
+    switch (field) {
+        case DOC_FILE_NAME:   return FLAG_FILE_NAME;
+        case DOC_URL:         return FLAG_URL;
+        case DOC_FINAL_URL:   return FLAG_FINAL_URL;
+        default:              return FLAG_DESCRIPTION;
+    }
+}
+
+void Normalize(const String& value, String& out) {
+    for (wchar_t c : value) {
+        out.push_back(c == FIELD_SEPARATOR ? L' ' : static_cast<wchar_t>(std::towlower(c)));
+    }
+}
+
+bool IsWordChar(wchar_t c) {
+    return std::iswalnum(c) != 0;
+}
+
+// [begin, end) of each field in a document's text
+struct Span {
+    size_t begin;
+    size_t end;
+};
+
+std::array<Span, DOC_FIELDS> SplitFields(const String& text) {
+    std::array<Span, DOC_FIELDS> fields{};
+    size_t begin = 0;
+    for (int f = 0; f < DOC_FIELDS; ++f) {
+        size_t end = f + 1 < DOC_FIELDS ? text.find(FIELD_SEPARATOR, begin) : text.size();
+        if (end == String::npos) end = text.size();
+        fields[f] = {begin, end};
+        begin = (std::min)(end + 1, text.size());
+    }
+    return fields;
+}
+
+// Host of a normalized URL: after "://", up to the path, port or query,
+// without user info
+Span HostOf(const String& text, Span url) {
+    size_t scheme = text.find(L"://", url.begin);
+    if (scheme == String::npos || scheme >= url.end) return {url.begin, url.begin};
+    size_t begin = scheme + 3;
+    size_t end = begin;
+    while (end < url.end && !wcschr(L"/?#:", text[end])) {
+        if (text[end] == L'@') begin = end + 1;
+        ++end;
+    }
+    return {begin, end};
+}
+
+uint64 TrigramKey(const wchar_t* c) {
+    return (static_cast<uint64>(static_cast<uint32>(c[0]) & 0x1FFFFF) << 42) |
+           (static_cast<uint64>(static_cast<uint32>(c[1]) & 0x1FFFFF) << 21) |
+           (static_cast<uint64>(static_cast<uint32>(c[2]) & 0x1FFFFF));
+}
+
+// ─── Postings Coding ───────────────────────────────────────────────────────
+
+void PutVarint(std::vector<uint8>& out, uint32 value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<uint8>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<uint8>(value));
+}
+
+uint32 GetVarint(const uint8*& pos) {
+    uint32 value = 0;
+    for (int shift = 0; ; shift += 7) {
+        uint8 byte = *pos++;
+        value |= static_cast<uint32>(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return value;
+    }
+}
+
+// ─── File Coding ───────────────────────────────────────────────────────────
+
+void PutU32(std::vector<uint8>& out, uint32 value) {
+    const uint8* bytes = reinterpret_cast<const uint8*>(&value);
+    out.insert(out.end(), bytes, bytes + sizeof(value));
+}
+
+void PutBytes(std::vector<uint8>& out, const void* data, size_t length) {
+    PutU32(out, static_cast<uint32>(length));
+    const uint8* bytes = static_cast<const uint8*>(data);
+    out.insert(out.end(), bytes, bytes + length);
+}
+
+// Bounds-checked reads; any overrun makes the whole file invalid
+struct Reader {
+    const uint8*    pos;
+    const uint8*    end;
+    bool            ok{true};
+
+    bool Take(void* out, size_t length) {
+        if (!ok || static_cast<size_t>(end - pos) < length) return ok = false;
+        memcpy(out, pos, length);
+        pos += length;
+        return true;
+    }
+
+    uint32 U32() {
+        uint32 value = 0;
+        Take(&value, sizeof(value));
+        return value;
+    }
+
+    String Str() {
+        uint32 length = U32();
+        if (length % sizeof(wchar_t) != 0) ok = false;
+        String value(ok ? length / sizeof(wchar_t) : 0, L'\0');
+        Take(value.data(), value.size() * sizeof(wchar_t));
+        return value;
+    }
+
+    std::vector<uint8> Bytes() {
+        uint32 length = U32();
+        std::vector<uint8> value;
+        if (ok && static_cast<size_t>(end - pos) >= length) value.resize(length);
+        Take(value.data(), length);
+        return value;
+    }
+};
+
+} // anonymous namespace
+
+// ─── Documents ─────────────────────────────────────────────────────────────
+
+bool SearchIndex::Update(const String& id, const String& fileName, const String& url,
+                         const String* finalUrl, const String& description) {
+    auto found = m_docNumbers.find(id);
+    const Document* old = found != m_docNumbers.end() ? &m_docs[found->second] : nullptr;
+
+    String text;
+    text.reserve(fileName.size() + url.size() + description.size() +
+                 (finalUrl ? finalUrl->size() : 0) + DOC_FIELDS);
+    Normalize(fileName, text);
+    text.push_back(FIELD_SEPARATOR);
+    Normalize(url, text);
+    text.push_back(FIELD_SEPARATOR);
+    if (finalUrl) {
+        Normalize(*finalUrl, text);
+    } else if (old) {
+        Span kept = SplitFields(old->text)[DOC_FINAL_URL];
+        text.append(old->text, kept.begin, kept.end - kept.begin);
+    }
+    text.push_back(FIELD_SEPARATOR);
+    Normalize(description, text);
+
+    if (old && old->text == text) return false;
+    if (old) Remove(id);
+    AddDocument(id, std::move(text));
+
+    if (m_deadDocs >= MIN_DEAD_DOCS && m_deadDocs > m_docNumbers.size()) {
+        Compact();
+    }
+    return true;
+}
+
+bool SearchIndex::Remove(const String& id) {
+    auto found = m_docNumbers.find(id);
+    if (found == m_docNumbers.end()) return false;
+
+    // The postings keep pointing here until the next compaction
+    Document& doc = m_docs[found->second];
+    String().swap(doc.id);
+    String().swap(doc.text);
+    m_docNumbers.erase(found);
+    ++m_deadDocs;
+    return true;
+}
+
+void SearchIndex::Clear() {
+    m_docs.clear();
+    m_docNumbers.clear();
+    m_deadDocs = 0;
+    m_tokens.clear();
+    m_trigrams.clear();
+}
+
+uint32 SearchIndex::AddDocument(const String& id, String text) {
+    uint32 doc = static_cast<uint32>(m_docs.size());
+    m_docs.push_back({id, std::move(text)});
+    m_docNumbers[id] = doc;
+    IndexDocument(doc);
+    return doc;
+}
+
+void SearchIndex::IndexDocument(uint32 doc) {
+    const String& text = m_docs[doc].text;
+    auto fields = SplitFields(text);
+
+    // Tokens with the fields they appear in
+    std::vector<std::pair<String, uint8>> tokens;
+    for (int f = 0; f < DOC_FIELDS; ++f) {
+        size_t pos = fields[f].begin;
+        while (pos < fields[f].end) {
+            while (pos < fields[f].end && !IsWordChar(text[pos])) ++pos;
+            size_t start = pos;
+            while (pos < fields[f].end && IsWordChar(text[pos])) ++pos;
+            if (pos > start) tokens.emplace_back(text.substr(start, pos - start), FieldFlag(f));
+        }
+    }
+
+    // Hosts, their parent domains down to two labels, and their words
+    for (int f : {DOC_URL, DOC_FINAL_URL}) {
+        Span host = HostOf(text, fields[f]);
+        if (host.end == host.begin) continue;
+        String name = text.substr(host.begin, host.end - host.begin);
+        tokens.emplace_back(name, FLAG_HOST);
+        for (size_t dot = name.find(L'.'); dot != String::npos; dot = name.find(L'.', dot + 1)) {
+            if (name.find(L'.', dot + 1) == String::npos) break;
+            tokens.emplace_back(name.substr(dot + 1), FLAG_HOST);
+        }
+        for (size_t pos = 0; pos < name.size(); ) {
+            while (pos < name.size() && !IsWordChar(name[pos])) ++pos;
+            size_t start = pos;
+            while (pos < name.size() && IsWordChar(name[pos])) ++pos;
+            if (pos > start) tokens.emplace_back(name.substr(start, pos - start), FLAG_HOST);
+        }
+    }
+
+    // One posting per token, with the flags of all its occurrences
+    std::sort(tokens.begin(), tokens.end());
+    for (size_t i = 0; i < tokens.size(); ) {
+        const String& token = tokens[i].first;
+        uint8 flags = 0;
+        for (; i < tokens.size() && tokens[i].first == token; ++i) flags |= tokens[i].second;
+        Postings& postings = m_tokens[token];
+        PutVarint(postings.bytes, doc - postings.last);
+        postings.bytes.push_back(flags);
+        postings.last = doc;
+        postings.count++;
+    }
+
+    // Trigrams of each field, once per document
+    std::vector<uint64> trigrams;
+    for (int f = 0; f < DOC_FIELDS; ++f) {
+        for (size_t pos = fields[f].begin; pos + 3 <= fields[f].end; ++pos) {
+            trigrams.push_back(TrigramKey(text.data() + pos));
+        }
+    }
+    std::sort(trigrams.begin(), trigrams.end());
+    trigrams.erase(std::unique(trigrams.begin(), trigrams.end()), trigrams.end());
+    for (uint64 key : trigrams) {
+        Postings& postings = m_trigrams[key];
+        PutVarint(postings.bytes, doc - postings.last);
+        postings.last = doc;
+        postings.count++;
+    }
+}
+
+void SearchIndex::Compact() {
+    std::vector<Document> docs;
+    docs.reserve(m_docNumbers.size());
+    for (Document& doc : m_docs) {
+        if (!doc.id.empty()) docs.push_back(std::move(doc));
+    }
+
+    m_docs = std::move(docs);
+    m_docNumbers.clear();
+    m_deadDocs = 0;
+    m_tokens.clear();
+    m_trigrams.clear();
+    for (uint32 doc = 0; doc < m_docs.size(); ++doc) {
+        m_docNumbers[m_docs[doc].id] = doc;
+        IndexDocument(doc);
+    }
+}
+
+// ─── Search ────────────────────────────────────────────────────────────────
+
+std::vector<uint32> SearchIndex::TrigramCandidates(const String& term) const {
+    std::vector<const Postings*> lists;
+    for (size_t pos = 0; pos + 3 <= term.size(); ++pos) {
+        auto found = m_trigrams.find(TrigramKey(term.data() + pos));
+        if (found == m_trigrams.end()) return {};
+        lists.push_back(&found->second);
+    }
+    std::sort(lists.begin(), lists.end(), [](const Postings* a, const Postings* b) {
+        return a->count < b->count;
+    });
+    lists.erase(std::unique(lists.begin(), lists.end()), lists.end());
+
+    auto decode = [](const Postings& postings) {
+        std::vector<uint32> docs;
+        docs.reserve(postings.count);
+        const uint8* pos = postings.bytes.data();
+        uint32 doc = 0;
+        for (uint32 i = 0; i < postings.count; ++i) {
+            doc += GetVarint(pos);
+            docs.push_back(doc);
+        }
+        return docs;
+    };
+
+    // The rarest few narrow it down enough; the text check does the rest
+    std::vector<uint32> candidates = decode(*lists[0]);
+    for (size_t i = 1; i < lists.size() && i < 3 && !candidates.empty(); ++i) {
+        std::vector<uint32> other = decode(*lists[i]);
+        std::vector<uint32> both;
+        std::set_intersection(candidates.begin(), candidates.end(),
+                              other.begin(), other.end(), std::back_inserter(both));
+        candidates.swap(both);
+    }
+    return candidates;
+}
+
+std::vector<String> SearchIndex::Search(const String& query, size_t maxResults) const {
+    String normalized;
+    Normalize(query, normalized);
+    std::vector<String> terms;
+    std::wistringstream words(normalized);
+    for (String term; words >> term; ) {
+        terms.push_back(term);
+    }
+    if (terms.empty() || m_docNumbers.empty()) return {};
+
+    // Per document: the best score of the current term, and the sum over
+    // the terms so far (0 once a term didn't match)
+    std::vector<uint8> termScores(m_docs.size());
+    std::vector<uint32> scores(m_docs.size());
+
+    for (size_t t = 0; t < terms.size(); ++t) {
+        const String& term = terms[t];
+        std::fill(termScores.begin(), termScores.end(), static_cast<uint8>(0));
+        bool matched = false;
+
+        // Tokens starting with the term
+        for (auto it = m_tokens.lower_bound(term);
+             it != m_tokens.end() && it->first.compare(0, term.size(), term) == 0; ++it) {
+            uint8 kind = it->first.size() == term.size() ? MATCH_TOKEN : MATCH_PREFIX;
+            const uint8* pos = it->second.bytes.data();
+            uint32 doc = 0;
+            for (uint32 i = 0; i < it->second.count; ++i) {
+                doc += GetVarint(pos);
+                uint8 flags = *pos++;
+                if (m_docs[doc].id.empty()) continue;
+                uint8 score = static_cast<uint8>(kind * FieldWeight(flags));
+                if (score > termScores[doc]) termScores[doc] = score;
+                matched = true;
+            }
+        }
+
+        // Substrings, checked against the text
+        if (term.size() >= 3) {
+            for (uint32 doc : TrigramCandidates(term)) {
+                const String& text = m_docs[doc].text;
+                if (text.empty() || termScores[doc] >= MATCH_SUBSTRING * MAX_FIELD_WEIGHT) continue;
+                size_t at = text.find(term);
+                if (at == String::npos) continue;
+                int field = static_cast<int>(std::count(text.begin(), text.begin() + at, FIELD_SEPARATOR));
+                uint8 score = static_cast<uint8>(MATCH_SUBSTRING * FieldWeight(FieldFlag(field)));
+                if (score > termScores[doc]) termScores[doc] = score;
+                matched = true;
+            }
+        }
+        if (!matched) return {};
+
+        for (size_t doc = 0; doc < scores.size(); ++doc) {
+            scores[doc] = (t == 0 || scores[doc] > 0) && termScores[doc] > 0
+                ? scores[doc] + termScores[doc] : 0;
+        }
+    }
+
+    std::vector<std::pair<uint32, uint32>> ranked;     // Score, document
+    for (uint32 doc = 0; doc < scores.size(); ++doc) {
+        if (scores[doc] > 0) ranked.emplace_back(scores[doc], doc);
+    }
+    size_t count = maxResults > 0 ? (std::min)(maxResults, ranked.size()) : ranked.size();
+    std::partial_sort(ranked.begin(), ranked.begin() + count, ranked.end(),
+                      std::greater<std::pair<uint32, uint32>>());
+
+    std::vector<String> ids;
+    ids.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        ids.push_back(m_docs[ranked[i].second].id);
+    }
+    return ids;
+}
+
+// ─── Persistence ───────────────────────────────────────────────────────────
+
+bool SearchIndex::Save(const String& path) {
+    if (m_deadDocs > 0) Compact();
+
+    SearchHeader header{};
+    memcpy(header.magic, SEARCH_MAGIC, sizeof(SEARCH_MAGIC));
+    header.version = SEARCH_VERSION;
+    header.docCount = static_cast<uint32>(m_docs.size());
+    header.tokenCount = static_cast<uint32>(m_tokens.size());
+    header.trigramCount = static_cast<uint32>(m_trigrams.size());
+
+    std::vector<uint8> body;
+    for (const Document& doc : m_docs) {
+        PutBytes(body, doc.id.data(), doc.id.size() * sizeof(wchar_t));
+        PutBytes(body, doc.text.data(), doc.text.size() * sizeof(wchar_t));
+    }
+    for (const auto& [token, postings] : m_tokens) {
+        PutBytes(body, token.data(), token.size() * sizeof(wchar_t));
+        PutU32(body, postings.last);
+        PutU32(body, postings.count);
+        PutBytes(body, postings.bytes.data(), postings.bytes.size());
+    }
+    for (const auto& [key, postings] : m_trigrams) {
+        const uint8* bytes = reinterpret_cast<const uint8*>(&key);
+        body.insert(body.end(), bytes, bytes + sizeof(key));
+        PutU32(body, postings.last);
+        PutU32(body, postings.count);
+        PutBytes(body, postings.bytes.data(), postings.bytes.size());
+    }
+    header.crc = Crypto::DataCRC32(body.data(), body.size());
+
+    // No flush: a file cut short by a crash fails its CRC and is rebuilt
+    String tempPath = path + L".tmp";
+    HANDLE hFile = ::CreateFileW(tempPath.c_str(), GENERIC_WRITE, 0, nullptr,
+                                 CREATE_ALWAYS, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        LOG_ERROR(L"SearchIndex: cannot create %s (error %lu)", tempPath.c_str(), ::GetLastError());
+        return false;
+    }
+    DWORD written = 0;
+    bool ok = ::WriteFile(hFile, &header, sizeof(header), &written, nullptr) && written == sizeof(header) &&
+              ::WriteFile(hFile, body.data(), static_cast<DWORD>(body.size()), &written, nullptr) &&
+              written == body.size();
+    ::CloseHandle(hFile);
+    if (!ok || !::MoveFileExW(tempPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING)) {
+        LOG_ERROR(L"SearchIndex: cannot write %s (error %lu)", path.c_str(), ::GetLastError());
+        ::DeleteFileW(tempPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool SearchIndex::Load(const String& path) {
+    Clear();
+    HANDLE hFile = ::CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                                 OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE) return false;
+
+    LARGE_INTEGER size{};
+    std::vector<uint8> data;
+    DWORD read = 0;
+    bool ok = ::GetFileSizeEx(hFile, &size) && size.QuadPart >= static_cast<LONGLONG>(sizeof(SearchHeader)) &&
+              size.QuadPart < 0x7FFFFFFF;
+    if (ok) {
+        data.resize(static_cast<size_t>(size.QuadPart));
+        ok = ::ReadFile(hFile, data.data(), static_cast<DWORD>(data.size()), &read, nullptr) &&
+             read == data.size();
+    }
+    ::CloseHandle(hFile);
+
+    SearchHeader header{};
+    if (ok) memcpy(&header, data.data(), sizeof(header));
+    const uint8* body = data.data() + sizeof(header);
+    size_t bodyLength = data.size() - sizeof(header);
+    if (!ok || memcmp(header.magic, SEARCH_MAGIC, sizeof(SEARCH_MAGIC)) != 0 ||
+        header.version != SEARCH_VERSION || Crypto::DataCRC32(body, bodyLength) != header.crc) {
+        LOG_WARN(L"SearchIndex: %s is unreadable, rebuilding", path.c_str());
+        return false;
+    }
+
+    Reader reader{body, body + bodyLength};
+    m_docs.resize(header.docCount);
+    for (uint32 doc = 0; doc < header.docCount && reader.ok; ++doc) {
+        m_docs[doc].id = reader.Str();
+        m_docs[doc].text = reader.Str();
+        m_docNumbers[m_docs[doc].id] = doc;
+    }
+    for (uint32 i = 0; i < header.tokenCount && reader.ok; ++i) {
+        Postings& postings = m_tokens[reader.Str()];
+        postings.last = reader.U32();
+        postings.count = reader.U32();
+        postings.bytes = reader.Bytes();
+    }
+    for (uint32 i = 0; i < header.trigramCount && reader.ok; ++i) {
+        uint64 key = 0;
+        reader.Take(&key, sizeof(key));
+        Postings& postings = m_trigrams[key];
+        postings.last = reader.U32();
+        postings.count = reader.U32();
+        postings.bytes = reader.Bytes();
+    }
+    if (!reader.ok || reader.pos != reader.end || m_docNumbers.size() != m_docs.size()) {
+        LOG_WARN(L"SearchIndex: %s is damaged, rebuilding", path.c_str());
+        Clear();
+        return false;
+    }
+    return true;
+}
+
+} // namespace idm
@@ -0,0 +1,100 @@
+/**
+ * @file SearchIndex.h
+ * @brief Inverted index for searching downloads by name, URL and host
+ *
+ * Each download is a document: its lowercased file name, URL, final URL
+ * and description. Two indexes point back at the documents:
+ *
+ *   - Tokens: runs of letters and digits, plus the host of each URL and
+ *     its parent domains ("cdn.example.com", "example.com"). Kept sorted,
+ *     so a prefix is a range scan. Each posting records which fields the
+ *     token came from.
+ *   - Trigrams: every three-character window of each field. A substring
+ *     query intersects the postings of its trigrams and checks the
+ *     remaining candidates against the document text.
+ *
+ * Postings are varint-coded document number deltas, appended in number
+ * order. A changed document gets a new number; the old one is only marked
+ * dead and skipped, and the postings are rebuilt once dead documents
+ * outnumber live ones (and before saving).
+ *
+ * Results are ranked by where each query term matched (file name first,
+ * then host, description, URLs) and how (whole token, prefix, substring),
+ * then by most recently indexed.
+ *
+ * File layout (<db>.search, derived data):
+ *   [Header: 32 bytes]     magic, version, counts, CRC32 of the rest
+ *   [Documents]            id, text
+ *   [Tokens]               token, postings
+ *   [Trigrams]             key, postings
+ *
+ * Not thread-safe: the Database calls it under its lock.
+ */
+
+#pragma once
+#include "stdafx.h"
+
+namespace idm {
+
+class SearchIndex {
+public:
+    SearchIndex() = default;
+
+    SearchIndex(const SearchIndex&) = delete;
+    SearchIndex& operator=(const SearchIndex&) = delete;
+
+    /**
+     * Index a download, or re-index it if its text changed. A null
+     * 'finalUrl' keeps the one indexed before. Returns false if nothing
+     * changed.
+     */
+    bool Update(const String& id, const String& fileName, const String& url,
+                const String* finalUrl, const String& description);
+
+    bool Remove(const String& id);
+    void Clear();
+
+    size_t Size() const { return m_docNumbers.size(); }
+    bool Contains(const String& id) const { return m_docNumbers.count(id) != 0; }
+
+    /**
+     * IDs of the downloads matching every whitespace-separated term of
+     * 'query' as a token prefix or (3+ characters) a substring, best
+     * first. 'maxResults' 0 returns all.
+     */
+    std::vector<String> Search(const String& query, size_t maxResults = 0) const;
+
+    /**
+     * Read or write the index file. Load fails (leaving the index empty)
+     * if the file is missing, from another version or damaged.
+     */
+    bool Load(const String& path);
+    bool Save(const String& path);
+
+private:
+    struct Postings {
+        std::vector<uint8>  bytes;
+        uint32              last{0};    // Highest document number
+        uint32              count{0};
+    };
+
+    struct Document {
+        String  id;                     // Empty once dead
+        String  text;                   // Normalized fields, separated
+    };
+
+    uint32 AddDocument(const String& id, String text);
+    void IndexDocument(uint32 doc);
+    void Compact();                     // Renumber live documents, rebuild postings
+
+    // Document numbers whose text has every trigram of 'term'
+    std::vector<uint32> TrigramCandidates(const String& term) const;
+
+    std::vector<Document>                   m_docs;
+    std::unordered_map<String, uint32>      m_docNumbers;   // ID -> live document
+    size_t                                  m_deadDocs{0};
+    std::map<String, Postings>              m_tokens;       // Postings carry field flags
+    std::unordered_map<uint64, Postings>    m_trigrams;
+};
+
+} // namespace idm
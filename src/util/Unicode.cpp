@@ -148,6 +148,7 @@ uint16 Unicode::ExtractPortFromUrl(const String& url) {
     if (url.find(L"https://") == 0) return 443;
     if (url.find(L"http://") == 0) return 80;
     if (url.find(L"ftp://") == 0) return 21;
+    if (url.find(L"ftps://") == 0) return 990;
     return 80;
 }
 
@@ -177,7 +178,7 @@ bool Unicode::IsHttpsUrl(const String& url) {
 }
 
 bool Unicode::IsFtpUrl(const String& url) {
-    return url.find(L"ftp://") == 0;
+    return url.find(L"ftp://") == 0 || url.find(L"ftps://") == 0;
 }
 
 // ─── File Operations ───────────────────────────────────────────────────────
@@ -340,6 +341,22 @@ String Unicode::FormatDateTime(const SystemTimePoint& time) {
     return buf;
 }
 
+String Unicode::FormatHttpDate(const SystemTimePoint& time) {
+    // RFC 1123 names are fixed English, so don't go through the C locale
+    static const wchar_t* const days[] = { L"Sun", L"Mon", L"Tue", L"Wed", L"Thu", L"Fri", L"Sat" };
+    static const wchar_t* const months[] = { L"Jan", L"Feb", L"Mar", L"Apr", L"May", L"Jun",
+                                             L"Jul", L"Aug", L"Sep", L"Oct", L"Nov", L"Dec" };
+    auto timeT = SystemClock::to_time_t(time);
+    struct tm timeInfo;
+    if (gmtime_s(&timeInfo, &timeT) != 0) return L"";
+    
+    wchar_t buf[64];
+    swprintf_s(buf, L"%s, %02d %s %04d %02d:%02d:%02d GMT",
+               days[timeInfo.tm_wday], timeInfo.tm_mday, months[timeInfo.tm_mon],
+               timeInfo.tm_year + 1900, timeInfo.tm_hour, timeInfo.tm_min, timeInfo.tm_sec);
+    return buf;
+}
+
 // ─── String Operations ─────────────────────────────────────────────────────
 String Unicode::ToLower(const String& str) {
     String result = str;
@@ -41,6 +41,7 @@ public:
     static String FormatSpeed(double bytesPerSec);
     static String FormatTimeRemaining(double seconds);
     static String FormatDateTime(const SystemTimePoint& time);
+    static String FormatHttpDate(const SystemTimePoint& time);   // RFC 1123, UTC
     
     // ─── String Operations ─────────────────────────────────────────────────
     static String ToLower(const String& str);